@@ -29,7 +29,16 @@ use std::path::Path;
 use lexopt::prelude::*;
 use std::process;
 
+pub enum Mode {
+    Tui,
+    /// play with no ui, controlled over a socket
+    Server,
+    /// send a command to the server
+    Control(Vec<String>),
+}
+
 pub struct Args {
+    pub mode: Mode,
     pub music_dir_from_cli: Option<String>,
     pub disable_album_art_from_cli: bool,
     pub disable_discord_rpc_from_cli: bool,
@@ -42,6 +51,7 @@ impl Args {
         let mut disable_album_art_from_cli = false;
         let mut disable_discord_rpc_from_cli = false;
         let mut max_depth_cli = 4;
+        let mut mode = Mode::Tui;
 
         let mut parser = lexopt::Parser::from_env();
         while let Some(arg) = parser.next()? {
@@ -63,6 +73,19 @@ impl Args {
                 Short('m') | Long("max-depth") => {
                     max_depth_cli = parser.value()?.parse()?;
                 }
+                Value(val) if music_dir_from_cli.is_none() && val == "server" => {
+                    mode = Mode::Server;
+                }
+                Value(val) if music_dir_from_cli.is_none() && val == "ctl" => {
+                    let command = parser
+                        .raw_args()?
+                        .map(|arg| {
+                            arg.into_string()
+                                .map_err(|e| anyhow!("string convert error: {:?}", e))
+                        })
+                        .collect::<Result<_>>()?;
+                    mode = Mode::Control(command);
+                }
                 Value(val) if music_dir_from_cli.is_none() => {
                     let dir = val
                         .into_string()
@@ -92,6 +115,7 @@ impl Args {
         }
 
         Ok(Args {
+            mode,
             music_dir_from_cli,
             disable_album_art_from_cli,
             disable_discord_rpc_from_cli,
@@ -105,6 +129,13 @@ fn display_help() {
         "\
 Termusic help:
 Usage: termusic [OPTIONS] [MUSIC_DIRECTORY]
+       termusic [OPTIONS] server
+       termusic ctl COMMAND
+
+With `server`, play with no ui until `termusic ctl quit`. Both need a build with
+the `server` feature, the ui cannot be used while a server plays. COMMAND is one of
+status, watch, toggle, next, previous, stop, quit, seek SECONDS,
+volume +|-|NUMBER, speed +|- or add FILE.
 
 With no MUSIC_DIRECTORY, use config in `~/.config/termusic/config.toml`, 
 defaults to ~/Music.
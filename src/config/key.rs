@@ -17,6 +17,7 @@ pub const CONTROL_ALT_SHIFT: KeyModifiers = KeyModifiers::from_bits_truncate(
 );
 
 #[derive(Clone, Deserialize, Serialize)]
+#[serde(default)]
 pub struct Keys {
     pub global_esc: BindingForEvent,
     pub global_quit: BindingForEvent,
@@ -53,6 +54,7 @@ pub struct Keys {
     pub playlist_delete: BindingForEvent,
     pub playlist_delete_all: BindingForEvent,
     pub playlist_shuffle: BindingForEvent,
+    pub playlist_shuffle_mode_cycle: BindingForEvent,
     pub playlist_mode_cycle: BindingForEvent,
     pub playlist_play_selected: BindingForEvent,
     pub playlist_add_front: BindingForEvent,
@@ -61,6 +63,9 @@ pub struct Keys {
     pub playlist_swap_up: BindingForEvent,
     pub playlist_cmus_lqueue: BindingForEvent,
     pub playlist_cmus_tqueue: BindingForEvent,
+    pub playlist_undo: BindingForEvent,
+    pub playlist_redo: BindingForEvent,
+    pub playlist_saved: BindingForEvent,
     pub database_add_all: BindingForEvent,
     pub global_player_toggle_gapless: BindingForEvent,
     pub global_config_open: BindingForEvent,
@@ -68,6 +73,10 @@ pub struct Keys {
     pub library_switch_root: BindingForEvent,
     pub library_add_root: BindingForEvent,
     pub library_remove_root: BindingForEvent,
+    pub global_tag_suggestions_apply: BindingForEvent,
+    pub global_download_cancel_all: BindingForEvent,
+    pub global_player_next_eq_preset: BindingForEvent,
+    pub global_visualizer_cycle: BindingForEvent,
 }
 
 impl Keys {
@@ -101,6 +110,10 @@ impl Keys {
             .chain(once(self.global_player_toggle_gapless))
             .chain(once(self.global_config_open))
             .chain(once(self.global_config_save))
+            .chain(once(self.global_tag_suggestions_apply))
+            .chain(once(self.global_download_cancel_all))
+            .chain(once(self.global_player_next_eq_preset))
+            .chain(once(self.global_visualizer_cycle))
     }
 
     pub fn iter_library(&self) -> impl Iterator<Item = BindingForEvent> {
@@ -122,6 +135,7 @@ impl Keys {
         once(self.playlist_delete)
             .chain(once(self.playlist_delete_all))
             .chain(once(self.playlist_shuffle))
+            .chain(once(self.playlist_shuffle_mode_cycle))
             .chain(once(self.playlist_mode_cycle))
             .chain(once(self.playlist_play_selected))
             .chain(once(self.playlist_add_front))
@@ -130,6 +144,9 @@ impl Keys {
             .chain(once(self.playlist_swap_up))
             .chain(once(self.playlist_cmus_lqueue))
             .chain(once(self.playlist_cmus_tqueue))
+            .chain(once(self.playlist_undo))
+            .chain(once(self.playlist_redo))
+            .chain(once(self.playlist_saved))
     }
 
     pub fn has_unique_elements(&self) -> bool {
@@ -410,6 +427,10 @@ impl Default for Keys {
                 code: Key::Char('r'),
                 modifier: KeyModifiers::NONE,
             },
+            playlist_shuffle_mode_cycle: BindingForEvent {
+                code: Key::Char('R'),
+                modifier: KeyModifiers::SHIFT,
+            },
             playlist_mode_cycle: BindingForEvent {
                 code: Key::Char('m'),
                 modifier: KeyModifiers::NONE,
@@ -442,6 +463,18 @@ impl Default for Keys {
                 code: Key::Char('s'),
                 modifier: KeyModifiers::NONE,
             },
+            playlist_undo: BindingForEvent {
+                code: Key::Char('u'),
+                modifier: KeyModifiers::NONE,
+            },
+            playlist_redo: BindingForEvent {
+                code: Key::Char('U'),
+                modifier: KeyModifiers::SHIFT,
+            },
+            playlist_saved: BindingForEvent {
+                code: Key::Char('w'),
+                modifier: KeyModifiers::NONE,
+            },
             global_layout_treeview: BindingForEvent {
                 code: Key::Char('1'),
                 modifier: KeyModifiers::NONE,
@@ -466,6 +499,22 @@ impl Default for Keys {
                 code: Key::Char('s'),
                 modifier: KeyModifiers::CONTROL,
             },
+            global_tag_suggestions_apply: BindingForEvent {
+                code: Key::Char('t'),
+                modifier: KeyModifiers::CONTROL,
+            },
+            global_download_cancel_all: BindingForEvent {
+                code: Key::Char('x'),
+                modifier: KeyModifiers::CONTROL,
+            },
+            global_player_next_eq_preset: BindingForEvent {
+                code: Key::Char('e'),
+                modifier: KeyModifiers::CONTROL,
+            },
+            global_visualizer_cycle: BindingForEvent {
+                code: Key::Char('v'),
+                modifier: KeyModifiers::CONTROL,
+            },
             library_switch_root: BindingForEvent {
                 code: Key::Char('o'),
                 modifier: KeyModifiers::NONE,
@@ -24,7 +24,8 @@
 mod key;
 mod theme;
 
-use crate::player::Loop;
+use crate::loudness::ReplayGain;
+use crate::player::{EqBand, EqPreset, Loop, Shuffle};
 use crate::ui::components::Xywh;
 use anyhow::{anyhow, Result};
 pub use key::{BindingForEvent, Keys, ALT_SHIFT, CONTROL_ALT, CONTROL_ALT_SHIFT, CONTROL_SHIFT};
@@ -37,6 +38,7 @@ pub const MUSIC_DIR: [&str; 2] = ["~/Music/mp3", "~/Music"];
 
 #[derive(Clone, Deserialize, Serialize)]
 #[allow(clippy::struct_excessive_bools)]
+#[serde(default)]
 pub struct Settings {
     pub music_dir: Vec<String>,
     #[serde(skip)]
@@ -48,10 +50,34 @@ pub struct Settings {
     #[serde(skip)]
     pub max_depth_cli: usize,
     pub loop_mode: Loop,
+    /// how the shuffle key orders the playlist: Random, Balanced or Weighted
+    pub shuffle_mode: Shuffle,
     pub volume: i32,
     pub speed: i32,
     pub add_playlist_front: bool,
     pub gapless: bool,
+    /// seconds the end of a track overlaps the start of the next, 0 turns crossfading off.
+    /// With gapless on, tracks of the same album are never crossfaded.
+    pub crossfade_secs: u64,
+    /// start the crossfade early when a track ends in silence
+    pub crossfade_on_silence: bool,
+    /// look up missing lyrics and covers of upcoming tracks in the background
+    pub enrich_upcoming_tracks: bool,
+    /// downloads running at the same time, the rest wait in the queue
+    pub download_workers: usize,
+    /// read buffer of the decoder in KiB, bigger buffers ride out slow disks and network shares
+    pub decoder_buffer_kib: usize,
+    /// play tracks at the same loudness: Off, Track or Album
+    pub replaygain: ReplayGain,
+    /// threads measuring the loudness and waveform of the library in the background, 0 turns
+    /// it off
+    pub loudness_workers: usize,
+    /// name of the equalizer preset in use, see eq_presets
+    pub eq_preset: String,
+    /// frames per second of the spectrum and oscilloscope, the ui redraws at most this often
+    pub visualizer_fps: u32,
+    /// draw the waveform of the playing track in the progress bar once it is analyzed
+    pub progress_waveform: bool,
     pub enable_exit_confirmation: bool,
     pub playlist_display_symbol: bool,
     pub playlist_select_random_track_quantity: u32,
@@ -60,6 +86,7 @@ pub struct Settings {
     pub album_photo_xywh: Xywh,
     pub style_color_symbol: StyleColorSymbol,
     pub keys: Keys,
+    pub eq_presets: Vec<EqPreset>,
 }
 
 impl Default for Settings {
@@ -76,13 +103,25 @@ impl Default for Settings {
             music_dir,
             music_dir_from_cli: None,
             loop_mode: Loop::Queue,
+            shuffle_mode: Shuffle::Random,
             volume: 70,
             speed: 10,
             add_playlist_front: false,
             gapless: true,
+            crossfade_secs: 0,
+            crossfade_on_silence: false,
+            enrich_upcoming_tracks: false,
+            download_workers: 2,
+            decoder_buffer_kib: 256,
+            replaygain: ReplayGain::Off,
+            loudness_workers: 1,
+            eq_preset: "Flat".to_string(),
+            visualizer_fps: 30,
+            progress_waveform: true,
             enable_exit_confirmation: true,
             playlist_display_symbol: true,
             keys: Keys::default(),
+            eq_presets: EqPreset::defaults(),
             theme_selected: "default".to_string(),
             style_color_symbol: StyleColorSymbol::default(),
             album_photo_xywh: Xywh::default(),
@@ -96,6 +135,14 @@ impl Default for Settings {
 }
 
 impl Settings {
+    /// Bands of the selected equalizer preset, none if it is not found.
+    pub fn eq_bands(&self) -> &[EqBand] {
+        self.eq_presets
+            .iter()
+            .find(|p| p.name == self.eq_preset)
+            .map_or(&[][..], |p| p.bands.as_slice())
+    }
+
     pub fn save(&self) -> Result<()> {
         let mut path = get_app_config_path()?;
         path.push("config.toml");
@@ -122,6 +169,19 @@ impl Settings {
     }
 }
 
+/// The music directory given on the command line, or else the first one of the config.
+pub fn get_full_path_from_config(config: &Settings) -> PathBuf {
+    let mut full_path = String::new();
+    if let Some(dir) = config.music_dir.get(0) {
+        full_path = shellexpand::tilde(dir).to_string();
+    }
+
+    if let Some(music_dir) = &config.music_dir_from_cli {
+        full_path = shellexpand::tilde(music_dir).to_string();
+    };
+    PathBuf::from(full_path)
+}
+
 pub fn get_app_config_path() -> Result<PathBuf> {
     let mut path = dirs::config_dir().ok_or_else(|| anyhow!("failed to find os config dir."))?;
     path.push("termusic");
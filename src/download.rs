@@ -0,0 +1,807 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// download manager
+use crate::config::get_app_config_path;
+use crate::songtag::SongTag;
+use crate::ui::model::UpdateComponents;
+use anyhow::{anyhow, bail, Result};
+use id3::TagLike;
+use id3::Version::Id3v24;
+use lazy_static::lazy_static;
+use regex::Regex;
+use rusqlite::{params, Connection, OptionalExtension};
+use std::collections::HashMap;
+use std::io::{BufRead, BufReader, Read};
+use std::path::Path;
+use std::process::{Child, Command, Stdio};
+use std::sync::mpsc::Sender;
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+
+const DOWNLOADER: &str = "yt-dlp";
+
+lazy_static! {
+    static ref RE_FILENAME_YTDLP: Regex =
+        Regex::new(r"\[ExtractAudio\] Destination: (?P<name>.*)\.mp3").unwrap();
+    static ref RE_PROGRESS: Regex = Regex::new(r"^\[download\]\s+(?P<percent>[0-9.]+)%").unwrap();
+}
+
+pub enum DownloadJob {
+    Youtube { url: String, dir: String },
+    SongTag { song_tag: Box<SongTag>, dir: String },
+}
+
+impl DownloadJob {
+    const fn kind(&self) -> &'static str {
+        match self {
+            Self::Youtube { .. } => "youtube",
+            Self::SongTag { .. } => "songtag",
+        }
+    }
+
+    fn source(&self) -> Result<String> {
+        match self {
+            Self::Youtube { url, .. } => Ok(url.clone()),
+            Self::SongTag { song_tag, .. } => Ok(serde_json::to_string(song_tag)?),
+        }
+    }
+
+    fn dir(&self) -> &str {
+        match self {
+            Self::Youtube { dir, .. } | Self::SongTag { dir, .. } => dir,
+        }
+    }
+
+    fn from_row(kind: &str, source: &str, dir: String) -> Result<Self> {
+        match kind {
+            "youtube" => Ok(Self::Youtube {
+                url: source.to_string(),
+                dir,
+            }),
+            "songtag" => Ok(Self::SongTag {
+                song_tag: Box::new(serde_json::from_str(source)?),
+                dir,
+            }),
+            _ => bail!("unknown download kind {}", kind),
+        }
+    }
+}
+
+/// Snapshot of the queue, sent to the ui whenever it changes.
+#[derive(Clone, Copy, Default)]
+pub struct DownloadSummary {
+    pub running: usize,
+    pub queued: usize,
+    /// average progress of the running jobs
+    pub percent: f32,
+}
+
+enum Outcome {
+    Finished(Option<String>),
+    EmbedFailed,
+    Failed(String),
+    Cancelled,
+}
+
+// claimed by a worker, the child is only there once the downloader has been started
+struct Running {
+    child: Option<Child>,
+    percent: f32,
+    cancelled: bool,
+}
+
+struct State {
+    conn: Connection,
+    running: HashMap<i64, Running>,
+    // last file of the current batch, the library is reloaded once the queue drains
+    finished_file: Option<String>,
+    // set when the manager goes away, idle workers return instead of waiting for jobs
+    shutdown: bool,
+}
+
+struct Shared {
+    state: Mutex<State>,
+    job_queued: Condvar,
+    program: String,
+    tx: Sender<UpdateComponents>,
+}
+
+/// Runs downloads from a queue persisted in sqlite, with at most `workers` downloader
+/// processes at a time. Jobs left over from a previous session are picked up again.
+pub struct DownloadManager {
+    shared: Arc<Shared>,
+}
+
+impl DownloadManager {
+    pub fn new(workers: usize, tx: Sender<UpdateComponents>) -> Self {
+        let mut db_path = get_app_config_path().expect("failed to get app configuration path");
+        db_path.push("downloads.db");
+        Self::open(&db_path, DOWNLOADER, workers, tx).expect("open download queue failed")
+    }
+
+    pub fn open(
+        db_path: &Path,
+        program: &str,
+        workers: usize,
+        tx: Sender<UpdateComponents>,
+    ) -> Result<Self> {
+        let conn = Connection::open(db_path)?;
+        conn.execute(
+            "create table if not exists download_job(
+             id integer primary key,
+             kind TEXT NOT NULL,
+             source TEXT NOT NULL,
+             dir TEXT NOT NULL,
+             status TEXT NOT NULL
+            )",
+            [],
+        )?;
+        // jobs that were running when termusic quit start over
+        conn.execute(
+            "UPDATE download_job SET status = 'queued' WHERE status = 'running'",
+            [],
+        )?;
+
+        let shared = Arc::new(Shared {
+            state: Mutex::new(State {
+                conn,
+                running: HashMap::new(),
+                finished_file: None,
+                shutdown: false,
+            }),
+            job_queued: Condvar::new(),
+            program: program.to_string(),
+            tx,
+        });
+
+        for _ in 0..workers {
+            let shared = shared.clone();
+            thread::spawn(move || {
+                while let Some((id, job)) = shared.next_job() {
+                    let outcome = shared
+                        .run(id, &job)
+                        .unwrap_or_else(|e| Outcome::Failed(e.to_string()));
+                    shared.finish(id, outcome);
+                }
+            });
+        }
+
+        let manager = Self { shared };
+        manager.shared.report();
+        Ok(manager)
+    }
+
+    pub fn enqueue(&self, job: &DownloadJob) -> Result<i64> {
+        let state = self.shared.state.lock().unwrap();
+        state.conn.execute(
+            "INSERT INTO download_job (kind, source, dir, status) VALUES (?1, ?2, ?3, 'queued')",
+            params![job.kind(), job.source()?, job.dir()],
+        )?;
+        let id = state.conn.last_insert_rowid();
+        drop(state);
+
+        self.shared.job_queued.notify_one();
+        self.shared.report();
+        Ok(id)
+    }
+
+    pub fn cancel(&self, id: i64) {
+        let mut state = self.shared.state.lock().unwrap();
+        if let Some(running) = state.running.get_mut(&id) {
+            running.cancel();
+        } else {
+            state
+                .conn
+                .execute(
+                    "DELETE FROM download_job WHERE id = ?1 AND status = 'queued'",
+                    [id],
+                )
+                .ok();
+        }
+        drop(state);
+        self.shared.report();
+    }
+
+    pub fn cancel_all(&self) {
+        let mut state = self.shared.state.lock().unwrap();
+        state
+            .conn
+            .execute("DELETE FROM download_job WHERE status = 'queued'", [])
+            .ok();
+        for running in state.running.values_mut() {
+            running.cancel();
+        }
+        drop(state);
+        self.shared.report();
+    }
+
+    #[cfg(test)]
+    pub fn summary(&self) -> DownloadSummary {
+        Shared::summary(&self.shared.state.lock().unwrap())
+    }
+}
+
+impl Drop for DownloadManager {
+    fn drop(&mut self) {
+        self.shared.state.lock().unwrap().shutdown = true;
+        self.shared.job_queued.notify_all();
+    }
+}
+
+impl Running {
+    fn cancel(&mut self) {
+        self.cancelled = true;
+        if let Some(child) = &mut self.child {
+            // yt-dlp hands the conversion to ffmpeg, the whole process group has to go
+            #[cfg(unix)]
+            if let Ok(pid) = libc::pid_t::try_from(child.id()) {
+                unsafe {
+                    libc::kill(-pid, libc::SIGKILL);
+                }
+            }
+            child.kill().ok();
+        }
+    }
+}
+
+impl Shared {
+    #[allow(clippy::cast_precision_loss)]
+    fn summary(state: &State) -> DownloadSummary {
+        let count = |status: &str| -> usize {
+            state
+                .conn
+                .query_row(
+                    "SELECT COUNT(*) FROM download_job WHERE status = ?1",
+                    [status],
+                    |r| r.get(0),
+                )
+                .unwrap_or_default()
+        };
+        // claimed jobs count as running before their process is started
+        let (running, queued) = (count("running"), count("queued"));
+        let percent = if state.running.is_empty() {
+            0.0
+        } else {
+            state.running.values().map(|r| r.percent).sum::<f32>() / state.running.len() as f32
+        };
+        DownloadSummary {
+            running,
+            queued,
+            percent,
+        }
+    }
+
+    fn report(&self) {
+        let summary = Self::summary(&self.state.lock().unwrap());
+        self.tx
+            .send(UpdateComponents::DownloadProgress(summary))
+            .ok();
+    }
+
+    // blocks until a queued job can be claimed, none once the manager is dropped
+    fn next_job(&self) -> Option<(i64, DownloadJob)> {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            if state.shutdown {
+                return None;
+            }
+            let row: Option<(i64, String, String, String)> = state
+                .conn
+                .query_row(
+                    "SELECT id, kind, source, dir FROM download_job
+                     WHERE status = 'queued' ORDER BY id LIMIT 1",
+                    [],
+                    |r| Ok((r.get(0)?, r.get(1)?, r.get(2)?, r.get(3)?)),
+                )
+                .optional()
+                .unwrap_or_default();
+
+            if let Some((id, kind, source, dir)) = row {
+                state
+                    .conn
+                    .execute(
+                        "UPDATE download_job SET status = 'running' WHERE id = ?1",
+                        [id],
+                    )
+                    .ok();
+                // registered right away, so cancel_all reaches jobs that are still resolving
+                state.running.insert(
+                    id,
+                    Running {
+                        child: None,
+                        percent: 0.0,
+                        cancelled: false,
+                    },
+                );
+                match DownloadJob::from_row(&kind, &source, dir) {
+                    Ok(job) => return Some((id, job)),
+                    Err(_) => {
+                        state.running.remove(&id);
+                        state
+                            .conn
+                            .execute("DELETE FROM download_job WHERE id = ?1", [id])
+                            .ok();
+                        continue;
+                    }
+                }
+            }
+
+            state = self.job_queued.wait(state).unwrap();
+        }
+    }
+
+    fn run(&self, id: i64, job: &DownloadJob) -> Result<Outcome> {
+        let (args, file) = match job {
+            DownloadJob::Youtube { url, .. } => (youtube_args(url), None),
+            DownloadJob::SongTag { song_tag, dir } => {
+                let stem = song_tag.download_file_stem();
+                let file = format!("{}/{}.mp3", dir, stem);
+                std::fs::remove_file(&file).ok();
+                (songtag_args(&stem, &song_tag.download_url()?), Some(file))
+            }
+        };
+
+        let mut command = Command::new(&self.program);
+        command
+            .args(&args)
+            .current_dir(job.dir())
+            .stdin(Stdio::null())
+            .stdout(Stdio::piped())
+            .stderr(Stdio::piped());
+        #[cfg(unix)]
+        {
+            use std::os::unix::process::CommandExt;
+            command.process_group(0);
+        }
+
+        // spawned under the lock, a cancel either comes before and is seen here or after and
+        // finds the child
+        let mut state = self.state.lock().unwrap();
+        let running = state
+            .running
+            .get_mut(&id)
+            .ok_or_else(|| anyhow!("download job {} vanished", id))?;
+        if running.cancelled {
+            state.running.remove(&id);
+            return Ok(Outcome::Cancelled);
+        }
+        let mut child = command.spawn()?;
+        let stdout = child.stdout.take().ok_or_else(|| anyhow!("no stdout"))?;
+        let mut stderr = child.stderr.take().ok_or_else(|| anyhow!("no stderr"))?;
+        running.child = Some(child);
+        drop(state);
+        self.report();
+
+        let stderr_reader = thread::spawn(move || {
+            let mut errors = String::new();
+            stderr.read_to_string(&mut errors).ok();
+            errors
+        });
+
+        let mut output = String::new();
+        for line in BufReader::new(stdout).lines().flatten() {
+            if let Some(percent) = parse_progress(&line) {
+                let mut state = self.state.lock().unwrap();
+                if let Some(running) = state.running.get_mut(&id) {
+                    // the label only shows whole percents
+                    let changed = percent.floor() > running.percent.floor();
+                    running.percent = percent;
+                    drop(state);
+                    if changed {
+                        self.report();
+                    }
+                }
+            }
+            output.push_str(&line);
+            output.push('\n');
+        }
+        let errors = stderr_reader.join().unwrap_or_default();
+
+        let running = self
+            .state
+            .lock()
+            .unwrap()
+            .running
+            .remove(&id)
+            .ok_or_else(|| anyhow!("download job {} vanished", id))?;
+        let status = running
+            .child
+            .ok_or_else(|| anyhow!("download job {} has no process", id))?
+            .wait()?;
+        if running.cancelled {
+            return Ok(Outcome::Cancelled);
+        }
+        if !status.success() {
+            let error = errors.lines().last().unwrap_or("downloader failed");
+            return Ok(Outcome::Failed(error.to_string()));
+        }
+
+        match job {
+            DownloadJob::Youtube { dir, .. } => {
+                let file = extract_filepath(&output, dir);
+                if let Some(file) = &file {
+                    // here we remove downloaded live_chat.json file
+                    remove_downloaded_json(Path::new(dir), file);
+                    embed_downloaded_lrc(Path::new(dir), file);
+                }
+                Ok(Outcome::Finished(file))
+            }
+            DownloadJob::SongTag { song_tag, .. } => {
+                if let Some(file) = &file {
+                    if song_tag.embed_tags(file).is_err() {
+                        return Ok(Outcome::EmbedFailed);
+                    }
+                }
+                Ok(Outcome::Finished(file))
+            }
+        }
+    }
+
+    fn finish(&self, id: i64, outcome: Outcome) {
+        let mut state = self.state.lock().unwrap();
+        // a job that failed before its downloader started is still registered
+        state.running.remove(&id);
+        state
+            .conn
+            .execute("DELETE FROM download_job WHERE id = ?1", [id])
+            .ok();
+
+        match outcome {
+            Outcome::Finished(file) => {
+                if file.is_some() {
+                    state.finished_file = file;
+                }
+                self.tx.send(UpdateComponents::DownloadSuccess).ok();
+            }
+            Outcome::EmbedFailed => {
+                self.tx.send(UpdateComponents::DownloadErrEmbedData).ok();
+            }
+            Outcome::Failed(e) => {
+                self.tx.send(UpdateComponents::DownloadErrDownload(e)).ok();
+            }
+            Outcome::Cancelled => {}
+        }
+
+        let summary = Self::summary(&state);
+        if summary.running == 0 && summary.queued == 0 {
+            let file = state.finished_file.take();
+            self.tx.send(UpdateComponents::DownloadCompleted(file)).ok();
+        }
+        drop(state);
+        self.tx
+            .send(UpdateComponents::DownloadProgress(summary))
+            .ok();
+    }
+}
+
+fn youtube_args(url: &str) -> Vec<String> {
+    [
+        "--newline",
+        "--extract-audio",
+        // "--audio-format", "vorbis",
+        "--audio-format",
+        "mp3",
+        "--add-metadata",
+        "--embed-thumbnail",
+        "--metadata-from-title",
+        "%(artist) - %(title)s",
+        "--write-sub",
+        "--all-subs",
+        "--convert-subs",
+        "lrc",
+        "--output",
+        "%(title).90s.%(ext)s",
+        url,
+    ]
+    .iter()
+    .map(ToString::to_string)
+    .collect()
+}
+
+fn songtag_args(file_stem: &str, url: &str) -> Vec<String> {
+    vec![
+        "--newline".to_string(),
+        "--output".to_string(),
+        format!("{}.%(ext)s", file_stem),
+        "--extract-audio".to_string(),
+        "--audio-format".to_string(),
+        "mp3".to_string(),
+        url.to_string(),
+    ]
+}
+
+fn parse_progress(line: &str) -> Option<f32> {
+    RE_PROGRESS
+        .captures(line)?
+        .name("percent")?
+        .as_str()
+        .parse()
+        .ok()
+}
+
+// This just parsing the output from youtubedl to get the audio path
+// This is used because we need to get the song name
+// example ~/path/to/song/song.mp3
+fn extract_filepath(output: &str, dir: &str) -> Option<String> {
+    if let Some(cap) = RE_FILENAME_YTDLP.captures(output) {
+        if let Some(c) = cap.name("name") {
+            let filename = format!("{}/{}.mp3", dir, c.as_str());
+            return Some(filename);
+        }
+    }
+    None
+}
+
+fn remove_downloaded_json(path: &Path, file_fullname: &str) {
+    let files = walkdir::WalkDir::new(path).follow_links(true);
+    for f in files
+        .into_iter()
+        .filter_map(std::result::Result::ok)
+        .filter(|f| {
+            let name = f.file_name();
+            let p = Path::new(&name);
+            p.extension().map_or(false, |ext| ext == "json")
+        })
+        .filter(|f| {
+            let path_json = Path::new(f.file_name());
+            let p1: &Path = Path::new(file_fullname);
+            path_json.file_stem().map_or(false, |stem_lrc| {
+                p1.file_stem().map_or(false, |p_base| {
+                    stem_lrc
+                        .to_string_lossy()
+                        .to_string()
+                        .contains(p_base.to_string_lossy().as_ref())
+                })
+            })
+        })
+    {
+        std::fs::remove_file(f.path()).ok();
+    }
+}
+
+fn embed_downloaded_lrc(path: &Path, file_fullname: &str) {
+    let mut id3_tag = if let Ok(tag) = id3::Tag::read_from_path(file_fullname) {
+        tag
+    } else {
+        let mut t = id3::Tag::new();
+        let p: &Path = Path::new(file_fullname);
+        if let Some(p_base) = p.file_stem() {
+            t.set_title(p_base.to_string_lossy());
+        }
+        t.write_to_path(p, Id3v24).ok();
+        t
+    };
+
+    // here we add all downloaded lrc file
+    let files = walkdir::WalkDir::new(path).follow_links(true);
+
+    for f in files
+        .into_iter()
+        .filter_map(std::result::Result::ok)
+        .filter(|f| f.file_type().is_file())
+        .filter(|f| {
+            let name = f.file_name();
+            let p = Path::new(&name);
+            p.extension().map_or(false, |ext| ext == "lrc")
+        })
+        .filter(|f| {
+            let path_lrc = Path::new(f.file_name());
+            let p1: &Path = Path::new(file_fullname);
+            path_lrc.file_stem().map_or(false, |stem_lrc| {
+                p1.file_stem().map_or(false, |p_base| {
+                    stem_lrc
+                        .to_string_lossy()
+                        .to_string()
+                        .contains(p_base.to_string_lossy().as_ref())
+                })
+            })
+        })
+    {
+        let path_lrc = Path::new(f.file_name());
+        let mut lang_ext = "eng".to_string();
+        if let Some(p_short) = path_lrc.file_stem() {
+            let p2 = Path::new(p_short);
+            if let Some(ext2) = p2.extension() {
+                lang_ext = ext2.to_string_lossy().to_string();
+            }
+        }
+        let lyric_string = std::fs::read_to_string(f.path());
+        id3_tag.add_frame(id3::frame::Lyrics {
+            lang: "eng".to_string(),
+            description: lang_ext,
+            text: lyric_string.unwrap_or_else(|_| String::from("[00:00:01] No lyric")),
+        });
+        std::fs::remove_file(f.path()).ok();
+    }
+
+    id3_tag.write_to_path(file_fullname, Id3v24).ok();
+}
+
+#[cfg(test)]
+#[allow(clippy::non_ascii_literal)]
+mod tests {
+    use super::*;
+    use pretty_assertions::assert_eq;
+    use std::path::PathBuf;
+    use std::sync::mpsc::{self, Receiver};
+    use std::time::Duration;
+
+    #[test]
+    fn test_youtube_output_parsing() {
+        assert_eq!(
+            extract_filepath(
+                r"sdflsdf [ExtractAudio] Destination: 观众说“小哥哥，到饭点了”《干饭人之歌》走，端起饭盆干饭去.mp3 sldflsdfj",
+                "/tmp"
+            )
+            .unwrap(),
+            "/tmp/观众说“小哥哥，到饭点了”《干饭人之歌》走，端起饭盆干饭去.mp3".to_string()
+        );
+    }
+
+    #[test]
+    fn test_progress_parsing() {
+        assert_eq!(
+            parse_progress("[download]  42.3% of 3.45MiB at 1.20MiB/s ETA 00:02"),
+            Some(42.3)
+        );
+        assert_eq!(parse_progress("[ExtractAudio] Destination: a.mp3"), None);
+    }
+
+    // a stand in for yt-dlp, that reports progress and then runs `tail`
+    #[cfg(unix)]
+    fn stub_downloader(dir: &Path, tail: &str) -> PathBuf {
+        use std::os::unix::fs::PermissionsExt;
+        let program = dir.join("stub-downloader");
+        std::fs::write(
+            &program,
+            format!(
+                "#!/bin/sh\necho '[download]  50.0% of 1.00MiB'\necho '[download] 100.0% of 1.00MiB'\n{}\n",
+                tail
+            ),
+        )
+        .unwrap();
+        std::fs::set_permissions(&program, std::fs::Permissions::from_mode(0o755)).unwrap();
+        program
+    }
+
+    fn test_dir(name: &str) -> PathBuf {
+        let dir =
+            std::env::temp_dir().join(format!("termusic_download_{}_{}", name, std::process::id()));
+        std::fs::remove_dir_all(&dir).ok();
+        std::fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    fn youtube_job(dir: &Path, n: usize) -> DownloadJob {
+        DownloadJob::Youtube {
+            url: format!("https://www.youtube.com/watch?v={}", n),
+            dir: dir.to_string_lossy().to_string(),
+        }
+    }
+
+    fn recv(rx: &Receiver<UpdateComponents>) -> UpdateComponents {
+        rx.recv_timeout(Duration::from_secs(10))
+            .expect("download manager stalled")
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_queue_runs_bounded_and_resumes() {
+        let dir = test_dir("queue");
+        let program = stub_downloader(
+            &dir,
+            "echo '[ExtractAudio] Destination: stub.mp3'\ntouch stub.mp3",
+        );
+        let program = program.to_string_lossy().to_string();
+        let db = dir.join("downloads.db");
+
+        // no workers, the jobs just sit in the queue like after a crash
+        let (tx, _rx) = mpsc::channel();
+        let manager = DownloadManager::open(&db, &program, 0, tx).unwrap();
+        for n in 0..5 {
+            manager.enqueue(&youtube_job(&dir, n)).unwrap();
+        }
+        assert_eq!(manager.summary().queued, 5);
+        drop(manager);
+
+        let (tx, rx) = mpsc::channel();
+        let _manager = DownloadManager::open(&db, &program, 2, tx).unwrap();
+        let (mut succeeded, mut peak) = (0, 0);
+        let completed = loop {
+            match recv(&rx) {
+                UpdateComponents::DownloadProgress(summary) => {
+                    peak = peak.max(summary.running);
+                }
+                UpdateComponents::DownloadSuccess => succeeded += 1,
+                UpdateComponents::DownloadCompleted(file) => break file,
+                _ => {}
+            }
+        };
+        assert_eq!(succeeded, 5);
+        assert!(peak <= 2);
+        assert_eq!(
+            completed,
+            Some(format!("{}/stub.mp3", dir.to_string_lossy()))
+        );
+        std::fs::remove_dir_all(dir).ok();
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_cancel_running_download() {
+        let dir = test_dir("cancel");
+        let program = stub_downloader(&dir, "exec sleep 30");
+        let (tx, rx) = mpsc::channel();
+        let manager =
+            DownloadManager::open(&dir.join("downloads.db"), &program.to_string_lossy(), 1, tx)
+                .unwrap();
+        manager.enqueue(&youtube_job(&dir, 0)).unwrap();
+        manager.enqueue(&youtube_job(&dir, 1)).unwrap();
+
+        // wait until the first job reports progress
+        loop {
+            if let UpdateComponents::DownloadProgress(summary) = recv(&rx) {
+                if summary.percent >= 50.0 {
+                    break;
+                }
+            }
+        }
+        manager.cancel_all();
+
+        loop {
+            match recv(&rx) {
+                UpdateComponents::DownloadSuccess | UpdateComponents::DownloadErrDownload(_) => {
+                    panic!("cancelled download finished")
+                }
+                UpdateComponents::DownloadCompleted(file) => {
+                    assert!(file.is_none());
+                    break;
+                }
+                _ => {}
+            }
+        }
+        let summary = manager.summary();
+        assert_eq!((summary.running, summary.queued), (0, 0));
+        std::fs::remove_dir_all(dir).ok();
+    }
+
+    #[test]
+    fn test_idle_workers_exit_with_the_manager() {
+        let dir = test_dir("shutdown");
+        let (tx, rx) = mpsc::channel();
+        let manager = DownloadManager::open(&dir.join("downloads.db"), "true", 2, tx).unwrap();
+        drop(manager);
+        // the workers hold the last sender, the channel closes once they are gone
+        loop {
+            match rx.recv_timeout(Duration::from_secs(10)) {
+                Ok(_) => {}
+                Err(e) => {
+                    assert_eq!(e, mpsc::RecvTimeoutError::Disconnected);
+                    break;
+                }
+            }
+        }
+        std::fs::remove_dir_all(dir).ok();
+    }
+}
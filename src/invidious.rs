@@ -22,11 +22,19 @@
  * SOFTWARE.
  */
 use anyhow::{anyhow, bail, Result};
+use lazy_static::lazy_static;
 use rand::seq::SliceRandom;
+use serde::{Deserialize, Serialize};
 use serde_json::Value;
+use std::cmp::Ordering;
+use std::collections::{HashMap, HashSet};
 // left for debug
 // use std::io::Write;
-use std::time::Duration;
+use std::path::PathBuf;
+use std::sync::mpsc::{self, RecvTimeoutError};
+use std::sync::{Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 use ureq::{Agent, AgentBuilder};
 
 const INVIDIOUS_INSTANCE_LIST: [&str; 7] = [
@@ -48,13 +56,147 @@ const INVIDIOUS_INSTANCE_LIST: [&str; 7] = [
 ];
 
 const INVIDIOUS_DOMAINS: &str = "https://api.invidious.io/instances.json?sort_by=type,users";
+// the instance list changes slowly, no need to ask api.invidious.io before every search
+const INSTANCE_LIST_TTL_SECS: u64 = 24 * 60 * 60;
 
+// at most this many instances are asked at once, a new one joins every HEDGE_DELAY
+const HEDGE_FANOUT: usize = 3;
+const HEDGE_DELAY: Duration = Duration::from_millis(600);
+// cost of an instance we know nothing about, and of a failed request
+const UNKNOWN_LATENCY_MS: f64 = 3000.0;
+const FAILURE_LATENCY_MS: f64 = 20_000.0;
+// what we learned about an instance fades back to unknown with this half life
+const HEALTH_HALF_LIFE_SECS: f64 = 24.0 * 60.0 * 60.0;
+
+// flipping back and forth through results should not hit the network again
+const SEARCH_PAGE_TTL: Duration = Duration::from_secs(10 * 60);
+
+lazy_static! {
+    static ref HEALTH: Mutex<Health> = Mutex::new(Health::default());
+    static ref SEARCH_PAGES: Mutex<SearchPages> = Mutex::new(SearchPages::default());
+    // signalled whenever a prefetch ends, so a page already on its way is not asked again
+    static ref PREFETCH_DONE: Condvar = Condvar::new();
+}
+
+/// Search result pages keyed by query and page number, also filled by prefetching.
+#[derive(Default)]
+struct SearchPages {
+    pages: HashMap<(String, u32), (Instant, Vec<YoutubeVideo>)>,
+    prefetching: HashSet<(String, u32)>,
+}
+
+impl SearchPages {
+    fn get(&self, query: &str, page: u32) -> Option<Vec<YoutubeVideo>> {
+        let (fetched, videos) = self.pages.get(&(query.to_string(), page))?;
+        (fetched.elapsed() < SEARCH_PAGE_TTL).then(|| videos.clone())
+    }
+
+    fn insert(&mut self, query: &str, page: u32, videos: &[YoutubeVideo]) {
+        self.pages
+            .retain(|_, (fetched, _)| fetched.elapsed() < SEARCH_PAGE_TTL);
+        self.pages
+            .insert((query.to_string(), page), (Instant::now(), videos.to_vec()));
+    }
+}
+
+#[derive(Clone, Copy, Deserialize, Serialize)]
+struct HealthEntry {
+    latency_ms: f64,
+    updated: u64,
+}
+
+/// Latency of every instance we talked to, as an exponential moving average where failures
+/// count as very slow responses. Persisted in the cache dir between sessions.
+#[derive(Default, Deserialize, Serialize)]
+struct Health {
+    domains: Vec<String>,
+    domains_fetched: u64,
+    entries: HashMap<String, HealthEntry>,
+    // where the scores are saved, none until they were loaded from there
+    #[serde(skip)]
+    path: Option<PathBuf>,
+}
+
+fn now_secs() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map(|d| d.as_secs())
+        .unwrap_or_default()
+}
+
+impl Health {
+    fn user_path() -> Option<PathBuf> {
+        let mut path = dirs::cache_dir()?;
+        path.push("termusic");
+        std::fs::create_dir_all(&path).ok()?;
+        path.push("invidious.json");
+        Some(path)
+    }
+
+    fn load(path: PathBuf) -> Self {
+        let mut health: Self = std::fs::read_to_string(&path)
+            .ok()
+            .and_then(|text| serde_json::from_str(&text).ok())
+            .unwrap_or_default();
+        health.path = Some(path);
+        health
+    }
+
+    fn save(&self) {
+        if let Some(path) = &self.path {
+            if let Ok(text) = serde_json::to_string(self) {
+                std::fs::write(path, text).ok();
+            }
+        }
+    }
+
+    #[allow(clippy::cast_precision_loss)]
+    fn cost(&self, domain: &str, now: u64) -> f64 {
+        self.entries
+            .get(domain)
+            .map_or(UNKNOWN_LATENCY_MS, |entry| {
+                let age = now.saturating_sub(entry.updated) as f64;
+                let weight = 0.5_f64.powf(age / HEALTH_HALF_LIFE_SECS);
+                UNKNOWN_LATENCY_MS + (entry.latency_ms - UNKNOWN_LATENCY_MS) * weight
+            })
+    }
+
+    fn record(&mut self, domain: &str, latency: Option<Duration>) {
+        let now = now_secs();
+        let sample = latency.map_or(FAILURE_LATENCY_MS, |l| l.as_secs_f64() * 1000.0);
+        let latency_ms = (self.cost(domain, now) + sample) / 2.0;
+        self.entries.insert(
+            domain.to_string(),
+            HealthEntry {
+                latency_ms,
+                updated: now,
+            },
+        );
+    }
+
+    // cheapest first, instances with equal cost in random order
+    fn rank(&self, domains: &[String]) -> Vec<String> {
+        let now = now_secs();
+        let mut ranked = domains.to_vec();
+        ranked.shuffle(&mut rand::thread_rng());
+        ranked.sort_by(|a, b| {
+            self.cost(a, now)
+                .partial_cmp(&self.cost(b, now))
+                .unwrap_or(Ordering::Equal)
+        });
+        ranked
+    }
+}
+
+#[derive(Clone)]
 pub struct Instance {
     pub domain: Option<String>,
     client: Agent,
     query: Option<String>,
+    domains: Vec<String>,
 }
 
+#[derive(Clone)]
 pub struct YoutubeVideo {
     pub title: String,
     pub length_seconds: u64,
@@ -71,6 +213,7 @@ impl Default for Instance {
             domain,
             client,
             query,
+            domains: vec![],
         }
     }
 }
@@ -80,75 +223,153 @@ impl Instance {
     pub fn new(query: &str) -> Result<(Self, Vec<YoutubeVideo>)> {
         let client = AgentBuilder::new().timeout(Duration::from_secs(10)).build();
 
-        let mut domain = String::new();
-        let mut domains = vec![];
-
-        // prefor fetch invidious instance from website, but will provide 7 backups
-        if let Ok(domain_list) = Self::get_invidious_instance_list(&client) {
-            domains = domain_list;
-        } else {
-            for item in &INVIDIOUS_INSTANCE_LIST {
-                domains.push((*item).to_string());
-            }
-        }
-
-        domains.shuffle(&mut rand::thread_rng());
-
-        let mut video_result: Vec<YoutubeVideo> = Vec::new();
-        for v in domains {
-            let url = format!("{}/api/v1/search", v);
-
-            if let Ok(result) = client
-                .get(&url)
-                .query("q", query)
-                .query("page", "1")
-                .query("type", "video")
-                .query("sort_by", "relevance")
-                .call()
-            {
-                if result.status() == 200 {
-                    if let Ok(text) = result.into_string() {
-                        if let Some(vr) = Self::parse_youtube_options(&text) {
-                            video_result = vr;
-                            domain = v;
-                            break;
-                        }
-                    }
+        // the instance list is fetched without holding the lock, other searches keep going
+        let (mut domains, fetched) = {
+            let mut health = HEALTH.lock().unwrap();
+            if health.path.is_none() {
+                if let Some(path) = Health::user_path() {
+                    *health = Health::load(path);
                 }
             }
+            (health.domains.clone(), health.domains_fetched)
+        };
+        if domains.is_empty() || now_secs().saturating_sub(fetched) > INSTANCE_LIST_TTL_SECS {
+            // prefor fetch invidious instance from website, but will provide 7 backups
+            let fetched = Self::get_invidious_instance_list(&client).ok();
+            let mut health = HEALTH.lock().unwrap();
+            if let Some(domain_list) = fetched {
+                health.domains = domain_list;
+                health.domains_fetched = now_secs();
+            } else if health.domains.is_empty() {
+                health.domains = INVIDIOUS_INSTANCE_LIST
+                    .iter()
+                    .map(|item| (*item).to_string())
+                    .collect();
+            }
+            domains = health.domains.clone();
         }
-        if domain.len() < 2 {
-            bail!("All 7 invidious servers are down? Please check your network connection first.");
-        }
 
-        let domain = Some(domain);
+        Self::new_with_domains(client, domains, query)
+    }
+
+    fn new_with_domains(
+        client: Agent,
+        domains: Vec<String>,
+        query: &str,
+    ) -> Result<(Self, Vec<YoutubeVideo>)> {
+        let cached = SEARCH_PAGES.lock().unwrap().get(query, 1);
+        let (domain, video_result) = if let Some(video_result) = cached {
+            // no need to find a working instance before the user turns the page
+            (
+                HEALTH.lock().unwrap().rank(&domains).first().cloned(),
+                video_result,
+            )
+        } else {
+            let (domain, video_result) = Self::hedged_search(&client, &domains, query, 1)?;
+            SEARCH_PAGES.lock().unwrap().insert(query, 1, &video_result);
+            (Some(domain), video_result)
+        };
         Ok((
             Self {
                 domain,
                 client,
                 query: Some(query.to_string()),
+                domains,
             },
             video_result,
         ))
     }
 
     // GetSearchQuery fetches query result from an Invidious instance.
-    pub fn get_search_query(&self, page: u32) -> Result<Vec<YoutubeVideo>> {
-        if self.domain.is_none() {
-            bail!("No server available");
-        }
-        let url = format!("{}/api/v1/search", self.domain.as_ref().unwrap());
-
+    // Paging stays on the instance that answered the first page, unless it stops answering.
+    pub fn get_search_query(&mut self, page: u32) -> Result<Vec<YoutubeVideo>> {
         let query = match &self.query {
-            Some(q) => q,
+            Some(q) => q.clone(),
             None => bail!("No query string found"),
         };
 
-        let result = self
-            .client
+        let key = (query.clone(), page);
+        let mut pages = SEARCH_PAGES.lock().unwrap();
+        while pages.prefetching.contains(&key) {
+            pages = PREFETCH_DONE.wait(pages).unwrap();
+        }
+        if let Some(video_result) = pages.get(&query, page) {
+            return Ok(video_result);
+        }
+        drop(pages);
+        let video_result = self.fetch_page(&query, page)?;
+        SEARCH_PAGES
+            .lock()
+            .unwrap()
+            .insert(&query, page, &video_result);
+        Ok(video_result)
+    }
+
+    /// Fetch a page in the background, so that turning to it is instant.
+    pub fn prefetch(&self, page: u32) {
+        let (query, domain) = match (&self.query, &self.domain) {
+            (Some(query), Some(domain)) => (query.clone(), domain.clone()),
+            _ => return,
+        };
+        let mut pages = SEARCH_PAGES.lock().unwrap();
+        if pages.get(&query, page).is_some() || !pages.prefetching.insert((query.clone(), page)) {
+            return;
+        }
+        drop(pages);
+
+        let client = self.client.clone();
+        thread::spawn(move || {
+            let start = Instant::now();
+            let result = Self::search_page(&client, &domain, &query, page);
+            let mut health = HEALTH.lock().unwrap();
+            health.record(&domain, result.as_ref().ok().map(|_| start.elapsed()));
+            health.save();
+            drop(health);
+            let mut pages = SEARCH_PAGES.lock().unwrap();
+            pages.prefetching.remove(&(query.clone(), page));
+            if let Ok(video_result) = result {
+                pages.insert(&query, page, &video_result);
+            }
+            PREFETCH_DONE.notify_all();
+        });
+    }
+
+    fn fetch_page(&mut self, query: &str, page: u32) -> Result<Vec<YoutubeVideo>> {
+        if let Some(domain) = &self.domain {
+            let start = Instant::now();
+            let result = Self::search_page(&self.client, domain, query, page);
+            let mut health = HEALTH.lock().unwrap();
+            health.record(domain, result.as_ref().ok().map(|_| start.elapsed()));
+            if result.is_ok() {
+                health.save();
+                return result;
+            }
+        }
+
+        let others: Vec<String> = self
+            .domains
+            .iter()
+            .filter(|d| Some(*d) != self.domain.as_ref())
+            .cloned()
+            .collect();
+        let (domain, video_result) = Self::hedged_search(&self.client, &others, query, page)?;
+        self.domain = Some(domain);
+        Ok(video_result)
+    }
+
+    fn search_page(
+        client: &Agent,
+        domain: &str,
+        query: &str,
+        page: u32,
+    ) -> Result<Vec<YoutubeVideo>> {
+        let url = format!("{}/api/v1/search", domain);
+        let result = client
             .get(&url)
             .query("q", query)
             .query("page", &page.to_string())
+            .query("type", "video")
+            .query("sort_by", "relevance")
             .call()?;
 
         match result.status() {
@@ -160,6 +381,66 @@ impl Instance {
         }
     }
 
+    // Ask the best ranked instances, starting another one every HEDGE_DELAY or as soon as one
+    // fails. The first good answer wins; requests still in flight only update the health.
+    fn hedged_search(
+        client: &Agent,
+        domains: &[String],
+        query: &str,
+        page: u32,
+    ) -> Result<(String, Vec<YoutubeVideo>)> {
+        let ranked = HEALTH.lock().unwrap().rank(domains);
+        let (tx, rx) = mpsc::channel();
+        let mut next = 0;
+        let mut in_flight = 0;
+
+        let launch = |domain: &str| {
+            let (tx, client, domain, query) = (
+                tx.clone(),
+                client.clone(),
+                domain.to_string(),
+                query.to_string(),
+            );
+            thread::spawn(move || {
+                let start = Instant::now();
+                let result = Self::search_page(&client, &domain, &query, page);
+                HEALTH
+                    .lock()
+                    .unwrap()
+                    .record(&domain, result.as_ref().ok().map(|_| start.elapsed()));
+                tx.send((domain, result)).ok();
+            });
+        };
+
+        loop {
+            if next < ranked.len() && in_flight < HEDGE_FANOUT {
+                launch(&ranked[next]);
+                next += 1;
+                in_flight += 1;
+            }
+            if in_flight == 0 {
+                break;
+            }
+
+            match rx.recv_timeout(HEDGE_DELAY) {
+                Ok((domain, Ok(video_result))) => {
+                    HEALTH.lock().unwrap().save();
+                    return Ok((domain, video_result));
+                }
+                Ok((_, Err(_))) => in_flight -= 1,
+                // the running requests are slow, hedge with the next instance
+                Err(RecvTimeoutError::Timeout) => {}
+                Err(RecvTimeoutError::Disconnected) => break,
+            }
+        }
+
+        HEALTH.lock().unwrap().save();
+        bail!(
+            "All {} invidious servers are down? Please check your network connection first.",
+            domains.len()
+        )
+    }
+
     // GetSuggestions returns video suggestions based on prefix strings. This is the
     // same result as youtube search autocomplete.
     pub fn get_suggestions(&self, prefix: &str) -> Result<Vec<YoutubeVideo>> {
@@ -278,3 +559,133 @@ impl Instance {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::{Read, Write};
+    use std::net::TcpListener;
+
+    enum Behaviour {
+        Hang,
+        Fail,
+        Answer(&'static str),
+    }
+
+    // a fake invidious instance, returns its base url
+    fn mock_instance(behaviour: Behaviour) -> String {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let address = listener.local_addr().unwrap();
+        thread::spawn(move || {
+            for mut stream in listener.incoming().flatten() {
+                let mut buf = [0_u8; 4096];
+                stream.read(&mut buf).ok();
+                let response = match behaviour {
+                    Behaviour::Hang => {
+                        thread::sleep(Duration::from_secs(30));
+                        continue;
+                    }
+                    Behaviour::Fail => {
+                        "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n"
+                            .to_string()
+                    }
+                    Behaviour::Answer(title) => {
+                        let body = format!(
+                            r#"[{{"title":"{}","videoId":"id","lengthSeconds":60}}]"#,
+                            title
+                        );
+                        format!(
+                            "HTTP/1.1 200 OK\r\nContent-Length: {}\r\n\r\n{}",
+                            body.len(),
+                            body
+                        )
+                    }
+                };
+                stream.write_all(response.as_bytes()).ok();
+            }
+        });
+        format!("http://{}", address)
+    }
+
+    #[test]
+    fn test_hedged_search_skips_dead_instances() {
+        let hanging = mock_instance(Behaviour::Hang);
+        let failing = mock_instance(Behaviour::Fail);
+        let working = mock_instance(Behaviour::Answer("from working"));
+        let client = AgentBuilder::new().timeout(Duration::from_secs(10)).build();
+
+        let start = Instant::now();
+        let (instance, videos) = Instance::new_with_domains(
+            client,
+            vec![hanging.clone(), failing.clone(), working.clone()],
+            "hedged query",
+        )
+        .unwrap();
+        // well below the 10 s a dead instance used to cost
+        assert!(start.elapsed() < Duration::from_secs(5));
+        assert_eq!(instance.domain.as_deref(), Some(working.as_str()));
+        assert_eq!(videos[0].title, "from working");
+
+        let health = HEALTH.lock().unwrap();
+        let now = now_secs();
+        assert!(health.cost(&working, now) < health.cost(&hanging, now));
+        assert!(health.cost(&working, now) < UNKNOWN_LATENCY_MS);
+    }
+
+    #[test]
+    fn test_paging_fails_over() {
+        let first = mock_instance(Behaviour::Answer("first"));
+        let second = mock_instance(Behaviour::Answer("second"));
+        let client = AgentBuilder::new().timeout(Duration::from_secs(10)).build();
+        let mut instance = Instance {
+            domain: Some(first.clone()),
+            client,
+            query: Some("paging query".to_string()),
+            domains: vec![first.clone(), second.clone()],
+        };
+        assert_eq!(instance.get_search_query(2).unwrap()[0].title, "first");
+
+        // the instance we were paging on went away
+        instance.domain = Some(mock_instance(Behaviour::Fail));
+        assert_eq!(instance.get_search_query(3).unwrap().len(), 1);
+        let domain = instance.domain.unwrap();
+        assert!(domain == first || domain == second);
+    }
+
+    #[test]
+    fn test_page_being_prefetched_is_waited_for() {
+        let working = mock_instance(Behaviour::Answer("prefetched"));
+        let client = AgentBuilder::new().timeout(Duration::from_secs(10)).build();
+        let mut instance = Instance {
+            domain: Some(working.clone()),
+            client,
+            query: Some("prefetch query".to_string()),
+            domains: vec![working],
+        };
+        instance.prefetch(2);
+
+        // every instance but the one prefetching is gone, the page must come from the prefetch
+        instance.domain = Some(mock_instance(Behaviour::Fail));
+        instance.domains.clear();
+        assert_eq!(instance.get_search_query(2).unwrap()[0].title, "prefetched");
+    }
+
+    #[test]
+    fn test_health_decays_to_unknown() {
+        let mut health = Health::default();
+        health.entries.insert(
+            "slow".to_string(),
+            HealthEntry {
+                latency_ms: FAILURE_LATENCY_MS,
+                updated: 0,
+            },
+        );
+        health.record("fast", Some(Duration::from_millis(100)));
+        let now = now_secs();
+        assert!((health.cost("slow", now) - UNKNOWN_LATENCY_MS).abs() < 1.0);
+        assert_eq!(
+            health.rank(&["slow".to_string(), "fast".to_string()])[0],
+            "fast"
+        );
+    }
+}
@@ -0,0 +1,797 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use crate::config::get_app_config_path;
+use crate::track::{Fields, Track};
+use crate::waveform::{self, Envelope, EnvelopeBuilder};
+use anyhow::{anyhow, Result};
+use rusqlite::{params, Connection, OptionalExtension};
+use serde::{Deserialize, Serialize};
+use std::f64::consts::PI;
+use std::ffi::OsStr;
+use std::fs::File;
+use std::panic;
+use std::path::Path;
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+use symphonia::core::audio::SampleBuffer;
+use symphonia::core::codecs::DecoderOptions;
+use symphonia::core::errors::Error;
+use symphonia::core::formats::FormatOptions;
+use symphonia::core::io::{MediaSourceStream, MediaSourceStreamOptions};
+use symphonia::core::meta::MetadataOptions;
+use symphonia::core::probe::Hint;
+use symphonia::default::{get_codecs, get_probe};
+
+// ReplayGain 2.0 plays everything at -18 LUFS
+const REFERENCE_LUFS: f64 = -18.0;
+// 400 ms gating blocks advanced in 100 ms steps
+const SUB_BLOCKS: usize = 4;
+const ABSOLUTE_GATE: f64 = -70.0;
+const RELATIVE_GATE: f64 = -10.0;
+// true peak is searched on a 4x oversampled signal
+const OVERSAMPLING: usize = 4;
+const TAPS_PER_PHASE: usize = 12;
+// tracks handed to the workers at a time, results are written in one transaction
+const BATCH: u32 = 64;
+// how often a fully analyzed library is checked for new tracks
+const RESCAN: Duration = Duration::from_secs(60);
+
+/// Which stored gain is applied on playback.
+#[derive(Clone, Copy, Debug, Deserialize, Eq, PartialEq, Serialize)]
+pub enum ReplayGain {
+    Off,
+    Track,
+    Album,
+}
+
+/// The `REPLAYGAIN_*` tags of a track, gains in dB and linear peaks.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct ReplayGainTags {
+    pub track_gain: Option<f64>,
+    pub track_peak: Option<f64>,
+    pub album_gain: Option<f64>,
+    pub album_peak: Option<f64>,
+}
+
+/// Parse a gain like `-6.50 dB` or a peak like `0.988547`.
+pub fn parse_tag(value: &str) -> Option<f64> {
+    value
+        .trim()
+        .trim_end_matches(|c: char| c.is_ascii_alphabetic())
+        .trim()
+        .parse()
+        .ok()
+}
+
+#[derive(Clone, Copy, Default)]
+struct Biquad {
+    b: [f64; 3],
+    a: [f64; 2],
+    z: [f64; 2],
+}
+
+impl Biquad {
+    fn process(&mut self, x: f64) -> f64 {
+        let y = self.b[0] * x + self.z[0];
+        self.z[0] = self.b[1] * x - self.a[0] * y + self.z[1];
+        self.z[1] = self.b[2] * x - self.a[1] * y;
+        y
+    }
+}
+
+// the two stage K-weighting filter of ITU-R BS.1770, derived for any sample rate
+fn k_weighting(rate: u32) -> [Biquad; 2] {
+    let rate = f64::from(rate);
+
+    let (f0, gain, q) = (
+        1_681.974_450_955_533,
+        3.999_843_853_973_347,
+        0.707_175_236_955_419_6,
+    );
+    let k = (PI * f0 / rate).tan();
+    let vh = 10_f64.powf(gain / 20.0);
+    let vb = vh.powf(0.499_666_774_154_541_6);
+    let a0 = 1.0 + k / q + k * k;
+    let shelf = Biquad {
+        b: [
+            (vh + vb * k / q + k * k) / a0,
+            2.0 * (k * k - vh) / a0,
+            (vh - vb * k / q + k * k) / a0,
+        ],
+        a: [2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0],
+        z: [0.0; 2],
+    };
+
+    let (f0, q) = (38.135_470_876_024_44, 0.500_327_037_323_877_3);
+    let k = (PI * f0 / rate).tan();
+    let a0 = 1.0 + k / q + k * k;
+    let high_pass = Biquad {
+        b: [1.0, -2.0, 1.0],
+        a: [2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0],
+        z: [0.0; 2],
+    };
+
+    [shelf, high_pass]
+}
+
+// polyphase windowed sinc, phase 0 passes the input through unchanged
+#[allow(clippy::cast_precision_loss)]
+fn interpolator() -> Vec<[f64; TAPS_PER_PHASE]> {
+    let center = (OVERSAMPLING * TAPS_PER_PHASE / 2) as f64;
+    (0..OVERSAMPLING)
+        .map(|phase| {
+            let mut taps = [0.0; TAPS_PER_PHASE];
+            for (j, tap) in taps.iter_mut().enumerate() {
+                let n = (phase + j * OVERSAMPLING) as f64 - center;
+                let x = n / OVERSAMPLING as f64;
+                let sinc = if x == 0.0 {
+                    1.0
+                } else {
+                    (PI * x).sin() / (PI * x)
+                };
+                *tap = sinc * (0.5 + 0.5 * (PI * n / center).cos());
+            }
+            taps
+        })
+        .collect()
+}
+
+fn to_lufs(energy: f64) -> f64 {
+    -0.691 + 10.0 * energy.log10()
+}
+
+fn from_lufs(lufs: f64) -> f64 {
+    10_f64.powf((lufs + 0.691) / 10.0)
+}
+
+/// The measurement of one track.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Loudness {
+    /// integrated loudness in LUFS
+    pub lufs: f64,
+    /// linear true peak, 1.0 is full scale
+    pub peak: f64,
+    /// number of blocks that passed the gates, weighs the track in the album loudness
+    pub weight: f64,
+}
+
+/// Integrated loudness and true peak following EBU R128 / ITU-R BS.1770.
+pub struct Meter {
+    channels: usize,
+    weights: Vec<f64>,
+    filters: Vec<[Biquad; 2]>,
+    phases: Vec<[f64; TAPS_PER_PHASE]>,
+    history: Vec<[f64; TAPS_PER_PHASE]>,
+    sub_block_len: usize,
+    sub_block_pos: usize,
+    sub_block_energy: f64,
+    recent: [f64; SUB_BLOCKS],
+    sub_blocks_seen: usize,
+    blocks: Vec<f64>,
+    peak: f64,
+}
+
+impl Meter {
+    #[allow(clippy::cast_possible_truncation)]
+    pub fn new(channels: usize, rate: u32) -> Self {
+        // the LFE of a 5.1 layout does not count, the surround channels are boosted
+        let weights = if channels == 6 {
+            vec![1.0, 1.0, 1.0, 0.0, 1.41, 1.41]
+        } else {
+            vec![1.0; channels]
+        };
+        Self {
+            channels,
+            weights,
+            filters: vec![k_weighting(rate); channels],
+            phases: interpolator(),
+            history: vec![[0.0; TAPS_PER_PHASE]; channels],
+            sub_block_len: (rate as usize / 10).max(1),
+            sub_block_pos: 0,
+            sub_block_energy: 0.0,
+            recent: [0.0; SUB_BLOCKS],
+            sub_blocks_seen: 0,
+            blocks: Vec::new(),
+            peak: 0.0,
+        }
+    }
+
+    /// Feed interleaved samples.
+    pub fn push(&mut self, samples: &[f32]) {
+        for frame in samples.chunks_exact(self.channels) {
+            for (c, &sample) in frame.iter().enumerate() {
+                let x = f64::from(sample);
+
+                let history = &mut self.history[c];
+                history.copy_within(..TAPS_PER_PHASE - 1, 1);
+                history[0] = x;
+                for taps in &self.phases {
+                    let y: f64 = taps.iter().zip(history.iter()).map(|(t, h)| t * h).sum();
+                    self.peak = self.peak.max(y.abs());
+                }
+
+                let [shelf, high_pass] = &mut self.filters[c];
+                let y = high_pass.process(shelf.process(x));
+                self.sub_block_energy += self.weights[c] * y * y;
+            }
+
+            self.sub_block_pos += 1;
+            if self.sub_block_pos == self.sub_block_len {
+                self.end_sub_block();
+            }
+        }
+    }
+
+    #[allow(clippy::cast_precision_loss)]
+    fn end_sub_block(&mut self) {
+        self.recent[self.sub_blocks_seen % SUB_BLOCKS] =
+            self.sub_block_energy / self.sub_block_len as f64;
+        self.sub_blocks_seen += 1;
+        self.sub_block_energy = 0.0;
+        self.sub_block_pos = 0;
+        if self.sub_blocks_seen >= SUB_BLOCKS {
+            self.blocks
+                .push(self.recent.iter().sum::<f64>() / SUB_BLOCKS as f64);
+        }
+    }
+
+    /// Gate the blocks seen so far, `None` if all of them are below the absolute gate.
+    #[allow(clippy::cast_precision_loss)]
+    pub fn finish(&self) -> Option<Loudness> {
+        let threshold = from_lufs(ABSOLUTE_GATE);
+        let loud: Vec<f64> = self
+            .blocks
+            .iter()
+            .copied()
+            .filter(|&e| e > threshold)
+            .collect();
+        if loud.is_empty() {
+            return None;
+        }
+
+        let mean = loud.iter().sum::<f64>() / loud.len() as f64;
+        let threshold = from_lufs(to_lufs(mean) + RELATIVE_GATE);
+        let gated: Vec<f64> = loud.into_iter().filter(|&e| e > threshold).collect();
+
+        Some(Loudness {
+            lufs: to_lufs(gated.iter().sum::<f64>() / gated.len() as f64),
+            peak: self.peak,
+            weight: gated.len() as f64,
+        })
+    }
+}
+
+// decode the whole track at `path`, handing interleaved samples to `f` with the channel count
+// and rate
+fn decode(path: &str, mut f: impl FnMut(&[f32], usize, u32)) -> Result<()> {
+    let file = File::open(path)?;
+    let mss = MediaSourceStream::new(Box::new(file), MediaSourceStreamOptions::default());
+    let mut hint = Hint::new();
+    if let Some(ext) = Path::new(path).extension().and_then(OsStr::to_str) {
+        hint.with_extension(ext);
+    }
+    let mut probed = get_probe().format(
+        &hint,
+        mss,
+        &FormatOptions {
+            enable_gapless: true,
+            ..FormatOptions::default()
+        },
+        &MetadataOptions::default(),
+    )?;
+    let track = probed
+        .format
+        .default_track()
+        .ok_or_else(|| anyhow!("no audio track"))?;
+    let track_id = track.id;
+    let mut decoder = get_codecs().make(&track.codec_params, &DecoderOptions::default())?;
+
+    let mut buffer: Option<(usize, SampleBuffer<f32>)> = None;
+    loop {
+        let packet = match probed.format.next_packet() {
+            Ok(packet) => packet,
+            Err(Error::IoError(e)) if e.kind() == std::io::ErrorKind::UnexpectedEof => break,
+            Err(e) => return Err(e.into()),
+        };
+        if packet.track_id() != track_id {
+            continue;
+        }
+        let decoded = match decoder.decode(&packet) {
+            Ok(decoded) if decoded.frames() > 0 => decoded,
+            Ok(_) | Err(Error::DecodeError(_)) => continue,
+            Err(e) => return Err(e.into()),
+        };
+
+        let spec = *decoded.spec();
+        let capacity = decoded.capacity();
+        if !matches!(buffer, Some((c, _)) if c >= capacity) {
+            buffer = Some((capacity, SampleBuffer::new(capacity as u64, spec)));
+        }
+        if let Some((_, buffer)) = buffer.as_mut() {
+            buffer.copy_interleaved_ref(decoded);
+            f(buffer.samples(), spec.channels.count(), spec.rate);
+        }
+    }
+    Ok(())
+}
+
+/// What is stored per track, gains in dB relative to the reference and linear peaks.
+#[derive(Clone, Copy, Debug, PartialEq)]
+struct Gain {
+    track_gain: f64,
+    track_peak: f64,
+    album_gain: Option<f64>,
+    album_peak: Option<f64>,
+    weight: f64,
+}
+
+impl Gain {
+    fn from_loudness(loudness: Loudness) -> Self {
+        Self {
+            track_gain: REFERENCE_LUFS - loudness.lufs,
+            track_peak: loudness.peak,
+            album_gain: None,
+            album_peak: None,
+            weight: loudness.weight,
+        }
+    }
+
+    // tags win over the measurement, as long as they can prevent clipping
+    fn from_tags(track: &Track) -> Option<Self> {
+        let tags = track.replay_gain();
+        Some(Self {
+            track_gain: tags.track_gain?,
+            track_peak: tags.track_peak?,
+            album_gain: tags.album_gain,
+            album_peak: tags.album_peak,
+            weight: track.duration().as_secs_f64() * 10.0,
+        })
+    }
+}
+
+fn create_table(conn: &Connection) -> rusqlite::Result<()> {
+    conn.execute(
+        "create table if not exists loudness(
+         file TEXT PRIMARY KEY,
+         last_modified TEXT,
+         track_gain REAL,
+         track_peak REAL,
+         album_gain REAL,
+         album_peak REAL,
+         weight REAL
+        )",
+        [],
+    )?;
+    waveform::create_table(conn)
+}
+
+// tracks never analyzed or changed since, tracks that failed keep a row without gain or
+// envelope
+fn pending(conn: &Connection, limit: u32) -> rusqlite::Result<Vec<(String, String)>> {
+    let mut stmt = conn.prepare(
+        "SELECT track.file, track.last_modified FROM track
+         LEFT JOIN loudness ON loudness.file = track.file
+         LEFT JOIN waveform ON waveform.file = track.file
+         WHERE loudness.file IS NULL OR loudness.last_modified != track.last_modified
+         OR waveform.file IS NULL OR waveform.last_modified != track.last_modified
+         LIMIT ?",
+    )?;
+    let rows = stmt.query_map([limit], |row| Ok((row.get(0)?, row.get(1)?)))?;
+    rows.collect()
+}
+
+// the result of one decoding pass over a track
+struct Analysis {
+    file: String,
+    last_modified: String,
+    gain: Option<Gain>,
+    envelope: Option<Envelope>,
+}
+
+fn store(conn: &mut Connection, results: &[Analysis]) -> rusqlite::Result<()> {
+    let tx = conn.transaction()?;
+    for Analysis {
+        file,
+        last_modified,
+        gain,
+        envelope,
+    } in results
+    {
+        tx.execute(
+            "INSERT OR REPLACE INTO loudness
+             (file, last_modified, track_gain, track_peak, album_gain, album_peak, weight)
+             values (?1, ?2, ?3, ?4, ?5, ?6, ?7)",
+            params![
+                file,
+                last_modified,
+                gain.map(|g| g.track_gain),
+                gain.map(|g| g.track_peak),
+                gain.and_then(|g| g.album_gain),
+                gain.and_then(|g| g.album_peak),
+                gain.map(|g| g.weight),
+            ],
+        )?;
+        waveform::store(&tx, file, last_modified, envelope.as_ref())?;
+    }
+    tx.commit()
+}
+
+// the album plays at the loudness of all its blocks together, so loud tracks count for more
+// than in a plain average of the track gains
+fn album_gain(tracks: &[(f64, f64)]) -> f64 {
+    let weight: f64 = tracks.iter().map(|(_, w)| w).sum();
+    let energy: f64 = tracks
+        .iter()
+        .map(|(gain, w)| w * 10_f64.powf(-gain / 10.0))
+        .sum::<f64>()
+        / weight;
+    -10.0 * energy.log10()
+}
+
+// gain and peak for `file`, the album ones only once the whole album is analyzed
+fn lookup(conn: &Connection, file: &str, mode: ReplayGain) -> rusqlite::Result<Option<(f64, f64)>> {
+    let gain: Option<(Option<f64>, Option<f64>, Option<f64>, Option<f64>)> = conn
+        .query_row(
+            "SELECT track_gain, track_peak, album_gain, album_peak FROM loudness WHERE file = ?",
+            [file],
+            |row| Ok((row.get(0)?, row.get(1)?, row.get(2)?, row.get(3)?)),
+        )
+        .optional()?;
+    let (track_gain, track_peak, album_gain, album_peak) = match gain {
+        Some((Some(gain), Some(peak), album_gain, album_peak)) => {
+            (gain, peak, album_gain, album_peak)
+        }
+        _ => return Ok(None),
+    };
+
+    match mode {
+        ReplayGain::Off => return Ok(None),
+        ReplayGain::Track => return Ok(Some((track_gain, track_peak))),
+        ReplayGain::Album => {}
+    }
+    if let (Some(gain), Some(peak)) = (album_gain, album_peak) {
+        return Ok(Some((gain, peak)));
+    }
+
+    let mut stmt = conn.prepare(
+        "SELECT loudness.file, loudness.track_gain, loudness.track_peak, loudness.weight
+         FROM track LEFT JOIN loudness ON loudness.file = track.file
+         WHERE track.album = (SELECT album FROM track WHERE file = ?1)
+         AND track.directory = (SELECT directory FROM track WHERE file = ?1)",
+    )?;
+    let rows = stmt.query_map([file], |row| {
+        Ok((
+            row.get::<_, Option<String>>(0)?,
+            row.get::<_, Option<f64>>(1)?,
+            row.get::<_, Option<f64>>(2)?,
+            row.get::<_, Option<f64>>(3)?,
+        ))
+    })?;
+
+    let mut tracks = Vec::new();
+    let mut peak = track_peak;
+    for row in rows {
+        match row? {
+            (None, _, _, _) => return Ok(Some((track_gain, track_peak))),
+            (Some(_), Some(gain), Some(track_peak), Some(weight)) => {
+                tracks.push((gain, weight));
+                peak = peak.max(track_peak);
+            }
+            // silent or undecodable tracks do not take part
+            _ => {}
+        }
+    }
+    if tracks.is_empty() {
+        return Ok(Some((track_gain, track_peak)));
+    }
+    Ok(Some((album_gain(&tracks), peak)))
+}
+
+// a gain that would push the peak over full scale is lowered until it does not
+#[allow(clippy::cast_possible_truncation)]
+fn factor(gain: f64, peak: f64) -> f32 {
+    let factor = 10_f64.powf(gain / 20.0);
+    let factor = if peak > 0.0 {
+        factor.min(1.0 / peak)
+    } else {
+        factor
+    };
+    factor as f32
+}
+
+fn open_db() -> Result<Connection> {
+    let mut db_path = get_app_config_path()?;
+    db_path.push("library.db");
+    let conn = Connection::open(db_path)?;
+    // the analyzer and the ui write to the same file
+    conn.busy_timeout(Duration::from_secs(5))?;
+    create_table(&conn)?;
+    Ok(conn)
+}
+
+/// Looks up the stored gains of the tracks that are about to play.
+pub struct Gains {
+    conn: Option<Connection>,
+}
+
+impl Gains {
+    pub fn open() -> Self {
+        Self {
+            conn: open_db().ok(),
+        }
+    }
+
+    /// The linear factor to play `file` with, 1.0 when nothing is known about it yet.
+    pub fn factor(&self, file: &str, mode: ReplayGain) -> f32 {
+        if mode == ReplayGain::Off {
+            return 1.0;
+        }
+        self.conn
+            .as_ref()
+            .and_then(|conn| lookup(conn, file, mode).ok().flatten())
+            .map_or(1.0, |(gain, peak)| factor(gain, peak))
+    }
+}
+
+// one decoding pass gives both the loudness and the waveform overview
+fn measure(file: String, last_modified: String) -> Analysis {
+    let tagged = Track::read_with(&file, Fields::BASIC | Fields::PROPERTIES)
+        .ok()
+        .and_then(|track| Gain::from_tags(&track));
+    let mut meter: Option<Meter> = None;
+    let mut builder: Option<EnvelopeBuilder> = None;
+    let decoded = decode(&file, |samples, channels, rate| {
+        if tagged.is_none() {
+            meter
+                .get_or_insert_with(|| Meter::new(channels, rate))
+                .push(samples);
+        }
+        builder
+            .get_or_insert_with(|| EnvelopeBuilder::new(channels))
+            .push(samples);
+    });
+    // a track that breaks halfway is not measured from its first half
+    if decoded.is_err() {
+        meter = None;
+        builder = None;
+    }
+    Analysis {
+        gain: tagged.or_else(|| meter.and_then(|m| m.finish()).map(Gain::from_loudness)),
+        envelope: builder.and_then(|b| b.finish(waveform::BUCKETS)),
+        file,
+        last_modified,
+    }
+}
+
+// playback keeps the cpu whenever it needs it
+fn lower_priority() {
+    #[cfg(target_os = "linux")]
+    // on linux the nice value belongs to the calling thread only
+    unsafe {
+        libc::setpriority(libc::PRIO_PROCESS, 0, 19);
+    }
+}
+
+/// Analyze the library in the background with `workers` threads and store the loudness and the
+/// waveform overview of each track in library.db. Tracks analyzed before are skipped, so a
+/// restart continues where it stopped.
+pub fn spawn_analyzer(workers: usize) {
+    if workers == 0 {
+        return;
+    }
+    let mut conn = match open_db() {
+        Ok(conn) => conn,
+        Err(_) => return,
+    };
+
+    let (job_tx, job_rx): (Sender<(String, String)>, Receiver<(String, String)>) = mpsc::channel();
+    let (result_tx, result_rx): (Sender<Analysis>, Receiver<Analysis>) = mpsc::channel();
+    let job_rx = Arc::new(Mutex::new(job_rx));
+
+    for _ in 0..workers {
+        let job_rx = job_rx.clone();
+        let result_tx = result_tx.clone();
+        thread::spawn(move || {
+            lower_priority();
+            loop {
+                let job = job_rx.lock().unwrap().recv();
+                let (file, last_modified) = match job {
+                    Ok(job) => job,
+                    Err(_) => return,
+                };
+                let start = Instant::now();
+                // a track that crashes the decoder is stored without results, so the batch
+                // completes and the track is not tried again
+                let analysis = panic::catch_unwind(|| measure(file.clone(), last_modified.clone()))
+                    .unwrap_or(Analysis {
+                        gain: None,
+                        envelope: None,
+                        file,
+                        last_modified,
+                    });
+                if result_tx.send(analysis).is_err() {
+                    return;
+                }
+                // idle as long as the track took, a library scan never hogs the cpu
+                thread::sleep(start.elapsed());
+            }
+        });
+    }
+
+    thread::spawn(move || loop {
+        let batch = pending(&conn, BATCH).unwrap_or_default();
+        if batch.is_empty() {
+            thread::sleep(RESCAN);
+            continue;
+        }
+        let count = batch.len();
+        for job in batch {
+            job_tx.send(job).ok();
+        }
+        let results: Vec<_> = result_rx.iter().take(count).collect();
+        if results.len() < count || store(&mut conn, &results).is_err() {
+            return;
+        }
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sine(channels: usize, rate: u32, amplitude: f32, secs: usize) -> Vec<f32> {
+        let mut samples = Vec::new();
+        for i in 0..rate as usize * secs {
+            let t = i as f32 / rate as f32;
+            let v = amplitude * (2.0 * std::f32::consts::PI * 1000.0 * t).sin();
+            samples.extend(std::iter::repeat(v).take(channels));
+        }
+        samples
+    }
+
+    #[test]
+    fn test_sine_reads_its_level() {
+        // a stereo 1 kHz sine at -23 dBFS reads -23 LUFS at any rate
+        for rate in [44_100, 48_000, 96_000] {
+            let mut meter = Meter::new(2, rate);
+            meter.push(&sine(2, rate, 10_f32.powf(-23.0 / 20.0), 5));
+            let loudness = meter.finish().unwrap();
+            assert!((loudness.lufs + 23.0).abs() < 0.1, "{}", loudness.lufs);
+            assert!((loudness.peak - 0.0708).abs() < 0.001, "{}", loudness.peak);
+        }
+    }
+
+    #[test]
+    fn test_silence_is_gated() {
+        let mut meter = Meter::new(2, 48_000);
+        meter.push(&vec![0.0; 48_000 * 2 * 5]);
+        assert!(meter.finish().is_none());
+
+        // long silence around the music does not make it any quieter
+        meter.push(&sine(2, 48_000, 10_f32.powf(-23.0 / 20.0), 5));
+        meter.push(&vec![0.0; 48_000 * 2 * 5]);
+        assert!((meter.finish().unwrap().lufs + 23.0).abs() < 0.1);
+    }
+
+    #[test]
+    fn test_true_peak_sees_between_samples() {
+        // a quarter of the sample rate sampled 45 degrees off its crest
+        let samples: Vec<f32> = (0..48_000)
+            .map(|i| {
+                0.5 * (std::f32::consts::FRAC_PI_2 * i as f32 + std::f32::consts::FRAC_PI_4).sin()
+            })
+            .collect();
+        let mut meter = Meter::new(1, 48_000);
+        meter.push(&samples);
+        let peak = meter.finish().unwrap().peak;
+        assert!(samples.iter().all(|s| s.abs() < 0.36));
+        assert!((peak - 0.5).abs() < 0.01, "{}", peak);
+    }
+
+    #[test]
+    fn test_gain_is_clipped_by_peak() {
+        assert!((factor(-6.0, 0.5) - 0.501).abs() < 0.001);
+        assert!((factor(6.0, 0.9) - 1.0 / 0.9).abs() < 0.001);
+        assert!((factor(6.0, 0.25) - 1.995).abs() < 0.001);
+    }
+
+    #[test]
+    fn test_album_gain_favours_loud_tracks() {
+        assert!((album_gain(&[(-4.0, 10.0), (-4.0, 30.0)]) + 4.0).abs() < 1e-9);
+        let gain = album_gain(&[(-6.0, 10.0), (0.0, 10.0)]);
+        assert!(gain < -3.0 && gain > -6.0, "{}", gain);
+    }
+
+    #[test]
+    fn test_parse_tag() {
+        assert_eq!(parse_tag("-6.50 dB"), Some(-6.5));
+        assert_eq!(parse_tag("+1.2 dB"), Some(1.2));
+        assert_eq!(parse_tag("0.988547"), Some(0.988_547));
+        assert_eq!(parse_tag("loud"), None);
+    }
+
+    #[test]
+    fn test_analysis_resumes_and_feeds_album_gain() {
+        let mut conn = Connection::open_in_memory().unwrap();
+        conn.execute(
+            "create table track(file TEXT, album TEXT, directory TEXT, last_modified TEXT)",
+            [],
+        )
+        .unwrap();
+        create_table(&conn).unwrap();
+        for file in ["a", "b", "c"] {
+            conn.execute(
+                "INSERT INTO track values (?1, 'album', '/music', '1')",
+                [file],
+            )
+            .unwrap();
+        }
+        let gain = |track_gain| Gain {
+            track_gain,
+            track_peak: 0.5,
+            album_gain: None,
+            album_peak: None,
+            weight: 10.0,
+        };
+        let analysis = |file: &str, gain| Analysis {
+            file: file.into(),
+            last_modified: "1".into(),
+            gain,
+            envelope: None,
+        };
+
+        store(&mut conn, &[analysis("a", Some(gain(-6.0)))]).unwrap();
+        let left: Vec<String> = pending(&conn, BATCH)
+            .unwrap()
+            .into_iter()
+            .map(|p| p.0)
+            .collect();
+        assert_eq!(left, vec!["b", "c"]);
+        // until the album is complete it plays with its track gain
+        assert_eq!(
+            lookup(&conn, "a", ReplayGain::Album).unwrap(),
+            Some((-6.0, 0.5))
+        );
+
+        store(
+            &mut conn,
+            &[analysis("b", Some(gain(0.0))), analysis("c", None)],
+        )
+        .unwrap();
+        assert!(pending(&conn, BATCH).unwrap().is_empty());
+        let (album, _) = lookup(&conn, "a", ReplayGain::Album).unwrap().unwrap();
+        assert!((album - album_gain(&[(-6.0, 10.0), (0.0, 10.0)])).abs() < 1e-9);
+        assert_eq!(lookup(&conn, "c", ReplayGain::Track).unwrap(), None);
+
+        // a tag edit changes the modification time and queues the track again
+        conn.execute("UPDATE track SET last_modified = '2' WHERE file = 'a'", [])
+            .unwrap();
+        assert_eq!(
+            pending(&conn, BATCH).unwrap(),
+            vec![(String::from("a"), String::from("2"))]
+        );
+    }
+}
@@ -30,9 +30,14 @@ mod cli;
 mod config;
 #[cfg(feature = "discord")]
 mod discord;
+mod download;
 mod invidious;
+mod loudness;
 mod player;
 mod playlist;
+mod saved;
+#[cfg(all(unix, feature = "server"))]
+mod server;
 mod songtag;
 mod sqlite;
 mod track;
@@ -40,8 +45,9 @@ mod track;
 mod ueberzug;
 mod ui;
 mod utils;
+mod waveform;
 
-use anyhow::Result;
+use anyhow::{bail, Result};
 use config::Settings;
 
 use ui::{UI, VERSION};
@@ -56,7 +62,24 @@ fn main() -> Result<()> {
     config.disable_discord_rpc_from_cli = args.disable_discord_rpc_from_cli;
     config.max_depth_cli = args.max_depth_cli;
 
-    let mut ui = UI::new(&config);
-    ui.run();
-    Ok(())
+    match args.mode {
+        #[cfg(all(unix, feature = "server"))]
+        cli::Mode::Server => server::run(&config),
+        #[cfg(all(unix, feature = "server"))]
+        cli::Mode::Control(command) => server::control(&command),
+        #[cfg(not(all(unix, feature = "server")))]
+        cli::Mode::Server | cli::Mode::Control(_) => {
+            bail!("termusic was built without the server, it needs the `server` feature on unix")
+        }
+        cli::Mode::Tui => {
+            // two players would fight over the audio device and the playlist file
+            #[cfg(all(unix, feature = "server"))]
+            if server::is_running() {
+                bail!("a server is already playing, stop it with `termusic ctl quit` first");
+            }
+            let mut ui = UI::new(&config);
+            ui.run();
+            Ok(())
+        }
+    }
 }
@@ -23,6 +23,7 @@
  */
 use super::{PlayerMsg, PlayerTrait};
 use crate::config::Settings;
+use crate::utils::is_url;
 use anyhow::Result;
 use gst::ClockTime;
 use gstreamer as gst;
@@ -43,6 +44,9 @@ pub trait PathToURI {
 impl PathToURI for Path {
     /// Returns `self` as a URI. Panics in case of an error.
     fn to_uri(&self) -> String {
+        if let Some(url) = self.to_str().filter(|p| is_url(p)) {
+            return url.to_string();
+        }
         glib::filename_to_uri(self, None)
             .expect("Error converting path to URI")
             .to_string()
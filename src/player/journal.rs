@@ -0,0 +1,438 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Append-only log of the changes to the playlist. Every change is one line written as it
+// happens, so a crash loses at most the line being written. The log is compacted into a
+// snapshot once it grows well past the playlist it describes.
+use super::sequence::Sequence;
+use anyhow::Result;
+use std::fs::{self, File, OpenOptions};
+use std::io::{BufRead, BufReader, Write};
+use std::path::PathBuf;
+use std::time::Duration;
+
+// entries past a snapshot of this many tracks before the log is compacted again
+const SLACK: usize = 1024;
+
+/// What the playlist keeps of a track without opening the file.
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct Cached {
+    pub file: String,
+    pub duration: Duration,
+    pub artist: Option<String>,
+    pub album: Option<String>,
+    pub title: Option<String>,
+}
+
+#[derive(Clone, Debug, PartialEq)]
+pub enum Entry {
+    Insert(usize, Cached),
+    Remove(usize),
+    Move(usize, usize),
+    Clear,
+    /// the track playing and the seconds played of it
+    Position(String, i64),
+    /// keep the playlist as it is now on the undo stack
+    Remember,
+    Undo,
+    Redo,
+}
+
+fn escape(field: &str) -> String {
+    let mut out = String::with_capacity(field.len());
+    for c in field.chars() {
+        match c {
+            '\\' => out.push_str("\\\\"),
+            '\t' => out.push_str("\\t"),
+            '\n' => out.push_str("\\n"),
+            '\r' => out.push_str("\\r"),
+            c => out.push(c),
+        }
+    }
+    out
+}
+
+fn unescape(field: &str) -> String {
+    let mut out = String::with_capacity(field.len());
+    let mut chars = field.chars();
+    while let Some(c) = chars.next() {
+        if c != '\\' {
+            out.push(c);
+            continue;
+        }
+        match chars.next() {
+            Some('t') => out.push('\t'),
+            Some('n') => out.push('\n'),
+            Some('r') => out.push('\r'),
+            Some(c) => out.push(c),
+            None => {}
+        }
+    }
+    out
+}
+
+fn optional(field: &str) -> Option<String> {
+    Some(unescape(field)).filter(|f| !f.is_empty())
+}
+
+impl Entry {
+    fn encode(&self) -> String {
+        match self {
+            Self::Insert(index, track) => format!(
+                "i\t{}\t{}\t{}\t{}\t{}\t{}\n",
+                index,
+                track.duration.as_millis(),
+                escape(&track.file),
+                escape(track.artist.as_deref().unwrap_or_default()),
+                escape(track.album.as_deref().unwrap_or_default()),
+                escape(track.title.as_deref().unwrap_or_default()),
+            ),
+            Self::Remove(index) => format!("r\t{}\n", index),
+            Self::Move(from, to) => format!("m\t{}\t{}\n", from, to),
+            Self::Clear => "c\n".to_string(),
+            Self::Position(file, secs) => format!("p\t{}\t{}\n", secs, escape(file)),
+            Self::Remember => "s\n".to_string(),
+            Self::Undo => "u\n".to_string(),
+            Self::Redo => "U\n".to_string(),
+        }
+    }
+
+    fn decode(line: &str) -> Option<Self> {
+        let fields: Vec<&str> = line.split('\t').collect();
+        Some(match fields.as_slice() {
+            ["i", index, millis, file, artist, album, title] => Self::Insert(
+                index.parse().ok()?,
+                Cached {
+                    file: unescape(file),
+                    duration: Duration::from_millis(millis.parse().ok()?),
+                    artist: optional(artist),
+                    album: optional(album),
+                    title: optional(title),
+                },
+            ),
+            ["r", index] => Self::Remove(index.parse().ok()?),
+            ["m", from, to] => Self::Move(from.parse().ok()?, to.parse().ok()?),
+            ["c"] => Self::Clear,
+            ["p", secs, file] => Self::Position(unescape(file), secs.parse().ok()?),
+            ["s"] => Self::Remember,
+            ["u"] => Self::Undo,
+            ["U"] => Self::Redo,
+            _ => return None,
+        })
+    }
+}
+
+/// The playlist rebuilt from a log, with its undo history.
+pub struct Replayed<T> {
+    pub tracks: Sequence<T>,
+    pub undo: Vec<Sequence<T>>,
+    pub redo: Vec<Sequence<T>>,
+    pub position: Option<(String, i64)>,
+}
+
+/// The tracks, history and last position described by `entries`, in one pass. The history
+/// levels share every part of the tree they have in common, as they do in the player.
+pub fn replay<T: Clone>(entries: Vec<Entry>, mut track: impl FnMut(Cached) -> T) -> Replayed<T> {
+    let mut tracks = Sequence::default();
+    let mut undo = Vec::new();
+    let mut redo = Vec::new();
+    let mut position = None;
+    for entry in entries {
+        match entry {
+            Entry::Insert(index, cached) if index <= tracks.len() => {
+                tracks.insert(index, track(cached));
+            }
+            Entry::Remove(index) => {
+                tracks.remove(index);
+            }
+            Entry::Move(from, to) if from < tracks.len() && to < tracks.len() => {
+                tracks.move_item(from, to);
+            }
+            Entry::Clear => tracks.clear(),
+            Entry::Position(file, secs) => position = Some((file, secs)),
+            Entry::Remember => {
+                undo.push(tracks.clone());
+                redo.clear();
+            }
+            Entry::Undo => {
+                if let Some(previous) = undo.pop() {
+                    redo.push(std::mem::replace(&mut tracks, previous));
+                }
+            }
+            Entry::Redo => {
+                if let Some(next) = redo.pop() {
+                    undo.push(std::mem::replace(&mut tracks, next));
+                }
+            }
+            // an entry that does not fit is from a log damaged by hand, skip it
+            _ => {}
+        }
+    }
+    Replayed {
+        tracks,
+        undo,
+        redo,
+        position,
+    }
+}
+
+pub struct Journal {
+    path: PathBuf,
+    file: File,
+    // entries written since the last snapshot
+    written: usize,
+    // tracks in the last snapshot
+    snapshot_len: usize,
+}
+
+impl Journal {
+    /// Open the log at `path`, creating it if needed, with the entries it holds. A last line cut
+    /// short by a crash is dropped.
+    pub fn open(path: PathBuf) -> Result<(Self, Vec<Entry>)> {
+        let mut entries = Vec::new();
+        let mut complete = 0;
+        if let Ok(file) = File::open(&path) {
+            let mut reader = BufReader::new(file);
+            let mut line = String::new();
+            while reader.read_line(&mut line)? > 0 {
+                if let Some(line) = line.strip_suffix('\n') {
+                    complete += line.len() + 1;
+                    entries.extend(Entry::decode(line));
+                }
+                line.clear();
+            }
+        }
+        let file = OpenOptions::new().create(true).append(true).open(&path)?;
+        // later entries must not be glued to the torn one
+        if file.metadata()?.len() > complete as u64 {
+            file.set_len(complete as u64)?;
+        }
+        let journal = Self {
+            path,
+            file,
+            written: entries.len(),
+            snapshot_len: 0,
+        };
+        Ok((journal, entries))
+    }
+
+    pub fn append(&mut self, entry: &Entry) -> Result<()> {
+        // one write per entry, whole lines reach the file or nothing does
+        self.file.write_all(entry.encode().as_bytes())?;
+        self.written += 1;
+        Ok(())
+    }
+
+    /// Whether the log holds so much history that a snapshot pays off.
+    pub fn needs_compaction(&self, len: usize) -> bool {
+        self.written > self.snapshot_len.max(len) * 2 + SLACK
+    }
+
+    /// Replace the log with one insert per track, written aside and renamed over it. `states`
+    /// is the history from the oldest level on, the last `redo` of them lie ahead of the
+    /// playlist as it is now.
+    pub fn compact<I: Iterator<Item = Cached>>(
+        &mut self,
+        states: impl Iterator<Item = I>,
+        redo: usize,
+        position: Option<(&str, i64)>,
+    ) -> Result<()> {
+        let mut tmp = self.path.clone();
+        tmp.set_extension("tmp");
+        let mut out = std::io::BufWriter::new(File::create(&tmp)?);
+        let mut lines = 0;
+        for (level, tracks) in states.enumerate() {
+            if level > 0 {
+                out.write_all(Entry::Remember.encode().as_bytes())?;
+                out.write_all(Entry::Clear.encode().as_bytes())?;
+                lines += 2;
+            }
+            let mut len = 0;
+            for track in tracks {
+                out.write_all(Entry::Insert(len, track).encode().as_bytes())?;
+                len += 1;
+            }
+            lines += len;
+        }
+        for _ in 0..redo {
+            out.write_all(Entry::Undo.encode().as_bytes())?;
+        }
+        if let Some((file, secs)) = position {
+            out.write_all(Entry::Position(file.to_string(), secs).encode().as_bytes())?;
+        }
+        let file = out.into_inner().map_err(|e| e.into_error())?;
+        file.sync_all()?;
+        fs::rename(&tmp, &self.path)?;
+        self.file = OpenOptions::new().append(true).open(&self.path)?;
+        self.written = lines + redo;
+        self.snapshot_len = self.written;
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn cached(file: &str) -> Cached {
+        Cached {
+            file: file.to_string(),
+            duration: Duration::from_millis(1500),
+            artist: Some("a\tb\\c".to_string()),
+            album: None,
+            title: Some("line\nbreak".to_string()),
+        }
+    }
+
+    #[test]
+    fn test_entries_round_trip() {
+        for entry in [
+            Entry::Insert(3, cached("/music/x.flac")),
+            Entry::Remove(1),
+            Entry::Move(0, 4),
+            Entry::Clear,
+            Entry::Position("/music/\ty.mp3".to_string(), 93),
+            Entry::Remember,
+            Entry::Undo,
+            Entry::Redo,
+        ] {
+            let line = entry.encode();
+            assert_eq!(Entry::decode(line.strip_suffix('\n').unwrap()), Some(entry));
+        }
+    }
+
+    #[test]
+    fn test_replay_survives_a_torn_line_and_compacts() {
+        let dir = std::env::temp_dir().join(format!("termusic-journal-{}", std::process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("queue.journal");
+        fs::remove_file(&path).ok();
+
+        let (mut journal, entries) = Journal::open(path.clone()).unwrap();
+        assert!(entries.is_empty());
+        for (i, file) in ["a", "b", "c"].iter().enumerate() {
+            journal.append(&Entry::Insert(i, cached(file))).unwrap();
+        }
+        journal.append(&Entry::Move(2, 0)).unwrap();
+        journal.append(&Entry::Remove(1)).unwrap();
+        journal.append(&Entry::Position("c".into(), 42)).unwrap();
+        // a crash in the middle of a write
+        journal.file.write_all(b"i\t0\t10\tpartial").unwrap();
+        drop(journal);
+
+        let (mut journal, entries) = Journal::open(path.clone()).unwrap();
+        journal.append(&Entry::Remove(5)).unwrap();
+        let replayed = replay(entries, |c| c.file);
+        assert_eq!(files(&replayed.tracks), ["c", "b"]);
+        assert_eq!(replayed.position, Some(("c".to_string(), 42)));
+
+        journal
+            .compact(
+                std::iter::once(replayed.tracks.iter().map(|f| cached(f))),
+                0,
+                Some(("c", 42)),
+            )
+            .unwrap();
+        drop(journal);
+        let (_, entries) = Journal::open(path.clone()).unwrap();
+        assert_eq!(entries.len(), 3);
+        assert_eq!(files(&replay(entries, |c| c.file).tracks), ["c", "b"]);
+        fs::remove_dir_all(dir).ok();
+    }
+
+    fn files(tracks: &Sequence<String>) -> Vec<&str> {
+        tracks.iter().map(String::as_str).collect()
+    }
+
+    #[test]
+    fn test_history_survives_replay_and_compaction() {
+        let mut entries = vec![];
+        for (i, file) in ["a", "b", "c"].iter().enumerate() {
+            entries.push(Entry::Insert(i, cached(file)));
+        }
+        entries.push(Entry::Remember);
+        entries.push(Entry::Remove(0));
+        entries.push(Entry::Remember);
+        entries.push(Entry::Move(1, 0));
+        entries.push(Entry::Remember);
+        entries.push(Entry::Clear);
+        entries.push(Entry::Undo);
+        entries.push(Entry::Undo);
+        let replayed = replay(entries.clone(), |c| c.file);
+        assert_eq!(files(&replayed.tracks), ["b", "c"]);
+        assert_eq!(replayed.undo.len(), 1);
+        assert_eq!(files(&replayed.undo[0]), ["a", "b", "c"]);
+        assert_eq!(replayed.redo.len(), 2);
+        assert!(replayed.redo[0].is_empty());
+        assert_eq!(files(&replayed.redo[1]), ["c", "b"]);
+
+        // redo, then a new edit drops what was ahead
+        entries.push(Entry::Redo);
+        let replayed = replay(entries.clone(), |c| c.file);
+        assert_eq!(files(&replayed.tracks), ["c", "b"]);
+        entries.push(Entry::Remember);
+        entries.push(Entry::Remove(0));
+        let replayed = replay(entries, |c| c.file);
+        assert_eq!(files(&replayed.tracks), ["b"]);
+        assert!(replayed.redo.is_empty());
+        assert_eq!(replayed.undo.len(), 3);
+
+        let dir = std::env::temp_dir().join(format!("termusic-history-{}", std::process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("queue.journal");
+        fs::remove_file(&path).ok();
+        let (mut journal, _) = Journal::open(path.clone()).unwrap();
+        let before = replay(
+            vec![
+                Entry::Insert(0, cached("a")),
+                Entry::Remember,
+                Entry::Insert(1, cached("b")),
+                Entry::Remember,
+                Entry::Remove(0),
+                Entry::Undo,
+            ],
+            |c| c.file,
+        );
+        let states = before
+            .undo
+            .iter()
+            .chain(std::iter::once(&before.tracks))
+            .chain(before.redo.iter().rev());
+        journal
+            .compact(
+                states.map(|s| s.iter().map(|f| cached(f))),
+                before.redo.len(),
+                None,
+            )
+            .unwrap();
+        drop(journal);
+        let (_, entries) = Journal::open(path).unwrap();
+        let after = replay(entries, |c| c.file);
+        assert_eq!(files(&after.tracks), ["a", "b"]);
+        assert_eq!(after.undo.len(), 1);
+        assert_eq!(files(&after.undo[0]), ["a"]);
+        assert_eq!(after.redo.len(), 1);
+        assert_eq!(files(&after.redo[0]), ["b"]);
+        fs::remove_dir_all(dir).ok();
+    }
+}
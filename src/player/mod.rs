@@ -24,21 +24,35 @@
 
 #[cfg(all(feature = "gst", not(feature = "mpv")))]
 mod gstreamer_backend;
+mod journal;
 #[cfg(feature = "mpv")]
 mod mpv_backend;
 mod playlist;
 #[cfg(not(any(feature = "mpv", feature = "gst")))]
+mod readahead;
+#[cfg(not(any(feature = "mpv", feature = "gst")))]
 mod rusty_backend;
+mod sequence;
+mod shuffle;
+mod tap;
 use crate::config::Settings;
-use crate::track::Track;
+use crate::track::{Fields, Track};
 use anyhow::Result;
+pub use journal::Cached;
 #[cfg(feature = "mpv")]
 use mpv_backend::MpvBackend;
 pub use playlist::Playlist;
 use serde::{Deserialize, Serialize};
+pub use shuffle::Plays;
 use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::Arc;
 #[cfg(not(any(feature = "mpv", feature = "gst")))]
 use std::time::Duration;
+pub use tap::AudioTap;
+
+// decoders kept ready for the tracks after the current one
+#[cfg(not(any(feature = "mpv", feature = "gst")))]
+const PRELOAD_TRACKS: usize = 2;
 
 #[derive(Clone, Copy, PartialEq)]
 pub enum Status {
@@ -83,12 +97,116 @@ impl Loop {
     }
 }
 
+/// How the shuffle key orders the playlist.
+#[derive(Clone, Copy, Deserialize, Serialize)]
+pub enum Shuffle {
+    Random,
+    /// tracks of one artist or album kept apart
+    Balanced,
+    /// tracks played seldom and long ago first
+    Weighted,
+}
+
+#[allow(clippy::non_ascii_literal)]
+impl Shuffle {
+    pub fn display(self, display_symbol: bool) -> String {
+        if display_symbol {
+            match self {
+                Self::Random => "🔀".to_string(),
+                Self::Balanced => "⚖".to_string(),
+                Self::Weighted => "⏳".to_string(),
+            }
+        } else {
+            match self {
+                Self::Random => "random".to_string(),
+                Self::Balanced => "balanced".to_string(),
+                Self::Weighted => "weighted".to_string(),
+            }
+        }
+    }
+
+    #[must_use]
+    pub const fn next(self) -> Self {
+        match self {
+            Self::Random => Self::Balanced,
+            Self::Balanced => Self::Weighted,
+            Self::Weighted => Self::Random,
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, Deserialize, PartialEq, Serialize)]
+pub enum EqFilter {
+    LowShelf,
+    Peak,
+    HighShelf,
+}
+
+/// One band of the parametric equalizer.
+#[derive(Clone, Copy, Debug, Deserialize, PartialEq, Serialize)]
+pub struct EqBand {
+    pub filter: EqFilter,
+    /// center or corner frequency in Hz
+    pub freq: f32,
+    pub gain_db: f32,
+    pub q: f32,
+}
+
+#[derive(Clone, Debug, Deserialize, Serialize)]
+pub struct EqPreset {
+    pub name: String,
+    pub bands: Vec<EqBand>,
+}
+
+impl EqPreset {
+    fn new(name: &str, bands: &[(EqFilter, f32, f32, f32)]) -> Self {
+        Self {
+            name: name.to_string(),
+            bands: bands
+                .iter()
+                .map(|&(filter, freq, gain_db, q)| EqBand {
+                    filter,
+                    freq,
+                    gain_db,
+                    q,
+                })
+                .collect(),
+        }
+    }
+
+    pub fn defaults() -> Vec<Self> {
+        use EqFilter::{HighShelf, LowShelf, Peak};
+        vec![
+            Self::new("Flat", &[]),
+            Self::new("Bass", &[(LowShelf, 100.0, 6.0, 0.7)]),
+            Self::new("Treble", &[(HighShelf, 8_000.0, 6.0, 0.7)]),
+            Self::new(
+                "Vocal",
+                &[
+                    (LowShelf, 120.0, -3.0, 0.7),
+                    (Peak, 2_500.0, 4.0, 1.0),
+                    (HighShelf, 10_000.0, -2.0, 0.7),
+                ],
+            ),
+            Self::new(
+                "Loudness",
+                &[(LowShelf, 80.0, 5.0, 0.7), (HighShelf, 10_000.0, 4.0, 0.7)],
+            ),
+        ]
+    }
+}
+
 #[allow(clippy::module_name_repetitions)]
 pub enum PlayerMsg {
     Eos,
     AboutToFinish,
     CurrentTrackUpdated,
     Progress(i64, i64),
+    // a stream the rusty backend opened in the background, or why it could not
+    #[cfg(not(any(feature = "mpv", feature = "gst")))]
+    StreamOpened(String),
+    #[cfg(not(any(feature = "mpv", feature = "gst")))]
+    StreamFailed(String),
 }
 
 #[allow(clippy::module_name_repetitions)]
@@ -122,6 +240,7 @@ impl GeneralPlayer {
         if let Ok(p) = Playlist::new() {
             playlist = p;
         }
+        Self::restore_position(&mut playlist, config.loop_mode);
         Self {
             player,
             message_tx,
@@ -134,6 +253,56 @@ impl GeneralPlayer {
             next_track_duration: Duration::from_secs(0),
         }
     }
+    // put the track the last session stopped in back where the next start picks it up
+    fn restore_position(playlist: &mut Playlist, loop_mode: Loop) {
+        let file = match playlist.resume_file() {
+            Some(file) => file.to_string(),
+            None => return,
+        };
+        if playlist.tracks().front().and_then(Track::file) == Some(file.as_str()) {
+            return;
+        }
+        match loop_mode {
+            Loop::Playlist => {
+                if playlist.tracks().back().and_then(Track::file) == Some(file.as_str()) {
+                    playlist.move_track(playlist.len() - 1, 0);
+                }
+            }
+            // played tracks leave the queue, this one file is read again
+            Loop::Queue => {
+                if let Ok(track) = Track::read_with(&file, Fields::PLAYLIST) {
+                    playlist.push_front(track);
+                }
+            }
+            Loop::Single => {}
+        }
+        playlist.current_track = playlist.tracks().front().cloned();
+    }
+
+    /// Switch to the equalizer preset after the current one in the config, only the rusty
+    /// backend has an equalizer.
+    pub fn next_eq_preset(&mut self) -> &str {
+        let presets = &self.config.eq_presets;
+        let next = presets
+            .iter()
+            .position(|p| p.name == self.config.eq_preset)
+            .map_or(0, |i| (i + 1) % presets.len().max(1));
+        if let Some(preset) = presets.get(next) {
+            self.config.eq_preset = preset.name.clone();
+            #[cfg(not(any(feature = "mpv", feature = "gst")))]
+            self.player.sink.set_equalizer(&preset.bands);
+        }
+        &self.config.eq_preset
+    }
+
+    /// The samples going to the device, only the rusty backend exposes them.
+    pub fn audio_tap(&self) -> Option<Arc<AudioTap>> {
+        #[cfg(not(any(feature = "mpv", feature = "gst")))]
+        return Some(self.player.sink.audio_tap());
+        #[cfg(any(feature = "mpv", feature = "gst"))]
+        None
+    }
+
     pub fn toggle_gapless(&mut self) {
         self.player.gapless = !self.player.gapless;
     }
@@ -143,6 +312,11 @@ impl GeneralPlayer {
             self.set_status(Status::Running);
         }
         self.handle_current_track();
+        // by the time the next track is due its start is in the page cache
+        #[cfg(not(any(feature = "mpv", feature = "gst")))]
+        if let Some(next) = self.playlist.tracks().get(0).and_then(Track::file) {
+            readahead::warm(next);
+        }
         if let Some(file) = self.playlist.get_current_track() {
             if self.has_next_track() {
                 self.next_track = None;
@@ -157,6 +331,11 @@ impl GeneralPlayer {
                 }
             } else {
                 self.add_and_play(&file);
+                #[cfg(not(any(feature = "mpv", feature = "gst")))]
+                if let Some(secs) = self.playlist.take_resume(&file) {
+                    self.player
+                        .seek_to(Duration::from_secs(secs.try_into().unwrap_or(0)));
+                }
                 // eprintln!("completely new track added");
                 #[cfg(not(any(feature = "mpv", feature = "gst")))]
                 {
@@ -167,16 +346,44 @@ impl GeneralPlayer {
                 }
             }
         }
+
+        // after the current track took its decoder, which may have been preloaded itself
+        #[cfg(not(any(feature = "mpv", feature = "gst")))]
+        {
+            let upcoming = self
+                .playlist
+                .tracks()
+                .iter()
+                .take(PRELOAD_TRACKS)
+                .filter_map(Track::file)
+                .map(String::from)
+                .collect();
+            self.player.preload(upcoming);
+        }
+    }
+
+    /// Start the stream the player opened in the background, unless another track took over.
+    #[cfg(not(any(feature = "mpv", feature = "gst")))]
+    pub fn stream_opened(&mut self, item: &str) {
+        if self.playlist.get_current_track().as_deref() == Some(item) {
+            self.player.enqueue(item);
+            self.player.sink.message_on_end();
+        }
     }
 
     fn handle_current_track(&mut self) {
-        if let Some(song) = self.playlist.tracks.pop_front() {
-            match self.config.loop_mode {
-                Loop::Playlist => self.playlist.tracks.push_back(song.clone()),
-                Loop::Single => self.playlist.tracks.push_front(song.clone()),
-                Loop::Queue => {}
+        let song = match self.config.loop_mode {
+            Loop::Playlist => {
+                let last = self.playlist.len().saturating_sub(1);
+                self.playlist.move_track(0, last);
+                self.playlist.tracks().back().cloned()
             }
-            self.playlist.current_track = Some(song);
+            Loop::Single => self.playlist.tracks().front().cloned(),
+            Loop::Queue => self.playlist.pop_front(),
+        };
+        if let Some(song) = song {
+            // the journal restores tracks without lyrics and cover, read them when they play
+            self.playlist.current_track = Some(song.hydrate());
             // self.message_tx
             //     .send(PlayerMsg::CurrentTrackUpdated)
             //     .expect("fail to send track updated signal");
@@ -188,13 +395,28 @@ impl GeneralPlayer {
 
     pub fn enqueue_next(&mut self) {
         if self.next_track.is_none() {
-            if let Some(track) = self.playlist.tracks.get(0) {
+            if let Some(track) = self.playlist.tracks().get(0) {
                 self.next_track = Some(track.clone());
                 if let Some(file) = track.file() {
+                    // tracks of one album flow into each other when playing gapless
                     #[cfg(not(any(feature = "mpv", feature = "gst")))]
-                    if let Some(d) = self.player.enqueue_next(file) {
-                        self.next_track_duration = d;
-                        // eprintln!("next track queued");
+                    let crossfade = !self.player.gapless
+                        || self
+                            .playlist
+                            .current_track
+                            .as_ref()
+                            .and_then(Track::album)
+                            .map_or(true, |album| track.album() != Some(album));
+                    #[cfg(not(any(feature = "mpv", feature = "gst")))]
+                    match self.player.enqueue_next(file, crossfade) {
+                        Ok(d) => {
+                            if let Some(d) = d {
+                                self.next_track_duration = d;
+                            }
+                            // eprintln!("next track queued");
+                        }
+                        // a stream still opening, start_play picks it up when this one ends
+                        Err(_) => self.next_track = None,
                     }
                     #[cfg(all(feature = "gst", not(feature = "mpv")))]
                     {
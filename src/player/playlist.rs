@@ -1,44 +1,84 @@
-use crate::{config::get_app_config_path, track::Track};
+use super::journal::{self, Entry, Journal};
+use super::sequence::Sequence;
+use super::shuffle::{self, Plays};
+use super::Shuffle;
+use crate::{
+    config::get_app_config_path,
+    track::{Fields, Track},
+};
 // use anyhow::{anyhow, bail, Result};
 use anyhow::Result;
-use std::collections::VecDeque;
+use rand::thread_rng;
+use std::collections::{HashMap, VecDeque};
 use std::fs::File;
 // use std::io::{BufRead, BufReader, Write};
-use std::io::{BufRead, BufReader, Write};
+use std::io::{BufRead, BufReader};
+use std::time::{SystemTime, UNIX_EPOCH};
 // use std::thread;
 
+// the position is written again once it moved this far
+const CHECKPOINT_SECS: i64 = 5;
+// levels of undo kept in memory
+const HISTORY_DEPTH: usize = 32;
+// tracks of history a snapshot of the journal carries along, newest levels first
+const HISTORY_TRACKS: usize = 16384;
+
+// Every change to `tracks` goes through the methods below, which also write it to the journal.
 #[derive(Default)]
 pub struct Playlist {
-    pub tracks: VecDeque<Track>,
+    tracks: Sequence<Track>,
     pub current_track: Option<Track>,
     pub index: Option<usize>,
+    journal: Option<Journal>,
+    // last checkpoint of the playing track
+    position: Option<(String, i64)>,
+    // where the last session stopped, until the first track starts
+    resume: Option<(String, i64)>,
+    // earlier versions of `tracks`, sharing every node they did not change
+    undo: Vec<Sequence<Track>>,
+    redo: Vec<Sequence<Track>>,
 }
 
 #[allow(unused)]
 impl Playlist {
+    /// Restore the playlist from the journal, without opening the audio files. The first run
+    /// after an upgrade reads the old playlist.log once.
     pub fn new() -> Result<Self> {
-        let tracks = Self::load()?;
-        let mut current_track: Option<Track> = None;
-        if let Some(track) = tracks.get(0) {
-            current_track = Some(track.clone());
-        }
+        let mut path = get_app_config_path()?;
+        path.push("playlist.journal");
+        let upgrade = !path.exists();
+        let (journal, entries) = Journal::open(path)?;
+        let mut replayed = journal::replay(entries, Track::from_cached);
+        let keep = replayed.undo.len().saturating_sub(HISTORY_DEPTH);
+        replayed.undo.drain(..keep);
 
-        Ok(Self {
-            tracks,
-            current_track,
+        let mut playlist = Self {
+            tracks: replayed.tracks,
+            current_track: None,
             index: Some(0),
-        })
+            journal: Some(journal),
+            position: replayed.position.clone(),
+            resume: replayed.position,
+            undo: replayed.undo,
+            redo: replayed.redo,
+        };
+        if upgrade {
+            playlist.tracks = Self::load()?.into_iter().collect();
+            playlist.save()?;
+        }
+        playlist.current_track = playlist.tracks.get(0).cloned();
+        Ok(playlist)
     }
 
+    // the playlist as written by older versions, one path per line
     pub fn load() -> Result<VecDeque<Track>> {
         let mut path = get_app_config_path()?;
         path.push("playlist.log");
 
-        let file = if let Ok(f) = File::open(path.as_path()) {
-            f
-        } else {
-            File::create(path.as_path())?;
-            File::open(path)?
+        let mut playlist_items = VecDeque::new();
+        let file = match File::open(path.as_path()) {
+            Ok(f) => f,
+            Err(_) => return Ok(playlist_items),
         };
         let reader = BufReader::new(file);
         let lines: Vec<_> = reader
@@ -46,9 +86,8 @@ impl Playlist {
             .map(|line| line.unwrap_or_else(|_| "Error".to_string()))
             .collect();
 
-        let mut playlist_items = VecDeque::new();
         for line in &lines {
-            if let Ok(s) = Track::read_from_path(line, false) {
+            if let Ok(s) = Track::read_with(line, Fields::PLAYLIST) {
                 playlist_items.push_back(s);
             };
         }
@@ -56,17 +95,266 @@ impl Playlist {
         Ok(playlist_items)
     }
 
+    /// Compact the journal into a snapshot of the playlist and its recent history.
     pub fn save(&mut self) -> Result<()> {
-        let mut path = get_app_config_path()?;
-        path.push("playlist.log");
-        let mut file = File::create(path.as_path())?;
-        for i in &self.tracks {
-            if let Some(f) = i.file() {
-                writeln!(&mut file, "{}", f)?;
+        let journal = match &mut self.journal {
+            Some(journal) => journal,
+            None => return Ok(()),
+        };
+        let undo = Self::levels_within(self.undo.iter().rev(), HISTORY_TRACKS);
+        let kept: usize = self.undo.iter().rev().take(undo).map(Sequence::len).sum();
+        let redo = Self::levels_within(self.redo.iter().rev(), HISTORY_TRACKS - kept);
+        let states = self.undo[self.undo.len() - undo..]
+            .iter()
+            .chain(std::iter::once(&self.tracks))
+            .chain(self.redo[self.redo.len() - redo..].iter().rev());
+        journal.compact(
+            states.map(|tracks| tracks.iter().filter_map(Track::to_cached)),
+            redo,
+            self.position.as_ref().map(|(f, s)| (f.as_str(), *s)),
+        )
+    }
+
+    // how many of `levels` fit into `budget` tracks
+    fn levels_within<'a>(
+        levels: impl Iterator<Item = &'a Sequence<Track>>,
+        budget: usize,
+    ) -> usize {
+        let mut left = budget;
+        levels
+            .take_while(|level| match left.checked_sub(level.len()) {
+                Some(rest) => {
+                    left = rest;
+                    true
+                }
+                None => false,
+            })
+            .count()
+    }
+
+    // a failed write leaves the journal behind the playlist until the next snapshot
+    fn log(&mut self, entry: &Entry) {
+        self.log_many([entry]);
+    }
+
+    // entries that only make sense together, compaction waits until all are written
+    fn log_many<'a>(&mut self, entries: impl IntoIterator<Item = &'a Entry>) {
+        let stale = match &mut self.journal {
+            Some(journal) => {
+                let mut failed = false;
+                for entry in entries {
+                    failed |= journal.append(entry).is_err();
+                }
+                failed || journal.needs_compaction(self.tracks.len())
             }
+            None => false,
+        };
+        if stale {
+            self.save().ok();
         }
+    }
 
-        Ok(())
+    fn log_insert(&mut self, index: usize) {
+        if let Some(cached) = self.tracks.get(index).and_then(Track::to_cached) {
+            self.log(&Entry::Insert(index, cached));
+        }
+    }
+
+    pub fn tracks(&self) -> &Sequence<Track> {
+        &self.tracks
+    }
+
+    pub fn push_back(&mut self, track: Track) {
+        self.tracks.push_back(track);
+        self.log_insert(self.tracks.len() - 1);
+    }
+
+    pub fn push_front(&mut self, track: Track) {
+        self.insert(0, track);
+    }
+
+    pub fn insert(&mut self, index: usize, track: Track) {
+        let index = index.min(self.tracks.len());
+        self.tracks.insert(index, track);
+        self.log_insert(index);
+    }
+
+    pub fn pop_front(&mut self) -> Option<Track> {
+        self.take(0)
+    }
+
+    pub fn pop_back(&mut self) -> Option<Track> {
+        self.take(self.tracks.len().checked_sub(1)?)
+    }
+
+    // remove without touching the selection
+    fn take(&mut self, index: usize) -> Option<Track> {
+        let track = self.tracks.remove(index)?;
+        self.log(&Entry::Remove(index));
+        Some(track)
+    }
+
+    /// Move the track at `from` so that it ends up at `to`.
+    pub fn move_track(&mut self, from: usize, to: usize) {
+        if from == to || from >= self.tracks.len() || to >= self.tracks.len() {
+            return;
+        }
+        self.tracks.move_item(from, to);
+        self.log(&Entry::Move(from, to));
+    }
+
+    pub fn clear(&mut self) {
+        self.tracks.clear();
+        self.log(&Entry::Clear);
+    }
+
+    pub fn retain(&mut self, mut keep: impl FnMut(&Track) -> bool) {
+        let mut index = 0;
+        while let Some(track) = self.tracks.get(index) {
+            if keep(track) {
+                index += 1;
+            } else {
+                self.take(index);
+            }
+        }
+    }
+
+    /// Swap in `track` for every entry of the same file, after its tags changed.
+    pub fn replace(&mut self, track: &Track) {
+        for index in 0..self.tracks.len() {
+            let same = self.tracks.get(index).and_then(Track::file).is_some()
+                && self.tracks.get(index).and_then(Track::file) == track.file();
+            if same {
+                self.tracks.set(index, track.clone());
+                let mut entries = vec![Entry::Remove(index)];
+                entries.extend(track.to_cached().map(|cached| Entry::Insert(index, cached)));
+                self.log_many(&entries);
+            }
+        }
+    }
+
+    /// Reorder the playlist the way `mode` asks for, `plays` is only read by the weighted mode.
+    pub fn shuffle(&mut self, mode: Shuffle, plays: &HashMap<String, Plays>) {
+        let rng = &mut thread_rng();
+        match mode {
+            Shuffle::Random => self.tracks.shuffle(rng),
+            Shuffle::Balanced => {
+                let tracks: Vec<_> = self
+                    .tracks
+                    .iter()
+                    .map(|t| (t.artist(), t.album()))
+                    .collect();
+                let order = shuffle::balanced(&tracks, rng);
+                self.tracks.permute(&order);
+            }
+            Shuffle::Weighted => {
+                let now = SystemTime::now()
+                    .duration_since(UNIX_EPOCH)
+                    .unwrap_or_default()
+                    .as_secs();
+                let weights: Vec<f64> = self
+                    .tracks
+                    .iter()
+                    .map(|t| shuffle::weight(t.file().and_then(|f| plays.get(f)), now))
+                    .collect();
+                let order = shuffle::weighted(&weights, rng);
+                self.tracks.permute(&order);
+            }
+        }
+        self.log_all();
+    }
+
+    /// Replace every track at once, as when switching to a saved playlist.
+    pub fn set_tracks(&mut self, tracks: impl IntoIterator<Item = Track>) {
+        self.tracks = tracks.into_iter().collect();
+        self.log_all();
+        self.clamp_index();
+    }
+
+    // the whole order written again
+    fn log_all(&mut self) {
+        let mut entries = vec![Entry::Clear];
+        for (index, cached) in self.tracks.iter().filter_map(Track::to_cached).enumerate() {
+            entries.push(Entry::Insert(index, cached));
+        }
+        self.log_many(&entries);
+    }
+
+    /// Keep the playlist as it is now, so the edit that follows can be undone.
+    pub fn remember(&mut self) {
+        self.undo.push(self.tracks.clone());
+        if self.undo.len() > HISTORY_DEPTH {
+            self.undo.remove(0);
+        }
+        self.redo.clear();
+        self.log(&Entry::Remember);
+    }
+
+    /// Go back to the playlist before the last remembered edit. False if there is none.
+    pub fn undo(&mut self) -> bool {
+        match self.undo.pop() {
+            Some(previous) => {
+                self.redo
+                    .push(std::mem::replace(&mut self.tracks, previous));
+                self.log(&Entry::Undo);
+                self.clamp_index();
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Apply again the last edit undone. False if there is none.
+    pub fn redo(&mut self) -> bool {
+        match self.redo.pop() {
+            Some(next) => {
+                self.undo.push(std::mem::replace(&mut self.tracks, next));
+                self.log(&Entry::Redo);
+                self.clamp_index();
+                true
+            }
+            None => false,
+        }
+    }
+
+    fn clamp_index(&mut self) {
+        if self.tracks.is_empty() {
+            self.index = None;
+        } else {
+            let last = self.tracks.len() - 1;
+            self.index = Some(self.index.map_or(0, |i| i.min(last)));
+        }
+    }
+
+    /// Remember how far into the playing track playback is, so the next start resumes there.
+    pub fn checkpoint(&mut self, secs: i64) {
+        let file = match self.current_track.as_ref().and_then(Track::file) {
+            Some(file) => file.to_string(),
+            None => return,
+        };
+        let due = match &self.position {
+            Some((last_file, last_secs)) => {
+                *last_file != file || (secs - last_secs).abs() >= CHECKPOINT_SECS
+            }
+            None => true,
+        };
+        if due {
+            self.log(&Entry::Position(file.clone(), secs));
+            self.position = Some((file, secs));
+        }
+    }
+
+    /// The checkpoint of the last session, when `file` is the first track to start.
+    pub fn take_resume(&mut self, file: &str) -> Option<i64> {
+        self.resume
+            .take()
+            .filter(|(f, secs)| f == file && *secs > 0)
+            .map(|(_, secs)| secs)
+    }
+
+    /// The file the last session stopped in.
+    pub fn resume_file(&self) -> Option<&str> {
+        self.resume.as_ref().map(|(f, _)| f.as_str())
     }
 
     pub fn up(&mut self) {
@@ -138,11 +426,10 @@ impl Playlist {
     pub fn is_empty(&self) -> bool {
         self.tracks.is_empty()
     }
-    pub fn as_slice(&self) -> &VecDeque<Track> {
-        &self.tracks
-    }
     pub fn remove(&mut self, index: usize) {
-        self.tracks.remove(index);
+        if self.take(index).is_none() {
+            return;
+        }
         let len = self.len();
         if let Some(selected) = self.index {
             if index == len && selected == len {
@@ -156,18 +443,14 @@ impl Playlist {
     }
 
     pub fn swap_down(&mut self, index: usize) {
-        if index < self.len() - 1 {
-            if let Some(track) = self.tracks.remove(index) {
-                self.tracks.insert(index + 1, track);
-            }
+        if index + 1 < self.len() {
+            self.move_track(index, index + 1);
         }
     }
 
     pub fn swap_up(&mut self, index: usize) {
         if index > 0 {
-            if let Some(track) = self.tracks.remove(index) {
-                self.tracks.insert(index - 1, track);
-            }
+            self.move_track(index, index - 1);
         }
     }
 
@@ -181,3 +464,49 @@ impl Playlist {
         result
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::player::Cached;
+
+    fn track(file: &str, title: &str) -> Track {
+        Track::from_cached(Cached {
+            file: file.to_string(),
+            title: Some(title.to_string()),
+            ..Cached::default()
+        })
+    }
+
+    #[test]
+    fn test_compaction_inside_replace_keeps_one_copy() {
+        let dir = std::env::temp_dir().join(format!("termusic-playlist-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("playlist.journal");
+        std::fs::remove_file(&path).ok();
+
+        let (journal, _) = Journal::open(path.clone()).unwrap();
+        let mut playlist = Playlist {
+            journal: Some(journal),
+            ..Playlist::default()
+        };
+        playlist.push_back(track("/a.mp3", "a"));
+        playlist.push_back(track("/b.mp3", "b"));
+        // the next entry written compacts the log
+        if let Some(journal) = &mut playlist.journal {
+            while !journal.needs_compaction(2) {
+                journal
+                    .append(&Entry::Position("/a.mp3".into(), 1))
+                    .unwrap();
+            }
+        }
+        playlist.replace(&track("/a.mp3", "a retagged"));
+        drop(playlist);
+
+        let (_, entries) = Journal::open(path).unwrap();
+        let tracks = journal::replay(entries, |c| c.title).tracks;
+        let titles: Vec<_> = tracks.iter().flatten().map(String::as_str).collect();
+        assert_eq!(titles, ["a retagged", "b"]);
+        std::fs::remove_dir_all(&dir).ok();
+    }
+}
@@ -0,0 +1,82 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use std::fs::File;
+use std::path::Path;
+use std::thread;
+
+// Only the beginning of huge files is warmed, the decoder's own readahead handles the rest.
+const WARM_MAX_BYTES: u64 = 64 * 1024 * 1024;
+
+/// Tell the kernel that `file` is read front to back, so it reads ahead more aggressively and
+/// the decoder does not stall on a slow disk or network share.
+pub fn advise_sequential(file: &File) {
+    #[cfg(target_os = "linux")]
+    {
+        use std::os::unix::io::AsRawFd;
+        // purely a hint, the file reads the same without it
+        unsafe {
+            libc::posix_fadvise(file.as_raw_fd(), 0, 0, libc::POSIX_FADV_SEQUENTIAL);
+        }
+    }
+    #[cfg(not(target_os = "linux"))]
+    let _ = file;
+}
+
+/// Pull the start of the track at `path` into the page cache in the background, so that
+/// opening it later does not wait for a spun down disk.
+pub fn warm(path: &str) {
+    let path = Path::new(path).to_path_buf();
+    thread::spawn(move || {
+        let file = match File::open(&path) {
+            Ok(file) => file,
+            Err(_) => return,
+        };
+
+        #[cfg(target_os = "linux")]
+        {
+            use std::os::unix::io::AsRawFd;
+            let len = file
+                .metadata()
+                .map_or(WARM_MAX_BYTES, |m| m.len().min(WARM_MAX_BYTES));
+            // the kernel starts the reads and returns right away
+            unsafe {
+                libc::posix_fadvise(
+                    file.as_raw_fd(),
+                    0,
+                    libc::off_t::try_from(len).unwrap_or(0),
+                    libc::POSIX_FADV_WILLNEED,
+                );
+            }
+        }
+
+        // elsewhere reading it once has the same effect
+        #[cfg(not(target_os = "linux"))]
+        {
+            use std::io::Read;
+            let mut buf = vec![0_u8; 256 * 1024];
+            let mut reader = file.take(WARM_MAX_BYTES);
+            while matches!(reader.read(&mut buf), Ok(n) if n > 0) {}
+        }
+    });
+}
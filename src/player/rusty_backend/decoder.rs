@@ -1,12 +1,12 @@
 use super::Source;
-use std::{fmt, fs::File, time::Duration};
+use std::{fmt, time::Duration};
 use symphonia::{
     core::{
         audio::{AudioBufferRef, SampleBuffer, SignalSpec},
         codecs::{self, CodecParameters},
         errors::Error,
         formats::{FormatOptions, FormatReader, SeekMode, SeekTo},
-        io::{MediaSourceStream, MediaSourceStreamOptions},
+        io::{MediaSource, MediaSourceStream, MediaSourceStreamOptions},
         meta::MetadataOptions,
         probe::Hint,
         units::{Time, TimeBase},
@@ -29,10 +29,12 @@ pub struct Symphonia {
 }
 
 impl Symphonia {
-    pub fn new(file: File, gapless: bool) -> Result<Self, SymphoniaDecoderError> {
-        let source = Box::new(file);
-
-        let mss = MediaSourceStream::new(source, MediaSourceStreamOptions::default());
+    pub fn new(
+        source: Box<dyn MediaSource>,
+        gapless: bool,
+        buffer_len: usize,
+    ) -> Result<Self, SymphoniaDecoderError> {
+        let mss = MediaSourceStream::new(source, MediaSourceStreamOptions { buffer_len });
         match Self::init(mss, gapless) {
             Err(e) => match e {
                 Error::IoError(e) => Err(SymphoniaDecoderError::IoError(e.to_string())),
@@ -81,6 +83,8 @@ impl Symphonia {
         let decode_result = loop {
             let current_frame = probed.format.next_packet()?;
             match decoder.decode(&current_frame) {
+                // gapless trimming can swallow the whole first packet of the encoder delay
+                Ok(result) if result.frames() == 0 => {}
                 Ok(result) => break result,
                 Err(e) => match e {
                     Error::DecodeError(_) => {
@@ -170,9 +174,12 @@ impl Source for Symphonia {
         Some(self.duration)
     }
 
+    // time of the current packet plus the frames of it already played
     #[inline]
+    #[allow(clippy::cast_precision_loss)]
     fn elapsed(&mut self) -> Duration {
-        self.elapsed
+        let frames = self.current_frame_offset / self.spec.channels.count().max(1);
+        self.elapsed + Duration::from_secs_f64(frames as f64 / f64::from(self.spec.rate))
     }
 
     #[inline]
@@ -212,6 +219,8 @@ impl Iterator for Symphonia {
             let decoded = loop {
                 match self.format.next_packet() {
                     Ok(packet) => match self.decoder.decode(&packet) {
+                        // fully trimmed delay or padding, nothing to play
+                        Ok(decoded) if decoded.frames() == 0 => {}
                         Ok(decoded) => {
                             let ts = packet.ts();
                             if let Some(track) = self.format.default_track() {
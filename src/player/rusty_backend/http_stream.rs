@@ -0,0 +1,516 @@
+use anyhow::{bail, Result};
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, Read, Seek, SeekFrom, Write};
+use std::ops::Range;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::Duration;
+use symphonia::core::io::MediaSource;
+
+// Bytes written to the cache file between two checks of where the reader is.
+const CHUNK_SIZE: usize = 64 * 1024;
+// How far the reader may run ahead of the download before the download is restarted at the
+// reader's position, anything closer is cheaper to just wait for.
+const READ_AHEAD: u64 = 512 * 1024;
+// Streams without a length and without range support, internet radio, never end. Only this
+// much of them is kept, in a cache file used as a ring.
+const LIVE_WINDOW: u64 = 1024 * 1024;
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(5);
+const READ_TIMEOUT: Duration = Duration::from_secs(15);
+
+// several streams of the same url may be open at once, e.g. when a track is queued twice
+static STREAM_COUNTER: AtomicU64 = AtomicU64::new(0);
+
+#[derive(Default)]
+struct Progress {
+    len: Option<u64>,
+    // cached byte ranges, sorted and merged
+    ranges: Vec<Range<u64>>,
+    // position the reader is waiting for or reading at
+    wanted: u64,
+    // the server answers range requests
+    seekable: bool,
+    // no length and no range support, only the last LIVE_WINDOW bytes are cached
+    live: bool,
+    finished: bool,
+    closed: bool,
+    error: Option<String>,
+}
+
+impl Progress {
+    // end of the cached range that contains `pos`
+    fn cached_until(&self, pos: u64) -> Option<u64> {
+        self.ranges
+            .iter()
+            .find(|r| r.start <= pos && pos < r.end)
+            .map(|r| r.end)
+    }
+
+    fn first_missing(&self, from: u64) -> Option<u64> {
+        let mut pos = from;
+        for range in &self.ranges {
+            if range.start > pos {
+                break;
+            }
+            pos = pos.max(range.end);
+        }
+        match self.len {
+            Some(len) if pos >= len => None,
+            _ => Some(pos),
+        }
+    }
+
+    // the reader's position first, then any holes it left behind by seeking
+    fn next_fetch(&self) -> Option<u64> {
+        let wanted = self.first_missing(self.wanted);
+        // a live stream only goes forward, what left the window is gone
+        if self.live {
+            return wanted;
+        }
+        wanted.or_else(|| self.first_missing(0))
+    }
+
+    fn add(&mut self, new: Range<u64>) {
+        self.ranges.push(new);
+        self.ranges.sort_by_key(|r| r.start);
+        let mut merged: Vec<Range<u64>> = Vec::with_capacity(self.ranges.len());
+        for range in self.ranges.drain(..) {
+            match merged.last_mut() {
+                Some(last) if range.start <= last.end => last.end = last.end.max(range.end),
+                _ => merged.push(range),
+            }
+        }
+        self.ranges = merged;
+        if self.live {
+            if let Some(range) = self.ranges.first_mut() {
+                range.start = range.start.max(range.end.saturating_sub(LIVE_WINDOW));
+            }
+        }
+    }
+
+    // where `pos` is stored in the cache file, and how much may be read there in one go
+    fn file_span(&self, pos: u64, end: u64) -> (u64, u64) {
+        if self.live {
+            let offset = pos % LIVE_WINDOW;
+            (offset, (end - pos).min(LIVE_WINDOW - offset))
+        } else {
+            (pos, end - pos)
+        }
+    }
+}
+
+type Shared = Arc<(Mutex<Progress>, Condvar)>;
+
+/// A remote file played while it downloads. A background thread fetches the file with range
+/// requests into a sparse cache file, following the reader when it seeks past the download.
+pub struct HttpStream {
+    shared: Shared,
+    file: File,
+    path: PathBuf,
+    pos: u64,
+}
+
+impl HttpStream {
+    /// Start downloading `url` and return once the server has answered.
+    pub fn open(url: &str) -> Result<Self> {
+        let mut path = dirs::cache_dir().unwrap_or_else(std::env::temp_dir);
+        path.push("termusic");
+        path.push("stream");
+        fs::create_dir_all(&path)?;
+        path.push(format!(
+            "{:x}-{}.part",
+            md5::compute(url),
+            STREAM_COUNTER.fetch_add(1, Ordering::Relaxed)
+        ));
+
+        let writer = OpenOptions::new()
+            .write(true)
+            .create(true)
+            .truncate(true)
+            .open(&path)?;
+        let file = File::open(&path)?;
+
+        let shared: Shared = Arc::new((Mutex::new(Progress::default()), Condvar::new()));
+        let fetcher_shared = shared.clone();
+        let url = url.to_string();
+        thread::spawn(move || {
+            if let Err(e) = fetch(&url, writer, &fetcher_shared) {
+                let (lock, cvar) = &*fetcher_shared;
+                lock.lock().unwrap().error = Some(e.to_string());
+                cvar.notify_all();
+            }
+        });
+
+        let stream = Self {
+            shared,
+            file,
+            path,
+            pos: 0,
+        };
+
+        let (lock, cvar) = &*stream.shared;
+        let progress = cvar
+            .wait_timeout_while(lock.lock().unwrap(), READ_TIMEOUT, |p| {
+                p.error.is_none() && p.ranges.is_empty() && !p.finished
+            })
+            .unwrap()
+            .0;
+        if let Some(e) = &progress.error {
+            bail!("cannot stream: {}", e);
+        }
+        if progress.ranges.is_empty() && !progress.finished {
+            bail!("cannot stream: server did not answer");
+        }
+        drop(progress);
+
+        Ok(stream)
+    }
+}
+
+fn fetch(url: &str, mut writer: File, shared: &Shared) -> Result<()> {
+    let (lock, cvar) = &**shared;
+    let agent = ureq::AgentBuilder::new()
+        .timeout_connect(CONNECT_TIMEOUT)
+        .timeout_read(READ_TIMEOUT)
+        .build();
+    let mut buf = vec![0_u8; CHUNK_SIZE];
+
+    loop {
+        let start = {
+            let mut progress = lock.lock().unwrap();
+            if progress.closed {
+                return Ok(());
+            }
+            if let Some(start) = progress.next_fetch() {
+                start
+            } else {
+                progress.finished = true;
+                cvar.notify_all();
+                return Ok(());
+            }
+        };
+
+        let response = agent
+            .get(url)
+            .set("Range", &format!("bytes={}-", start))
+            .call()?;
+        // servers without range support send the whole file from the beginning
+        let (mut pos, len, seekable) = if response.status() == 206 {
+            let (offset, len) = response
+                .header("Content-Range")
+                .and_then(parse_content_range)
+                .unwrap_or((start, None));
+            (offset, len, true)
+        } else {
+            let len = response
+                .header("Content-Length")
+                .and_then(|l| l.parse().ok());
+            (0, len, false)
+        };
+
+        {
+            let mut progress = lock.lock().unwrap();
+            progress.seekable = seekable;
+            progress.live = len.is_none() && !seekable;
+            if progress.len.is_none() {
+                if let Some(len) = len {
+                    writer.set_len(len)?;
+                }
+                progress.len = len;
+            }
+        }
+
+        let mut reader = response.into_reader();
+        loop {
+            let n = reader.read(&mut buf)?;
+            let mut progress = lock.lock().unwrap();
+            if n == 0 {
+                // streams of unknown length end where the response ends
+                if progress.len.is_none() {
+                    progress.len = Some(pos);
+                }
+                break;
+            }
+
+            if progress.live {
+                // the window is full of bytes the reader has not had yet
+                while pos + n as u64 > progress.wanted + LIVE_WINDOW && !progress.closed {
+                    progress = cvar.wait(progress).unwrap();
+                }
+                if progress.closed {
+                    return Ok(());
+                }
+            }
+            let mut written = 0;
+            while written < n {
+                let at = pos + written as u64;
+                let (offset, room) = progress.file_span(at, pos + n as u64);
+                let room = usize::try_from(room).unwrap_or(n - written);
+                writer.seek(SeekFrom::Start(offset))?;
+                writer.write_all(&buf[written..written + room])?;
+                written += room;
+            }
+            progress.add(pos..pos + n as u64);
+            pos += n as u64;
+            cvar.notify_all();
+
+            if progress.closed {
+                return Ok(());
+            }
+            if !progress.seekable {
+                continue;
+            }
+            // the reader seeked somewhere this response will not reach soon, or the rest of
+            // it is cached already
+            let wanted = progress.wanted;
+            let reader_lost = progress.cached_until(wanted).is_none()
+                && (wanted < pos || wanted > pos + READ_AHEAD);
+            if reader_lost || progress.cached_until(pos).is_some() {
+                break;
+            }
+        }
+    }
+}
+
+// "bytes 100-199/1000" or "bytes 100-199/*"
+fn parse_content_range(value: &str) -> Option<(u64, Option<u64>)> {
+    let value = value.strip_prefix("bytes ")?;
+    let (range, len) = value.split_once('/')?;
+    let (start, _) = range.split_once('-')?;
+    Some((start.trim().parse().ok()?, len.trim().parse().ok()))
+}
+
+impl Read for HttpStream {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        let (lock, cvar) = &*self.shared;
+        let mut progress = lock.lock().unwrap();
+        progress.wanted = self.pos;
+        if progress.live {
+            // the download may wait for room in the window
+            cvar.notify_all();
+        }
+        let end = loop {
+            if let Some(end) = progress.cached_until(self.pos) {
+                break end;
+            }
+            if progress.len.map_or(false, |len| self.pos >= len) || progress.finished {
+                return Ok(0);
+            }
+            if let Some(e) = &progress.error {
+                return Err(io::Error::new(io::ErrorKind::Other, e.clone()));
+            }
+            cvar.notify_all();
+            let (guard, timeout) = cvar.wait_timeout(progress, READ_TIMEOUT).unwrap();
+            progress = guard;
+            if timeout.timed_out() && progress.cached_until(self.pos).is_none() {
+                return Err(io::Error::new(io::ErrorKind::TimedOut, "stream stalled"));
+            }
+        };
+        let (offset, len) = progress.file_span(self.pos, end);
+        drop(progress);
+
+        let len = usize::try_from(len).map_or(buf.len(), |n| n.min(buf.len()));
+        self.file.seek(SeekFrom::Start(offset))?;
+        let n = self.file.read(&mut buf[..len])?;
+        self.pos += n as u64;
+        Ok(n)
+    }
+}
+
+impl Seek for HttpStream {
+    fn seek(&mut self, pos: SeekFrom) -> io::Result<u64> {
+        let (lock, cvar) = &*self.shared;
+        let mut progress = lock.lock().unwrap();
+        let target = match pos {
+            SeekFrom::Start(pos) => i128::from(pos),
+            SeekFrom::Current(offset) => i128::from(self.pos) + i128::from(offset),
+            SeekFrom::End(offset) => match progress.len {
+                Some(len) => i128::from(len) + i128::from(offset),
+                None => {
+                    return Err(io::Error::new(
+                        io::ErrorKind::Unsupported,
+                        "stream length unknown",
+                    ))
+                }
+            },
+        };
+        self.pos = u64::try_from(target).map_err(|_| {
+            io::Error::new(io::ErrorKind::InvalidInput, "seek before start of stream")
+        })?;
+        progress.wanted = self.pos;
+        cvar.notify_all();
+        Ok(self.pos)
+    }
+}
+
+impl MediaSource for HttpStream {
+    fn is_seekable(&self) -> bool {
+        self.shared.0.lock().unwrap().len.is_some()
+    }
+
+    fn byte_len(&self) -> Option<u64> {
+        self.shared.0.lock().unwrap().len
+    }
+}
+
+impl Drop for HttpStream {
+    fn drop(&mut self) {
+        let (lock, cvar) = &*self.shared;
+        lock.lock().unwrap().closed = true;
+        cvar.notify_all();
+        fs::remove_file(&self.path).ok();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::BufRead;
+    use std::net::TcpListener;
+
+    fn content() -> Vec<u8> {
+        (0..3_000_000_u32).map(|i| (i % 251) as u8).collect()
+    }
+
+    // serves `content()` and answers range requests if `ranges` is set
+    fn mock_server(ranges: bool) -> String {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let address = listener.local_addr().unwrap();
+        thread::spawn(move || {
+            let content = content();
+            for stream in listener.incoming().flatten() {
+                let content = content.clone();
+                thread::spawn(move || {
+                    let mut reader = io::BufReader::new(stream.try_clone().unwrap());
+                    let mut start = None;
+                    loop {
+                        let mut line = String::new();
+                        if reader.read_line(&mut line).unwrap_or(0) == 0 || line == "\r\n" {
+                            break;
+                        }
+                        if let Some(range) = line.to_lowercase().strip_prefix("range: bytes=") {
+                            start = range.trim().trim_end_matches('-').parse::<usize>().ok();
+                        }
+                    }
+
+                    let mut stream = stream;
+                    let (head, body) = match start {
+                        Some(start) if ranges => (
+                            format!(
+                                "HTTP/1.1 206 Partial Content\r\nContent-Length: {}\r\nContent-Range: bytes {}-{}/{}\r\n\r\n",
+                                content.len() - start,
+                                start,
+                                content.len() - 1,
+                                content.len()
+                            ),
+                            &content[start..],
+                        ),
+                        _ => (
+                            format!("HTTP/1.1 200 OK\r\nContent-Length: {}\r\n\r\n", content.len()),
+                            &content[..],
+                        ),
+                    };
+                    stream.write_all(head.as_bytes()).ok();
+                    stream.write_all(body).ok();
+                });
+            }
+        });
+        format!("http://{}/song.mp3", address)
+    }
+
+    #[test]
+    fn test_stream_reads_whole_file() {
+        let mut stream = HttpStream::open(&mock_server(true)).unwrap();
+        let mut data = Vec::new();
+        stream.read_to_end(&mut data).unwrap();
+        assert_eq!(data, content());
+        assert_eq!(stream.byte_len(), Some(3_000_000));
+    }
+
+    #[test]
+    fn test_stream_seeks_with_range_requests() {
+        let content = content();
+        let mut stream = HttpStream::open(&mock_server(true)).unwrap();
+        let mut buf = [0_u8; 1000];
+
+        stream.seek(SeekFrom::Start(2_500_000)).unwrap();
+        stream.read_exact(&mut buf).unwrap();
+        assert_eq!(&buf[..], &content[2_500_000..2_501_000]);
+
+        stream.seek(SeekFrom::End(-1000)).unwrap();
+        stream.read_exact(&mut buf).unwrap();
+        assert_eq!(&buf[..], &content[2_999_000..]);
+
+        stream.seek(SeekFrom::Start(10)).unwrap();
+        stream.read_exact(&mut buf).unwrap();
+        assert_eq!(&buf[..], &content[10..1010]);
+        assert!(stream.shared.0.lock().unwrap().seekable);
+    }
+
+    #[test]
+    fn test_stream_without_range_support() {
+        let content = content();
+        let mut stream = HttpStream::open(&mock_server(false)).unwrap();
+        let mut buf = [0_u8; 1000];
+
+        stream.seek(SeekFrom::Start(2_000_000)).unwrap();
+        stream.read_exact(&mut buf).unwrap();
+        assert_eq!(&buf[..], &content[2_000_000..2_001_000]);
+        assert!(!stream.shared.0.lock().unwrap().seekable);
+    }
+
+    #[test]
+    fn test_live_stream_keeps_a_window() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let address = listener.local_addr().unwrap();
+        thread::spawn(move || {
+            for mut stream in listener.incoming().flatten() {
+                let mut buf = [0_u8; 4096];
+                stream.read(&mut buf).ok();
+                // no length, the body ends when the connection does
+                stream.write_all(b"HTTP/1.1 200 OK\r\n\r\n").ok();
+                stream.write_all(&content()).ok();
+            }
+        });
+        let mut stream = HttpStream::open(&format!("http://{}/radio", address)).unwrap();
+        let mut data = Vec::new();
+        stream.read_to_end(&mut data).unwrap();
+        assert_eq!(data, content());
+        assert!(stream.shared.0.lock().unwrap().live);
+        assert!(fs::metadata(&stream.path).unwrap().len() <= LIVE_WINDOW);
+    }
+
+    #[test]
+    fn test_stream_reports_server_errors() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let address = listener.local_addr().unwrap();
+        thread::spawn(move || {
+            for mut stream in listener.incoming().flatten() {
+                let mut buf = [0_u8; 4096];
+                stream.read(&mut buf).ok();
+                stream
+                    .write_all(b"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n")
+                    .ok();
+            }
+        });
+        assert!(HttpStream::open(&format!("http://{}/missing.mp3", address)).is_err());
+    }
+
+    #[test]
+    fn test_progress_merges_ranges() {
+        let mut progress = Progress {
+            len: Some(100),
+            ..Progress::default()
+        };
+        progress.add(10..20);
+        progress.add(30..40);
+        progress.add(20..30);
+        assert_eq!(progress.ranges, vec![10..40]);
+        assert_eq!(progress.first_missing(0), Some(0));
+        assert_eq!(progress.first_missing(15), Some(40));
+        progress.add(0..100);
+        assert_eq!(progress.next_fetch(), None);
+    }
+}
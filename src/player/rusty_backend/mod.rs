@@ -1,6 +1,8 @@
 #![cfg_attr(test, deny(missing_docs))]
 
 mod conversions;
+mod http_stream;
+mod preload;
 mod sink;
 mod stream;
 
@@ -16,6 +18,8 @@ pub use cpal::{
     SupportedStreamConfig,
 };
 pub use decoder::Symphonia;
+pub use http_stream::HttpStream;
+pub use preload::Preloader;
 pub use sink::Sink;
 pub use source::Source;
 pub use stream::{OutputStream, OutputStreamHandle, PlayError, StreamError};
@@ -23,14 +27,30 @@ pub use stream::{OutputStream, OutputStreamHandle, PlayError, StreamError};
 use std::fs::File;
 use std::path::Path;
 use std::sync::mpsc::Sender;
+#[cfg(unix)]
+use std::sync::{Mutex, PoisonError};
 use std::time::Duration;
 
-use super::{PlayerMsg, PlayerTrait};
+use super::{readahead, PlayerMsg, PlayerTrait};
 use crate::config::Settings;
-use anyhow::Result;
+use crate::loudness::{Gains, ReplayGain};
+use crate::utils::is_url;
+use anyhow::{anyhow, Result};
+#[cfg(unix)]
+use lazy_static::lazy_static;
+use symphonia::core::io::MediaSource;
 
 static VOLUME_STEP: u16 = 5;
 static SEEK_STEP: f64 = 5.0;
+// symphonia needs a power of two that holds its largest single read
+static MIN_BUFFER_LEN: usize = 64 * 1024;
+
+#[cfg(unix)]
+lazy_static! {
+    // the gag redirects stderr of the whole process, the preloader and the player open
+    // decoders at the same time and would restore it under each other
+    static ref STDERR_GAG: Mutex<()> = Mutex::new(());
+}
 
 pub struct Player {
     _stream: OutputStream,
@@ -41,6 +61,12 @@ pub struct Player {
     volume: u16,
     speed: i32,
     pub gapless: bool,
+    crossfade: Duration,
+    crossfade_on_silence: bool,
+    buffer_len: usize,
+    preloader: Preloader,
+    replaygain: ReplayGain,
+    gains: Gains,
     // pub current_item: Option<String>,
     // pub next_item: Option<String>,
     pub message_tx: Sender<PlayerMsg>,
@@ -51,9 +77,16 @@ impl Player {
         let (stream, handle) = OutputStream::try_default().unwrap();
         let gapless = config.gapless;
         let sink = Sink::try_new(&handle, gapless, tx.clone()).unwrap();
+        let crossfade = Duration::from_secs(config.crossfade_secs);
+        let crossfade_on_silence = config.crossfade_on_silence;
+        sink.set_crossfade(crossfade, crossfade_on_silence);
+        sink.set_equalizer(config.eq_bands());
         let volume = config.volume.try_into().unwrap();
         sink.set_volume(f32::from(volume) / 100.0);
         let speed = config.speed;
+        let buffer_len = (config.decoder_buffer_kib * 1024)
+            .next_power_of_two()
+            .max(MIN_BUFFER_LEN);
 
         let mut this = Self {
             _stream: stream,
@@ -63,47 +96,68 @@ impl Player {
             volume,
             speed,
             gapless,
+            crossfade,
+            crossfade_on_silence,
+            buffer_len,
+            preloader: Preloader::new(buffer_len, tx.clone()),
+            replaygain: config.replaygain,
+            gains: Gains::open(),
             message_tx: tx,
         };
         this.set_speed(speed);
         this
     }
 
+    /// Start `item`, streams that are not preloaded are opened in the background and come back
+    /// as `PlayerMsg::StreamOpened`.
     pub fn enqueue(&mut self, item: &str) {
-        #[cfg(unix)]
-        let _gag = gag::Gag::stderr().unwrap();
-        eprintln!("gag works?");
-
-        let p1 = Path::new(item);
-        if let Ok(file) = File::open(p1) {
-            // if let Ok(decoder) = Symphonia::new(file, self.gapless) {
-            //     self.total_duration = decoder.total_duration();
-            //     self.sink.append(decoder);
-            //     self.set_speed(self.speed);
-            //     // self.sink.message_on_end();
-            // }
-            match Symphonia::new(file, self.gapless) {
-                Ok(decoder) => {
-                    self.total_duration = decoder.total_duration();
-                    self.sink.append(decoder);
-                    self.set_speed(self.speed);
-                }
-                Err(e) => eprintln!("error is: {:?}", e),
-            }
+        if let Some(decoder) = self.decoder(item) {
+            // self.sink.message_on_end();
+            self.total_duration = decoder.total_duration();
+            let gain = self.gain(item);
+            self.sink.append(decoder.amplify(gain));
+            self.set_speed(self.speed);
+        } else if is_url(item) {
+            self.preloader.open(item, self.gapless);
         }
     }
 
-    pub fn enqueue_next(&mut self, item: &str) -> Option<Duration> {
-        let mut duration = None;
-        let p1 = Path::new(item);
-        if let Ok(file) = File::open(p1) {
-            if let Ok(decoder) = Symphonia::new(file, self.gapless) {
-                duration = decoder.total_duration();
-                self.sink.append(decoder);
-                // self.sink.message_on_end();
-            }
+    /// Queue the track after the current one, `crossfade` lets the two overlap. Fails if its
+    /// decoder is not at hand, then the track is started when the current one ends.
+    pub fn enqueue_next(&mut self, item: &str, crossfade: bool) -> Result<Option<Duration>> {
+        let decoder = self
+            .decoder(item)
+            .ok_or_else(|| anyhow!("{} is not ready", item))?;
+        let duration = decoder.total_duration();
+        let decoder = decoder.amplify(self.gain(item));
+        if crossfade {
+            self.sink.append(decoder);
+        } else {
+            self.sink.append_gapless(decoder);
         }
-        duration
+        // self.sink.message_on_end();
+        Ok(duration)
+    }
+
+    /// Prepare the decoders of the tracks that play next in the background.
+    pub fn preload(&self, items: Vec<String>) {
+        self.preloader.preload(items, self.gapless);
+    }
+
+    // a preloaded decoder if there is one, opening the track here is the slow path and only
+    // taken for local files
+    fn decoder(&self, item: &str) -> Option<Symphonia> {
+        self.preloader.take(item, self.gapless).or_else(|| {
+            if is_url(item) {
+                return None;
+            }
+            open_decoder(item, self.gapless, self.buffer_len).ok()
+        })
+    }
+
+    // looked up when the track is queued, the analyzer may have measured it by now
+    fn gain(&self, item: &str) -> f32 {
+        self.gains.factor(item, self.replaygain)
     }
 
     fn play(&mut self, current_item: &str) {
@@ -116,13 +170,15 @@ impl Player {
         // self.next_item = None;
         self.sink = Sink::try_new(&self.handle, self.gapless, self.message_tx.clone()).unwrap();
         self.sink.set_volume(f32::from(self.volume) / 100.0);
+        self.sink
+            .set_crossfade(self.crossfade, self.crossfade_on_silence);
     }
     fn elapsed(&self) -> Duration {
         self.sink.elapsed()
     }
     fn duration(&self) -> Option<f64> {
-        self.total_duration
-            .map(|duration| duration.as_secs_f64() - 0.29)
+        // with gapless enabled symphonia leaves encoder delay and padding out of the frame count
+        self.total_duration.map(|duration| duration.as_secs_f64())
     }
 
     fn seek_fw(&mut self) {
@@ -141,7 +197,8 @@ impl Player {
 
         self.seek_to(Duration::from_secs_f64(new_pos));
     }
-    fn seek_to(&self, time: Duration) {
+    /// Jump to `time` into the playing track.
+    pub fn seek_to(&self, time: Duration) {
         self.sink.seek(time);
         self.get_progress().ok();
     }
@@ -164,6 +221,27 @@ impl Player {
     // }
 }
 
+fn open_decoder(item: &str, gapless: bool, buffer_len: usize) -> Result<Symphonia> {
+    let source = open_source(item)?;
+    // locals drop in reverse, the gag is gone before the next open may take the lock
+    #[cfg(unix)]
+    let _lock = STDERR_GAG.lock().unwrap_or_else(PoisonError::into_inner);
+    #[cfg(unix)]
+    let _gag = gag::Gag::stderr().ok();
+
+    Ok(Symphonia::new(source, gapless, buffer_len)?)
+}
+
+// remote files start playing while they download
+fn open_source(item: &str) -> Result<Box<dyn MediaSource>> {
+    if is_url(item) {
+        return Ok(Box::new(HttpStream::open(item)?));
+    }
+    let file = File::open(Path::new(item))?;
+    readahead::advise_sequential(&file);
+    Ok(Box::new(file))
+}
+
 impl PlayerTrait for Player {
     fn add_and_play(&mut self, current_track: &str) {
         self.play(current_track);
@@ -259,3 +337,65 @@ impl PlayerTrait for Player {
         self.stop();
     }
 }
+
+// 16 bit pcm wav in the temp dir, returns its path
+#[cfg(test)]
+#[allow(clippy::cast_possible_truncation)]
+fn write_test_wav(name: &str, channels: u16, rate: u32, samples: &[i16]) -> String {
+    use std::io::Write;
+    let mut path = std::env::temp_dir();
+    path.push(format!("termusic_{}_{}.wav", std::process::id(), name));
+    let data_len = (samples.len() * 2) as u32;
+    let mut wav = Vec::new();
+    wav.extend_from_slice(b"RIFF");
+    wav.extend_from_slice(&(36 + data_len).to_le_bytes());
+    wav.extend_from_slice(b"WAVEfmt ");
+    wav.extend_from_slice(&16_u32.to_le_bytes());
+    wav.extend_from_slice(&1_u16.to_le_bytes());
+    wav.extend_from_slice(&channels.to_le_bytes());
+    wav.extend_from_slice(&rate.to_le_bytes());
+    wav.extend_from_slice(&(rate * u32::from(channels) * 2).to_le_bytes());
+    wav.extend_from_slice(&(channels * 2).to_le_bytes());
+    wav.extend_from_slice(&16_u16.to_le_bytes());
+    wav.extend_from_slice(b"data");
+    wav.extend_from_slice(&data_len.to_le_bytes());
+    for sample in samples {
+        wav.extend_from_slice(&sample.to_le_bytes());
+    }
+    File::create(&path).unwrap().write_all(&wav).unwrap();
+    path.to_string_lossy().to_string()
+}
+
+// Silent 128 kbps stereo mp3 in the temp dir, `frames` mpeg frames of 1152 samples behind an
+// Info frame whose LAME extension carries the encoder `delay` and `padding`. Returns its path.
+#[cfg(test)]
+#[allow(clippy::cast_possible_truncation)]
+fn write_test_mp3(name: &str, frames: u32, delay: u32, padding: u32) -> String {
+    use std::io::Write;
+    const FRAME_LEN: usize = 417;
+    let mut path = std::env::temp_dir();
+    path.push(format!("termusic_{}_{}.mp3", std::process::id(), name));
+    let mut frame = vec![0_u8; FRAME_LEN];
+    frame[..4].copy_from_slice(&[0xFF, 0xFB, 0x90, 0x00]);
+
+    // the tag sits behind the 32 bytes of side information
+    let mut info = frame.clone();
+    let mut tag = Vec::new();
+    tag.extend_from_slice(b"Info");
+    // frame count and byte count present
+    tag.extend_from_slice(&3_u32.to_be_bytes());
+    tag.extend_from_slice(&frames.to_be_bytes());
+    tag.extend_from_slice(&((frames + 1) * FRAME_LEN as u32).to_be_bytes());
+    tag.extend_from_slice(b"LAME3.100");
+    // revision, lowpass, peak, radio and audiophile gain, flags, abr bitrate
+    tag.extend_from_slice(&[0; 1 + 1 + 4 + 2 + 2 + 1 + 1]);
+    tag.extend_from_slice(&((delay << 12) | padding).to_be_bytes()[1..]);
+    info[36..36 + tag.len()].copy_from_slice(&tag);
+
+    let mut file = File::create(&path).unwrap();
+    file.write_all(&info).unwrap();
+    for _ in 0..frames {
+        file.write_all(&frame).unwrap();
+    }
+    path.to_string_lossy().to_string()
+}
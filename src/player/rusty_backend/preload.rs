@@ -0,0 +1,266 @@
+use super::{open_decoder, Symphonia};
+use crate::player::PlayerMsg;
+use crate::utils::is_url;
+use std::collections::VecDeque;
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::SystemTime;
+
+struct Prepared {
+    item: String,
+    gapless: bool,
+    modified: Option<SystemTime>,
+    decoder: Symphonia,
+}
+
+#[derive(Default)]
+struct State {
+    ready: Vec<Prepared>,
+    preparing: Option<String>,
+    // items of the latest request the worker has not reached yet
+    pending: VecDeque<String>,
+    gapless: bool,
+    // a stream the player waits for, it is told once the decoder is ready
+    wanted: Option<String>,
+}
+
+enum Request {
+    // the upcoming tracks, decoders prepared for others are dropped
+    Upcoming { items: Vec<String>, gapless: bool },
+    // a wanted stream went in front of the pending items
+    Wanted,
+}
+
+type Shared = Arc<(Mutex<State>, Condvar)>;
+
+/// Opens, probes and primes the decoders of upcoming tracks on a worker thread, so that starting
+/// one of them only swaps in a decoder that already holds its first packet.
+pub struct Preloader {
+    shared: Shared,
+    request_tx: Sender<Request>,
+}
+
+impl Preloader {
+    /// Start the worker, it prepares decoders with a read buffer of `buffer_len` bytes and
+    /// tells `message_tx` about the streams it was asked to open.
+    pub fn new(buffer_len: usize, message_tx: Sender<PlayerMsg>) -> Self {
+        let shared: Shared = Arc::new((Mutex::new(State::default()), Condvar::new()));
+        let (request_tx, request_rx): (Sender<Request>, Receiver<Request>) = mpsc::channel();
+
+        let worker_shared = shared.clone();
+        thread::spawn(move || {
+            let (lock, cvar) = &*worker_shared;
+            while let Ok(request) = request_rx.recv() {
+                // only the latest queue matters
+                let upcoming = std::iter::once(request)
+                    .chain(request_rx.try_iter())
+                    .filter_map(|request| match request {
+                        Request::Upcoming { items, gapless } => Some((items, gapless)),
+                        Request::Wanted => None,
+                    })
+                    .last();
+
+                if let Some((items, gapless)) = upcoming {
+                    let mut state = lock.lock().unwrap();
+                    let wanted = state.wanted.clone();
+                    state.ready.retain(|p| {
+                        p.gapless == gapless
+                            && (items.contains(&p.item) || wanted.as_ref() == Some(&p.item))
+                    });
+                    state.pending = items.into();
+                    state.gapless = gapless;
+                    if let Some(wanted) = wanted {
+                        let ready = state.ready.iter().any(|p| p.item == wanted);
+                        if !ready && state.preparing.as_ref() != Some(&wanted) {
+                            state.pending.retain(|p| *p != wanted);
+                            state.pending.push_front(wanted);
+                        }
+                    }
+                }
+
+                loop {
+                    let (item, gapless) = {
+                        let mut state = lock.lock().unwrap();
+                        let item = match state.pending.pop_front() {
+                            Some(item) => item,
+                            None => break,
+                        };
+                        if state.ready.iter().any(|p| p.item == item) {
+                            continue;
+                        }
+                        state.preparing = Some(item.clone());
+                        (item, state.gapless)
+                    };
+
+                    let modified = modified(&item);
+                    let decoder = open_decoder(&item, gapless, buffer_len);
+
+                    let mut state = lock.lock().unwrap();
+                    state.preparing = None;
+                    let wanted = state.wanted.as_ref() == Some(&item);
+                    let message = match decoder {
+                        Ok(decoder) => {
+                            state.ready.push(Prepared {
+                                item: item.clone(),
+                                gapless,
+                                modified,
+                                decoder,
+                            });
+                            PlayerMsg::StreamOpened(item)
+                        }
+                        Err(e) => PlayerMsg::StreamFailed(format!("{}: {}", item, e)),
+                    };
+                    if wanted {
+                        state.wanted = None;
+                        message_tx.send(message).ok();
+                    }
+                    cvar.notify_all();
+                }
+            }
+        });
+
+        Self { shared, request_tx }
+    }
+
+    /// Prepare decoders for `items`, dropping the ones prepared for tracks no longer upcoming.
+    pub fn preload(&self, items: Vec<String>, gapless: bool) {
+        self.request_tx
+            .send(Request::Upcoming { items, gapless })
+            .ok();
+    }
+
+    /// Open the stream `item` ahead of everything else, `PlayerMsg::StreamOpened` tells when
+    /// `take` has its decoder.
+    pub fn open(&self, item: &str, gapless: bool) {
+        let (lock, _) = &*self.shared;
+        let mut state = lock.lock().unwrap();
+        state.wanted = Some(item.to_string());
+        state.gapless = gapless;
+        if state.preparing.as_deref() != Some(item) {
+            state.pending.retain(|p| p != item);
+            state.pending.push_front(item.to_string());
+        }
+        drop(state);
+        self.request_tx.send(Request::Wanted).ok();
+    }
+
+    /// The prepared decoder of `item`, waits if it is being prepared right now. Streams may
+    /// take seconds to answer, they are not waited for.
+    pub fn take(&self, item: &str, gapless: bool) -> Option<Symphonia> {
+        let (lock, cvar) = &*self.shared;
+        let mut state = cvar
+            .wait_while(lock.lock().unwrap(), |s| {
+                !is_url(item) && s.preparing.as_deref() == Some(item)
+            })
+            .unwrap();
+        let index = match state
+            .ready
+            .iter()
+            .position(|p| p.item == item && p.gapless == gapless)
+        {
+            Some(index) => index,
+            None => {
+                // the caller opens it now, the worker must not prepare it a second time
+                state.pending.retain(|p| p != item);
+                return None;
+            }
+        };
+        let prepared = state.ready.remove(index);
+        drop(state);
+
+        // the tags were edited since, the decoder may point at stale offsets
+        if prepared.modified != modified(item) {
+            return None;
+        }
+        Some(prepared.decoder)
+    }
+}
+
+fn modified(item: &str) -> Option<SystemTime> {
+    std::fs::metadata(item).and_then(|m| m.modified()).ok()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::player::rusty_backend::{write_test_wav, Source};
+    use std::time::{Duration, Instant};
+
+    // one second of stereo silence
+    fn write_wav(name: &str) -> String {
+        write_test_wav(&format!("preload_{}", name), 2, 44_100, &[0; 44_100 * 2])
+    }
+
+    fn take_eventually(preloader: &Preloader, item: &str, gapless: bool) -> Option<Symphonia> {
+        let start = Instant::now();
+        while start.elapsed() < Duration::from_secs(5) {
+            if let Some(decoder) = preloader.take(item, gapless) {
+                return Some(decoder);
+            }
+            thread::sleep(Duration::from_millis(10));
+        }
+        None
+    }
+
+    #[test]
+    fn test_preloaded_decoder_is_handed_out_once() {
+        let first = write_wav("first");
+        let second = write_wav("second");
+        let preloader = Preloader::new(64 * 1024, mpsc::channel().0);
+        preloader.preload(vec![first.clone(), second.clone()], true);
+
+        let decoder = take_eventually(&preloader, &second, true).unwrap();
+        assert_eq!(decoder.sample_rate(), 44_100);
+        assert_eq!(decoder.channels(), 2);
+        assert!(take_eventually(&preloader, &first, true).is_some());
+        assert!(preloader.take(&first, true).is_none());
+
+        std::fs::remove_file(first).ok();
+        std::fs::remove_file(second).ok();
+    }
+
+    #[test]
+    fn test_preloaded_decoder_follows_gapless_setting() {
+        let item = write_wav("gapless");
+        let preloader = Preloader::new(64 * 1024, mpsc::channel().0);
+        preloader.preload(vec![item.clone()], true);
+        assert!(take_eventually(&preloader, &item, true).is_some());
+
+        preloader.preload(vec![item.clone()], true);
+        assert!(preloader.take(&item, false).is_none());
+        assert!(take_eventually(&preloader, &item, true).is_some());
+
+        std::fs::remove_file(item).ok();
+    }
+
+    #[test]
+    fn test_wanted_item_is_announced() {
+        let item = write_wav("wanted");
+        let (tx, rx) = mpsc::channel();
+        let preloader = Preloader::new(64 * 1024, tx);
+        preloader.open(&item, true);
+        match rx.recv_timeout(Duration::from_secs(5)).unwrap() {
+            PlayerMsg::StreamOpened(opened) => assert_eq!(opened, item),
+            _ => panic!("expected the opened stream"),
+        }
+        assert!(preloader.take(&item, true).is_some());
+
+        preloader.open("/nonexistent/termusic.mp3", true);
+        assert!(matches!(
+            rx.recv_timeout(Duration::from_secs(5)).unwrap(),
+            PlayerMsg::StreamFailed(_)
+        ));
+        std::fs::remove_file(item).ok();
+    }
+
+    #[test]
+    fn test_missed_item_leaves_the_queue() {
+        let preloader = Preloader::new(64 * 1024, mpsc::channel().0);
+        let (lock, _) = &*preloader.shared;
+        lock.lock().unwrap().pending = vec!["a".to_string(), "b".to_string()].into();
+
+        assert!(preloader.take("b", true).is_none());
+        assert_eq!(lock.lock().unwrap().pending, ["a"]);
+    }
+}
@@ -1,16 +1,28 @@
 //! Queue that plays sounds one after the other.
 
+use std::f32::consts::FRAC_PI_2;
 use std::sync::mpsc::{Receiver, Sender};
 use std::sync::{mpsc, Arc, Mutex};
 use std::time::Duration;
 use std::{
     collections::VecDeque,
-    sync::atomic::{AtomicBool, Ordering},
+    sync::atomic::{AtomicBool, AtomicU64, Ordering},
 };
 
 use super::source::{Empty, Source, Zero};
 use super::Sample;
 
+// Frames between two looks at the time left in the current sound.
+const CROSSFADE_CHECK_FRAMES: u64 = 1024;
+// Samples sharing one pair of crossfade gains.
+const CROSSFADE_GAIN_BLOCK: u64 = 256;
+// When starting crossfades on silence, how long before the regular start to listen for it, and
+// how long it has to last.
+const SILENCE_WINDOW: Duration = Duration::from_secs(10);
+const SILENCE_MIN: Duration = Duration::from_secs(1);
+// roughly -60 dBFS
+const SILENCE_LEVEL: f32 = 0.001;
+
 /// Builds a new queue. It consists of an input and an output.
 ///
 /// The input can be used to add sounds to the end of the queue, while the output implements
@@ -32,6 +44,8 @@ where
     let input = Arc::new(SourcesQueueInput {
         next_sounds: Mutex::new(Vec::new()),
         keep_alive_if_empty: AtomicBool::new(keep_alive_if_empty),
+        crossfade_ms: AtomicU64::new(0),
+        crossfade_on_silence: AtomicBool::new(false),
     });
 
     let output = SourcesQueueOutput {
@@ -40,6 +54,15 @@ where
         input: input.clone(),
         sample_cache: VecDeque::new(),
         _gapless_playback: gapless_playback,
+        fading: None,
+        fade_pos: 0,
+        fade_len: 0,
+        gain_in: 1.0,
+        gain_out: 0.0,
+        played: 0,
+        next_check: 0,
+        watch_silence: false,
+        silent_run: 0,
     };
 
     (input, output)
@@ -50,10 +73,15 @@ where
 /// The input of the queue.
 #[allow(clippy::type_complexity)]
 pub struct SourcesQueueInput<S> {
-    next_sounds: Mutex<Vec<(Box<dyn Source<Item = S> + Send>, Option<Sender<()>>)>>,
+    // sound, end signal, whether it may crossfade with the sound before it
+    next_sounds: Mutex<Vec<(Box<dyn Source<Item = S> + Send>, Option<Sender<()>>, bool)>>,
 
     // See constructor.
     keep_alive_if_empty: AtomicBool,
+
+    // 0 turns crossfading off
+    crossfade_ms: AtomicU64,
+    crossfade_on_silence: AtomicBool,
 }
 
 #[allow(unused)]
@@ -70,14 +98,16 @@ where
         self.next_sounds
             .lock()
             .unwrap()
-            .push((Box::new(source) as Box<_>, None));
+            .push((Box::new(source) as Box<_>, None, false));
     }
 
     /// Adds a new source to the end of the queue.
     ///
-    /// The `Receiver` will be signalled when the sound has finished playing.
+    /// The `Receiver` will be signalled when the sound has finished playing, or when it starts
+    /// fading out under the next one. `crossfade` allows the start of this sound to overlap the
+    /// end of the previous one.
     #[inline]
-    pub fn append_with_signal<T>(&self, source: T) -> Receiver<()>
+    pub fn append_with_signal<T>(&self, source: T, crossfade: bool) -> Receiver<()>
     where
         T: Source<Item = S> + Send + 'static,
     {
@@ -85,10 +115,30 @@ where
         self.next_sounds
             .lock()
             .unwrap()
-            .push((Box::new(source) as Box<_>, Some(tx)));
+            .push((Box::new(source) as Box<_>, Some(tx), crossfade));
         rx
     }
 
+    /// Overlap the end of each sound with the start of the next by `duration`, zero turns
+    /// crossfading off. With `on_silence` the overlap starts early when the end of a sound has
+    /// gone quiet.
+    #[allow(clippy::cast_possible_truncation)]
+    pub fn set_crossfade(&self, duration: Duration, on_silence: bool) {
+        self.crossfade_ms
+            .store(duration.as_millis() as u64, Ordering::Relaxed);
+        self.crossfade_on_silence
+            .store(on_silence, Ordering::Relaxed);
+    }
+
+    /// How long before the end of a sound a crossfade may start.
+    pub fn crossfade_lead(&self) -> Duration {
+        let crossfade = Duration::from_millis(self.crossfade_ms.load(Ordering::Relaxed));
+        if !crossfade.is_zero() && self.crossfade_on_silence.load(Ordering::Relaxed) {
+            return crossfade + SILENCE_WINDOW;
+        }
+        crossfade
+    }
+
     /// Sets whether the queue stays alive if there's no more sound to play.
     ///
     /// See also the constructor.
@@ -119,6 +169,20 @@ pub struct SourcesQueueOutput<S> {
     sample_cache: VecDeque<Option<S>>,
 
     _gapless_playback: bool,
+
+    // The end of the previous sound, faded out under the start of `current`.
+    fading: Option<Box<dyn Source<Item = S> + Send>>,
+    // Position in and length of the crossfade in samples, no crossfade if `fade_len` is 0.
+    fade_pos: u64,
+    fade_len: u64,
+    gain_in: f32,
+    gain_out: f32,
+
+    // Samples of `current` played, and when to look at the time it has left again.
+    played: u64,
+    next_check: u64,
+    watch_silence: bool,
+    silent_run: u64,
 }
 
 impl<S> Source for SourcesQueueOutput<S>
@@ -195,13 +259,26 @@ where
             if !self.sample_cache.is_empty() {
                 return self.sample_cache.pop_front().unwrap();
             }
+            if self.played == self.next_check {
+                self.check_crossfade();
+            }
+
             // Basic situation that will happen most of the time.
             if let Some(sample) = self.current.next() {
+                self.played += 1;
+                if self.watch_silence {
+                    self.listen_for_silence(sample);
+                }
+                if self.fade_len > 0 {
+                    return Some(self.mix(sample));
+                }
                 return Some(sample);
             }
 
             // Since `self.current` has finished, we need to pick the next sound.
             // In order to avoid inlining this expensive operation, the code is in another function.
+            self.fading = None;
+            self.fade_len = 0;
             if self.go_next().is_err() {
                 return None;
             }
@@ -263,13 +340,236 @@ where
             //     }
             //     (next, signal_after_end)
             } else {
-                next.remove(0)
+                let (next, signal_after_end, _) = next.remove(0);
+                (next, signal_after_end)
             }
         };
 
         self.current = next;
 
         self.signal_after_end = signal_after_end;
+        self.played = 0;
+        self.next_check = 0;
+        self.watch_silence = false;
+        self.silent_run = 0;
         Ok(())
     }
+
+    // Called every few frames of `current`, starts fading it out under the next sound once it
+    // is about to end.
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_sign_loss,
+        clippy::cast_precision_loss
+    )]
+    fn check_crossfade(&mut self) {
+        let channels = u64::from(self.current.channels().max(1));
+        let rate = u64::from(self.current.sample_rate());
+        self.next_check = self.played + CROSSFADE_CHECK_FRAMES * channels;
+
+        let crossfade = Duration::from_millis(self.input.crossfade_ms.load(Ordering::Relaxed));
+        // only sounds appended with a signal are tracks, the rest is filler silence
+        if crossfade.is_zero() || self.fade_len > 0 || self.signal_after_end.is_none() {
+            return;
+        }
+        let remaining = match self.current.total_duration() {
+            Some(total) => total.saturating_sub(self.current.elapsed()),
+            None => return,
+        };
+
+        let on_silence = self.input.crossfade_on_silence.load(Ordering::Relaxed);
+        self.watch_silence = on_silence && remaining <= crossfade + SILENCE_WINDOW;
+        let gone_quiet = self.watch_silence
+            && self.silent_run >= (SILENCE_MIN.as_secs_f64() * (rate * channels) as f64) as u64;
+        if remaining > crossfade && !gone_quiet {
+            return;
+        }
+
+        // whole frames, so that both sounds stay on the same channel
+        let fade_frames = (remaining.min(crossfade).as_secs_f64() * rate as f64).round() as u64;
+        if fade_frames == 0 {
+            return;
+        }
+
+        let (next, signal_after_end) = {
+            let mut next_sounds = self.input.next_sounds.lock().unwrap();
+            // gapless neighbours and sounds the mixer would have to convert play back to back
+            let fits = matches!(
+                next_sounds.first(),
+                Some((next, _, true))
+                    if next.channels() == self.current.channels()
+                        && next.sample_rate() == self.current.sample_rate()
+            );
+            if !fits {
+                return;
+            }
+            let (next, signal_after_end, _) = next_sounds.remove(0);
+            (next, signal_after_end)
+        };
+
+        self.fading = Some(std::mem::replace(&mut self.current, next));
+        if let Some(signal) = self.signal_after_end.take() {
+            let _ = signal.send(());
+        }
+        self.signal_after_end = signal_after_end;
+        self.fade_pos = 0;
+        self.fade_len = fade_frames * channels;
+        self.played = 0;
+        self.next_check = CROSSFADE_CHECK_FRAMES * channels;
+        self.watch_silence = false;
+        self.silent_run = 0;
+    }
+
+    #[inline]
+    fn listen_for_silence(&mut self, sample: S) {
+        if sample.to_f32().abs() < SILENCE_LEVEL {
+            self.silent_run += 1;
+        } else {
+            self.silent_run = 0;
+        }
+    }
+
+    // Equal power crossfade, the gains are updated once per block.
+    #[inline]
+    #[allow(clippy::cast_precision_loss)]
+    fn mix(&mut self, sample: S) -> S {
+        if self.fade_pos % CROSSFADE_GAIN_BLOCK == 0 {
+            let t = self.fade_pos as f32 / self.fade_len as f32;
+            self.gain_in = (t * FRAC_PI_2).sin();
+            self.gain_out = (t * FRAC_PI_2).cos();
+        }
+        self.fade_pos += 1;
+
+        let old = self.fading.as_mut().and_then(Iterator::next);
+        let mixed = match old {
+            Some(old) => sample
+                .amplify(self.gain_in)
+                .saturating_add(old.amplify(self.gain_out)),
+            None => sample.amplify(self.gain_in),
+        };
+
+        if self.fade_pos >= self.fade_len {
+            self.fading = None;
+            self.fade_len = 0;
+        }
+        mixed
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::player::rusty_backend::{write_test_mp3, write_test_wav, Symphonia};
+    use std::fs::File;
+
+    fn decode(path: &str) -> Symphonia {
+        Symphonia::new(Box::new(File::open(path).unwrap()), true, 64 * 1024).unwrap()
+    }
+
+    #[test]
+    #[allow(clippy::cast_possible_truncation)]
+    fn test_gapless_golden_output() {
+        // odd lengths, so neither track ends on a packet boundary
+        let first: Vec<i16> = (0..44_101 * 2).map(|i| (i % 1000) as i16).collect();
+        let second: Vec<i16> = (0..30_007 * 2).map(|i| -((i % 700) as i16)).collect();
+        let first_path = write_test_wav("golden_first", 2, 44_100, &first);
+        let second_path = write_test_wav("golden_second", 2, 44_100, &second);
+
+        let (input, output) = queue::<i16>(false, true);
+        let first_end = input.append_with_signal(decode(&first_path), false);
+        input.append_with_signal(decode(&second_path), false);
+
+        let mut played = Vec::new();
+        let mut boundary = None;
+        for sample in output {
+            played.push(sample);
+            if boundary.is_none() && first_end.try_recv().is_ok() {
+                boundary = Some(played.len() - 1);
+            }
+        }
+        // the end of the first track is signalled with the first sample of the second
+        assert_eq!(boundary, Some(first.len()));
+
+        // through a file, the way it would be heard
+        let played_path = write_test_wav("golden_played", 2, 44_100, &played);
+        let golden: Vec<i16> = first.iter().chain(second.iter()).copied().collect();
+        assert_eq!(decode(&played_path).collect::<Vec<i16>>(), golden);
+
+        for path in [first_path, second_path, played_path] {
+            std::fs::remove_file(path).ok();
+        }
+    }
+
+    #[test]
+    #[allow(clippy::cast_possible_truncation)]
+    fn test_gapless_golden_output_trims_mp3_delay_and_padding() {
+        // the padding has to cover the 529 samples of decoder delay symphonia moves to the front
+        let (frames, delay, padding) = (20, 576, 1000);
+        let first_path = write_test_mp3("golden_lame", frames, delay, padding);
+        let second: Vec<i16> = (1..=30_007 * 2).map(|i| (i % 700) as i16 + 1).collect();
+        let second_path = write_test_wav("golden_after_lame", 2, 44_100, &second);
+
+        let (input, output) = queue::<i16>(false, true);
+        let first_end = input.append_with_signal(decode(&first_path), false);
+        input.append_with_signal(decode(&second_path), false);
+
+        let mut played = Vec::new();
+        let mut boundary = None;
+        for sample in output {
+            played.push(sample);
+            if boundary.is_none() && first_end.try_recv().is_ok() {
+                boundary = Some(played.len() - 1);
+            }
+        }
+
+        // every frame of the mp3 less its delay and padding, in stereo
+        let trimmed = (frames * 1152 - delay - padding) as usize * 2;
+        assert_eq!(boundary, Some(trimmed));
+        assert!(played[..trimmed].iter().all(|s| *s == 0));
+        assert_eq!(played[trimmed], second[0]);
+        assert_eq!(&played[trimmed..], &second[..]);
+
+        std::fs::remove_file(first_path).ok();
+        std::fs::remove_file(second_path).ok();
+    }
+
+    // one second of a constant stereo signal on both tracks, crossfaded or not
+    fn play_pair(name: &str, crossfade: bool) -> (Vec<i16>, bool) {
+        let track = vec![8000_i16; 44_100 * 2];
+        let first_path = write_test_wav(&format!("{}_first", name), 2, 44_100, &track);
+        let second_path = write_test_wav(&format!("{}_second", name), 2, 44_100, &track);
+
+        let (input, output) = queue::<i16>(false, true);
+        input.set_crossfade(Duration::from_millis(200), false);
+        let first_end = input.append_with_signal(decode(&first_path), true);
+        input.append_with_signal(decode(&second_path), crossfade);
+        let played = output.collect();
+
+        std::fs::remove_file(first_path).ok();
+        std::fs::remove_file(second_path).ok();
+        (played, first_end.try_recv().is_ok())
+    }
+
+    #[test]
+    #[allow(clippy::cast_possible_wrap)]
+    fn test_crossfade_overlaps_tracks() {
+        let (played, first_ended) = play_pair("crossfade", true);
+        assert!(first_ended);
+
+        // 200 ms of stereo, give or take a check interval
+        let overlap = (44_100 * 4 - played.len()) as i64;
+        assert!((overlap - 17_640).abs() < 2 * 2048, "overlap {}", overlap);
+
+        // equal power on correlated tracks swells by up to 3 dB and never dips
+        let peak = played.iter().copied().max().unwrap();
+        assert!((i32::from(peak) - 11_313).abs() < 150, "peak {}", peak);
+        assert!(played.iter().all(|s| *s >= 7_900));
+    }
+
+    #[test]
+    fn test_gapless_tracks_are_not_crossfaded() {
+        let (played, first_ended) = play_pair("no_crossfade", false);
+        assert!(first_ended);
+        assert_eq!(played, vec![8000_i16; 44_100 * 4]);
+    }
 }
@@ -5,13 +5,18 @@ use std::time::Duration;
 //     collections::VecDeque,
 //     sync::atomic::{AtomicBool, AtomicUsize, Ordering},
 // };
-use crate::player::PlayerMsg;
+use crate::player::{AudioTap, EqBand, PlayerMsg};
 use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
 use std::sync::mpsc::Sender;
 
-use super::{queue, source::Done, Sample, Source};
+use super::source::{Done, EqControls};
+use super::{queue, Sample, Source};
 use super::{OutputStreamHandle, PlayError};
 
+// Time left in a track when the next one is asked for, enough to queue a preloaded decoder
+// behind it so that the queue switches over without running dry.
+const ABOUT_TO_FINISH: Duration = Duration::from_secs(5);
+
 /// Handle to an device that outputs sounds.
 ///
 /// Dropping the `Sink` stops all sounds. You can use `detach` if you want the sounds to continue
@@ -22,7 +27,14 @@ pub struct Sink {
     sleep_until_end: Mutex<Option<Receiver<()>>>,
 
     controls: Arc<Controls>,
+    equalizer: Arc<EqControls>,
+    // what goes out to the device, for the visualizer
+    tap: Arc<AudioTap>,
     sound_count: Arc<AtomicUsize>,
+    // ids of the sounds appended so far and of the one that started last, while crossfading
+    // only the latter follows seeks and reports its position
+    appended: AtomicUsize,
+    playing: Arc<AtomicUsize>,
 
     detached: bool,
 
@@ -49,7 +61,7 @@ impl Sink {
         tx: Sender<PlayerMsg>,
     ) -> Result<Self, PlayError> {
         let (sink, queue_rx) = Self::new_idle(gapless_playback, tx);
-        stream.play_raw(queue_rx)?;
+        stream.play_raw(queue_rx.tap(sink.tap.clone()))?;
         Ok(sink)
     }
 
@@ -72,7 +84,11 @@ impl Sink {
                 speed: Mutex::new(1.0),
                 do_skip: AtomicBool::new(false),
             }),
+            equalizer: Arc::new(EqControls::default()),
+            tap: Arc::new(AudioTap::default()),
             sound_count: Arc::new(AtomicUsize::new(0)),
+            appended: AtomicUsize::new(0),
+            playing: Arc::new(AtomicUsize::new(0)),
             detached: false,
             elapsed: Arc::new(RwLock::new(Duration::from_secs(0))),
             message_tx: tx,
@@ -83,6 +99,25 @@ impl Sink {
     /// Appends a sound to the queue of sounds to play.
     #[inline]
     pub fn append<S>(&self, source: S)
+    where
+        S: Source + Send + 'static,
+        S::Item: Sample + Send,
+    {
+        self.append_source(source, true);
+    }
+
+    /// Appends a sound that follows the previous one without crossfading, e.g. the next track
+    /// of a gapless album.
+    #[inline]
+    pub fn append_gapless<S>(&self, source: S)
+    where
+        S: Source + Send + 'static,
+        S::Item: Sample + Send,
+    {
+        self.append_source(source, false);
+    }
+
+    fn append_source<S>(&self, source: S, crossfade: bool)
     where
         S: Source + Send + 'static,
         S::Item: Sample + Send,
@@ -90,6 +125,14 @@ impl Sink {
         let controls = self.controls.clone();
 
         let elapsed = self.elapsed.clone();
+        let total_duration = source.total_duration();
+        let message_tx = self.message_tx.clone();
+        let mut about_to_finish_sent = false;
+        // the next track has to be queued before a crossfade into it can start
+        let about_to_finish = ABOUT_TO_FINISH + self.queue_tx.crossfade_lead();
+        let id = self.appended.fetch_add(1, Ordering::Relaxed);
+        let playing = self.playing.clone();
+        let mut started = false;
         let source = source
             .speed(1.0)
             .pausable(false)
@@ -97,17 +140,40 @@ impl Sink {
             .skippable()
             .stoppable()
             .periodic_access(Duration::from_millis(50), move |src| {
+                if !started {
+                    playing.store(id, Ordering::Relaxed);
+                    started = true;
+                }
+                let is_current = playing.load(Ordering::Relaxed) == id;
+
                 if controls.stopped.load(Ordering::SeqCst) {
                     src.stop();
-                } else if controls.do_skip.load(Ordering::SeqCst) {
+                } else if is_current && controls.do_skip.load(Ordering::SeqCst) {
                     src.inner_mut().skip();
                     controls.do_skip.store(false, Ordering::SeqCst);
                 } else {
-                    if let Some(seek_time) = controls.seek.lock().unwrap().take() {
-                        src.seek(seek_time).unwrap();
-                        // src.seek(seek_time);
+                    if is_current {
+                        if let Some(seek_time) = controls.seek.lock().unwrap().take() {
+                            src.seek(seek_time).unwrap();
+                            // src.seek(seek_time);
+                            // seeking back out of the tail announces the end again when it comes
+                            // around, enqueue_next ignores it if the next track is already queued
+                            if total_duration
+                                .map_or(true, |d| d.saturating_sub(seek_time) >= about_to_finish)
+                            {
+                                about_to_finish_sent = false;
+                            }
+                        }
+                        let position = src.elapsed();
+                        *elapsed.write().unwrap() = position;
+                        if !about_to_finish_sent
+                            && total_duration
+                                .map_or(false, |d| d.saturating_sub(position) < about_to_finish)
+                        {
+                            message_tx.send(PlayerMsg::AboutToFinish).ok();
+                            about_to_finish_sent = true;
+                        }
                     }
-                    *elapsed.write().unwrap() = src.elapsed();
 
                     // src.inner_mut().set_factor(*controls.volume.lock().unwrap());
                     // Workaround for buffer underrun issue
@@ -128,10 +194,28 @@ impl Sink {
                         .set_factor(*controls.speed.lock().unwrap());
                 }
             })
-            .convert_samples();
+            .convert_samples()
+            .equalizer(self.equalizer.clone());
         self.sound_count.fetch_add(1, Ordering::Relaxed);
         let source = Done::new(source, self.sound_count.clone());
-        *self.sleep_until_end.lock().unwrap() = Some(self.queue_tx.append_with_signal(source));
+        *self.sleep_until_end.lock().unwrap() =
+            Some(self.queue_tx.append_with_signal(source, crossfade));
+    }
+
+    /// Overlaps the end of each track with the start of the next by `duration`, zero turns
+    /// crossfading off. With `on_silence` the overlap starts early when a track ends quietly.
+    pub fn set_crossfade(&self, duration: Duration, on_silence: bool) {
+        self.queue_tx.set_crossfade(duration, on_silence);
+    }
+
+    /// The samples sent to the device, after volume, equalizer and crossfading.
+    pub fn audio_tap(&self) -> Arc<AudioTap> {
+        self.tap.clone()
+    }
+
+    /// Replaces the equalizer bands of all sounds, including the one playing.
+    pub fn set_equalizer(&self, bands: &[EqBand]) {
+        self.equalizer.set(bands);
     }
 
     /// Gets the volume of the sound.
@@ -249,8 +333,8 @@ impl Sink {
     ///
     /// See `pause()` for information about pausing a `Sink`.
     pub fn clear(&self) {
-        let len = self.queue_tx.clear();
-        self.sound_count.fetch_sub(len, Ordering::SeqCst);
+        // the cleared sounds take themselves off sound_count when they are dropped
+        self.queue_tx.clear();
         self.pause();
     }
 
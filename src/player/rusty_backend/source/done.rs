@@ -4,8 +4,8 @@ use std::time::Duration;
 
 use super::{Sample, Source};
 
-/// When the inner source is empty this decrements an `AtomicUsize`.
-#[derive(Debug, Clone)]
+/// When the inner source is empty, or dropped before that, this decrements an `AtomicUsize`.
+#[derive(Debug)]
 pub struct Done<I> {
     input: I,
     signal: Arc<AtomicUsize>,
@@ -34,11 +34,15 @@ impl<I> Done<I> {
     pub fn inner_mut(&mut self) -> &mut I {
         &mut self.input
     }
+}
 
-    /// Returns the inner source.
-    #[inline]
-    pub fn into_inner(self) -> I {
-        self.input
+// a crossfade drops the end of the old sound, and clearing the queue drops sounds that never
+// played, both still count as done
+impl<I> Drop for Done<I> {
+    fn drop(&mut self) {
+        if !self.signal_sent {
+            self.signal.fetch_sub(1, Ordering::Relaxed);
+        }
     }
 }
 
@@ -0,0 +1,513 @@
+use std::f64::consts::PI;
+use std::sync::atomic::{fence, AtomicU32, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+
+use super::Source;
+use crate::player::{EqBand, EqFilter};
+
+/// Most bands a preset can have.
+pub const MAX_BANDS: usize = 16;
+// frames filtered at a time, small enough to stay in L1 next to the filter state
+const BLOCK_FRAMES: usize = 256;
+const FLAT: EqBand = EqBand {
+    filter: EqFilter::Peak,
+    freq: 1000.0,
+    gain_db: 0.0,
+    q: 1.0,
+};
+
+/// Bands shared between the ui and the audio thread. The ui writes them like a seqlock, the
+/// audio thread picks up a consistent set between two blocks and never waits for a lock.
+#[derive(Default)]
+pub struct EqControls {
+    sequence: AtomicUsize,
+    len: AtomicUsize,
+    // filter, frequency, gain and q of each band as f32 bits
+    bands: [[AtomicU32; 4]; MAX_BANDS],
+}
+
+impl EqControls {
+    /// Replace the bands, bands past `MAX_BANDS` are ignored. Only one thread may write.
+    pub fn set(&self, bands: &[EqBand]) {
+        let bands = &bands[..bands.len().min(MAX_BANDS)];
+        // odd while writing, readers keep their filters until it is even again
+        self.sequence.fetch_add(1, Ordering::Relaxed);
+        fence(Ordering::Release);
+        for (slot, band) in self.bands.iter().zip(bands) {
+            let filter = match band.filter {
+                EqFilter::LowShelf => 0,
+                EqFilter::Peak => 1,
+                EqFilter::HighShelf => 2,
+            };
+            slot[0].store(filter, Ordering::Relaxed);
+            slot[1].store(band.freq.to_bits(), Ordering::Relaxed);
+            slot[2].store(band.gain_db.to_bits(), Ordering::Relaxed);
+            slot[3].store(band.q.to_bits(), Ordering::Relaxed);
+        }
+        self.len.store(bands.len(), Ordering::Relaxed);
+        self.sequence.fetch_add(1, Ordering::Release);
+    }
+
+    // cheap to compare against the sequence of the bands in use, odd while a write is in progress
+    fn sequence(&self) -> usize {
+        self.sequence.load(Ordering::Relaxed)
+    }
+
+    // copies the bands into `bands` and returns their sequence number and count, `None` while a
+    // write is in progress
+    fn read(&self, bands: &mut [EqBand; MAX_BANDS]) -> Option<(usize, usize)> {
+        let sequence = self.sequence.load(Ordering::Acquire);
+        if sequence % 2 == 1 {
+            return None;
+        }
+        let len = self.len.load(Ordering::Relaxed).min(MAX_BANDS);
+        for (band, slot) in bands.iter_mut().zip(&self.bands[..len]) {
+            *band = EqBand {
+                filter: match slot[0].load(Ordering::Relaxed) {
+                    0 => EqFilter::LowShelf,
+                    2 => EqFilter::HighShelf,
+                    _ => EqFilter::Peak,
+                },
+                freq: f32::from_bits(slot[1].load(Ordering::Relaxed)),
+                gain_db: f32::from_bits(slot[2].load(Ordering::Relaxed)),
+                q: f32::from_bits(slot[3].load(Ordering::Relaxed)),
+            };
+        }
+        fence(Ordering::Acquire);
+        if self.sequence.load(Ordering::Relaxed) != sequence {
+            return None;
+        }
+        Some((sequence, len))
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+struct Coeffs {
+    b0: f64,
+    b1: f64,
+    b2: f64,
+    a1: f64,
+    a2: f64,
+}
+
+impl Coeffs {
+    // the shelf and peaking filters of the RBJ audio EQ cookbook
+    fn new(band: &EqBand, rate: u32) -> Self {
+        let rate = f64::from(rate);
+        let freq = f64::from(band.freq).clamp(10.0, rate * 0.49);
+        let q = f64::from(band.q).max(0.1);
+        let a = 10_f64.powf(f64::from(band.gain_db) / 40.0);
+        let w0 = 2.0 * PI * freq / rate;
+        let (sin, cos) = w0.sin_cos();
+        let alpha = sin / (2.0 * q);
+        let shelf = 2.0 * a.sqrt() * alpha;
+
+        let (b0, b1, b2, a0, a1, a2) = match band.filter {
+            EqFilter::Peak => (
+                1.0 + alpha * a,
+                -2.0 * cos,
+                1.0 - alpha * a,
+                1.0 + alpha / a,
+                -2.0 * cos,
+                1.0 - alpha / a,
+            ),
+            EqFilter::LowShelf => (
+                a * ((a + 1.0) - (a - 1.0) * cos + shelf),
+                2.0 * a * ((a - 1.0) - (a + 1.0) * cos),
+                a * ((a + 1.0) - (a - 1.0) * cos - shelf),
+                (a + 1.0) + (a - 1.0) * cos + shelf,
+                -2.0 * ((a - 1.0) + (a + 1.0) * cos),
+                (a + 1.0) + (a - 1.0) * cos - shelf,
+            ),
+            EqFilter::HighShelf => (
+                a * ((a + 1.0) + (a - 1.0) * cos + shelf),
+                -2.0 * a * ((a - 1.0) + (a + 1.0) * cos),
+                a * ((a + 1.0) + (a - 1.0) * cos - shelf),
+                (a + 1.0) - (a - 1.0) * cos + shelf,
+                2.0 * ((a - 1.0) - (a + 1.0) * cos),
+                (a + 1.0) - (a - 1.0) * cos - shelf,
+            ),
+        };
+
+        Self {
+            b0: b0 / a0,
+            b1: b1 / a0,
+            b2: b2 / a0,
+            a1: a1 / a0,
+            a2: a2 / a0,
+        }
+    }
+}
+
+// one band, transposed direct form II with a state per channel
+struct Biquad {
+    coeffs: Coeffs,
+    z1: Vec<f64>,
+    z2: Vec<f64>,
+}
+
+impl Biquad {
+    // the channel loop has a length known at compile time, so the compiler turns it into
+    // vector instructions, two f64 lanes for stereo
+    fn process<const N: usize>(&mut self, samples: &mut [f32]) {
+        let c = self.coeffs;
+        let mut z1 = [0.0; N];
+        let mut z2 = [0.0; N];
+        z1.copy_from_slice(&self.z1[..N]);
+        z2.copy_from_slice(&self.z2[..N]);
+        for frame in samples.chunks_exact_mut(N) {
+            for ch in 0..N {
+                let x = f64::from(frame[ch]);
+                let y = c.b0 * x + z1[ch];
+                z1[ch] = c.b1 * x - c.a1 * y + z2[ch];
+                z2[ch] = c.b2 * x - c.a2 * y;
+                frame[ch] = y as f32;
+            }
+        }
+        self.z1[..N].copy_from_slice(&z1);
+        self.z2[..N].copy_from_slice(&z2);
+    }
+
+    fn process_any(&mut self, samples: &mut [f32], channels: usize) {
+        let c = self.coeffs;
+        for frame in samples.chunks_exact_mut(channels) {
+            for (ch, sample) in frame.iter_mut().enumerate() {
+                let x = f64::from(*sample);
+                let y = c.b0 * x + self.z1[ch];
+                self.z1[ch] = c.b1 * x - c.a1 * y + self.z2[ch];
+                self.z2[ch] = c.b2 * x - c.a2 * y;
+                *sample = y as f32;
+            }
+        }
+    }
+}
+
+/// Internal function that builds a `Equalizer` object.
+pub fn equalizer<I>(input: I, controls: Arc<EqControls>) -> Equalizer<I>
+where
+    I: Source<Item = f32>,
+{
+    Equalizer {
+        input,
+        controls,
+        sequence: None,
+        bands: Vec::new(),
+        headroom: 1.0,
+        channels: 0,
+        sample_rate: 0,
+        block: Vec::with_capacity(BLOCK_FRAMES * 2),
+        pos: 0,
+    }
+}
+
+/// Filter that runs the sound through the bands of a parametric equalizer.
+pub struct Equalizer<I> {
+    input: I,
+    controls: Arc<EqControls>,
+    sequence: Option<usize>,
+    bands: Vec<Biquad>,
+    // boosting bands would clip, so the whole signal is lowered by the largest boost
+    headroom: f32,
+    channels: u16,
+    sample_rate: u32,
+    block: Vec<f32>,
+    pos: usize,
+}
+
+#[allow(clippy::missing_const_for_fn, unused)]
+impl<I> Equalizer<I>
+where
+    I: Source<Item = f32>,
+{
+    /// Returns a reference to the inner source.
+    #[inline]
+    pub fn inner(&self) -> &I {
+        &self.input
+    }
+
+    /// Returns a mutable reference to the inner source.
+    #[inline]
+    pub fn inner_mut(&mut self) -> &mut I {
+        &mut self.input
+    }
+
+    /// Returns the inner source.
+    #[inline]
+    pub fn into_inner(self) -> I {
+        self.input
+    }
+
+    // new bands or a new format, the filter state survives a change of bands so that
+    // switching presets does not click
+    fn update(&mut self) {
+        let channels = self.input.channels();
+        let sample_rate = self.input.sample_rate();
+        let format_changed = channels != self.channels || sample_rate != self.sample_rate;
+        // runs before every block, nothing changed almost every time
+        if !format_changed && self.sequence == Some(self.controls.sequence()) {
+            return;
+        }
+        let mut bands = [FLAT; MAX_BANDS];
+        let len = match self.controls.read(&mut bands) {
+            Some((sequence, len)) => {
+                self.sequence = Some(sequence);
+                len
+            }
+            None => return,
+        };
+        let bands = &bands[..len];
+        self.channels = channels;
+        self.sample_rate = sample_rate;
+
+        let len = usize::from(channels);
+        self.bands.truncate(bands.len());
+        for (i, band) in bands.iter().enumerate() {
+            let coeffs = Coeffs::new(band, sample_rate);
+            match self.bands.get_mut(i) {
+                Some(biquad) if !format_changed => biquad.coeffs = coeffs,
+                _ => {
+                    self.bands.truncate(i);
+                    self.bands.push(Biquad {
+                        coeffs,
+                        z1: vec![0.0; len],
+                        z2: vec![0.0; len],
+                    });
+                }
+            }
+        }
+        let boost = bands.iter().map(|b| b.gain_db).fold(0.0, f32::max);
+        self.headroom = 10_f32.powf(-boost / 20.0);
+    }
+
+    fn refill(&mut self) -> Option<f32> {
+        self.update();
+        if self.bands.is_empty() {
+            return self.input.next();
+        }
+
+        let channels = usize::from(self.channels.max(1));
+        // a block never crosses a change of format
+        let len = match self.input.current_frame_len() {
+            Some(0) => return self.input.next(),
+            Some(n) => n.min(BLOCK_FRAMES * channels),
+            None => BLOCK_FRAMES * channels,
+        };
+        self.block.clear();
+        self.block.extend(self.input.by_ref().take(len));
+        self.pos = 0;
+
+        for sample in &mut self.block {
+            *sample *= self.headroom;
+        }
+        for band in &mut self.bands {
+            match channels {
+                1 => band.process::<1>(&mut self.block),
+                2 => band.process::<2>(&mut self.block),
+                _ => band.process_any(&mut self.block, channels),
+            }
+        }
+
+        let sample = self.block.first().copied();
+        self.pos = 1;
+        sample
+    }
+}
+
+impl<I> Iterator for Equalizer<I>
+where
+    I: Source<Item = f32>,
+{
+    type Item = f32;
+
+    #[inline]
+    fn next(&mut self) -> Option<f32> {
+        if let Some(&sample) = self.block.get(self.pos) {
+            self.pos += 1;
+            return Some(sample);
+        }
+        self.block.clear();
+        self.refill()
+    }
+
+    #[inline]
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        let buffered = self.block.len() - self.pos;
+        let (lower, upper) = self.input.size_hint();
+        (
+            lower.saturating_add(buffered),
+            upper.and_then(|u| u.checked_add(buffered)),
+        )
+    }
+}
+
+impl<I> Source for Equalizer<I>
+where
+    I: Source<Item = f32>,
+{
+    #[inline]
+    fn current_frame_len(&self) -> Option<usize> {
+        let buffered = self.block.len() - self.pos;
+        if buffered > 0 {
+            return Some(buffered);
+        }
+        self.input.current_frame_len()
+    }
+
+    #[inline]
+    fn channels(&self) -> u16 {
+        self.input.channels()
+    }
+
+    #[inline]
+    fn sample_rate(&self) -> u32 {
+        self.input.sample_rate()
+    }
+
+    #[inline]
+    fn total_duration(&self) -> Option<Duration> {
+        self.input.total_duration()
+    }
+
+    #[inline]
+    fn elapsed(&mut self) -> Duration {
+        self.input.elapsed()
+    }
+
+    fn seek(&mut self, time: Duration) -> Option<Duration> {
+        self.block.clear();
+        self.pos = 0;
+        for band in &mut self.bands {
+            band.z1.iter_mut().for_each(|z| *z = 0.0);
+            band.z2.iter_mut().for_each(|z| *z = 0.0);
+        }
+        self.input.seek(time)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::player::rusty_backend::buffer::SamplesBuffer;
+    use std::time::Instant;
+
+    fn sine(channels: u16, rate: u32, freq: f32, secs: f32) -> Vec<f32> {
+        let frames = (rate as f32 * secs) as usize;
+        let mut samples = Vec::with_capacity(frames * usize::from(channels));
+        for i in 0..frames {
+            let v = 0.25 * (2.0 * std::f32::consts::PI * freq * i as f32 / rate as f32).sin();
+            samples.extend(std::iter::repeat(v).take(usize::from(channels)));
+        }
+        samples
+    }
+
+    fn peak(samples: &[f32]) -> f32 {
+        // past the filter settling in
+        samples[samples.len() / 2..]
+            .iter()
+            .fold(0.0, |p, s| p.max(s.abs()))
+    }
+
+    fn run(bands: &[EqBand], channels: u16, rate: u32, samples: Vec<f32>) -> Vec<f32> {
+        let controls = Arc::new(EqControls::default());
+        controls.set(bands);
+        SamplesBuffer::new(channels, rate, samples)
+            .equalizer(controls)
+            .collect()
+    }
+
+    fn band(filter: EqFilter, freq: f32, gain_db: f32) -> EqBand {
+        EqBand {
+            filter,
+            freq,
+            gain_db,
+            q: 0.707,
+        }
+    }
+
+    #[test]
+    fn test_without_bands_samples_pass_unchanged() {
+        let input = sine(2, 44_100, 440.0, 0.5);
+        assert_eq!(run(&[], 2, 44_100, input.clone()), input);
+    }
+
+    #[test]
+    fn test_bands_shape_the_response() {
+        // a peak cut at the frequency of the tone lowers it by its gain
+        let output = run(
+            &[band(EqFilter::Peak, 1_000.0, -12.0)],
+            2,
+            48_000,
+            sine(2, 48_000, 1_000.0, 0.5),
+        );
+        assert!(
+            (peak(&output) / 0.25 - 0.251).abs() < 0.01,
+            "{}",
+            peak(&output)
+        );
+
+        // a bass boost leaves the treble alone apart from the headroom it needs
+        let bass = [band(EqFilter::LowShelf, 100.0, 6.0)];
+        let low = run(&bass, 1, 48_000, sine(1, 48_000, 30.0, 1.0));
+        let high = run(&bass, 1, 48_000, sine(1, 48_000, 10_000.0, 0.5));
+        assert!((peak(&low) / 0.25 - 1.0).abs() < 0.05, "{}", peak(&low));
+        assert!((peak(&high) / 0.25 - 0.501).abs() < 0.02, "{}", peak(&high));
+    }
+
+    #[test]
+    fn test_channels_are_filtered_independently() {
+        let mut input = sine(3, 48_000, 1_000.0, 0.5);
+        for frame in input.chunks_exact_mut(3) {
+            frame[1] = 0.0;
+        }
+        let output = run(&[band(EqFilter::Peak, 1_000.0, -12.0)], 3, 48_000, input);
+        assert!(output.chunks_exact(3).all(|f| f[1] == 0.0));
+        assert!((peak(&output) / 0.25 - 0.251).abs() < 0.01);
+    }
+
+    #[test]
+    fn test_bands_follow_the_controls() {
+        let controls = Arc::new(EqControls::default());
+        let mut eq = SamplesBuffer::new(1, 48_000, sine(1, 48_000, 1_000.0, 2.0))
+            .equalizer(controls.clone());
+        let first: Vec<f32> = eq.by_ref().take(48_000).collect();
+        controls.set(&[band(EqFilter::Peak, 1_000.0, -12.0)]);
+        let second: Vec<f32> = eq.collect();
+        assert!((peak(&first) - 0.25).abs() < 0.001);
+        assert!((peak(&second) / 0.25 - 0.251).abs() < 0.01);
+    }
+
+    // cargo test --release -- --ignored bench_equalizer
+    #[test]
+    #[ignore = "benchmark"]
+    fn bench_equalizer_96k_stereo() {
+        let bands: Vec<EqBand> = (0..10)
+            .map(|i| band(EqFilter::Peak, 31.25 * 2_f32.powi(i), 3.0))
+            .collect();
+        let secs = 60.0;
+        let input = sine(2, 96_000, 440.0, secs);
+
+        let start = Instant::now();
+        let plain: f32 = SamplesBuffer::new(2, 96_000, input.clone()).sum();
+        let baseline = start.elapsed();
+
+        let controls = Arc::new(EqControls::default());
+        controls.set(&bands);
+        let start = Instant::now();
+        let filtered: f32 = SamplesBuffer::new(2, 96_000, input)
+            .equalizer(controls)
+            .sum();
+        let cost = start.elapsed().saturating_sub(baseline);
+
+        let load = cost.as_secs_f32() / secs;
+        println!(
+            "10 bands at 96 kHz stereo: {:?} for {} s of audio, {:.3}% of a core ({} {})",
+            cost,
+            secs,
+            load * 100.0,
+            plain,
+            filtered
+        );
+        assert!(load < 0.01);
+    }
+}
@@ -1,12 +1,15 @@
 //! Sources of sound and various filters.
 
+use std::sync::Arc;
 use std::time::Duration;
 
 use super::Sample;
+use crate::player::AudioTap;
 
 pub use self::amplify::Amplify;
 pub use self::done::Done;
 pub use self::empty::Empty;
+pub use self::equalizer::{EqControls, Equalizer};
 pub use self::fadein::FadeIn;
 pub use self::pausable::Pausable;
 pub use self::periodic::PeriodicAccess;
@@ -15,12 +18,14 @@ pub use self::skippable::Skippable;
 pub use self::speed::Speed;
 pub use self::stoppable::Stoppable;
 pub use self::take::TakeDuration;
+pub use self::tap::Tap;
 pub use self::uniform::UniformSourceIterator;
 pub use self::zero::Zero;
 
 mod amplify;
 mod done;
 mod empty;
+mod equalizer;
 mod fadein;
 mod pausable;
 mod periodic;
@@ -29,6 +34,7 @@ mod skippable;
 mod speed;
 mod stoppable;
 mod take;
+mod tap;
 mod uniform;
 mod zero;
 
@@ -148,6 +154,24 @@ where
         amplify::amplify(self, value)
     }
 
+    /// Runs the sound through a parametric equalizer whose bands are set through `controls`.
+    #[inline]
+    fn equalizer(self, controls: Arc<EqControls>) -> Equalizer<Self>
+    where
+        Self: Sized + Iterator<Item = f32>,
+    {
+        equalizer::equalizer(self, controls)
+    }
+
+    /// Copies the samples into `tap` for readers on other threads.
+    #[inline]
+    fn tap(self, tap: Arc<AudioTap>) -> Tap<Self>
+    where
+        Self: Sized + Iterator<Item = f32>,
+    {
+        tap::tap(self, tap)
+    }
+
     /// Fades in the sound.
     #[inline]
     fn fade_in(self, duration: Duration) -> FadeIn<Self>
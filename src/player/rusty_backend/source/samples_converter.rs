@@ -90,7 +90,7 @@ where
     }
     #[inline]
     fn elapsed(&mut self) -> Duration {
-        Duration::from_secs(0)
+        self.inner.elapsed()
     }
     fn seek(&mut self, time: Duration) -> Option<Duration> {
         self.inner.seek(time)
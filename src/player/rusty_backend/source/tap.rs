@@ -0,0 +1,152 @@
+use std::sync::Arc;
+use std::time::Duration;
+
+use super::Source;
+use crate::player::AudioTap;
+
+// samples handed to the tap at a time
+const TAP_BLOCK: usize = 512;
+
+/// Internal function that builds a `Tap` object.
+pub fn tap<I>(input: I, tap: Arc<AudioTap>) -> Tap<I>
+where
+    I: Source<Item = f32>,
+{
+    Tap {
+        input,
+        tap,
+        block: [0.0; TAP_BLOCK],
+        len: 0,
+        enabled: false,
+    }
+}
+
+/// Filter that copies the samples passing through into an `AudioTap`, a block at a time.
+pub struct Tap<I> {
+    input: I,
+    tap: Arc<AudioTap>,
+    block: [f32; TAP_BLOCK],
+    len: usize,
+    // checked once per block, so a reader turning up costs nothing per sample
+    enabled: bool,
+}
+
+#[allow(clippy::missing_const_for_fn, unused)]
+impl<I> Tap<I>
+where
+    I: Source<Item = f32>,
+{
+    /// Returns a reference to the inner source.
+    #[inline]
+    pub fn inner(&self) -> &I {
+        &self.input
+    }
+
+    /// Returns a mutable reference to the inner source.
+    #[inline]
+    pub fn inner_mut(&mut self) -> &mut I {
+        &mut self.input
+    }
+
+    /// Returns the inner source.
+    #[inline]
+    pub fn into_inner(self) -> I {
+        self.input
+    }
+
+    fn flush(&mut self) {
+        if self.enabled {
+            self.tap.write(
+                &self.block[..self.len],
+                self.input.channels(),
+                self.input.sample_rate(),
+            );
+        }
+        self.len = 0;
+        self.enabled = self.tap.is_enabled();
+    }
+}
+
+impl<I> Iterator for Tap<I>
+where
+    I: Source<Item = f32>,
+{
+    type Item = f32;
+
+    #[inline]
+    fn next(&mut self) -> Option<f32> {
+        let sample = self.input.next()?;
+        self.block[self.len] = sample;
+        self.len += 1;
+        if self.len == TAP_BLOCK {
+            self.flush();
+        }
+        Some(sample)
+    }
+
+    #[inline]
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.input.size_hint()
+    }
+}
+
+impl<I> Source for Tap<I>
+where
+    I: Source<Item = f32>,
+{
+    #[inline]
+    fn current_frame_len(&self) -> Option<usize> {
+        self.input.current_frame_len()
+    }
+
+    #[inline]
+    fn channels(&self) -> u16 {
+        self.input.channels()
+    }
+
+    #[inline]
+    fn sample_rate(&self) -> u32 {
+        self.input.sample_rate()
+    }
+
+    #[inline]
+    fn total_duration(&self) -> Option<Duration> {
+        self.input.total_duration()
+    }
+
+    #[inline]
+    fn elapsed(&mut self) -> Duration {
+        self.input.elapsed()
+    }
+
+    fn seek(&mut self, time: Duration) -> Option<Duration> {
+        self.input.seek(time)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::player::rusty_backend::buffer::SamplesBuffer;
+
+    #[test]
+    fn test_tap_sees_what_is_played_once_enabled() {
+        let audio_tap = Arc::new(AudioTap::new(4096));
+        let samples: Vec<f32> = (0..2048).map(|n| n as f32).collect();
+        let mut source = SamplesBuffer::new(2, 48_000, samples.clone()).tap(audio_tap.clone());
+
+        let played: Vec<f32> = source.by_ref().take(TAP_BLOCK).collect();
+        assert_eq!(audio_tap.written(), 0);
+
+        audio_tap.set_enabled(true);
+        let played: Vec<f32> = played.into_iter().chain(source).collect();
+        assert_eq!(played, samples);
+
+        let mut out = Vec::new();
+        assert_eq!(
+            audio_tap.read_latest(TAP_BLOCK, &mut out),
+            Some((2, 48_000))
+        );
+        assert_eq!(out, samples[2048 - TAP_BLOCK * 2..]);
+    }
+}
@@ -0,0 +1,560 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// A persistent sequence for the playlist: a B-tree of chunks indexed by position. Insert,
+// remove and move are O(log n), and a clone shares every node with the original until one of
+// them changes it, which makes snapshots of a large playlist nearly free.
+use std::sync::Arc;
+
+const MAX_LEAF: usize = 64;
+const MAX_CHILDREN: usize = 16;
+
+enum Node<T> {
+    Leaf(Vec<Arc<T>>),
+    // the number of items below, and the subtrees all of the same depth
+    Branch(usize, Vec<Arc<Node<T>>>),
+}
+
+// a shallow copy, items and subtrees stay shared
+impl<T> Clone for Node<T> {
+    fn clone(&self) -> Self {
+        match self {
+            Self::Leaf(items) => Self::Leaf(items.clone()),
+            Self::Branch(len, children) => Self::Branch(*len, children.clone()),
+        }
+    }
+}
+
+fn sum<T>(children: &[Arc<Node<T>>]) -> usize {
+    children.iter().map(|c| c.len()).sum()
+}
+
+fn unshare<T>(node: Arc<Node<T>>) -> Node<T> {
+    Arc::try_unwrap(node).unwrap_or_else(|node| (*node).clone())
+}
+
+impl<T> Node<T> {
+    fn len(&self) -> usize {
+        match self {
+            Self::Leaf(items) => items.len(),
+            Self::Branch(len, _) => *len,
+        }
+    }
+
+    fn is_small(&self) -> bool {
+        match self {
+            Self::Leaf(items) => items.len() < MAX_LEAF / 4,
+            Self::Branch(_, children) => children.len() < MAX_CHILDREN / 4,
+        }
+    }
+
+    // the child holding `index` and the index within it, the end of a child counts as inside
+    // it when `end` is set
+    fn locate(children: &[Arc<Self>], mut index: usize, end: bool) -> (usize, usize) {
+        let last = children.len() - 1;
+        for (i, child) in children.iter().enumerate() {
+            let len = child.len();
+            if index < len || (end && index == len) || i == last {
+                return (i, index);
+            }
+            index -= len;
+        }
+        (last, index)
+    }
+
+    fn get(&self, index: usize) -> &Arc<T> {
+        match self {
+            Self::Leaf(items) => &items[index],
+            Self::Branch(_, children) => {
+                let (i, index) = Self::locate(children, index, false);
+                children[i].get(index)
+            }
+        }
+    }
+
+    fn get_mut(&mut self, index: usize) -> &mut Arc<T> {
+        match self {
+            Self::Leaf(items) => &mut items[index],
+            Self::Branch(_, children) => {
+                let (i, index) = Self::locate(children, index, false);
+                Arc::make_mut(&mut children[i]).get_mut(index)
+            }
+        }
+    }
+
+    // the new right sibling when the node overflows
+    fn insert(&mut self, index: usize, item: Arc<T>) -> Option<Self> {
+        match self {
+            Self::Leaf(items) => {
+                items.insert(index, item);
+                (items.len() > MAX_LEAF).then(|| Self::Leaf(items.split_off(items.len() / 2)))
+            }
+            Self::Branch(len, children) => {
+                *len += 1;
+                let (i, index) = Self::locate(children, index, true);
+                let right = Arc::make_mut(&mut children[i]).insert(index, item)?;
+                children.insert(i + 1, Arc::new(right));
+                Self::split_branch(len, children)
+            }
+        }
+    }
+
+    fn split_branch(len: &mut usize, children: &mut Vec<Arc<Self>>) -> Option<Self> {
+        if children.len() <= MAX_CHILDREN {
+            return None;
+        }
+        let right = children.split_off(children.len() / 2);
+        let right_len = sum(&right);
+        *len -= right_len;
+        Some(Self::Branch(right_len, right))
+    }
+
+    fn remove(&mut self, index: usize) -> Arc<T> {
+        match self {
+            Self::Leaf(items) => items.remove(index),
+            Self::Branch(len, children) => {
+                *len -= 1;
+                let (i, index) = Self::locate(children, index, false);
+                let item = Arc::make_mut(&mut children[i]).remove(index);
+                Self::rebalance(children, i);
+                item
+            }
+        }
+    }
+
+    // a child that got too small is merged with a neighbour, and split again evenly if the two
+    // do not fit in one node
+    fn rebalance(children: &mut Vec<Arc<Self>>, i: usize) {
+        if children.len() < 2 || !children[i].is_small() {
+            return;
+        }
+        let left = if i + 1 < children.len() { i } else { i - 1 };
+        let right = unshare(children.remove(left + 1));
+        if let Some(split) = Arc::make_mut(&mut children[left]).append(right) {
+            children.insert(left + 1, Arc::new(split));
+        }
+    }
+
+    fn append(&mut self, other: Self) -> Option<Self> {
+        match (self, other) {
+            (Self::Leaf(items), Self::Leaf(more)) => {
+                items.extend(more);
+                (items.len() > MAX_LEAF).then(|| Self::Leaf(items.split_off(items.len() / 2)))
+            }
+            (Self::Branch(len, children), Self::Branch(more_len, more)) => {
+                *len += more_len;
+                children.extend(more);
+                Self::split_branch(len, children)
+            }
+            _ => unreachable!("siblings are at the same depth"),
+        }
+    }
+}
+
+/// An indexable sequence with O(log n) edits and O(1) clones.
+pub struct Sequence<T> {
+    root: Arc<Node<T>>,
+}
+
+impl<T> Clone for Sequence<T> {
+    fn clone(&self) -> Self {
+        Self {
+            root: self.root.clone(),
+        }
+    }
+}
+
+impl<T> Default for Sequence<T> {
+    fn default() -> Self {
+        Self {
+            root: Arc::new(Node::Leaf(Vec::new())),
+        }
+    }
+}
+
+impl<T> Sequence<T> {
+    pub fn len(&self) -> usize {
+        self.root.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    pub fn get(&self, index: usize) -> Option<&T> {
+        (index < self.len()).then(|| &**self.root.get(index))
+    }
+
+    pub fn front(&self) -> Option<&T> {
+        self.get(0)
+    }
+
+    pub fn back(&self) -> Option<&T> {
+        self.get(self.len().checked_sub(1)?)
+    }
+
+    /// Insert at `index`, at the end when it is past it.
+    pub fn insert(&mut self, index: usize, item: T) {
+        let index = index.min(self.len());
+        let root = Arc::make_mut(&mut self.root);
+        if let Some(right) = root.insert(index, Arc::new(item)) {
+            let left = std::mem::replace(root, Node::Leaf(Vec::new()));
+            *root = Node::Branch(
+                left.len() + right.len(),
+                vec![Arc::new(left), Arc::new(right)],
+            );
+        }
+    }
+
+    pub fn push_back(&mut self, item: T) {
+        self.insert(self.len(), item);
+    }
+
+    pub fn push_front(&mut self, item: T) {
+        self.insert(0, item);
+    }
+
+    fn remove_shared(&mut self, index: usize) -> Option<Arc<T>> {
+        if index >= self.len() {
+            return None;
+        }
+        let root = Arc::make_mut(&mut self.root);
+        let item = root.remove(index);
+        // the tree loses a level once the root is left with one child
+        if let Node::Branch(_, children) = root {
+            if children.len() == 1 {
+                if let Some(child) = children.pop() {
+                    *root = unshare(child);
+                }
+            }
+        }
+        Some(item)
+    }
+
+    /// Move the item at `from` so that it ends up at `to`, without copying it.
+    pub fn move_item(&mut self, from: usize, to: usize) {
+        if from == to || to >= self.len() {
+            return;
+        }
+        if let Some(item) = self.remove_shared(from) {
+            let root = Arc::make_mut(&mut self.root);
+            if let Some(right) = root.insert(to, item) {
+                let left = std::mem::replace(root, Node::Leaf(Vec::new()));
+                *root = Node::Branch(
+                    left.len() + right.len(),
+                    vec![Arc::new(left), Arc::new(right)],
+                );
+            }
+        }
+    }
+
+    pub fn clear(&mut self) {
+        *self = Self::default();
+    }
+
+    /// Shuffle the order, the items themselves are not copied.
+    pub fn shuffle(&mut self, rng: &mut impl rand::Rng) {
+        let mut items = self.shared();
+        rand::seq::SliceRandom::shuffle(items.as_mut_slice(), rng);
+        *self = Self::from_shared(items.into_iter());
+    }
+
+    /// Put the items in the order given by their current positions, `order` must hold every
+    /// position once. The items themselves are not copied.
+    pub fn permute(&mut self, order: &[usize]) {
+        debug_assert_eq!(order.len(), self.len());
+        let items = self.shared();
+        *self = Self::from_shared(order.iter().filter_map(|&i| items.get(i).cloned()));
+    }
+
+    fn shared(&self) -> Vec<Arc<T>> {
+        let mut items: Vec<Arc<T>> = Vec::with_capacity(self.len());
+        let mut stack = vec![&self.root];
+        while let Some(node) = stack.pop() {
+            match &**node {
+                Node::Leaf(leaf) => items.extend(leaf.iter().cloned()),
+                Node::Branch(_, children) => stack.extend(children.iter().rev()),
+            }
+        }
+        items
+    }
+
+    pub fn iter(&self) -> Iter<'_, T> {
+        Iter {
+            stack: vec![std::slice::from_ref(&self.root).iter()],
+            leaf: [].iter(),
+            remaining: self.len(),
+        }
+    }
+}
+
+impl<T: Clone> Sequence<T> {
+    pub fn remove(&mut self, index: usize) -> Option<T> {
+        self.remove_shared(index)
+            .map(|item| Arc::try_unwrap(item).unwrap_or_else(|item| (*item).clone()))
+    }
+
+    /// Replace the item at `index`, copying only the path down to it.
+    pub fn set(&mut self, index: usize, item: T) {
+        if index < self.len() {
+            *Arc::make_mut(&mut self.root).get_mut(index) = Arc::new(item);
+        }
+    }
+}
+
+impl<T> FromIterator<T> for Sequence<T> {
+    fn from_iter<I: IntoIterator<Item = T>>(iter: I) -> Self {
+        Self::from_shared(iter.into_iter().map(Arc::new))
+    }
+}
+
+impl<T> Sequence<T> {
+    // built bottom up, one level of full nodes at a time
+    fn from_shared(iter: impl Iterator<Item = Arc<T>>) -> Self {
+        let mut level: Vec<Arc<Node<T>>> = Vec::new();
+        let mut leaf = Vec::with_capacity(MAX_LEAF);
+        for item in iter {
+            leaf.push(item);
+            if leaf.len() == MAX_LEAF {
+                level.push(Arc::new(Node::Leaf(std::mem::take(&mut leaf))));
+            }
+        }
+        if !leaf.is_empty() || level.is_empty() {
+            level.push(Arc::new(Node::Leaf(leaf)));
+        }
+        while level.len() > 1 {
+            level = level
+                .chunks(MAX_CHILDREN)
+                .map(|children| Arc::new(Node::Branch(sum(children), children.to_vec())))
+                .collect();
+        }
+        let mut root = match level.pop() {
+            Some(root) => unshare(root),
+            None => Node::Leaf(Vec::new()),
+        };
+        // a short last chunk is merged into its neighbour
+        fix_right_edge(&mut root);
+        if let Node::Branch(_, children) = &mut root {
+            if children.len() == 1 {
+                if let Some(child) = children.pop() {
+                    root = unshare(child);
+                }
+            }
+        }
+        Self {
+            root: Arc::new(root),
+        }
+    }
+}
+
+fn fix_right_edge<T>(node: &mut Node<T>) {
+    if let Node::Branch(_, children) = node {
+        let last = children.len() - 1;
+        fix_right_edge(Arc::make_mut(&mut children[last]));
+        Node::rebalance(children, last);
+    }
+}
+
+pub struct Iter<'a, T> {
+    stack: Vec<std::slice::Iter<'a, Arc<Node<T>>>>,
+    leaf: std::slice::Iter<'a, Arc<T>>,
+    remaining: usize,
+}
+
+impl<'a, T> Iterator for Iter<'a, T> {
+    type Item = &'a T;
+
+    fn next(&mut self) -> Option<&'a T> {
+        loop {
+            if let Some(item) = self.leaf.next() {
+                self.remaining -= 1;
+                return Some(item);
+            }
+            match self.stack.last_mut()?.next() {
+                Some(node) => match &**node {
+                    Node::Leaf(items) => self.leaf = items.iter(),
+                    Node::Branch(_, children) => self.stack.push(children.iter()),
+                },
+                None => {
+                    self.stack.pop();
+                }
+            }
+        }
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        (self.remaining, Some(self.remaining))
+    }
+}
+
+impl<T> ExactSizeIterator for Iter<'_, T> {}
+
+impl<'a, T> IntoIterator for &'a Sequence<T> {
+    type Item = &'a T;
+    type IntoIter = Iter<'a, T>;
+
+    fn into_iter(self) -> Iter<'a, T> {
+        self.iter()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::VecDeque;
+    use std::time::Instant;
+
+    // a small xorshift, the tests must not depend on the seed of rand
+    struct Rng(u64);
+
+    impl Rng {
+        fn below(&mut self, n: usize) -> usize {
+            self.0 ^= self.0 << 13;
+            self.0 ^= self.0 >> 7;
+            self.0 ^= self.0 << 17;
+            (self.0 % n.max(1) as u64) as usize
+        }
+    }
+
+    fn depth<T>(node: &Node<T>) -> usize {
+        match node {
+            Node::Leaf(_) => 1,
+            Node::Branch(len, children) => {
+                assert_eq!(*len, sum(children));
+                let depths: Vec<usize> = children.iter().map(|c| depth(c)).collect();
+                assert!(depths.iter().all(|&d| d == depths[0]));
+                depths[0] + 1
+            }
+        }
+    }
+
+    #[test]
+    fn test_collect_builds_a_balanced_tree() {
+        for n in [0, 1, 64, 65, 1025, 100_000] {
+            let sequence: Sequence<usize> = (0..n).collect();
+            depth(&sequence.root);
+            assert_eq!(sequence.len(), n);
+            assert!(sequence.iter().copied().eq(0..n));
+        }
+    }
+
+    #[test]
+    fn test_matches_a_vecdeque() {
+        let mut rng = Rng(0x9e37_79b9_7f4a_7c15);
+        let mut sequence: Sequence<usize> = (0..500).collect();
+        let mut model: VecDeque<usize> = (0..500).collect();
+        for step in 0..20_000 {
+            let len = model.len();
+            match rng.below(5) {
+                0 | 1 => {
+                    let index = rng.below(len + 1);
+                    sequence.insert(index, step);
+                    model.insert(index, step);
+                }
+                2 => {
+                    let index = rng.below(len);
+                    assert_eq!(sequence.remove(index), model.remove(index));
+                }
+                3 => {
+                    let (from, to) = (rng.below(len), rng.below(len));
+                    sequence.move_item(from, to);
+                    if let Some(item) = model.remove(from) {
+                        model.insert(to.min(model.len()), item);
+                    }
+                }
+                _ => {
+                    let index = rng.below(len);
+                    sequence.set(index, step);
+                    if let Some(item) = model.get_mut(index) {
+                        *item = step;
+                    }
+                }
+            }
+        }
+        depth(&sequence.root);
+        assert_eq!(sequence.len(), model.len());
+        assert!(sequence.iter().eq(model.iter()));
+        assert_eq!(sequence.back(), model.back());
+        while let Some(item) = model.pop_front() {
+            assert_eq!(sequence.remove(0), Some(item));
+        }
+        assert!(sequence.is_empty());
+    }
+
+    #[test]
+    fn test_shuffle_keeps_every_item() {
+        let mut sequence: Sequence<usize> = (0..1000).collect();
+        sequence.shuffle(&mut rand::thread_rng());
+        depth(&sequence.root);
+        let mut seen: Vec<usize> = sequence.iter().copied().collect();
+        seen.sort_unstable();
+        assert!(seen.into_iter().eq(0..1000));
+    }
+
+    #[test]
+    fn test_clones_are_snapshots() {
+        let mut sequence: Sequence<String> = (0..1000).map(|i| i.to_string()).collect();
+        let snapshot = sequence.clone();
+        sequence.move_item(999, 0);
+        sequence.remove(500);
+        sequence.set(1, String::from("changed"));
+        assert_eq!(snapshot.len(), 1000);
+        assert_eq!(snapshot.get(0).map(String::as_str), Some("0"));
+        assert_eq!(snapshot.get(500).map(String::as_str), Some("500"));
+        assert_eq!(sequence.get(0).map(String::as_str), Some("999"));
+        assert_eq!(sequence.get(1).map(String::as_str), Some("changed"));
+        // untouched items are the same allocation in both
+        assert!(std::ptr::eq(
+            snapshot.get(700).unwrap(),
+            sequence.get(700).unwrap()
+        ));
+    }
+
+    #[test]
+    fn test_reordering_a_large_queue_keeps_every_item() {
+        let mut rng = Rng(7);
+        let mut sequence: Sequence<usize> = (0..100_000).collect();
+        for _ in 0..10_000 {
+            let (from, to) = (rng.below(100_000), rng.below(100_000));
+            sequence.move_item(from, to);
+        }
+        let mut seen: Vec<usize> = sequence.iter().copied().collect();
+        seen.sort_unstable();
+        assert!(seen.into_iter().eq(0..100_000));
+    }
+
+    // cargo test --release -- --ignored bench_reordering
+    #[test]
+    #[ignore = "benchmark"]
+    fn bench_reordering_a_large_queue() {
+        let mut rng = Rng(7);
+        let mut sequence: Sequence<usize> = (0..100_000).collect();
+        let start = Instant::now();
+        for _ in 0..100_000 {
+            let (from, to) = (rng.below(100_000), rng.below(100_000));
+            sequence.move_item(from, to);
+        }
+        // a VecDeque needs seconds for this
+        println!("100000 moves in a queue of 100000: {:?}", start.elapsed());
+    }
+}
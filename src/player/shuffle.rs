@@ -0,0 +1,249 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Orders for the shuffle modes other than plain random. Both return the new order as the old
+// positions of the tracks, and both are a sort away from random keys, O(n log n) in all.
+use rand::seq::SliceRandom;
+use rand::Rng;
+use std::collections::HashMap;
+
+// jitter of a slot, as a share of the distance between two tracks of a group
+const JITTER: f64 = 0.1;
+// days after which a track counts as not played at all
+const STALE_DAYS: u64 = 30;
+
+/// How often and when a track was last played, from the library database.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct Plays {
+    pub count: u32,
+    /// seconds since the unix epoch
+    pub last_played: u64,
+}
+
+// Every group is laid out evenly over [0, 1): its k members land on (offset + i) / k, moved a
+// little so groups of one size do not march in step. The offsets of the groups are drawn
+// from separate strata, so no two groups start out on top of each other. Sorting all slots
+// interleaves the groups, each as far from itself as the others allow.
+#[allow(clippy::cast_precision_loss)]
+fn spread(mut groups: Vec<Vec<usize>>, rng: &mut impl Rng) -> Vec<usize> {
+    let mut slots = Vec::with_capacity(groups.iter().map(Vec::len).sum());
+    groups.shuffle(rng);
+    let strata = groups.len() as f64;
+    for (j, group) in groups.into_iter().enumerate() {
+        let k = group.len() as f64;
+        let offset = (j as f64 + rng.gen::<f64>()) / strata / k;
+        for (i, item) in group.into_iter().enumerate() {
+            let jitter = (rng.gen::<f64>() - 0.5) * JITTER / k;
+            slots.push((offset + i as f64 / k + jitter, item));
+        }
+    }
+    slots.sort_by(|a, b| a.0.total_cmp(&b.0));
+    slots.into_iter().map(|(_, item)| item).collect()
+}
+
+/// An order that keeps tracks of one artist apart, and within an artist tracks of one album.
+/// `tracks` holds the artist and album of every track.
+pub fn balanced(tracks: &[(Option<&str>, Option<&str>)], rng: &mut impl Rng) -> Vec<usize> {
+    let mut artists: HashMap<&str, HashMap<&str, Vec<usize>>> = HashMap::new();
+    for (i, (artist, album)) in tracks.iter().enumerate() {
+        artists
+            .entry(artist.unwrap_or_default())
+            .or_default()
+            .entry(album.unwrap_or_default())
+            .or_default()
+            .push(i);
+    }
+    let groups = artists
+        .into_values()
+        .map(|albums| {
+            let albums = albums
+                .into_values()
+                .map(|mut album| {
+                    album.shuffle(rng);
+                    album
+                })
+                .collect();
+            spread(albums, rng)
+        })
+        .collect();
+    spread(groups, rng)
+}
+
+/// A random order in which each track comes early with a chance that grows with its weight,
+/// drawing all of them at once by sorting on -ln(u) / weight (Efraimidis and Spirakis).
+pub fn weighted(weights: &[f64], rng: &mut impl Rng) -> Vec<usize> {
+    let mut keys: Vec<(f64, usize)> = weights
+        .iter()
+        .enumerate()
+        .map(|(i, weight)| {
+            let u: f64 = rng.gen();
+            (-(1.0 - u).ln() / weight.max(f64::MIN_POSITIVE), i)
+        })
+        .collect();
+    keys.sort_by(|a, b| a.0.total_cmp(&b.0));
+    keys.into_iter().map(|(_, i)| i).collect()
+}
+
+/// Weight of a track for the weighted shuffle: tracks played seldom and long ago come first,
+/// one never played weighs 1.
+#[allow(clippy::cast_precision_loss)]
+pub fn weight(plays: Option<&Plays>, now: u64) -> f64 {
+    let plays = match plays {
+        Some(plays) => plays,
+        None => return 1.0,
+    };
+    let idle_days = (now.saturating_sub(plays.last_played) / 86400).min(STALE_DAYS);
+    (1 + idle_days) as f64 / (1 + STALE_DAYS) as f64 / f64::from(1 + plays.count)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use rand::rngs::StdRng;
+    use rand::SeedableRng;
+    use std::time::Instant;
+
+    fn is_permutation(order: &[usize], len: usize) -> bool {
+        let mut seen = order.to_vec();
+        seen.sort_unstable();
+        seen.into_iter().eq(0..len)
+    }
+
+    fn runs(order: &[usize], same: impl Fn(usize, usize) -> bool) -> usize {
+        order.windows(2).filter(|w| same(w[0], w[1])).count()
+    }
+
+    #[test]
+    fn test_balanced_keeps_artists_apart() {
+        let names: Vec<String> = (0..10).map(|i| format!("artist {}", i)).collect();
+        // ten artists with ten tracks each, then two big ones and eight small ones
+        let even: Vec<(Option<&str>, Option<&str>)> = (0..100)
+            .map(|i| (Some(names[i % 10].as_str()), Some("album")))
+            .collect();
+        let skewed: Vec<(Option<&str>, Option<&str>)> = (0..100)
+            .map(|i| {
+                let artist = match i {
+                    0..=29 => 0,
+                    30..=49 => 1,
+                    _ => 2 + i % 8,
+                };
+                (Some(names[artist].as_str()), Some("album"))
+            })
+            .collect();
+        let mut rng = StdRng::seed_from_u64(7);
+        for _ in 0..50 {
+            let order = balanced(&even, &mut rng);
+            assert!(is_permutation(&order, even.len()));
+            // a plain shuffle puts an artist next to itself about 9 times
+            assert!(runs(&order, |a, b| even[a].0 == even[b].0) <= 1);
+            // and about 13 times here
+            let order = balanced(&skewed, &mut rng);
+            assert!(runs(&order, |a, b| skewed[a].0 == skewed[b].0) <= 6);
+        }
+    }
+
+    #[test]
+    fn test_balanced_spreads_albums_of_an_artist() {
+        let tracks: Vec<(Option<&str>, Option<&str>)> = (0..40)
+            .map(|i| {
+                (
+                    Some("artist"),
+                    Some(if i < 20 { "first" } else { "second" }),
+                )
+            })
+            .collect();
+        let mut rng = StdRng::seed_from_u64(3);
+        // a plain shuffle averages about 19 here
+        let total: usize = (0..50)
+            .map(|_| {
+                runs(&balanced(&tracks, &mut rng), |a, b| {
+                    tracks[a].1 == tracks[b].1
+                })
+            })
+            .sum();
+        assert!(
+            total < 100,
+            "{} tracks followed one of the same album",
+            total
+        );
+    }
+
+    #[test]
+    fn test_weighted_prefers_heavy_tracks() {
+        let weights: Vec<f64> = (0..1000)
+            .map(|i| if i < 500 { 1.0 } else { 0.01 })
+            .collect();
+        let order = weighted(&weights, &mut StdRng::seed_from_u64(11));
+        assert!(is_permutation(&order, weights.len()));
+        let heavy = order[..100].iter().filter(|&&i| i < 500).count();
+        assert!(heavy > 90, "only {} of the first 100 are heavy", heavy);
+    }
+
+    #[test]
+    fn test_weight_follows_history() {
+        let now = 100 * 86400;
+        let fresh = weight(None, now);
+        let old = weight(
+            Some(&Plays {
+                count: 1,
+                last_played: 0,
+            }),
+            now,
+        );
+        let recent = weight(
+            Some(&Plays {
+                count: 1,
+                last_played: now - 60,
+            }),
+            now,
+        );
+        let often = weight(
+            Some(&Plays {
+                count: 20,
+                last_played: 0,
+            }),
+            now,
+        );
+        assert!(fresh > old && old > recent && old > often);
+    }
+
+    // cargo test --release -- --ignored bench_shuffle
+    #[test]
+    #[ignore = "benchmark"]
+    fn bench_shuffle_large_queues() {
+        let names: Vec<String> = (0..5000).map(|i| format!("{}", i)).collect();
+        let tracks: Vec<(Option<&str>, Option<&str>)> = (0..200_000)
+            .map(|i| (Some(names[i % 5000].as_str()), Some(names[i % 7].as_str())))
+            .collect();
+        let mut rng = StdRng::seed_from_u64(1);
+        let start = Instant::now();
+        assert_eq!(balanced(&tracks, &mut rng).len(), tracks.len());
+        assert_eq!(weighted(&vec![0.5; 200_000], &mut rng).len(), tracks.len());
+        let elapsed = start.elapsed();
+        println!(
+            "balanced and weighted shuffle of 200000 tracks: {:?}",
+            elapsed
+        );
+        assert!(elapsed.as_secs() < 5);
+    }
+}
@@ -0,0 +1,138 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use std::sync::atomic::{AtomicBool, AtomicU32, AtomicUsize, Ordering};
+
+// samples kept for readers, a second of 96 kHz stereo is far more than a frame ever needs
+const TAP_CAPACITY: usize = 1 << 18;
+
+/// A single producer ring of the samples sent to the device. The audio thread writes without
+/// ever waiting, readers copy the most recent samples and notice when they were overwritten
+/// while copying.
+pub struct AudioTap {
+    slots: Box<[AtomicU32]>,
+    // samples published so far, the slot of sample n is n % capacity
+    written: AtomicUsize,
+    channels: AtomicUsize,
+    sample_rate: AtomicU32,
+    enabled: AtomicBool,
+}
+
+impl Default for AudioTap {
+    fn default() -> Self {
+        Self::new(TAP_CAPACITY)
+    }
+}
+
+impl AudioTap {
+    /// `capacity` is rounded up to a power of two.
+    pub fn new(capacity: usize) -> Self {
+        let capacity = capacity.next_power_of_two();
+        Self {
+            slots: (0..capacity).map(|_| AtomicU32::new(0)).collect(),
+            written: AtomicUsize::new(0),
+            channels: AtomicUsize::new(2),
+            sample_rate: AtomicU32::new(44_100),
+            enabled: AtomicBool::new(false),
+        }
+    }
+
+    /// Nobody is looking, the writer skips the copy.
+    pub fn is_enabled(&self) -> bool {
+        self.enabled.load(Ordering::Relaxed)
+    }
+
+    pub fn set_enabled(&self, enabled: bool) {
+        self.enabled.store(enabled, Ordering::Relaxed);
+    }
+
+    /// Append interleaved samples. Only one thread may write.
+    #[cfg(any(test, not(any(feature = "mpv", feature = "gst"))))]
+    pub fn write(&self, samples: &[f32], channels: u16, sample_rate: u32) {
+        let mask = self.slots.len() - 1;
+        let start = self.written.load(Ordering::Relaxed);
+        for (i, sample) in samples.iter().enumerate() {
+            self.slots[(start + i) & mask].store(sample.to_bits(), Ordering::Relaxed);
+        }
+        self.channels
+            .store(usize::from(channels.max(1)), Ordering::Relaxed);
+        self.sample_rate.store(sample_rate, Ordering::Relaxed);
+        self.written.store(start + samples.len(), Ordering::Release);
+    }
+
+    /// Number of samples written so far, tells readers whether anything new arrived.
+    pub fn written(&self) -> usize {
+        self.written.load(Ordering::Acquire)
+    }
+
+    /// Copy the last `frames` frames into `out`, returns channels and sample rate. `None` if
+    /// not enough was written yet or the writer lapped the copy.
+    pub fn read_latest(&self, frames: usize, out: &mut Vec<f32>) -> Option<(usize, u32)> {
+        let mask = self.slots.len() - 1;
+        let end = self.written.load(Ordering::Acquire);
+        let channels = self.channels.load(Ordering::Relaxed);
+        let sample_rate = self.sample_rate.load(Ordering::Relaxed);
+        let len = (frames * channels).min(self.slots.len() / 2);
+        // stay on a frame boundary
+        let end = end - end % channels;
+        let start = end.checked_sub(len)?;
+
+        out.clear();
+        out.extend(
+            (start..end).map(|n| f32::from_bits(self.slots[n & mask].load(Ordering::Relaxed))),
+        );
+        if self.written.load(Ordering::Acquire) - start > self.slots.len() {
+            return None;
+        }
+        Some((channels, sample_rate))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_reader_gets_the_latest_frames() {
+        let tap = AudioTap::new(64);
+        let mut out = Vec::new();
+        assert!(tap.read_latest(4, &mut out).is_none());
+
+        let samples: Vec<f32> = (0..100).map(|n| n as f32).collect();
+        for chunk in samples.chunks(10) {
+            tap.write(chunk, 2, 48_000);
+        }
+        assert_eq!(tap.read_latest(4, &mut out), Some((2, 48_000)));
+        assert_eq!(out, vec![92.0, 93.0, 94.0, 95.0, 96.0, 97.0, 98.0, 99.0]);
+        assert_eq!(tap.written(), 100);
+    }
+
+    #[test]
+    fn test_reads_are_capped_to_what_cannot_be_overwritten() {
+        let tap = AudioTap::new(16);
+        tap.write(&[0.5; 40], 1, 8_000);
+        let mut out = Vec::new();
+        assert!(tap.read_latest(100, &mut out).is_some());
+        assert_eq!(out.len(), 8);
+    }
+}
@@ -1,8 +1,9 @@
-use quick_xml::events::Event;
+use super::XmlPath;
+use quick_xml::events::{BytesStart, Event};
 use quick_xml::Reader;
 use std::error::Error;
 
-#[derive(Clone)]
+#[derive(Clone, Default)]
 pub struct PlaylistItem {
     pub title: String,
     pub url: String,
@@ -10,61 +11,36 @@ pub struct PlaylistItem {
 
 pub fn decode(content: &str) -> Result<Vec<PlaylistItem>, Box<dyn Error>> {
     let mut list = vec![];
-    let mut item = PlaylistItem {
-        title: String::from(""),
-        url: String::from(""),
-    };
+    let mut item = PlaylistItem::default();
+    let mut in_title = false;
 
     let mut reader = Reader::from_str(content);
     reader.trim_text(true);
-    let mut xml_stack = vec![];
+    let mut entry = XmlPath::new(&[b"asx", b"entry"]);
     let mut buf = Vec::new();
     loop {
         match reader.read_event(&mut buf) {
             Ok(Event::Empty(ref e)) => {
-                xml_stack.push(reader.decode(e.name())?.to_lowercase());
-
-                let path = xml_stack.join("/");
-                for a in e.attributes() {
-                    let a = a?;
-                    let key = reader.decode(a.key)?.to_lowercase();
-                    let value = reader.decode(&a.value)?;
-                    if path == "asx/entry/ref" && key == "href" {
-                        item.url = value.to_string();
-                    }
+                if entry.at_children() {
+                    read_ref(e, &reader, &mut item)?;
                 }
-
-                xml_stack.pop();
             }
             Ok(Event::Start(ref e)) => {
-                xml_stack.push(reader.decode(e.name())?.to_lowercase());
-
-                let path = xml_stack.join("/");
-                for a in e.attributes() {
-                    let a = a?;
-                    let key = reader.decode(a.key)?.to_lowercase();
-                    let value = reader.decode(&a.value)?;
-                    if path == "asx/entry/ref" && key == "href" {
-                        item.url = value.to_string();
-                    }
+                if entry.at_children() {
+                    read_ref(e, &reader, &mut item)?;
+                    in_title = e.name().eq_ignore_ascii_case(b"title");
                 }
+                entry.open(e.name());
             }
             Ok(Event::End(_)) => {
-                let path = xml_stack.join("/");
-                if path == "asx/entry" {
-                    list.push(item.clone());
-                    item.title = String::from("");
-                    item.url = String::from("");
+                in_title = false;
+                if entry.close() {
+                    list.push(std::mem::take(&mut item));
                 }
-                xml_stack.pop();
             }
             Ok(Event::Text(e)) => {
-                let path = xml_stack.join("/");
-                if path == "asx/entry/title" {
-                    item.title = e
-                        .unescape_and_decode(&reader)
-                        .unwrap_or_else(|_| String::from(""))
-                        .clone();
+                if in_title {
+                    item.title = e.unescape_and_decode(&reader).unwrap_or_default();
                 }
             }
             Ok(Event::Eof) => break,
@@ -79,3 +55,21 @@ pub fn decode(content: &str) -> Result<Vec<PlaylistItem>, Box<dyn Error>> {
 
     Ok(list)
 }
+
+// the url of an entry is the href of its ref element
+fn read_ref(
+    e: &BytesStart<'_>,
+    reader: &Reader<&[u8]>,
+    item: &mut PlaylistItem,
+) -> Result<(), Box<dyn Error>> {
+    if !e.name().eq_ignore_ascii_case(b"ref") {
+        return Ok(());
+    }
+    for a in e.attributes() {
+        let a = a?;
+        if a.key.eq_ignore_ascii_case(b"href") {
+            item.url = a.unescape_and_decode_value(reader)?;
+        }
+    }
+    Ok(())
+}
@@ -1,20 +1,63 @@
-//! Extract urls from M3U playlist files
+//! Extract urls from M3U and M3U8 playlist files, with the duration and title of `#EXTINF`,
+//! and write extended M3U8 files
 
-pub struct PlaylistItem {
-    pub url: String,
+use super::ExportItem;
+
+pub struct PlaylistItem<'a> {
+    pub url: &'a str,
+    pub title: Option<&'a str>,
+    /// seconds, none when the list does not know
+    pub duration: Option<u64>,
 }
 
-pub fn decode(content: &str) -> Vec<PlaylistItem> {
-    let lines = content.lines();
-    let mut list = vec![];
-    for line in lines {
-        if line.starts_with('#') {
-            continue;
+/// The entries of `content` one by one, borrowed from it.
+pub fn decode(content: &str) -> impl Iterator<Item = PlaylistItem<'_>> {
+    let mut info = None;
+    content.lines().filter_map(move |line| {
+        let line = line.trim_start_matches('\u{feff}').trim();
+        if let Some(extinf) = line.strip_prefix("#EXTINF:") {
+            info = Some(extinf);
+            return None;
+        }
+        if line.is_empty() || line.starts_with('#') {
+            return None;
         }
+        let (duration, title) = info.take().map_or((None, None), extinf);
+        Some(PlaylistItem {
+            url: line,
+            title,
+            duration,
+        })
+    })
+}
 
-        list.push(PlaylistItem {
-            url: String::from(line),
-        });
+// `#EXTINF:<seconds> [attributes],<title>`, -1 seconds stands for unknown
+fn extinf(info: &str) -> (Option<u64>, Option<&str>) {
+    let (head, title) = info.split_once(',').unwrap_or((info, ""));
+    let duration = head.split_whitespace().next().and_then(|s| s.parse().ok());
+    let title = Some(title.trim()).filter(|t| !t.is_empty());
+    (duration, title)
+}
+
+/// Extended M3U in UTF-8, one `#EXTINF` line ahead of every location.
+pub fn encode(items: &[ExportItem<'_>]) -> String {
+    let mut out = String::from("#EXTM3U\n");
+    for item in items {
+        let label = match (item.artist, item.title) {
+            (Some(artist), Some(title)) => format!("{} - {}", artist, title),
+            (None, Some(title)) => title.to_string(),
+            _ => String::new(),
+        };
+        out.push_str(&format!(
+            "#EXTINF:{},{}\n{}\n",
+            item.duration.as_secs(),
+            one_line(&label),
+            one_line(item.location)
+        ));
     }
-    list
+    out
+}
+
+fn one_line(s: &str) -> String {
+    s.replace(&['\r', '\n'][..], " ")
 }
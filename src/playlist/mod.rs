@@ -1,13 +1,40 @@
 //! This is a very simple url extractor for different kinds of playlist formats: M3U, PLS, ASX, XSPF
 //!
-//! It is not optimized yet and does create a lot of strings on the way.
+//! M3U and PLS entries are borrowed from the content, the xml formats only copy the values
+//! they keep. M3U8 and XSPF can be written as well.
 
 mod asx;
 mod m3u;
 mod pls;
 mod xspf;
 
+use std::borrow::Cow;
 use std::error::Error;
+use std::path::Path;
+use std::time::Duration;
+
+/// A track as written into an exported playlist.
+pub struct ExportItem<'a> {
+    /// a path or an url
+    pub location: &'a str,
+    pub artist: Option<&'a str>,
+    pub album: Option<&'a str>,
+    pub title: Option<&'a str>,
+    pub duration: Duration,
+}
+
+/// Write `items` in the format the extension of `path` names, none for one that cannot be
+/// written: m3u, m3u8 or xspf.
+pub fn encode(path: &Path, items: &[ExportItem<'_>]) -> Option<String> {
+    let ext = path.extension()?.to_str()?;
+    if ext.eq_ignore_ascii_case("m3u") || ext.eq_ignore_ascii_case("m3u8") {
+        Some(m3u::encode(items))
+    } else if ext.eq_ignore_ascii_case("xspf") {
+        Some(xspf::encode(items))
+    } else {
+        None
+    }
+}
 
 /// Decode playlist content string. It checks for M3U, PLS, XSPF and ASX content in the string.
 /// # Example
@@ -34,47 +61,92 @@ use std::error::Error;
 /// ```
 /// # Arguments
 /// * `content` - A string slice containing a playlist
-pub fn decode(content: &str) -> Result<Vec<String>, Box<dyn Error>> {
-    let mut set = vec![];
-    let content_small = content.to_lowercase();
-    match content_small.find("<playlist") {
-        Some(_) => {
-            let xspf_items = xspf::decode(content)?;
-            for item in xspf_items {
-                if !item.url.is_empty() {
-                    set.push(item.url);
-                }
-                if !item.identifier.is_empty() {
-                    set.push(item.identifier);
-                }
+pub fn decode(content: &str) -> Result<Vec<Cow<'_, str>>, Box<dyn Error>> {
+    let set = if contains_ignore_case(content, "<playlist") {
+        let mut set = vec![];
+        for item in xspf::decode(content)? {
+            if !item.url.is_empty() {
+                set.push(Cow::Owned(item.url));
             }
-        }
-        None => match content_small.find("<asx") {
-            Some(_) => {
-                let pls_items = asx::decode(content)?;
-                for item in pls_items {
-                    set.push(item.url);
-                }
+            if !item.identifier.is_empty() {
+                set.push(Cow::Owned(item.identifier));
             }
-            None => match content_small.find("[playlist]") {
-                Some(_) => {
-                    let pls_items = pls::decode(content);
-                    for item in pls_items {
-                        set.push(item.url);
-                    }
-                }
-                None => {
-                    let m3u_items = m3u::decode(content);
-                    for item in m3u_items {
-                        set.push(item.url);
-                    }
-                }
-            },
-        },
+        }
+        set
+    } else if contains_ignore_case(content, "<asx") {
+        asx::decode(content)?
+            .into_iter()
+            .map(|item| Cow::Owned(item.url))
+            .collect()
+    } else if contains_ignore_case(content, "[playlist]") {
+        pls::decode(content)
+            .into_iter()
+            .map(|item| Cow::Borrowed(item.url))
+            .collect()
+    } else {
+        m3u::decode(content)
+            .map(|item| Cow::Borrowed(item.url))
+            .collect()
+    };
+    Ok(set)
+}
+
+// `contains` ignoring ascii case, without lowering a copy of the content. Only the places of
+// the first byte of `needle` are compared, which is never a letter here.
+fn contains_ignore_case(content: &str, needle: &str) -> bool {
+    let (content, needle) = (content.as_bytes(), needle.as_bytes());
+    content.iter().enumerate().any(|(i, &b)| {
+        b == needle[0]
+            && content
+                .get(i..i + needle.len())
+                .map_or(false, |w| w.eq_ignore_ascii_case(needle))
+    })
+}
+
+// How deep the open xml elements follow `path`, the tag names are compared in place.
+struct XmlPath {
+    path: &'static [&'static [u8]],
+    depth: usize,
+    matched: usize,
+}
+
+impl XmlPath {
+    const fn new(path: &'static [&'static [u8]]) -> Self {
+        Self {
+            path,
+            depth: 0,
+            matched: 0,
+        }
+    }
+
+    fn open(&mut self, name: &[u8]) {
+        if self.matched == self.depth
+            && self
+                .path
+                .get(self.depth)
+                .map_or(false, |p| p.eq_ignore_ascii_case(name))
+        {
+            self.matched += 1;
+        }
+        self.depth += 1;
+    }
+
+    // true when the element closed is the end of `path`
+    fn close(&mut self) -> bool {
+        let whole = self.matched == self.path.len() && self.depth == self.path.len();
+        if self.matched == self.depth {
+            self.matched = self.matched.saturating_sub(1);
+        }
+        self.depth = self.depth.saturating_sub(1);
+        whole
+    }
+
+    // an element opened now is a direct child of the end of `path`
+    fn at_children(&self) -> bool {
+        self.matched == self.path.len() && self.depth == self.path.len()
     }
-    let v: Vec<String> = set.into_iter().collect();
-    Ok(v)
 }
+
 #[allow(unused)]
 pub fn is_content_hls(content: &str) -> bool {
     if content.contains("EXT-X-STREAM-INF") {
@@ -142,7 +214,7 @@ mod tests {
 
     #[test]
     fn m3u() {
-        let items = crate::playlist::m3u::decode("http://this.is.an.example");
+        let items: Vec<_> = crate::playlist::m3u::decode("http://this.is.an.example").collect();
         assert!(items.len() == 1);
         assert!(items[0].url == "http://this.is.an.example");
     }
@@ -173,6 +245,112 @@ Title=mytitle
         assert!(items[0].title == "mytitle");
     }
 
+    #[test]
+    fn m3u_extinf() {
+        let items: Vec<_> = crate::playlist::m3u::decode(
+            "\u{feff}#EXTM3U\r\n#EXTINF:123 tvg-id=\"x\",Artist - Title\r\n../a b.mp3\r\n\r\n#EXTINF:-1,\nhttp://radio\n",
+        )
+        .collect();
+        assert!(items.len() == 2);
+        assert!(items[0].url == "../a b.mp3");
+        assert!(items[0].duration == Some(123));
+        assert!(items[0].title == Some("Artist - Title"));
+        assert!(items[1].url == "http://radio");
+        assert!(items[1].duration.is_none() && items[1].title.is_none());
+    }
+
+    #[test]
+    fn pls_keeps_order() {
+        let items = crate::playlist::pls::decode(
+            "[playlist]
+File2=second
+Title1=one
+File1=first
+File10=tenth
+NumberOfEntries=3
+",
+        );
+        let urls: Vec<&str> = items.iter().map(|i| i.url).collect();
+        assert!(urls == ["first", "second", "tenth"]);
+        assert!(items[0].title == "one");
+    }
+
+    #[test]
+    fn sniff_ignores_case_and_borrows() {
+        let content = "[PlayList]\nFile1=/music/a.flac\n";
+        let items = crate::playlist::decode(content).unwrap();
+        assert!(items.len() == 1);
+        assert!(matches!(
+            items[0],
+            std::borrow::Cow::Borrowed("/music/a.flac")
+        ));
+        let items = crate::playlist::decode(
+            "<ASX version=\"3.0\"><Entry><Ref HREF=\"x.mp3\"/></Entry></ASX>",
+        )
+        .unwrap();
+        assert!(items == ["x.mp3"]);
+    }
+
+    // cargo test --release -- --ignored bench_m3u
+    #[test]
+    #[ignore = "benchmark"]
+    fn bench_m3u_large_list() {
+        let content: String = (0..20_000)
+            .map(|i| format!("#EXTINF:{},Artist {} - Title\n/music/{}.mp3\n", i, i, i))
+            .collect();
+        let start = std::time::Instant::now();
+        assert!(crate::playlist::decode(&content).unwrap().len() == 20_000);
+        let elapsed = start.elapsed();
+        println!("m3u with 20000 entries: {:?}", elapsed);
+        assert!(elapsed.as_millis() < 500);
+    }
+
+    fn exported() -> Vec<crate::playlist::ExportItem<'static>> {
+        vec![
+            crate::playlist::ExportItem {
+                location: "/music/Rock & Roll/01 <intro>.flac",
+                artist: Some("AC/DC"),
+                album: Some("It's \"live\""),
+                title: Some("Intro\nPart 1"),
+                duration: std::time::Duration::from_millis(61_500),
+            },
+            crate::playlist::ExportItem {
+                location: "http://radio.example/stream",
+                artist: None,
+                album: None,
+                title: None,
+                duration: std::time::Duration::from_secs(0),
+            },
+        ]
+    }
+
+    #[test]
+    fn m3u8_export_reads_back() {
+        let path = std::path::Path::new("list.M3U8");
+        let content = crate::playlist::encode(path, &exported()).unwrap();
+        assert!(content.starts_with("#EXTM3U\n#EXTINF:61,AC/DC - Intro Part 1\n"));
+        let items: Vec<_> = crate::playlist::m3u::decode(&content).collect();
+        assert!(items.len() == 2);
+        assert!(items[0].url == "/music/Rock & Roll/01 <intro>.flac");
+        assert!(items[0].duration == Some(61));
+        assert!(items[1].url == "http://radio.example/stream");
+        assert!(crate::playlist::encode(std::path::Path::new("list.pls"), &exported()).is_none());
+    }
+
+    #[test]
+    fn xspf_export_reads_back() {
+        let content = crate::playlist::encode(std::path::Path::new("a.xspf"), &exported()).unwrap();
+        let items = crate::playlist::xspf::decode(&content).unwrap();
+        assert!(items.len() == 2);
+        assert!(items[0].url == "file:///music/Rock%20%26%20Roll/01%20%3Cintro%3E.flac");
+        assert!(
+            urlencoding::decode(&items[0].url).unwrap()
+                == "file:///music/Rock & Roll/01 <intro>.flac"
+        );
+        assert!(items[0].title == "Intro\nPart 1");
+        assert!(items[1].url == "http://radio.example/stream");
+    }
+
     #[test]
     fn pls3() {
         let items = crate::playlist::pls::decode(
@@ -1,59 +1,53 @@
 //! Decode File and Title parts from simple playlist PLS files
 
-use std::collections::HashMap;
-
-pub struct PlaylistItem {
-    pub title: String,
-    pub url: String,
+pub struct PlaylistItem<'a> {
+    pub title: &'a str,
+    pub url: &'a str,
 }
 
-pub fn decode(content: &str) -> Vec<PlaylistItem> {
-    let lines = content.lines();
-    let mut list = vec![];
+/// The entries of `content` in the order of their numbers, borrowed from it.
+pub fn decode(content: &str) -> Vec<PlaylistItem<'_>> {
     let mut found_pls = false;
-    let mut map_urls = HashMap::new();
-    let mut map_title = HashMap::new();
+    let mut files = vec![];
+    let mut titles = vec![];
     let mut default_title = "";
-    for line in lines {
+    for line in content.lines() {
+        let line = line.trim();
         if line.starts_with('#') {
             continue;
         }
-        if line.trim().to_lowercase() == "[playlist]" {
+        if line.eq_ignore_ascii_case("[playlist]") {
             found_pls = true;
-        } else if found_pls {
-            if line.starts_with("File") {
-                let idend = line.find('=');
-                if let Some(idend) = idend {
-                    let (key, value) = line.split_at(idend);
-                    let id: Result<u32, _> = key[4..idend].parse();
-                    if let Ok(id) = id {
-                        let (_, url) = value.split_at(1);
-                        map_urls.insert(id, url);
-                    }
-                }
-            } else if line.starts_with("Title") {
-                let idend = line.find('=');
-                if let Some(idend) = idend {
-                    let (key, value) = line.split_at(idend);
-                    let id: Result<u32, _> = key[5..idend].parse();
-                    let (_, title) = value.split_at(1);
-                    if let Ok(id) = id {
-                        map_title.insert(id, title);
-                    } else {
-                        default_title = title;
-                    }
-                }
+            continue;
+        }
+        if !found_pls {
+            continue;
+        }
+        let (key, value) = match line.split_once('=') {
+            Some(pair) => pair,
+            None => continue,
+        };
+        if let Some(id) = key.strip_prefix("File") {
+            if let Ok(id) = id.parse::<u32>() {
+                files.push((id, value));
+            }
+        } else if let Some(id) = key.strip_prefix("Title") {
+            match id.parse::<u32>() {
+                Ok(id) => titles.push((id, value)),
+                Err(_) => default_title = value,
             }
         }
     }
 
-    for (key, value) in map_urls {
-        let title = map_title.get(&key).unwrap_or(&default_title);
-        list.push(PlaylistItem {
-            title: String::from(*title),
-            url: String::from(value),
-        });
-    }
-
-    list
+    files.sort_by_key(|(id, _)| *id);
+    titles.sort_by_key(|(id, _)| *id);
+    files
+        .into_iter()
+        .map(|(id, url)| PlaylistItem {
+            title: titles
+                .binary_search_by_key(&id, |(id, _)| *id)
+                .map_or(default_title, |i| titles[i].1),
+            url,
+        })
+        .collect()
 }
@@ -1,76 +1,60 @@
+use super::{ExportItem, XmlPath};
 use quick_xml::events::Event;
 use quick_xml::Reader;
 use std::error::Error;
 
-#[derive(Clone)]
+#[derive(Clone, Default)]
 pub struct PlaylistItem {
     pub title: String,
     pub url: String,
     pub identifier: String,
 }
 
+enum Field {
+    Title,
+    Location,
+    Identifier,
+}
+
 pub fn decode(content: &str) -> Result<Vec<PlaylistItem>, Box<dyn Error>> {
     let mut list = vec![];
-    let mut item = PlaylistItem {
-        title: String::from(""),
-        url: String::from(""),
-        identifier: String::from(""),
-    };
+    let mut item = PlaylistItem::default();
+    let mut field = None;
 
     let mut reader = Reader::from_str(content);
     reader.trim_text(true);
-    let mut xml_stack = vec![];
+    let mut track = XmlPath::new(&[b"playlist", b"tracklist", b"track"]);
     let mut buf = Vec::new();
     loop {
         match reader.read_event(&mut buf) {
-            Ok(Event::Empty(ref e)) => {
-                xml_stack.push(reader.decode(e.name())?.to_lowercase());
-
-                let path = xml_stack.join("/");
-                for a in e.attributes() {
-                    let a = a?;
-                    let key = reader.decode(a.key)?.to_lowercase();
-                    let value = reader.decode(&a.value)?;
-                    if path == "asx/entry/ref" && key == "href" {
-                        item.url = value.to_string();
-                    }
-                }
-
-                xml_stack.pop();
-            }
             Ok(Event::Start(ref e)) => {
-                xml_stack.push(reader.decode(e.name())?.to_lowercase());
-
-                let path = xml_stack.join("/");
-                for a in e.attributes() {
-                    let a = a?;
-                    let key = reader.decode(a.key)?.to_lowercase();
-                    let value = reader.decode(&a.value)?;
-                    if path == "asx/entry/ref" && key == "href" {
-                        item.url = value.to_string();
-                    }
+                if track.at_children() {
+                    let name = e.name();
+                    field = if name.eq_ignore_ascii_case(b"title") {
+                        Some(Field::Title)
+                    } else if name.eq_ignore_ascii_case(b"location") {
+                        Some(Field::Location)
+                    } else if name.eq_ignore_ascii_case(b"identifier") {
+                        Some(Field::Identifier)
+                    } else {
+                        None
+                    };
                 }
+                track.open(e.name());
             }
             Ok(Event::End(_)) => {
-                let path = xml_stack.join("/");
-                if path == "playlist/tracklist/track" {
-                    list.push(item.clone());
-                    item.title = String::from("");
-                    item.url = String::from("");
-                    item.identifier = String::from("");
+                field = None;
+                if track.close() {
+                    list.push(std::mem::take(&mut item));
                 }
-                xml_stack.pop();
             }
             Ok(Event::Text(e)) => {
-                let path = xml_stack.join("/");
-                if path == "playlist/tracklist/track/title" {
-                    item.title = e.unescape_and_decode(&reader)?.clone();
-                }
-                if path == "playlist/tracklist/track/location" {
-                    item.url = e.unescape_and_decode(&reader)?.clone();
-                }
-                if path == "playlist/tracklist/track/identifier" {
-                    item.identifier = e.unescape_and_decode(&reader)?.clone();
+                // only the values kept are unescaped into strings
+                match field {
+                    Some(Field::Title) => item.title = e.unescape_and_decode(&reader)?,
+                    Some(Field::Location) => item.url = e.unescape_and_decode(&reader)?,
+                    Some(Field::Identifier) => item.identifier = e.unescape_and_decode(&reader)?,
+                    None => {}
                 }
             }
             Ok(Event::Eof) => break,
@@ -85,3 +69,54 @@ pub fn decode(content: &str) -> Result<Vec<PlaylistItem>, Box<dyn Error>> {
 
     Ok(list)
 }
+
+/// An XSPF document, files are written as percent encoded `file://` locations.
+pub fn encode(items: &[ExportItem<'_>]) -> String {
+    let mut out = String::from(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n  <trackList>\n",
+    );
+    for item in items {
+        out.push_str("    <track>\n");
+        push_element(&mut out, "location", &location(item.location));
+        for (tag, value) in [
+            ("creator", item.artist),
+            ("album", item.album),
+            ("title", item.title),
+        ] {
+            if let Some(value) = value {
+                push_element(&mut out, tag, value);
+            }
+        }
+        push_element(&mut out, "duration", &item.duration.as_millis().to_string());
+        out.push_str("    </track>\n");
+    }
+    out.push_str("  </trackList>\n</playlist>\n");
+    out
+}
+
+fn push_element(out: &mut String, tag: &str, value: &str) {
+    out.push_str(&format!("      <{}>{}</{}>\n", tag, escape(value), tag));
+}
+
+fn location(file: &str) -> String {
+    if file.contains("://") {
+        return file.to_string();
+    }
+    let path: Vec<_> = file.split('/').map(urlencoding::encode).collect();
+    format!("file://{}", path.join("/"))
+}
+
+fn escape(value: &str) -> String {
+    let mut out = String::with_capacity(value.len());
+    for c in value.chars() {
+        match c {
+            '&' => out.push_str("&amp;"),
+            '<' => out.push_str("&lt;"),
+            '>' => out.push_str("&gt;"),
+            '"' => out.push_str("&quot;"),
+            '\'' => out.push_str("&apos;"),
+            c => out.push(c),
+        }
+    }
+    out
+}
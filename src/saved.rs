@@ -0,0 +1,240 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Named playlists kept in the library database. A playlist is its track ids in order, packed
+// into one blob, so loading or comparing one is a single read. The ids point into saved_track,
+// which caches what the playlist shows of every track. It is kept apart from the track table,
+// which is rebuilt on every schema change and does not know files outside the music folder.
+use crate::player::Cached;
+use rusqlite::{params, Connection, OptionalExtension};
+use std::collections::HashSet;
+use std::time::Duration;
+
+pub fn create_table(conn: &Connection) -> rusqlite::Result<()> {
+    conn.execute(
+        "create table if not exists saved_track(
+         id INTEGER PRIMARY KEY,
+         file TEXT UNIQUE NOT NULL,
+         duration INTEGER NOT NULL,
+         artist TEXT,
+         album TEXT,
+         title TEXT
+        )",
+        [],
+    )?;
+    conn.execute(
+        "create table if not exists saved_playlist(
+         name TEXT PRIMARY KEY,
+         tracks BLOB NOT NULL
+        )",
+        [],
+    )?;
+    Ok(())
+}
+
+fn to_blob(ids: &[i64]) -> Vec<u8> {
+    ids.iter().flat_map(|id| id.to_le_bytes()).collect()
+}
+
+fn from_blob(blob: &[u8]) -> Vec<i64> {
+    blob.chunks_exact(8)
+        .map(|b| i64::from_le_bytes([b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7]]))
+        .collect()
+}
+
+/// The names of the saved playlists with the number of their tracks, by name.
+pub fn list(conn: &Connection) -> rusqlite::Result<Vec<(String, usize)>> {
+    let mut stmt = conn.prepare("SELECT name, length(tracks) FROM saved_playlist ORDER BY name")?;
+    let rows = stmt.query_map([], |row| {
+        Ok((
+            row.get::<_, String>(0)?,
+            usize::try_from(row.get::<_, i64>(1)?).unwrap_or(0) / 8,
+        ))
+    })?;
+    rows.collect()
+}
+
+/// Save `tracks` as `name`, replacing a playlist of that name.
+pub fn save(
+    conn: &mut Connection,
+    name: &str,
+    tracks: impl Iterator<Item = Cached>,
+) -> rusqlite::Result<()> {
+    let tx = conn.transaction()?;
+    let mut ids = Vec::new();
+    {
+        let mut upsert = tx.prepare(
+            "INSERT INTO saved_track (file, duration, artist, album, title)
+             VALUES (?1, ?2, ?3, ?4, ?5)
+             ON CONFLICT(file) DO UPDATE SET duration = ?2, artist = ?3, album = ?4, title = ?5
+             RETURNING id",
+        )?;
+        for track in tracks {
+            ids.push(upsert.query_row(
+                params![
+                    track.file,
+                    i64::try_from(track.duration.as_millis()).unwrap_or(i64::MAX),
+                    track.artist,
+                    track.album,
+                    track.title
+                ],
+                |row| row.get(0),
+            )?);
+        }
+    }
+    tx.execute(
+        "INSERT OR REPLACE INTO saved_playlist (name, tracks) VALUES (?1, ?2)",
+        params![name, to_blob(&ids)],
+    )?;
+    tx.commit()
+}
+
+/// The tracks of the playlist `name` as they were saved, none if there is no such playlist.
+pub fn load(conn: &Connection, name: &str) -> rusqlite::Result<Option<Vec<Cached>>> {
+    let blob: Option<Vec<u8>> = conn
+        .query_row(
+            "SELECT tracks FROM saved_playlist WHERE name = ?",
+            [name],
+            |row| row.get(0),
+        )
+        .optional()?;
+    let blob = match blob {
+        Some(blob) => blob,
+        None => return Ok(None),
+    };
+    let mut stmt =
+        conn.prepare("SELECT file, duration, artist, album, title FROM saved_track WHERE id = ?")?;
+    let mut tracks = Vec::new();
+    for id in from_blob(&blob) {
+        let track = stmt
+            .query_row([id], |row| {
+                Ok(Cached {
+                    file: row.get(0)?,
+                    duration: Duration::from_millis(row.get(1)?),
+                    artist: row.get(2)?,
+                    album: row.get(3)?,
+                    title: row.get(4)?,
+                })
+            })
+            .optional()?;
+        tracks.extend(track);
+    }
+    Ok(Some(tracks))
+}
+
+// the tracks no other playlist holds leave the cache with it
+pub fn delete(conn: &mut Connection, name: &str) -> rusqlite::Result<()> {
+    let tx = conn.transaction()?;
+    tx.execute("DELETE FROM saved_playlist WHERE name = ?", [name])?;
+    let mut kept = HashSet::new();
+    let mut ids = Vec::new();
+    {
+        let mut playlists = tx.prepare("SELECT tracks FROM saved_playlist")?;
+        for blob in playlists.query_map([], |row| row.get::<_, Vec<u8>>(0))? {
+            kept.extend(from_blob(&blob?));
+        }
+        let mut tracks = tx.prepare("SELECT id FROM saved_track")?;
+        for id in tracks.query_map([], |row| row.get::<_, i64>(0))? {
+            ids.push(id?);
+        }
+        let mut prune = tx.prepare("DELETE FROM saved_track WHERE id = ?")?;
+        for id in ids.into_iter().filter(|id| !kept.contains(id)) {
+            prune.execute([id])?;
+        }
+    }
+    tx.commit()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn cached(file: &str, title: &str) -> Cached {
+        Cached {
+            file: file.to_string(),
+            duration: Duration::from_millis(61_500),
+            artist: Some("artist".to_string()),
+            album: None,
+            title: Some(title.to_string()),
+        }
+    }
+
+    #[test]
+    fn test_playlists_round_trip_through_one_track_cache() {
+        let mut conn = Connection::open_in_memory().unwrap();
+        create_table(&conn).unwrap();
+        let first = vec![
+            cached("/a.mp3", "a"),
+            cached("/b.mp3", "b"),
+            cached("/a.mp3", "a"),
+        ];
+        save(&mut conn, "first", first.clone().into_iter()).unwrap();
+        save(
+            &mut conn,
+            "second",
+            vec![
+                cached("/b.mp3", "b retagged"),
+                cached("http://radio", "radio"),
+            ]
+            .into_iter(),
+        )
+        .unwrap();
+
+        assert_eq!(
+            list(&conn).unwrap(),
+            vec![("first".to_string(), 3), ("second".to_string(), 2)]
+        );
+        let count: i64 = conn
+            .query_row("SELECT count(*) FROM saved_track", [], |row| row.get(0))
+            .unwrap();
+        assert_eq!(count, 3);
+
+        // the newer tags of a shared track show in both
+        let loaded = load(&conn, "first").unwrap().unwrap();
+        assert_eq!(loaded.len(), 3);
+        assert_eq!(loaded[0], first[0]);
+        assert_eq!(loaded[1].title.as_deref(), Some("b retagged"));
+        assert_eq!(loaded[2], first[2]);
+
+        save(&mut conn, "first", std::iter::empty()).unwrap();
+        assert_eq!(load(&conn, "first").unwrap(), Some(vec![]));
+        delete(&mut conn, "first").unwrap();
+        assert_eq!(load(&conn, "first").unwrap(), None);
+        assert_eq!(list(&conn).unwrap().len(), 1);
+        // /a.mp3 was only in the deleted playlist
+        let files = conn
+            .prepare("SELECT file FROM saved_track ORDER BY file")
+            .unwrap()
+            .query_map([], |row| row.get::<_, String>(0))
+            .unwrap()
+            .collect::<rusqlite::Result<Vec<_>>>()
+            .unwrap();
+        assert_eq!(files, vec!["/b.mp3", "http://radio"]);
+    }
+
+    #[test]
+    fn test_blob_keeps_the_order() {
+        let ids = vec![3, 1, i64::MAX, 2, 3];
+        assert_eq!(from_blob(&to_blob(&ids)), ids);
+    }
+}
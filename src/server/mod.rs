@@ -0,0 +1,496 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Headless playback: a server owns the player, the playlist and the library database and keeps
+// playing with no ui attached. Clients talk to it over a unix socket, see protocol.rs.
+mod protocol;
+
+use crate::config::{get_app_config_path, get_full_path_from_config, Settings};
+use crate::loudness;
+use crate::player::{GeneralPlayer, Loop, PlayerMsg, PlayerTrait, Status};
+use crate::sqlite::DataBase;
+use crate::track::{Fields, Track};
+use anyhow::{anyhow, bail, Result};
+use protocol::{read_event, read_request, send_event, send_request, Event, Request};
+use std::collections::HashMap;
+use std::fs;
+use std::io::BufReader;
+use std::net::Shutdown;
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::{Path, PathBuf};
+use std::sync::mpsc::{self, Receiver, RecvTimeoutError, Sender, SyncSender};
+use std::thread;
+use std::time::{Duration, Instant};
+
+// longest wait for a request before the player messages are looked at
+const TICK: Duration = Duration::from_millis(50);
+// the rusty backend reports its position when asked
+const PROGRESS_EVERY: Duration = Duration::from_millis(500);
+// a client that does not read its events for this long is dropped
+const WRITE_TIMEOUT: Duration = Duration::from_secs(1);
+// events waiting for a slow client, it is dropped when more pile up
+const CLIENT_BACKLOG: usize = 64;
+
+pub fn socket_path() -> Result<PathBuf> {
+    let mut path = get_app_config_path()?;
+    path.push("termusic.sock");
+    Ok(path)
+}
+
+enum Incoming {
+    Connected(usize, UnixStream),
+    Request(usize, Request),
+    Closed(usize),
+}
+
+// events go out on a thread of their own per client, a slow one never holds up playback
+struct Client {
+    events: SyncSender<Event>,
+    subscribed: bool,
+}
+
+struct Server {
+    player: GeneralPlayer,
+    config: Settings,
+    // kept open so the library and its analysis stay current while no ui runs
+    db: DataBase,
+    clients: HashMap<usize, Client>,
+    progress: (i64, i64),
+    quit: bool,
+}
+
+const fn status_code(status: Status) -> u8 {
+    match status {
+        Status::Stopped => 0,
+        Status::Running => 1,
+        Status::Paused => 2,
+    }
+}
+
+impl Server {
+    fn new(config: &Settings) -> Self {
+        let mut db = DataBase::new(config);
+        db.sync_database(&get_full_path_from_config(config));
+        loudness::spawn_analyzer(config.loudness_workers);
+        let mut player = GeneralPlayer::new(config);
+        player.set_volume(config.volume);
+        Self {
+            player,
+            config: config.clone(),
+            db,
+            clients: HashMap::new(),
+            progress: (0, 0),
+            quit: false,
+        }
+    }
+
+    fn state(&self) -> Event {
+        Event::State {
+            status: status_code(self.player.status()),
+            volume: self.config.volume,
+            speed: self.config.speed,
+        }
+    }
+
+    fn track(&self) -> Event {
+        Event::Track(
+            self.player
+                .playlist
+                .current_track
+                .as_ref()
+                .and_then(Track::file)
+                .unwrap_or_default()
+                .to_string(),
+        )
+    }
+
+    fn send(&mut self, id: usize, event: &Event) {
+        let failed = self.clients.get(&id).map_or(false, |client| {
+            client.events.try_send(event.clone()).is_err()
+        });
+        if failed {
+            self.clients.remove(&id);
+        }
+    }
+
+    // state changes are pushed, subscribers never poll
+    fn broadcast(&mut self, event: &Event) {
+        self.clients.retain(|_, client| {
+            !client.subscribed || client.events.try_send(event.clone()).is_ok()
+        });
+    }
+
+    fn handle(&mut self, incoming: Incoming) {
+        match incoming {
+            Incoming::Connected(id, stream) => {
+                stream.set_write_timeout(Some(WRITE_TIMEOUT)).ok();
+                let (events, rx) = mpsc::sync_channel(CLIENT_BACKLOG);
+                thread::spawn(move || write_events(stream, &rx));
+                self.clients.insert(
+                    id,
+                    Client {
+                        events,
+                        subscribed: false,
+                    },
+                );
+            }
+            Incoming::Closed(id) => {
+                self.clients.remove(&id);
+            }
+            Incoming::Request(id, request) => self.request(id, request),
+        }
+    }
+
+    // every request is answered with the state, so a client knows when it is done
+    fn request(&mut self, id: usize, request: Request) {
+        match request {
+            Request::Subscribe => {
+                if let Some(client) = self.clients.get_mut(&id) {
+                    client.subscribed = true;
+                }
+                self.snapshot(id);
+                return;
+            }
+            Request::Status => {
+                self.snapshot(id);
+                return;
+            }
+            Request::TogglePause => self.toggle_pause(),
+            Request::Next => {
+                if self.player.is_stopped() {
+                    self.player.start_play();
+                } else {
+                    self.player.skip();
+                }
+            }
+            Request::Previous => self.previous(),
+            Request::Stop => self.stop(),
+            Request::Seek(secs) => {
+                self.player.seek(secs).ok();
+            }
+            Request::VolumeUp => self.player.volume_up(),
+            Request::VolumeDown => self.player.volume_down(),
+            Request::SetVolume(volume) => self.player.set_volume(volume),
+            Request::SpeedUp => self.player.speed_up(),
+            Request::SpeedDown => self.player.speed_down(),
+            Request::Add(file) => match Track::read_with(&file, Fields::PLAYLIST) {
+                Ok(track) => {
+                    self.player.playlist.remember();
+                    self.player.playlist.push_back(track);
+                }
+                Err(e) => self.send(id, &Event::Error(format!("{}: {}", file, e))),
+            },
+            Request::Quit => self.quit = true,
+        }
+        self.config.volume = self.player.volume();
+        self.config.speed = self.player.speed();
+        let state = self.state();
+        self.send(id, &state);
+        self.broadcast(&state);
+    }
+
+    fn snapshot(&mut self, id: usize) {
+        let (position, duration) = self.progress;
+        self.send(id, &self.track());
+        self.send(id, &Event::Progress { position, duration });
+        self.send(id, &self.state());
+    }
+
+    fn toggle_pause(&mut self) {
+        if self.player.is_stopped() {
+            if !self.player.playlist.is_empty() {
+                self.player.start_play();
+            }
+        } else if self.player.is_paused() {
+            self.player.set_status(Status::Running);
+            self.player.resume();
+        } else {
+            self.player.set_status(Status::Paused);
+            self.player.pause();
+        }
+    }
+
+    fn previous(&mut self) {
+        if let Loop::Single | Loop::Queue = self.config.loop_mode {
+            return;
+        }
+        if self.player.playlist.is_empty() {
+            self.stop();
+            return;
+        }
+        for _ in 0..2 {
+            let last = self.player.playlist.len() - 1;
+            self.player.playlist.move_track(last, 0);
+        }
+        self.player.skip();
+    }
+
+    fn stop(&mut self) {
+        self.player.playlist.current_track = None;
+        self.player.stop();
+        self.progress = (0, 0);
+        self.broadcast(&Event::Track(String::new()));
+    }
+
+    // the same reactions as the ui has to its player
+    fn player_message(&mut self, msg: PlayerMsg) {
+        match msg {
+            PlayerMsg::Eos => {
+                if self.player.playlist.is_empty() {
+                    self.stop();
+                    let state = self.state();
+                    self.broadcast(&state);
+                } else {
+                    self.player.start_play();
+                }
+            }
+            PlayerMsg::AboutToFinish => {
+                // only the rusty backend crossfades
+                #[cfg(not(any(feature = "mpv", feature = "gst")))]
+                let queue_next = self.config.gapless || self.config.crossfade_secs > 0;
+                #[cfg(any(feature = "mpv", feature = "gst"))]
+                let queue_next = self.config.gapless;
+                if queue_next {
+                    self.player.enqueue_next();
+                }
+            }
+            PlayerMsg::CurrentTrackUpdated => {
+                if (self.config.speed - 10).abs() >= 1 {
+                    self.player.set_speed(self.config.speed);
+                }
+                if let Some(file) = self.player.playlist.get_current_track() {
+                    self.db.record_play(&file).ok();
+                }
+                let track = self.track();
+                self.broadcast(&track);
+                let state = self.state();
+                self.broadcast(&state);
+            }
+            PlayerMsg::Progress(position, duration) => {
+                if (position, duration) != self.progress {
+                    self.progress = (position, duration);
+                    self.player.playlist.checkpoint(position);
+                    self.broadcast(&Event::Progress { position, duration });
+                }
+            }
+            #[cfg(not(any(feature = "mpv", feature = "gst")))]
+            PlayerMsg::StreamOpened(item) => self.player.stream_opened(&item),
+            #[cfg(not(any(feature = "mpv", feature = "gst")))]
+            PlayerMsg::StreamFailed(e) => self.broadcast(&Event::Error(e)),
+        }
+    }
+}
+
+// ends when the server drops the client or the client stops reading, the shutdown also ends
+// its reader
+fn write_events(mut stream: UnixStream, rx: &Receiver<Event>) {
+    while let Ok(event) = rx.recv() {
+        if send_event(&mut stream, &event).is_err() {
+            break;
+        }
+    }
+    stream.shutdown(Shutdown::Both).ok();
+}
+
+fn accept(listener: &UnixListener, tx: &Sender<Incoming>) {
+    for (id, stream) in listener.incoming().flatten().enumerate() {
+        let reader = match stream.try_clone() {
+            Ok(reader) => reader,
+            Err(_) => continue,
+        };
+        if tx.send(Incoming::Connected(id, stream)).is_err() {
+            return;
+        }
+        let tx = tx.clone();
+        thread::spawn(move || {
+            let mut reader = BufReader::new(reader);
+            while let Ok(Some(request)) = read_request(&mut reader) {
+                if tx.send(Incoming::Request(id, request)).is_err() {
+                    return;
+                }
+            }
+            tx.send(Incoming::Closed(id)).ok();
+        });
+    }
+}
+
+/// Whether a server answers on the socket, the ui must not start a second player next to it.
+pub fn is_running() -> bool {
+    socket_path().map_or(false, |path| UnixStream::connect(path).is_ok())
+}
+
+/// Play in the foreground with no ui until a client asks the server to quit.
+pub fn run(config: &Settings) -> Result<()> {
+    let path = socket_path()?;
+    if is_running() {
+        bail!("a server is already listening on {}", path.display());
+    }
+    // left behind by a server that did not shut down cleanly
+    fs::remove_file(&path).ok();
+    let listener = UnixListener::bind(&path)?;
+
+    let (tx, rx) = mpsc::channel();
+    thread::spawn(move || accept(&listener, &tx));
+
+    let mut server = Server::new(config);
+    let mut last_progress = Instant::now();
+    while !server.quit {
+        match rx.recv_timeout(TICK) {
+            Ok(incoming) => server.handle(incoming),
+            Err(RecvTimeoutError::Timeout) => {}
+            Err(RecvTimeoutError::Disconnected) => break,
+        }
+        while let Ok(msg) = server.player.message_rx.try_recv() {
+            server.player_message(msg);
+        }
+        if last_progress.elapsed() >= PROGRESS_EVERY {
+            last_progress = Instant::now();
+            #[cfg(not(any(feature = "mpv", feature = "gst")))]
+            server.player.get_progress().ok();
+        }
+    }
+
+    fs::remove_file(&path).ok();
+    server.player.playlist.save()
+}
+
+fn parse_command(args: &[String]) -> Result<Request> {
+    let command = args.get(0).map(String::as_str).unwrap_or("status");
+    let arg = args.get(1).map(String::as_str);
+    Ok(match (command, arg) {
+        ("status", _) => Request::Status,
+        ("watch", _) => Request::Subscribe,
+        ("toggle" | "play" | "pause", _) => Request::TogglePause,
+        ("next", _) => Request::Next,
+        ("previous" | "prev", _) => Request::Previous,
+        ("stop", _) => Request::Stop,
+        ("quit", _) => Request::Quit,
+        ("seek", Some(secs)) => Request::Seek(secs.parse()?),
+        ("volume", Some("+")) => Request::VolumeUp,
+        ("volume", Some("-")) => Request::VolumeDown,
+        ("volume", Some(volume)) => Request::SetVolume(volume.parse()?),
+        ("speed", Some("+")) => Request::SpeedUp,
+        ("speed", Some("-")) => Request::SpeedDown,
+        ("add", Some(file)) => {
+            let path = Path::new(file).canonicalize()?;
+            Request::Add(path.to_string_lossy().to_string())
+        }
+        _ => bail!("unknown command: {}", args.join(" ")),
+    })
+}
+
+fn print_event(event: &Event) {
+    match event {
+        Event::State {
+            status,
+            volume,
+            speed,
+        } => {
+            let status = match status {
+                1 => Status::Running,
+                2 => Status::Paused,
+                _ => Status::Stopped,
+            };
+            println!(
+                "status: {} | volume: {} | speed: {:.1}",
+                status,
+                volume,
+                f64::from(*speed) / 10.0
+            );
+        }
+        Event::Track(file) if file.is_empty() => println!("track: none"),
+        Event::Track(file) => println!("track: {}", file),
+        Event::Progress { position, duration } => println!(
+            "progress: {} / {}",
+            Track::duration_formatted_short(&Duration::from_secs(
+                (*position).try_into().unwrap_or(0)
+            )),
+            Track::duration_formatted_short(&Duration::from_secs(
+                (*duration).try_into().unwrap_or(0)
+            )),
+        ),
+        Event::Error(message) => eprintln!("error: {}", message),
+    }
+}
+
+/// Send one command to the running server and print its answer, `watch` prints every state
+/// change until the server goes away.
+pub fn control(args: &[String]) -> Result<()> {
+    let request = parse_command(args)?;
+    let path = socket_path()?;
+    let mut stream = UnixStream::connect(&path).map_err(|e| {
+        anyhow!(
+            "no server on {}, start one with `termusic server`: {}",
+            path.display(),
+            e
+        )
+    })?;
+    send_request(&mut stream, &request)?;
+
+    let watch = request == Request::Subscribe;
+    let mut reader = BufReader::new(stream);
+    while let Some(event) = read_event(&mut reader)? {
+        print_event(&event);
+        if !watch && matches!(event, Event::State { .. }) {
+            break;
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_command() {
+        let args = |line: &str| line.split(' ').map(String::from).collect::<Vec<_>>();
+        assert_eq!(parse_command(&[]).unwrap(), Request::Status);
+        assert_eq!(
+            parse_command(&args("seek -10")).unwrap(),
+            Request::Seek(-10)
+        );
+        assert_eq!(parse_command(&args("volume +")).unwrap(), Request::VolumeUp);
+        assert_eq!(
+            parse_command(&args("volume 40")).unwrap(),
+            Request::SetVolume(40)
+        );
+        assert!(parse_command(&args("seek")).is_err());
+        assert!(parse_command(&args("dance")).is_err());
+    }
+
+    #[test]
+    fn test_client_writer_ends_with_its_queue() {
+        let (server_side, client_side) = UnixStream::pair().unwrap();
+        let (events, rx) = mpsc::sync_channel(CLIENT_BACKLOG);
+        let writer = thread::spawn(move || write_events(server_side, &rx));
+        let track = Event::Track(String::from("/music/a.flac"));
+        events.send(track.clone()).unwrap();
+        drop(events);
+        writer.join().unwrap();
+
+        let mut reader = BufReader::new(client_side);
+        assert_eq!(read_event(&mut reader).unwrap(), Some(track));
+        assert_eq!(read_event(&mut reader).unwrap(), None);
+    }
+}
@@ -0,0 +1,304 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Frames between the playback server and its clients: a little endian u32 length, then a tag
+// byte and the fields of the message. Strings are a u32 length and utf-8 bytes.
+use anyhow::{anyhow, bail, Result};
+use std::io::{Read, Write};
+
+// a frame longer than this is a broken or foreign peer
+const MAX_FRAME: usize = 1 << 20;
+
+/// From a client to the server.
+#[derive(Clone, Debug, PartialEq)]
+pub enum Request {
+    /// push every state change to this client from now on, starting with the current state
+    Subscribe,
+    /// reply with the current state once
+    Status,
+    TogglePause,
+    Next,
+    Previous,
+    Stop,
+    /// seek by this many seconds, back when negative
+    Seek(i64),
+    VolumeUp,
+    VolumeDown,
+    SetVolume(i32),
+    SpeedUp,
+    SpeedDown,
+    /// append a file to the playlist
+    Add(String),
+    /// save the playlist and shut the server down
+    Quit,
+}
+
+/// From the server to its clients.
+#[derive(Clone, Debug, PartialEq)]
+pub enum Event {
+    /// 0 stopped, 1 running, 2 paused
+    State {
+        status: u8,
+        volume: i32,
+        speed: i32,
+    },
+    /// the file now playing, empty when nothing is
+    Track(String),
+    Progress {
+        position: i64,
+        duration: i64,
+    },
+    Error(String),
+}
+
+#[derive(Default)]
+struct Encoder(Vec<u8>);
+
+impl Encoder {
+    fn u8(mut self, v: u8) -> Self {
+        self.0.push(v);
+        self
+    }
+
+    fn i32(mut self, v: i32) -> Self {
+        self.0.extend_from_slice(&v.to_le_bytes());
+        self
+    }
+
+    fn i64(mut self, v: i64) -> Self {
+        self.0.extend_from_slice(&v.to_le_bytes());
+        self
+    }
+
+    fn str(mut self, v: &str) -> Result<Self> {
+        self.0
+            .extend_from_slice(&u32::try_from(v.len())?.to_le_bytes());
+        self.0.extend_from_slice(v.as_bytes());
+        Ok(self)
+    }
+}
+
+struct Decoder<'a>(&'a [u8]);
+
+impl Decoder<'_> {
+    fn take(&mut self, n: usize) -> Result<&[u8]> {
+        if self.0.len() < n {
+            bail!("truncated frame");
+        }
+        let (head, tail) = self.0.split_at(n);
+        self.0 = tail;
+        Ok(head)
+    }
+
+    fn u8(&mut self) -> Result<u8> {
+        Ok(self.take(1)?[0])
+    }
+
+    fn i32(&mut self) -> Result<i32> {
+        Ok(i32::from_le_bytes(self.take(4)?.try_into()?))
+    }
+
+    fn i64(&mut self) -> Result<i64> {
+        Ok(i64::from_le_bytes(self.take(8)?.try_into()?))
+    }
+
+    fn str(&mut self) -> Result<String> {
+        let len = u32::from_le_bytes(self.take(4)?.try_into()?) as usize;
+        Ok(String::from_utf8(self.take(len)?.to_vec())?)
+    }
+}
+
+impl Request {
+    fn encode(&self) -> Result<Vec<u8>> {
+        let e = Encoder::default();
+        Ok(match self {
+            Self::Subscribe => e.u8(0),
+            Self::Status => e.u8(1),
+            Self::TogglePause => e.u8(2),
+            Self::Next => e.u8(3),
+            Self::Previous => e.u8(4),
+            Self::Stop => e.u8(5),
+            Self::Seek(secs) => e.u8(6).i64(*secs),
+            Self::VolumeUp => e.u8(7),
+            Self::VolumeDown => e.u8(8),
+            Self::SetVolume(volume) => e.u8(9).i32(*volume),
+            Self::SpeedUp => e.u8(10),
+            Self::SpeedDown => e.u8(11),
+            Self::Add(file) => e.u8(12).str(file)?,
+            Self::Quit => e.u8(13),
+        }
+        .0)
+    }
+
+    fn decode(frame: &[u8]) -> Result<Self> {
+        let mut d = Decoder(frame);
+        Ok(match d.u8()? {
+            0 => Self::Subscribe,
+            1 => Self::Status,
+            2 => Self::TogglePause,
+            3 => Self::Next,
+            4 => Self::Previous,
+            5 => Self::Stop,
+            6 => Self::Seek(d.i64()?),
+            7 => Self::VolumeUp,
+            8 => Self::VolumeDown,
+            9 => Self::SetVolume(d.i32()?),
+            10 => Self::SpeedUp,
+            11 => Self::SpeedDown,
+            12 => Self::Add(d.str()?),
+            13 => Self::Quit,
+            tag => bail!("unknown request {}", tag),
+        })
+    }
+}
+
+impl Event {
+    fn encode(&self) -> Result<Vec<u8>> {
+        let e = Encoder::default();
+        Ok(match self {
+            Self::State {
+                status,
+                volume,
+                speed,
+            } => e.u8(0).u8(*status).i32(*volume).i32(*speed),
+            Self::Track(file) => e.u8(1).str(file)?,
+            Self::Progress { position, duration } => e.u8(2).i64(*position).i64(*duration),
+            Self::Error(message) => e.u8(3).str(message)?,
+        }
+        .0)
+    }
+
+    fn decode(frame: &[u8]) -> Result<Self> {
+        let mut d = Decoder(frame);
+        Ok(match d.u8()? {
+            0 => Self::State {
+                status: d.u8()?,
+                volume: d.i32()?,
+                speed: d.i32()?,
+            },
+            1 => Self::Track(d.str()?),
+            2 => Self::Progress {
+                position: d.i64()?,
+                duration: d.i64()?,
+            },
+            3 => Self::Error(d.str()?),
+            tag => bail!("unknown event {}", tag),
+        })
+    }
+}
+
+fn write_frame(w: &mut impl Write, body: &[u8]) -> Result<()> {
+    let mut frame = Vec::with_capacity(4 + body.len());
+    frame.extend_from_slice(&u32::try_from(body.len())?.to_le_bytes());
+    frame.extend_from_slice(body);
+    // one write per frame, so frames of concurrent writers never interleave
+    w.write_all(&frame)?;
+    Ok(())
+}
+
+// `None` when the peer closed the connection between two frames
+fn read_frame(r: &mut impl Read) -> Result<Option<Vec<u8>>> {
+    let mut len = [0; 4];
+    match r.read_exact(&mut len) {
+        Ok(()) => {}
+        Err(e) if e.kind() == std::io::ErrorKind::UnexpectedEof => return Ok(None),
+        Err(e) => return Err(e.into()),
+    }
+    let len = u32::from_le_bytes(len) as usize;
+    if len > MAX_FRAME {
+        return Err(anyhow!("frame of {} bytes", len));
+    }
+    let mut body = vec![0; len];
+    r.read_exact(&mut body)?;
+    Ok(Some(body))
+}
+
+pub fn send_request(w: &mut impl Write, request: &Request) -> Result<()> {
+    write_frame(w, &request.encode()?)
+}
+
+pub fn read_request(r: &mut impl Read) -> Result<Option<Request>> {
+    read_frame(r)?.map(|f| Request::decode(&f)).transpose()
+}
+
+pub fn send_event(w: &mut impl Write, event: &Event) -> Result<()> {
+    write_frame(w, &event.encode()?)
+}
+
+pub fn read_event(r: &mut impl Read) -> Result<Option<Event>> {
+    read_frame(r)?.map(|f| Event::decode(&f)).transpose()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::os::unix::net::UnixStream;
+
+    #[test]
+    fn test_messages_round_trip_over_a_socket() {
+        let (mut a, mut b) = UnixStream::pair().unwrap();
+        let requests = vec![
+            Request::Subscribe,
+            Request::Seek(-5),
+            Request::SetVolume(70),
+            Request::Add(String::from("/music/ü.flac")),
+            Request::Quit,
+        ];
+        for request in &requests {
+            send_request(&mut a, request).unwrap();
+        }
+        let events = vec![
+            Event::State {
+                status: 1,
+                volume: 70,
+                speed: 10,
+            },
+            Event::Track(String::new()),
+            Event::Progress {
+                position: 12,
+                duration: 240,
+            },
+        ];
+        for event in &events {
+            send_event(&mut b, event).unwrap();
+        }
+        for event in events {
+            assert_eq!(read_event(&mut a).unwrap(), Some(event));
+        }
+        drop(a);
+
+        for request in requests {
+            assert_eq!(read_request(&mut b).unwrap(), Some(request));
+        }
+        // a closed connection ends the stream instead of failing it
+        assert_eq!(read_request(&mut b).unwrap(), None);
+    }
+
+    #[test]
+    fn test_garbage_is_refused() {
+        assert!(Request::decode(&[200]).is_err());
+        assert!(Request::decode(&[6, 1, 2]).is_err());
+        let mut oversized: &[u8] = &[255, 255, 255, 255];
+        assert!(read_frame(&mut oversized).is_err());
+    }
+}
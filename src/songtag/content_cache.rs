@@ -0,0 +1,185 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use anyhow::Result;
+use rusqlite::{params, Connection, OptionalExtension};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+
+// Covers are a few hundred kilobytes each, this keeps a couple of hundred of them.
+pub const CONTENT_CACHE_MAX_BYTES: u64 = 64 * 1024 * 1024;
+
+/// Lyrics and covers downloaded from the providers, stored once per content hash and looked
+/// up by provider id. The index lives in sqlite next to the blobs, and the least recently
+/// used entries are dropped once the blobs grow past `max_bytes`.
+pub struct ContentCache {
+    dir: PathBuf,
+    conn: Mutex<Connection>,
+    max_bytes: u64,
+}
+
+impl ContentCache {
+    pub fn open(dir: &Path, max_bytes: u64) -> Result<Self> {
+        fs::create_dir_all(dir)?;
+        let conn = Connection::open(dir.join("index.db"))?;
+        conn.execute(
+            "create table if not exists entry(
+             key TEXT PRIMARY KEY,
+             hash TEXT NOT NULL,
+             size INTEGER NOT NULL,
+             last_access INTEGER NOT NULL
+            )",
+            [],
+        )?;
+
+        Ok(Self {
+            dir: dir.to_path_buf(),
+            conn: Mutex::new(conn),
+            max_bytes,
+        })
+    }
+
+    fn blob_path(&self, hash: &str) -> PathBuf {
+        self.dir.join(hash)
+    }
+
+    pub fn get(&self, key: &str) -> Option<Vec<u8>> {
+        let conn = self.conn.lock().unwrap();
+        let hash: String = conn
+            .query_row("SELECT hash FROM entry WHERE key = ?1", [key], |r| r.get(0))
+            .optional()
+            .ok()??;
+
+        if let Ok(data) = fs::read(self.blob_path(&hash)) {
+            conn.execute(
+                "UPDATE entry SET last_access = (SELECT MAX(last_access) + 1 FROM entry)
+                 WHERE key = ?1",
+                [key],
+            )
+            .ok();
+            Some(data)
+        } else {
+            // the blob was removed behind our back, forget about it
+            conn.execute("DELETE FROM entry WHERE key = ?1", [key]).ok();
+            None
+        }
+    }
+
+    pub fn put(&self, key: &str, data: &[u8]) -> Result<()> {
+        let hash = format!("{:x}", md5::compute(data));
+        let path = self.blob_path(&hash);
+        if !path.exists() {
+            write_file(&path, data)?;
+        }
+
+        let conn = self.conn.lock().unwrap();
+        conn.execute(
+            "INSERT OR REPLACE INTO entry (key, hash, size, last_access)
+             VALUES (?1, ?2, ?3, (SELECT IFNULL(MAX(last_access), 0) + 1 FROM entry))",
+            params![key, hash, data.len() as u64],
+        )?;
+        self.evict(&conn)
+    }
+
+    fn total_size(conn: &Connection) -> Result<u64> {
+        Ok(conn.query_row(
+            "SELECT IFNULL(SUM(size), 0) FROM (SELECT DISTINCT hash, size FROM entry)",
+            [],
+            |r| r.get(0),
+        )?)
+    }
+
+    fn evict(&self, conn: &Connection) -> Result<()> {
+        while Self::total_size(conn)? > self.max_bytes {
+            let (key, hash): (String, String) = conn.query_row(
+                "SELECT key, hash FROM entry ORDER BY last_access LIMIT 1",
+                [],
+                |r| Ok((r.get(0)?, r.get(1)?)),
+            )?;
+            conn.execute("DELETE FROM entry WHERE key = ?1", [&key])?;
+
+            let references: u64 =
+                conn.query_row("SELECT COUNT(*) FROM entry WHERE hash = ?1", [&hash], |r| {
+                    r.get(0)
+                })?;
+            if references == 0 {
+                fs::remove_file(self.blob_path(&hash)).ok();
+            }
+        }
+        Ok(())
+    }
+}
+
+// write then rename, so a concurrent reader never sees half a file
+pub fn write_file(path: &Path, data: &[u8]) -> std::io::Result<()> {
+    let tmp = path.with_extension("tmp");
+    fs::write(&tmp, data)?;
+    fs::rename(tmp, path)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn test_dir(name: &str) -> PathBuf {
+        let dir = std::env::temp_dir().join(format!(
+            "termusic_content_cache_{}_{}",
+            name,
+            std::process::id()
+        ));
+        fs::remove_dir_all(&dir).ok();
+        dir
+    }
+
+    #[test]
+    fn test_content_cache_shares_blobs() {
+        let dir = test_dir("shares");
+        let cache = ContentCache::open(&dir, 1024).unwrap();
+        cache.put("kugou photo a", b"cover").unwrap();
+        cache.put("netease photo b", b"cover").unwrap();
+        assert_eq!(cache.get("kugou photo a").as_deref(), Some(&b"cover"[..]));
+        assert_eq!(cache.get("netease photo b").as_deref(), Some(&b"cover"[..]));
+        let blobs = fs::read_dir(&dir)
+            .unwrap()
+            .filter(|e| e.as_ref().unwrap().file_name() != "index.db")
+            .count();
+        assert_eq!(blobs, 1);
+        fs::remove_dir_all(dir).ok();
+    }
+
+    #[test]
+    fn test_content_cache_evicts_least_recently_used() {
+        let dir = test_dir("evicts");
+        let cache = ContentCache::open(&dir, 10).unwrap();
+        cache.put("lyric a", b"aaaa").unwrap();
+        cache.put("lyric b", b"bbbb").unwrap();
+        // touch a, so b is the oldest when c arrives
+        assert!(cache.get("lyric a").is_some());
+        cache.put("lyric c", b"cccc").unwrap();
+        assert!(cache.get("lyric a").is_some());
+        assert!(cache.get("lyric b").is_none());
+        assert!(cache.get("lyric c").is_some());
+        fs::remove_dir_all(dir).ok();
+    }
+}
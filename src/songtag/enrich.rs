@@ -0,0 +1,287 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use super::{search_all, Endpoint, SongTag};
+use crate::track::Track;
+use crate::ui::model::UpdateComponents;
+use lofty::Picture;
+use std::collections::{HashMap, HashSet};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::thread::{self, sleep};
+use std::time::{Duration, Instant};
+
+// How many of the upcoming tracks are looked at each time the current track changes.
+pub const ENRICH_LOOKAHEAD: usize = 5;
+
+struct EnrichJob {
+    file: String,
+    artist: String,
+    title: String,
+    needs_lyric: bool,
+    needs_photo: bool,
+}
+
+/// Lyric and cover found for a file, waiting for the user to confirm them.
+#[derive(Clone)]
+pub struct StagedTags {
+    pub file: String,
+    pub lang_ext: String,
+    pub lyric: Option<String>,
+    pub picture: Option<Picture>,
+}
+
+/// Looks up missing lyrics and covers for queued tracks on a background thread. Provider
+/// requests are spaced by `interval`, and search results are cached by query, so walking a
+/// long playlist never floods the services.
+pub struct Enricher {
+    job_tx: Sender<EnrichJob>,
+    seen: HashSet<String>,
+}
+
+impl Enricher {
+    pub fn new(tx: Sender<UpdateComponents>, interval: Duration) -> Self {
+        let (job_tx, job_rx): (Sender<EnrichJob>, Receiver<EnrichJob>) = mpsc::channel();
+        thread::spawn(move || run(&job_rx, &tx, interval, &Endpoint::services()));
+
+        Self {
+            job_tx,
+            seen: HashSet::new(),
+        }
+    }
+
+    pub fn enqueue(&mut self, track: &Track) {
+        let file = match track.file() {
+            Some(file) => file,
+            None => return,
+        };
+        let needs_lyric = track.lyric_frames_is_empty();
+        let needs_photo = track.picture().is_none() && track.album_photo().is_none();
+        if !needs_lyric && !needs_photo {
+            return;
+        }
+
+        let (artist, title) = match (track.artist(), track.title()) {
+            (Some(artist), Some(title)) if artist != "Unsupported?" => (artist, title),
+            _ => return,
+        };
+
+        // every file is looked up once per session, whether or not anything was found
+        if !self.seen.insert(file.to_string()) {
+            return;
+        }
+
+        self.job_tx
+            .send(EnrichJob {
+                file: file.to_string(),
+                artist: artist.to_string(),
+                title: title.to_string(),
+                needs_lyric,
+                needs_photo,
+            })
+            .ok();
+    }
+}
+
+struct RateLimit {
+    interval: Duration,
+    last_request: Option<Instant>,
+}
+
+impl RateLimit {
+    fn wait(&mut self) {
+        if let Some(last_request) = self.last_request {
+            let elapsed = last_request.elapsed();
+            if elapsed < self.interval {
+                sleep(self.interval - elapsed);
+            }
+        }
+        self.last_request = Some(Instant::now());
+    }
+}
+
+fn run(
+    job_rx: &Receiver<EnrichJob>,
+    tx: &Sender<UpdateComponents>,
+    interval: Duration,
+    endpoint: &Endpoint,
+) {
+    let mut rate_limit = RateLimit {
+        interval,
+        last_request: None,
+    };
+    let mut matches: HashMap<String, Option<SongTag>> = HashMap::new();
+
+    while let Ok(job) = job_rx.recv() {
+        let query = format!("{} {}", job.artist, job.title);
+        let song_tag = if let Some(song_tag) = matches.get(&query) {
+            song_tag.clone()
+        } else {
+            rate_limit.wait();
+            let song_tag =
+                best_match(&search_all(&query, endpoint), &job.artist, &job.title).cloned();
+            matches.insert(query, song_tag.clone());
+            song_tag
+        };
+
+        let song_tag = match song_tag {
+            Some(song_tag) => song_tag,
+            None => continue,
+        };
+
+        let mut staged = StagedTags {
+            file: job.file,
+            lang_ext: song_tag.lang_ext().unwrap_or("eng").to_string(),
+            lyric: None,
+            picture: None,
+        };
+
+        if job.needs_lyric {
+            rate_limit.wait();
+            staged.lyric = song_tag
+                .fetch_lyric(endpoint)
+                .ok()
+                .filter(|l| !l.is_empty());
+        }
+
+        if job.needs_photo {
+            rate_limit.wait();
+            staged.picture = song_tag.fetch_photo(endpoint).ok();
+        }
+
+        if staged.lyric.is_some() || staged.picture.is_some() {
+            tx.send(UpdateComponents::TagSuggestionStaged(staged)).ok();
+        }
+    }
+}
+
+// Only accept results that clearly are the same song, a wrong lyric is worse than none.
+fn best_match<'a>(results: &'a [SongTag], artist: &str, title: &str) -> Option<&'a SongTag> {
+    let artist = artist.to_lowercase();
+    results.iter().find(|song_tag| {
+        let title_matches = song_tag
+            .title()
+            .map_or(false, |t| t.trim().eq_ignore_ascii_case(title.trim()));
+        let artist_matches = song_tag.artist().map_or(false, |a| {
+            let a = a.to_lowercase();
+            a.contains(&artist) || artist.contains(&a)
+        });
+        title_matches && artist_matches
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::{Read, Write};
+    use std::net::{TcpListener, TcpStream};
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+
+    // Answers like kugou does, every other provider gets a 404.
+    fn respond(mut stream: TcpStream, searches: &AtomicUsize) {
+        let mut request = Vec::new();
+        let mut buf = [0_u8; 1024];
+        while !request.windows(4).any(|w| w == b"\r\n\r\n") {
+            match stream.read(&mut buf) {
+                Ok(0) | Err(_) => return,
+                Ok(n) => request.extend_from_slice(&buf[..n]),
+            }
+        }
+        let request = String::from_utf8_lossy(&request);
+        let path = request.split_whitespace().nth(1).unwrap_or_default();
+
+        let body = if path.starts_with("/api/v3/search/song") {
+            searches.fetch_add(1, Ordering::SeqCst);
+            Some(
+                r#"{"status":1,"data":{"info":[{"hash":"H1","songname":"Some Title","singername":"Some Artist","album_name":"Album","album_id":"A1","price":0}]}}"#
+                    .to_string(),
+            )
+        } else if path.starts_with("/search") {
+            Some(r#"{"errcode":200,"candidates":[{"accesskey":"K1","id":"L1"}]}"#.to_string())
+        } else if path.starts_with("/download") {
+            Some(format!(
+                r#"{{"status":200,"content":"{}"}}"#,
+                base64::encode("[00:01.00]mock lyric")
+            ))
+        } else {
+            None
+        };
+
+        let response = match body {
+            Some(body) => format!(
+                "HTTP/1.1 200 OK\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+                body.len(),
+                body
+            ),
+            None => "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+                .to_string(),
+        };
+        stream.write_all(response.as_bytes()).ok();
+    }
+
+    fn job(file: &str) -> EnrichJob {
+        EnrichJob {
+            file: file.to_string(),
+            artist: "Some Artist".to_string(),
+            title: "Some Title".to_string(),
+            needs_lyric: true,
+            needs_photo: false,
+        }
+    }
+
+    #[test]
+    fn test_enrich_against_mock_providers() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let address = listener.local_addr().unwrap();
+        let searches = Arc::new(AtomicUsize::new(0));
+        let server_searches = searches.clone();
+        thread::spawn(move || {
+            for stream in listener.incoming().flatten() {
+                let searches = server_searches.clone();
+                thread::spawn(move || respond(stream, &searches));
+            }
+        });
+
+        let (job_tx, job_rx) = mpsc::channel();
+        let (tx, rx) = mpsc::channel();
+        job_tx.send(job("/music/a.mp3")).unwrap();
+        job_tx.send(job("/music/b.mp3")).unwrap();
+        drop(job_tx);
+        let endpoint = Endpoint::mock(format!("http://{}", address));
+        run(&job_rx, &tx, Duration::from_millis(10), &endpoint);
+
+        let staged: Vec<StagedTags> = rx
+            .try_iter()
+            .filter_map(|msg| match msg {
+                UpdateComponents::TagSuggestionStaged(staged) => Some(staged),
+                _ => None,
+            })
+            .collect();
+        assert_eq!(staged.len(), 2);
+        assert_eq!(staged[0].file, "/music/a.mp3");
+        assert_eq!(staged[0].lyric.as_deref(), Some("[00:01.00]mock lyric"));
+        assert!(staged[0].picture.is_none());
+        // the second file has the same artist and title, so no new search is made
+        assert_eq!(searches.load(Ordering::SeqCst), 1);
+    }
+}
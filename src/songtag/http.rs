@@ -0,0 +1,369 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use super::content_cache::write_file;
+use anyhow::Result;
+use lazy_static::lazy_static;
+use std::collections::HashMap;
+use std::fs;
+use std::io::Read;
+use std::path::{Path, PathBuf};
+use std::sync::{Condvar, Mutex};
+use std::thread::sleep;
+use std::time::{Duration, SystemTime};
+use ureq::{Agent, AgentBuilder, Response};
+
+// Requests in flight to a single host, the providers throttle clients that open more.
+const MAX_REQUESTS_PER_HOST: usize = 4;
+const MAX_ATTEMPTS: u32 = 3;
+const RETRY_BACKOFF: Duration = Duration::from_millis(250);
+// Search results hardly change, a day keeps repeated tag editor searches local.
+const RESPONSE_CACHE_TTL: Duration = Duration::from_secs(24 * 60 * 60);
+// Responses are a few kilobytes, this keeps thousands of them.
+const RESPONSE_CACHE_MAX_BYTES: u64 = 16 * 1024 * 1024;
+
+lazy_static! {
+    static ref AGENT: Agent = AgentBuilder::new()
+        .timeout(Duration::from_secs(10))
+        .max_idle_connections_per_host(MAX_REQUESTS_PER_HOST)
+        .build();
+    static ref HOST_SLOTS: HostSlots = HostSlots::default();
+}
+
+#[derive(Default)]
+struct HostSlots {
+    in_flight: Mutex<HashMap<String, usize>>,
+    released: Condvar,
+}
+
+struct HostSlot<'a> {
+    slots: &'a HostSlots,
+    host: String,
+}
+
+impl HostSlots {
+    fn acquire(&self, host: &str) -> HostSlot<'_> {
+        let mut in_flight = self.in_flight.lock().unwrap();
+        while in_flight.get(host).copied().unwrap_or_default() >= MAX_REQUESTS_PER_HOST {
+            in_flight = self.released.wait(in_flight).unwrap();
+        }
+        *in_flight.entry(host.to_string()).or_default() += 1;
+        HostSlot {
+            slots: self,
+            host: host.to_string(),
+        }
+    }
+}
+
+impl Drop for HostSlot<'_> {
+    fn drop(&mut self) {
+        let mut in_flight = self.slots.in_flight.lock().unwrap();
+        if let Some(count) = in_flight.get_mut(&self.host) {
+            *count = count.saturating_sub(1);
+        }
+        self.slots.released.notify_all();
+    }
+}
+
+fn host(url: &str) -> &str {
+    let start = url.find("://").map_or(0, |scheme_end| scheme_end + 3);
+    let rest = &url[start..];
+    let end = rest.find(|c| c == '/' || c == '?').unwrap_or(rest.len());
+    &rest[..end]
+}
+
+/// A response that keeps the slot of its host until the body has been read.
+pub struct Reply {
+    response: Response,
+    slot: HostSlot<'static>,
+}
+
+impl Reply {
+    pub fn header(&self, name: &str) -> Option<&str> {
+        self.response.header(name)
+    }
+
+    pub fn into_string(self) -> std::io::Result<String> {
+        self.response.into_string()
+    }
+
+    pub fn into_reader(self) -> Body {
+        Body {
+            reader: self.response.into_reader(),
+            _slot: self.slot,
+        }
+    }
+}
+
+pub struct Body {
+    reader: Box<dyn Read + Send + Sync>,
+    _slot: HostSlot<'static>,
+}
+
+impl Read for Body {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        self.reader.read(buf)
+    }
+}
+
+/// Run a request against `url`, waiting for a free slot of its host. Connection failures,
+/// rate limiting and server errors are retried with exponential backoff.
+pub fn send<F>(url: &str, request: F) -> Result<Reply>
+where
+    F: Fn(&Agent) -> std::result::Result<Response, ureq::Error>,
+{
+    let slot = HOST_SLOTS.acquire(host(url));
+    let mut attempt = 1;
+    loop {
+        match request(&*AGENT) {
+            Ok(response) => return Ok(Reply { response, slot }),
+            Err(ureq::Error::Status(code, _))
+                if (code == 429 || code >= 500) && attempt < MAX_ATTEMPTS => {}
+            Err(ureq::Error::Transport(_)) if attempt < MAX_ATTEMPTS => {}
+            Err(e) => return Err(e.into()),
+        }
+        sleep(RETRY_BACKOFF * 2_u32.pow(attempt - 1));
+        attempt += 1;
+    }
+}
+
+/// Serve `fetch` from `cache`, keyed by the logical query rather than the request bytes, as
+/// some providers encrypt every request with a fresh key. `fetch` also tells whether its value
+/// may be kept: providers answer errors and empty results with status 200, and those must not
+/// stick for a day.
+pub fn cached<F>(cache: Option<&ResponseCache>, key: &str, fetch: F) -> Result<String>
+where
+    F: FnOnce() -> Result<(String, bool)>,
+{
+    if let Some(value) = cache.and_then(|cache| cache.get(key)) {
+        return Ok(value);
+    }
+    let (value, keep) = fetch()?;
+    if let (Some(cache), true) = (cache, keep) {
+        cache.put(key, &value);
+    }
+    Ok(value)
+}
+
+/// Provider answers on disk, the least recently used go once they pass a size limit.
+pub struct ResponseCache {
+    dir: PathBuf,
+    ttl: Duration,
+    max_bytes: u64,
+    index: Mutex<CacheIndex>,
+}
+
+// size and last use of every cached file, the least recently used go once over max_bytes
+#[derive(Default)]
+struct CacheIndex {
+    entries: HashMap<PathBuf, (u64, u64)>,
+    total: u64,
+    clock: u64,
+}
+
+impl CacheIndex {
+    fn touch(&mut self, path: &Path, size: u64) {
+        self.clock += 1;
+        if let Some((old, _)) = self.entries.insert(path.to_path_buf(), (size, self.clock)) {
+            self.total -= old;
+        }
+        self.total += size;
+    }
+
+    fn remove(&mut self, path: &Path) {
+        if let Some((size, _)) = self.entries.remove(path) {
+            self.total -= size;
+        }
+    }
+
+    fn oldest(&self) -> Option<PathBuf> {
+        self.entries
+            .iter()
+            .min_by_key(|(_, (_, used))| *used)
+            .map(|(path, _)| path.clone())
+    }
+}
+
+impl ResponseCache {
+    pub fn open(dir: PathBuf) -> Option<Self> {
+        Self::with_limits(dir, RESPONSE_CACHE_TTL, RESPONSE_CACHE_MAX_BYTES)
+    }
+
+    // files left by earlier runs count as used in the order they were written
+    fn with_limits(dir: PathBuf, ttl: Duration, max_bytes: u64) -> Option<Self> {
+        fs::create_dir_all(&dir).ok()?;
+        let mut files: Vec<(SystemTime, PathBuf, u64)> = fs::read_dir(&dir)
+            .ok()?
+            .flatten()
+            .filter_map(|entry| {
+                let meta = entry.metadata().ok()?;
+                Some((meta.modified().ok()?, entry.path(), meta.len()))
+            })
+            .filter(|(_, path, _)| path.extension().is_none())
+            .collect();
+        files.sort();
+        let mut index = CacheIndex::default();
+        for (_, path, size) in files {
+            index.touch(&path, size);
+        }
+        Some(Self {
+            dir,
+            ttl,
+            max_bytes,
+            index: Mutex::new(index),
+        })
+    }
+
+    fn path(&self, key: &str) -> PathBuf {
+        self.dir.join(format!("{:x}", md5::compute(key)))
+    }
+
+    fn get(&self, key: &str) -> Option<String> {
+        let path = self.path(key);
+        let mut index = self.index.lock().unwrap();
+        let age = fs::metadata(&path)
+            .and_then(|m| m.modified())
+            .ok()
+            .and_then(|modified| SystemTime::now().duration_since(modified).ok());
+        match age {
+            Some(age) if age <= self.ttl => {}
+            _ => {
+                fs::remove_file(&path).ok();
+                index.remove(&path);
+                return None;
+            }
+        }
+        let value = fs::read_to_string(&path).ok()?;
+        index.touch(&path, value.len() as u64);
+        Some(value)
+    }
+
+    fn put(&self, key: &str, value: &str) {
+        let path = self.path(key);
+        if write_file(&path, value.as_bytes()).is_err() {
+            return;
+        }
+        let mut index = self.index.lock().unwrap();
+        index.touch(&path, value.len() as u64);
+        while index.total > self.max_bytes {
+            match index.oldest() {
+                Some(oldest) => {
+                    fs::remove_file(&oldest).ok();
+                    index.remove(&oldest);
+                }
+                None => break,
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+    use std::thread;
+
+    #[test]
+    fn test_host() {
+        assert_eq!(host("http://krcs.kugou.com/search"), "krcs.kugou.com");
+        assert_eq!(host("http://www.kugou.com?r=play/getdata"), "www.kugou.com");
+        assert_eq!(host("http://127.0.0.1:8080"), "127.0.0.1:8080");
+    }
+
+    #[test]
+    fn test_host_slots_limit_concurrency() {
+        let slots = Arc::new(HostSlots::default());
+        let running = Arc::new(AtomicUsize::new(0));
+        let peak = Arc::new(AtomicUsize::new(0));
+        let handles: Vec<_> = (0..MAX_REQUESTS_PER_HOST * 3)
+            .map(|_| {
+                let (slots, running, peak) = (slots.clone(), running.clone(), peak.clone());
+                thread::spawn(move || {
+                    let _slot = slots.acquire("example.com");
+                    let now = running.fetch_add(1, Ordering::SeqCst) + 1;
+                    peak.fetch_max(now, Ordering::SeqCst);
+                    sleep(Duration::from_millis(20));
+                    running.fetch_sub(1, Ordering::SeqCst);
+                })
+            })
+            .collect();
+        for handle in handles {
+            handle.join().unwrap();
+        }
+        assert!(peak.load(Ordering::SeqCst) <= MAX_REQUESTS_PER_HOST);
+    }
+
+    #[test]
+    fn test_response_cache_expiry() {
+        let dir = std::env::temp_dir().join(format!("termusic_http_test_{}", std::process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let cache = ResponseCache::with_limits(dir.clone(), RESPONSE_CACHE_TTL, 1024).unwrap();
+        assert!(cache.get("kugou search a").is_none());
+        cache.put("kugou search a", "result");
+        assert_eq!(cache.get("kugou search a").as_deref(), Some("result"));
+
+        let expired = ResponseCache::with_limits(dir.clone(), Duration::ZERO, 1024).unwrap();
+        sleep(Duration::from_millis(10));
+        assert!(expired.get("kugou search a").is_none());
+        fs::remove_dir_all(dir).ok();
+    }
+
+    #[test]
+    fn test_response_cache_evicts_least_recently_used() {
+        let dir = std::env::temp_dir().join(format!("termusic_http_lru_{}", std::process::id()));
+        fs::remove_dir_all(&dir).ok();
+        let cache = ResponseCache::with_limits(dir.clone(), RESPONSE_CACHE_TTL, 10).unwrap();
+        cache.put("a", "aaaa");
+        cache.put("b", "bbbb");
+        // touch a, so b is the oldest when c arrives
+        assert!(cache.get("a").is_some());
+        cache.put("c", "cccc");
+        assert!(cache.get("b").is_none());
+        assert_eq!(cache.get("a").as_deref(), Some("aaaa"));
+        assert_eq!(cache.get("c").as_deref(), Some("cccc"));
+
+        // a restart picks up the files, the oldest written goes first
+        drop(cache);
+        let cache = ResponseCache::with_limits(dir.clone(), RESPONSE_CACHE_TTL, 10).unwrap();
+        assert_eq!(cache.index.lock().unwrap().total, 8);
+        fs::remove_dir_all(dir).ok();
+    }
+
+    #[test]
+    fn test_cached_skips_values_not_kept() {
+        let dir = std::env::temp_dir().join(format!("termusic_http_keep_{}", std::process::id()));
+        fs::remove_dir_all(&dir).ok();
+        let cache = ResponseCache::with_limits(dir.clone(), RESPONSE_CACHE_TTL, 1024).unwrap();
+        let error = cached(Some(&cache), "k", || {
+            Ok(("{\"code\":-1}".to_string(), false))
+        });
+        assert_eq!(error.unwrap(), "{\"code\":-1}");
+        assert!(cache.get("k").is_none());
+
+        cached(Some(&cache), "k", || Ok(("[]".to_string(), true))).unwrap();
+        let hit = cached(Some(&cache), "k", || unreachable!("served from the cache"));
+        assert_eq!(hit.unwrap(), "[]");
+        fs::remove_dir_all(dir).ok();
+    }
+}
@@ -23,80 +23,87 @@
  */
 mod model;
 
+use super::{http, Endpoint};
 use anyhow::{anyhow, Result};
 use lofty::Picture;
 use model::{to_lyric, to_pic_url, to_song_info};
-use std::time::Duration;
-use ureq::{Agent, AgentBuilder};
 
 static URL_SEARCH_MIGU: &str = "https://m.music.migu.cn/migu/remoting/scr_search_tag";
 static URL_LYRIC_MIGU: &str = "https://music.migu.cn/v3/api/music/audioPlayer/getLyric";
 static URL_PIC_MIGU: &str = "https://music.migu.cn/v3/api/music/audioPlayer/getSongPic";
 
 pub struct Api {
-    client: Agent,
+    endpoint: Endpoint,
 }
 
 impl Api {
-    pub fn new() -> Self {
-        let client = AgentBuilder::new().timeout(Duration::from_secs(10)).build();
-
-        Self { client }
+    pub const fn with_endpoint(endpoint: Endpoint) -> Self {
+        Self { endpoint }
     }
 
     pub fn search(&self, keywords: &str, types: u32, offset: u16, limit: u16) -> Result<String> {
-        let result = self
-            .client
-            .post(URL_SEARCH_MIGU)
-            .set("Referer", "https://m.music.migu.cn")
-            .query("keyword", keywords)
-            .query("pgc", &offset.to_string())
-            .query("rows", &limit.to_string())
-            .query("type", &2.to_string())
-            .call()?
+        let key = format!("migu search {} {} {} {}", keywords, types, offset, limit);
+        http::cached(self.endpoint.responses(), &key, || {
+            let url = self.endpoint.url(URL_SEARCH_MIGU);
+            let result = http::send(&url, |client| {
+                client
+                    .post(&url)
+                    .set("Referer", "https://m.music.migu.cn")
+                    .query("keyword", keywords)
+                    .query("pgc", &offset.to_string())
+                    .query("rows", &limit.to_string())
+                    .query("type", &2.to_string())
+                    .call()
+            })?
             .into_string()?;
 
-        // let mut file = std::fs::File::create("data.txt").expect("create failed");
-        // file.write_all(result.as_bytes()).expect("write failed");
+            // let mut file = std::fs::File::create("data.txt").expect("create failed");
+            // file.write_all(result.as_bytes()).expect("write failed");
 
-        match types {
-            1 => {
-                let songtag_vec = to_song_info(&result).ok_or_else(|| anyhow!("Search Error"))?;
-                let songtag_string = serde_json::to_string(&songtag_vec)?;
-                Ok(songtag_string)
+            match types {
+                1 => {
+                    let songtag_vec =
+                        to_song_info(&result).ok_or_else(|| anyhow!("Search Error"))?;
+                    let songtag_string = serde_json::to_string(&songtag_vec)?;
+                    Ok((songtag_string, !songtag_vec.is_empty()))
+                }
+                _ => Err(anyhow!("None Error")),
             }
-            _ => Err(anyhow!("None Error")),
-        }
+        })
     }
 
     // search and download lyrics
     // music_id: 歌曲id
     pub fn song_lyric(&self, music_id: &str) -> Result<String> {
-        let result = self
-            .client
-            .get(URL_LYRIC_MIGU)
-            .set("Referer", "https://m.music.migu.cn")
-            .query("copyrightId", music_id)
-            .call()?
-            .into_string()?;
+        let url = self.endpoint.url(URL_LYRIC_MIGU);
+        let result = http::send(&url, |client| {
+            client
+                .get(&url)
+                .set("Referer", "https://m.music.migu.cn")
+                .query("copyrightId", music_id)
+                .call()
+        })?
+        .into_string()?;
 
         to_lyric(&result).ok_or_else(|| anyhow!("None Error"))
     }
 
     // download picture
     pub fn pic(&self, song_id: &str) -> Result<Picture> {
-        let result = self
-            .client
-            .get(URL_PIC_MIGU)
-            .set("Referer", "https://m.music.migu.cn")
-            .query("songId", song_id)
-            .call()?
-            .into_string()?;
+        let url = self.endpoint.url(URL_PIC_MIGU);
+        let result = http::send(&url, |client| {
+            client
+                .get(&url)
+                .set("Referer", "https://m.music.migu.cn")
+                .query("songId", song_id)
+                .call()
+        })?
+        .into_string()?;
 
         let pic_url = to_pic_url(&result).ok_or_else(|| anyhow!("Pic url error"))?;
-        let url = format!("https:{}", pic_url);
+        let url = self.endpoint.url(&format!("https:{}", pic_url));
 
-        let result = self.client.get(&url).call()?;
+        let result = http::send(&url, |client| client.get(&url).call())?;
 
         let picture = Picture::from_reader(&mut result.into_reader())?;
         Ok(picture)
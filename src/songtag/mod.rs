@@ -21,24 +21,30 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+mod content_cache;
 pub mod encrypt;
+mod enrich;
+mod http;
 mod kugou;
 pub mod lrc;
 mod migu;
 mod netease;
 
-use crate::ui::{model::UpdateComponents, SearchLyricState};
+use crate::ui::SearchLyricState;
 use anyhow::{anyhow, bail, Result};
+use content_cache::{ContentCache, CONTENT_CACHE_MAX_BYTES};
+pub use enrich::{Enricher, StagedTags, ENRICH_LOOKAHEAD};
+use http::ResponseCache;
+use lazy_static::lazy_static;
 use lofty::id3::v2::{Frame, FrameFlags, FrameValue, ID3v2Tag, LanguageFrame, TextEncoding};
 use lofty::{Accessor, Picture, TagExt};
 use serde::{Deserialize, Serialize};
-use std::path::{Path, PathBuf};
+use std::path::Path;
 use std::sync::mpsc::{self, Receiver, Sender};
-use std::thread::{self, sleep};
-use std::time::Duration;
-use ytd_rs::{Arg, YoutubeDL};
+use std::sync::Arc;
+use std::thread;
 
-#[derive(Deserialize, Serialize)]
+#[derive(Clone, Deserialize, Serialize)]
 pub struct SongTag {
     artist: Option<String>,
     title: Option<String>,
@@ -53,7 +59,7 @@ pub struct SongTag {
     // genre: Option<String>,
 }
 
-#[derive(Deserialize, Serialize)]
+#[derive(Clone, Deserialize, Serialize)]
 #[allow(clippy::use_self)]
 pub enum ServiceProvider {
     Netease,
@@ -72,15 +78,90 @@ impl std::fmt::Display for ServiceProvider {
     }
 }
 
-// Search function of 3 servers. Run in parallel to get results faster.
+// what a content cache key points at
+#[derive(Clone, Copy)]
+enum ContentKind {
+    Lyric,
+    Photo,
+}
+
+lazy_static! {
+    static ref SERVICES: Endpoint = dirs::cache_dir().map_or_else(Endpoint::default, |dir| {
+        Endpoint::default().cached_in(&dir.join("termusic"))
+    });
+}
+
+/// Where provider requests go, the real services or a local mock in tests, and the caches
+/// their answers are kept in.
+#[derive(Clone, Default)]
+pub struct Endpoint {
+    base: Option<String>,
+    responses: Option<Arc<ResponseCache>>,
+    contents: Option<Arc<ContentCache>>,
+}
+
+impl Endpoint {
+    pub fn services() -> Self {
+        SERVICES.clone()
+    }
+
+    #[cfg(test)]
+    pub fn mock(base: String) -> Self {
+        Self {
+            base: Some(base),
+            ..Self::default()
+        }
+    }
+
+    pub fn cached_in(mut self, dir: &Path) -> Self {
+        self.responses = ResponseCache::open(dir.join("http")).map(Arc::new);
+        self.contents = ContentCache::open(&dir.join("content"), CONTENT_CACHE_MAX_BYTES)
+            .ok()
+            .map(Arc::new);
+        self
+    }
+
+    fn responses(&self) -> Option<&ResponseCache> {
+        self.responses.as_deref()
+    }
+
+    fn contents(&self) -> Option<&ContentCache> {
+        self.contents.as_deref()
+    }
+
+    fn url(&self, url: &str) -> String {
+        if let Some(base) = &self.base {
+            let host_start = url.find("://").map_or(0, |scheme_end| scheme_end + 3);
+            let path = url[host_start..]
+                .find('/')
+                .map_or("", |path_start| &url[host_start + path_start..]);
+            return format!("{}{}", base, path);
+        }
+        url.to_string()
+    }
+}
+
 pub fn search(search_str: &str, tx_tageditor: Sender<SearchLyricState>) {
+    let search_str = search_str.to_string();
+    thread::spawn(move || {
+        tx_tageditor
+            .send(SearchLyricState::Finish(search_all(
+                &search_str,
+                &Endpoint::services(),
+            )))
+            .ok();
+    });
+}
+
+// Search function of 3 servers. Run in parallel to get results faster.
+fn search_all(search_str: &str, endpoint: &Endpoint) -> Vec<SongTag> {
     let mut results: Vec<SongTag> = Vec::new();
     let (tx, rx): (Sender<Vec<SongTag>>, Receiver<Vec<SongTag>>) = mpsc::channel();
 
     let tx1 = tx.clone();
     let search_str_netease = search_str.to_string();
+    let mut netease_api = netease::Api::with_endpoint(endpoint.clone());
     let handle_netease = thread::spawn(move || -> Result<()> {
-        let mut netease_api = netease::Api::new();
         if let Ok(results) = netease_api.search(&search_str_netease, 1, 0, 30) {
             let result_new: Vec<SongTag> = serde_json::from_str(&results)?;
             tx1.send(result_new).ok();
@@ -90,8 +171,8 @@ pub fn search(search_str: &str, tx_tageditor: Sender<SearchLyricState>) {
 
     let tx2 = tx.clone();
     let search_str_migu = search_str.to_string();
+    let migu_api = migu::Api::with_endpoint(endpoint.clone());
     let handle_migu = thread::spawn(move || -> Result<()> {
-        let migu_api = migu::Api::new();
         if let Ok(results) = migu_api.search(&search_str_migu, 1, 0, 30) {
             let result_new: Vec<SongTag> = serde_json::from_str(&results)?;
             tx2.send(result_new).ok();
@@ -99,7 +180,7 @@ pub fn search(search_str: &str, tx_tageditor: Sender<SearchLyricState>) {
         Ok(())
     });
 
-    let kugou_api = kugou::Api::new();
+    let kugou_api = kugou::Api::with_endpoint(endpoint.clone());
     let search_str_kugou = search_str.to_string();
     let handle_kugou = thread::spawn(move || -> Result<()> {
         if let Ok(r) = kugou_api.search(&search_str_kugou, 1, 0, 30) {
@@ -109,27 +190,25 @@ pub fn search(search_str: &str, tx_tageditor: Sender<SearchLyricState>) {
         Ok(())
     });
 
-    thread::spawn(move || {
-        if handle_netease.join().is_ok() {
-            if let Ok(result_new) = rx.try_recv() {
-                results.extend(result_new);
-            }
+    if handle_netease.join().is_ok() {
+        if let Ok(result_new) = rx.try_recv() {
+            results.extend(result_new);
         }
+    }
 
-        if handle_migu.join().is_ok() {
-            if let Ok(result_new) = rx.try_recv() {
-                results.extend(result_new);
-            }
+    if handle_migu.join().is_ok() {
+        if let Ok(result_new) = rx.try_recv() {
+            results.extend(result_new);
         }
+    }
 
-        if handle_kugou.join().is_ok() {
-            if let Ok(result_new) = rx.try_recv() {
-                results.extend(result_new);
-            }
+    if handle_kugou.join().is_ok() {
+        if let Ok(result_new) = rx.try_recv() {
+            results.extend(result_new);
         }
+    }
 
-        tx_tageditor.send(SearchLyricState::Finish(results)).ok();
-    });
+    results
 }
 
 impl SongTag {
@@ -177,25 +256,80 @@ impl SongTag {
     pub fn url(&self) -> Option<String> {
         self.url.as_ref().map(std::string::ToString::to_string)
     }
-    // get lyric by lyric_id
-    pub fn fetch_lyric(&self) -> Result<String> {
+    // lyrics and covers are looked up in the content cache first, see content_cache.rs
+    fn content_key(&self, kind: ContentKind) -> Option<String> {
+        let (kind, id) = match kind {
+            ContentKind::Lyric => ("lyric", self.lyric_id.clone()?),
+            ContentKind::Photo => (
+                "photo",
+                format!(
+                    "{} {}",
+                    self.pic_id.as_ref().or(self.song_id.as_ref())?,
+                    self.album_id.as_deref().unwrap_or_default()
+                ),
+            ),
+        };
+        Some(format!(
+            "{} {} {}",
+            self.service_provider.as_ref()?,
+            kind,
+            id
+        ))
+    }
+
+    pub fn fetch_lyric(&self, endpoint: &Endpoint) -> Result<String> {
+        let key = self.content_key(ContentKind::Lyric);
+        if let (Some(cache), Some(key)) = (endpoint.contents(), &key) {
+            if let Some(lyric) = cache.get(key).and_then(|data| String::from_utf8(data).ok()) {
+                return Ok(lyric);
+            }
+        }
+
+        let lyric_string = self.fetch_lyric_remote(endpoint)?;
+        if let (Some(cache), Some(key)) = (endpoint.contents(), &key) {
+            if !lyric_string.is_empty() {
+                cache.put(key, lyric_string.as_bytes()).ok();
+            }
+        }
+        Ok(lyric_string)
+    }
+
+    pub fn fetch_photo(&self, endpoint: &Endpoint) -> Result<Picture> {
+        let key = self.content_key(ContentKind::Photo);
+        if let (Some(cache), Some(key)) = (endpoint.contents(), &key) {
+            if let Some(picture) = cache
+                .get(key)
+                .and_then(|data| Picture::from_reader(&mut data.as_slice()).ok())
+            {
+                return Ok(picture);
+            }
+        }
+
+        let picture = self.fetch_photo_remote(endpoint)?;
+        if let (Some(cache), Some(key)) = (endpoint.contents(), &key) {
+            cache.put(key, picture.data()).ok();
+        }
+        Ok(picture)
+    }
+
+    fn fetch_lyric_remote(&self, endpoint: &Endpoint) -> Result<String> {
         let mut lyric_string = String::new();
 
         match self.service_provider {
             Some(ServiceProvider::Kugou) => {
-                let kugou_api = kugou::Api::new();
+                let kugou_api = kugou::Api::with_endpoint(endpoint.clone());
                 if let Some(lyric_id) = &self.lyric_id {
                     lyric_string = kugou_api.song_lyric(lyric_id)?;
                 }
             }
             Some(ServiceProvider::Netease) => {
-                let mut netease_api = netease::Api::new();
+                let mut netease_api = netease::Api::with_endpoint(endpoint.clone());
                 if let Some(lyric_id) = &self.lyric_id {
                     lyric_string = netease_api.song_lyric(lyric_id)?;
                 }
             }
             Some(ServiceProvider::Migu) => {
-                let migu_api = migu::Api::new();
+                let migu_api = migu::Api::with_endpoint(endpoint.clone());
                 if let Some(lyric_id) = &self.lyric_id {
                     lyric_string = migu_api.song_lyric(lyric_id)?;
                 }
@@ -207,12 +341,12 @@ impl SongTag {
     }
 
     // get photo by pic_id(kugou/netease) or song_id(migu)
-    pub fn fetch_photo(&self) -> Result<Picture> {
+    fn fetch_photo_remote(&self, endpoint: &Endpoint) -> Result<Picture> {
         // let mut encoded_image_bytes: Vec<u8> = Vec::new();
 
         match self.service_provider {
             Some(ServiceProvider::Kugou) => {
-                let kugou_api = kugou::Api::new();
+                let kugou_api = kugou::Api::with_endpoint(endpoint.clone());
                 if let Some(p) = &self.pic_id {
                     if let Some(album_id) = &self.album_id {
                         Ok(kugou_api.pic(p, album_id)?)
@@ -224,7 +358,7 @@ impl SongTag {
                 }
             }
             Some(ServiceProvider::Netease) => {
-                let mut netease_api = netease::Api::new();
+                let mut netease_api = netease::Api::with_endpoint(endpoint.clone());
                 if let Some(p) = &self.pic_id {
                     Ok(netease_api.pic(p)?)
                 } else {
@@ -232,7 +366,7 @@ impl SongTag {
                 }
             }
             Some(ServiceProvider::Migu) => {
-                let migu_api = migu::Api::new();
+                let migu_api = migu::Api::with_endpoint(endpoint.clone());
                 if let Some(p) = &self.song_id {
                     Ok(migu_api.pic(p)?)
                 } else {
@@ -256,45 +390,23 @@ impl SongTag {
         // ))
     }
 
-    #[allow(clippy::too_many_lines)]
-    pub fn download(&self, file: &str, tx_tageditor: &Sender<UpdateComponents>) -> Result<()> {
-        let p: &Path = Path::new(file);
-        let p_parent = PathBuf::from(p.parent().unwrap_or_else(|| Path::new("/tmp")));
+    /// File name the download ends up with, yt-dlp adds the extension.
+    pub fn download_file_stem(&self) -> String {
+        format!(
+            "{}-{}",
+            self.artist().unwrap_or("Unknown Artist"),
+            self.title().unwrap_or("Unknown Title")
+        )
+    }
+
+    // providers hand out short lived links, so this is resolved right before downloading
+    pub fn download_url(&self) -> Result<String> {
         let song_id = self
             .song_id
             .as_ref()
             .ok_or_else(|| anyhow!("error downloading because no song id is found"))?;
-        let artist = self
-            .artist
-            .clone()
-            .unwrap_or_else(|| "Unknown Artist".to_string());
-        let title = self
-            .title
-            .clone()
-            .unwrap_or_else(|| "Unknown Title".to_string());
-
-        let album = self.album.clone().unwrap_or_else(|| String::from("N/A"));
-        let lyric = self.fetch_lyric();
-        let photo = self.fetch_photo();
         let album_id = self.album_id.clone().unwrap_or_else(|| String::from("N/A"));
 
-        let filename = format!("{}-{}.%(ext)s", artist, title);
-
-        let args = vec![
-            Arg::new("--quiet"),
-            Arg::new_with_arg("--output", filename.as_ref()),
-            Arg::new("--extract-audio"),
-            Arg::new_with_arg("--audio-format", "mp3"),
-        ];
-
-        let p_full = format!(
-            "{}/{}-{}.mp3",
-            p_parent.to_str().unwrap_or("/tmp"),
-            artist,
-            title
-        );
-        if std::fs::remove_file(Path::new(p_full.as_str())).is_err() {}
-
         let mp3_url = self.url.clone().unwrap_or_else(|| String::from("N/A"));
         if mp3_url.starts_with("Copyright") {
             bail!("Copyright protected, please select another item.");
@@ -318,66 +430,46 @@ impl SongTag {
         if url.is_empty() {
             bail!("url fetch failed, please try another item.");
         }
+        Ok(url)
+    }
 
-        let ytd = YoutubeDL::new(&p_parent, args, &url)?;
-
-        let tx = tx_tageditor.clone();
-        thread::spawn(move || {
-            tx.send(UpdateComponents::DownloadRunning).ok();
-            // start download
-            let download = ytd.download();
-
-            // check what the result is and print out the path to the download or the error
-            match download {
-                Ok(_result) => {
-                    let mut tag = ID3v2Tag::default();
-
-                    tag.set_title(title);
-                    tag.set_artist(artist);
-                    tag.set_album(album);
-
-                    // safe to unwrap these frames, since the ID is valid
-                    if let Ok(l) = lyric {
-                        tag.insert(
-                            Frame::new(
-                                "USLT",
-                                FrameValue::UnSyncText(LanguageFrame {
-                                    encoding: TextEncoding::UTF8,
-                                    language: String::from("chi"),
-                                    description: String::from("saved by termusic."),
-                                    content: l,
-                                }),
-                                FrameFlags::default(),
-                            )
-                            .unwrap(),
-                        );
-                    }
+    pub fn embed_tags(&self, file: &str) -> Result<()> {
+        let mut tag = ID3v2Tag::default();
 
-                    if let Ok(picture) = photo {
-                        tag.insert_picture(picture);
-                    }
+        tag.set_title(
+            self.title
+                .clone()
+                .unwrap_or_else(|| "Unknown Title".to_string()),
+        );
+        tag.set_artist(
+            self.artist
+                .clone()
+                .unwrap_or_else(|| "Unknown Artist".to_string()),
+        );
+        tag.set_album(self.album.clone().unwrap_or_else(|| String::from("N/A")));
+
+        // safe to unwrap these frames, since the ID is valid
+        if let Ok(l) = self.fetch_lyric(&Endpoint::services()) {
+            tag.insert(
+                Frame::new(
+                    "USLT",
+                    FrameValue::UnSyncText(LanguageFrame {
+                        encoding: TextEncoding::UTF8,
+                        language: String::from("chi"),
+                        description: String::from("saved by termusic."),
+                        content: l,
+                    }),
+                    FrameFlags::default(),
+                )
+                .unwrap(),
+            );
+        }
 
-                    let file = p_full.as_str();
+        if let Ok(picture) = self.fetch_photo(&Endpoint::services()) {
+            tag.insert_picture(picture);
+        }
 
-                    if tag.save_to_path(file).is_ok() {
-                        tx.send(UpdateComponents::DownloadSuccess).ok();
-                        sleep(Duration::from_secs(5));
-                        tx.send(UpdateComponents::DownloadCompleted(Some(file.to_string())))
-                            .ok();
-                    } else {
-                        tx.send(UpdateComponents::DownloadErrEmbedData).ok();
-                        sleep(Duration::from_secs(5));
-                        tx.send(UpdateComponents::DownloadCompleted(None)).ok();
-                    }
-                }
-                Err(e) => {
-                    tx.send(UpdateComponents::DownloadErrDownload(e.to_string()))
-                        .ok();
-                    sleep(Duration::from_secs(5));
-                    tx.send(UpdateComponents::DownloadCompleted(None)).ok();
-                }
-            };
-        });
+        tag.save_to_path(file)?;
         Ok(())
     }
 }
@@ -6,14 +6,14 @@
 mod model;
 
 use super::encrypt::Crypto;
+use super::{http, Endpoint};
 use anyhow::{anyhow, bail, Result};
 use lazy_static::lazy_static;
 use lofty::Picture;
 use model::{to_lyric, to_song_info, to_song_url, Method, Parse, SongUrl};
 use regex::Regex;
 // use std::io::Write;
-use std::{collections::HashMap, time::Duration};
-use ureq::{Agent, AgentBuilder};
+use std::collections::HashMap;
 
 lazy_static! {
     static ref _CSRF: Regex = Regex::new(r"_csrf=(?P<csrf>[^(;|$)]+)").unwrap();
@@ -42,8 +42,8 @@ const USER_AGENT_LIST: [&str; 14] = [
 ];
 
 pub struct Api {
-    client: Agent,
     csrf: String,
+    endpoint: Endpoint,
 }
 
 #[allow(unused)]
@@ -56,11 +56,13 @@ enum CryptoApi {
 impl Api {
     #[allow(unused)]
     pub fn new() -> Self {
-        let client = AgentBuilder::new().timeout(Duration::from_secs(10)).build();
+        Self::with_endpoint(Endpoint::services())
+    }
 
+    pub const fn with_endpoint(endpoint: Endpoint) -> Self {
         Self {
-            client,
             csrf: String::new(),
+            endpoint,
         }
     }
 
@@ -78,7 +80,7 @@ impl Api {
         cryptoapi: CryptoApi,
         ua: &str,
     ) -> Result<String> {
-        let mut url = format!("{}{}", BASE_URL_NETEASE, path);
+        let mut url = self.endpoint.url(&format!("{}{}", BASE_URL_NETEASE, path));
         match method {
             Method::Post => {
                 let user_agent = match cryptoapi {
@@ -93,7 +95,7 @@ impl Api {
                             // QueryParams::from_map(params).json()
                             serde_json::to_string(&params)?
                         );
-                        url = "https://music.163.com/api/linux/forward".to_owned();
+                        url = self.endpoint.url("https://music.163.com/api/linux/forward");
                         Crypto::linuxapi(&data)
                     }
                     CryptoApi::Weapi => {
@@ -104,21 +106,22 @@ impl Api {
                     }
                 };
 
-                let response = self
-                    .client
-                    .post(&url)
-                    .set("Cookie", "os=pc; appver=2.7.1.198277")
-                    .set("Accept", "*/*")
-                    .set("Accept-Encoding", "gzip,deflate")
-                    // .set("Accept-Encoding", "gzip,deflate,br")
-                    // .set("Accept-Encoding", "identity")
-                    .set("Accept-Language", "en-US,en;q=0.5")
-                    .set("Connection", "keep-alive")
-                    .set("Content-Type", "application/x-www-form-urlencoded")
-                    .set("Host", "music.163.com")
-                    .set("Referer", "https://music.163.com")
-                    .set("User-Agent", &user_agent)
-                    .send_string(&body)?;
+                let response = http::send(&url, |client| {
+                    client
+                        .post(&url)
+                        .set("Cookie", "os=pc; appver=2.7.1.198277")
+                        .set("Accept", "*/*")
+                        .set("Accept-Encoding", "gzip,deflate")
+                        // .set("Accept-Encoding", "gzip,deflate,br")
+                        // .set("Accept-Encoding", "identity")
+                        .set("Accept-Language", "en-US,en;q=0.5")
+                        .set("Connection", "keep-alive")
+                        .set("Content-Type", "application/x-www-form-urlencoded")
+                        .set("Host", "music.163.com")
+                        .set("Referer", "https://music.163.com")
+                        .set("User-Agent", &user_agent)
+                        .send_string(&body)
+                })?;
 
                 if self.csrf.is_empty() {
                     let value = response.header("set-cookie");
@@ -137,7 +140,7 @@ impl Api {
                 }
                 Ok(response.into_string()?)
             }
-            Method::Get => Ok(self.client.get(&url).call()?.into_string()?),
+            Method::Get => Ok(http::send(&url, |client| client.get(&url).call())?.into_string()?),
         }
     }
 
@@ -154,29 +157,34 @@ impl Api {
         offset: u16,
         limit: u16,
     ) -> Result<String> {
-        let path = "/weapi/search/get";
-        let mut params = HashMap::new();
-        let types_str = &types.to_string();
-        let offset = &offset.to_string();
-        let limit = &limit.to_string();
-        params.insert("s", keywords);
-        params.insert("type", types_str);
-        params.insert("offset", offset);
-        params.insert("limit", limit);
-        let result = self.request(Method::Post, path, params, CryptoApi::Weapi, "")?;
+        let key = format!("netease search {} {} {} {}", keywords, types, offset, limit);
+        // the request needs self mutably, so hold the cache apart from it
+        let responses = self.endpoint.responses.clone();
+        http::cached(responses.as_deref(), &key, || {
+            let path = "/weapi/search/get";
+            let mut params = HashMap::new();
+            let types_str = &types.to_string();
+            let offset = &offset.to_string();
+            let limit = &limit.to_string();
+            params.insert("s", keywords);
+            params.insert("type", types_str);
+            params.insert("offset", offset);
+            params.insert("limit", limit);
+            let result = self.request(Method::Post, path, params, CryptoApi::Weapi, "")?;
 
-        // let mut file = std::fs::File::create("data.txt").expect("create failed");
-        // file.write_all(result.as_bytes()).expect("write failed");
+            // let mut file = std::fs::File::create("data.txt").expect("create failed");
+            // file.write_all(result.as_bytes()).expect("write failed");
 
-        match types {
-            1 => {
-                let songtag_vec =
-                    to_song_info(&result, Parse::Search).ok_or_else(|| anyhow!("Search Error"))?;
-                let songtag_string = serde_json::to_string(&songtag_vec)?;
-                Ok(songtag_string)
+            match types {
+                1 => {
+                    let songtag_vec = to_song_info(&result, Parse::Search)
+                        .ok_or_else(|| anyhow!("Search Error"))?;
+                    let songtag_string = serde_json::to_string(&songtag_vec)?;
+                    Ok((songtag_string, !songtag_vec.is_empty()))
+                }
+                _ => bail!("None Error"),
             }
-            _ => bail!("None Error"),
-        }
+        })
     }
 
     // 查询歌词
@@ -231,7 +239,8 @@ impl Api {
             id_encrypted, pic_id
         );
 
-        let result = self.client.get(&url).call()?; //.map_err(|_| Errors::None)?;
+        let url = self.endpoint.url(&url);
+        let result = http::send(&url, |client| client.get(&url).call())?;
 
         // let mut bytes: Vec<u8> = Vec::new();
         // result.into_reader().read_to_end(&mut bytes)?;
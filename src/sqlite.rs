@@ -23,12 +23,16 @@
  */
 // database
 use crate::config::{get_app_config_path, Settings};
+use crate::player::{Cached, Plays};
+use crate::saved;
 use crate::track::Track;
 use crate::utils::{filetype_supported, get_pin_yin};
+use crate::waveform::{self, Envelope};
 use rand::seq::SliceRandom;
 use rusqlite::{params, Connection, Error, Result, Row};
+use std::collections::HashMap;
 use std::path::Path;
-use std::time::{Duration, UNIX_EPOCH};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
 
 const DB_VERSION: u32 = 1;
 
@@ -120,6 +124,23 @@ impl DataBase {
         )
         .expect("create table track failed");
 
+        // playlists look their tracks up by file
+        conn.execute("create index if not exists track_file on track(file)", [])
+            .expect("create index track_file failed");
+
+        saved::create_table(&conn).expect("create table saved_playlist failed");
+
+        // kept apart from track, which is dropped on every schema change
+        conn.execute(
+            "create table if not exists play(
+             file TEXT PRIMARY KEY,
+             count INTEGER NOT NULL,
+             last_played INTEGER NOT NULL
+            )",
+            [],
+        )
+        .expect("create table play failed");
+
         let max_depth = config.max_depth_cli;
 
         Self { conn, max_depth }
@@ -358,4 +379,119 @@ impl DataBase {
         vec.sort_by_cached_key(|k| get_pin_yin(k));
         vec
     }
+
+    /// The tags the library holds for `files`, leaving out the files it does not know and
+    /// those changed since they were scanned.
+    pub fn get_cached(&self, files: &[&str]) -> HashMap<String, Cached> {
+        let mut cached = HashMap::new();
+        let mut stmt = match self.conn.prepare(
+            "SELECT artist, title, album, duration, last_modified FROM track WHERE file = ?",
+        ) {
+            Ok(stmt) => stmt,
+            Err(_) => return cached,
+        };
+        for &file in files {
+            if cached.contains_key(file) {
+                continue;
+            }
+            let row = stmt.query_row([file], |row| {
+                Ok((
+                    row.get::<_, String>(0)?,
+                    row.get::<_, String>(1)?,
+                    row.get::<_, String>(2)?,
+                    row.get::<_, u64>(3)?,
+                    row.get::<_, String>(4)?,
+                ))
+            });
+            let (artist, title, album, duration, last_modified) = match row {
+                Ok(row) => row,
+                Err(_) => continue,
+            };
+            let modified = Path::new(file)
+                .metadata()
+                .and_then(|m| m.modified())
+                .map(|t| t.duration_since(UNIX_EPOCH).unwrap_or_default().as_secs());
+            match (modified, last_modified.parse::<u64>()) {
+                (Ok(modified), Ok(scanned)) if modified <= scanned => {}
+                _ => continue,
+            }
+            // the placeholders add_records writes for missing tags
+            let known = |value: String, placeholder: &str| Some(value).filter(|v| v != placeholder);
+            cached.insert(
+                file.to_string(),
+                Cached {
+                    file: file.to_string(),
+                    duration: Duration::from_secs(duration),
+                    artist: known(artist, "Unknown Artist"),
+                    album: known(album, "empty"),
+                    title: known(title, "Unknown Title"),
+                },
+            );
+        }
+        cached
+    }
+
+    /// Count one more play of `file`, for the weighted shuffle.
+    pub fn record_play(&self, file: &str) -> Result<()> {
+        let now = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .unwrap_or_default()
+            .as_secs();
+        self.conn.execute(
+            "INSERT INTO play (file, count, last_played) VALUES (?1, 1, ?2)
+             ON CONFLICT(file) DO UPDATE SET count = count + 1, last_played = ?2",
+            params![file, now],
+        )?;
+        Ok(())
+    }
+
+    /// How often and when every file was played.
+    pub fn get_plays(&self) -> HashMap<String, Plays> {
+        let mut plays = HashMap::new();
+        if let Ok(mut stmt) = self
+            .conn
+            .prepare("SELECT file, count, last_played FROM play")
+        {
+            if let Ok(rows) = stmt.query_map([], |row| {
+                Ok((
+                    row.get::<_, String>(0)?,
+                    Plays {
+                        count: row.get(1)?,
+                        last_played: row.get(2)?,
+                    },
+                ))
+            }) {
+                plays.extend(rows.flatten());
+            }
+        }
+        plays
+    }
+
+    /// The saved playlists with the number of their tracks, by name.
+    pub fn saved_playlists(&self) -> Vec<(String, usize)> {
+        saved::list(&self.conn).unwrap_or_default()
+    }
+
+    /// Save `tracks` as the playlist `name`, replacing one of that name.
+    pub fn save_playlist(
+        &mut self,
+        name: &str,
+        tracks: impl Iterator<Item = Cached>,
+    ) -> Result<()> {
+        saved::save(&mut self.conn, name, tracks)
+    }
+
+    /// The tracks of the saved playlist `name`, from the database alone.
+    pub fn load_playlist(&self, name: &str) -> Option<Vec<Cached>> {
+        saved::load(&self.conn, name).ok().flatten()
+    }
+
+    pub fn delete_playlist(&mut self, name: &str) -> Result<()> {
+        saved::delete(&mut self.conn, name)
+    }
+
+    /// The waveform overview of `file` computed by the background analyzer, if it is current.
+    pub fn get_waveform(&self, file: &str) -> Option<Envelope> {
+        waveform::load(&self.conn, file).ok().flatten()
+    }
 }
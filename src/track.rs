@@ -21,23 +21,54 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+use crate::loudness::{parse_tag, ReplayGainTags};
+use crate::player::Cached;
 use crate::songtag::lrc::Lyric;
+use crate::utils::is_url;
 use anyhow::{bail, Result};
 use id3::frame::Lyrics;
 use lofty::id3::v2::{Frame, FrameFlags, FrameValue, ID3v2Tag, LanguageFrame, TextEncoding};
 use lofty::{
     mp3::Mp3File, Accessor, AudioFile, FileType, ItemKey, ItemValue, Picture, PictureType, TagExt,
-    TagItem,
+    TagItem, TaggedFile,
 };
 use std::convert::From;
 use std::ffi::OsStr;
 use std::fs::rename;
-use std::fs::File;
-use std::io::BufReader;
 use std::path::{Path, PathBuf};
 use std::str::FromStr;
 use std::time::Duration;
 
+/// The parts of a file `Track::read_with` reads.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Fields(u8);
+
+impl Fields {
+    /// Artist, album, title, genre, replay gain and a length tag.
+    pub const BASIC: Self = Self(0);
+    /// The lyrics frames.
+    pub const LYRICS: Self = Self(1);
+    /// The embedded picture and a cover image next to the file.
+    pub const ARTWORK: Self = Self(1 << 1);
+    /// The duration from the audio stream, which is read past the tags.
+    pub const PROPERTIES: Self = Self(1 << 2);
+    pub const ALL: Self = Self(0b111);
+    /// What a playlist row shows, the rest is read once the track plays.
+    pub const PLAYLIST: Self = Self(Self::BASIC.0 | Self::PROPERTIES.0);
+
+    pub const fn contains(self, other: Self) -> bool {
+        self.0 & other.0 == other.0
+    }
+}
+
+impl std::ops::BitOr for Fields {
+    type Output = Self;
+
+    fn bitor(self, other: Self) -> Self {
+        Self(self.0 | other.0)
+    }
+}
+
 #[derive(Clone)]
 pub struct Track {
     /// Artist of the song
@@ -71,6 +102,9 @@ pub struct Track {
     // Track
     // Genre
     genre: Option<String>,
+    replay_gain: ReplayGainTags,
+    // only what the playlist journal keeps is known, the file was not opened
+    cached: bool,
     // Composer
     // Performer
     // Disc
@@ -79,13 +113,50 @@ pub struct Track {
 
 impl Track {
     pub fn read_from_path<P: AsRef<Path>>(path: P, for_db: bool) -> Result<Self> {
+        let fields = if for_db {
+            Fields::BASIC | Fields::PROPERTIES
+        } else {
+            Fields::ALL
+        };
+        Self::read_with(path, fields)
+    }
+
+    /// Read `fields` of the file in one pass over its tags. A track read without its lyrics
+    /// or artwork is read in full by `hydrate` once it plays.
+    pub fn read_with<P: AsRef<Path>>(path: P, fields: Fields) -> Result<Self> {
         let path = path.as_ref();
+        if let Some(url) = path.to_str().filter(|p| is_url(p)) {
+            return Ok(Self::from_url(url));
+        }
 
         let probe = lofty::Probe::open(path)?;
         let file_type = probe.file_type();
+        let read_properties = fields.contains(Fields::PROPERTIES);
 
         let mut song = Self::new(path);
-        if let Ok(mut tagged_file) = probe.read(true) {
+        song.cached = !fields.contains(Fields::LYRICS | Fields::ARTWORK);
+        let mut lyric_frames: Vec<Lyrics> = Vec::new();
+        let tagged_file = match file_type {
+            // the generic tag keeps one lyrics text of an ID3v2 tag, so the USLT frames with
+            // their language are taken before the file is converted
+            Some(FileType::MP3) => Mp3File::read_from(&mut probe.into_inner(), read_properties)
+                .map(|file| {
+                    if let Some(id3v2_tag) =
+                        file.id3v2_tag().filter(|_| fields.contains(Fields::LYRICS))
+                    {
+                        for lyrics_frame in id3v2_tag.unsync_text() {
+                            lyric_frames.push(Lyrics {
+                                lang: lyrics_frame.language.clone(),
+                                description: lyrics_frame.description.clone(),
+                                text: lyrics_frame.content.clone(),
+                            });
+                        }
+                    }
+                    TaggedFile::from(file)
+                }),
+            _ => probe.read(read_properties),
+        };
+        if let Ok(mut tagged_file) = tagged_file {
             // We can at most get the duration and file type at this point
             let properties = tagged_file.properties();
             song.duration = properties.duration();
@@ -101,51 +172,49 @@ impl Track {
                 song.album = tag.album().map(str::to_string);
                 song.title = tag.title().map(str::to_string);
                 song.genre = tag.get_string(&ItemKey::Genre).map(str::to_string);
+                song.replay_gain = ReplayGainTags {
+                    track_gain: tag
+                        .get_string(&ItemKey::ReplayGainTrackGain)
+                        .and_then(parse_tag),
+                    track_peak: tag
+                        .get_string(&ItemKey::ReplayGainTrackPeak)
+                        .and_then(parse_tag),
+                    album_gain: tag
+                        .get_string(&ItemKey::ReplayGainAlbumGain)
+                        .and_then(parse_tag),
+                    album_peak: tag
+                        .get_string(&ItemKey::ReplayGainAlbumPeak)
+                        .and_then(parse_tag),
+                };
 
-                if for_db {
-                    return Ok(song);
+                if fields.contains(Fields::LYRICS) && file_type != Some(FileType::MP3) {
+                    create_lyrics(tag, &mut lyric_frames);
                 }
 
-                // Get all of the lyrics tags
-                let mut lyric_frames: Vec<Lyrics> = Vec::new();
-                match file_type {
-                    Some(FileType::MP3) => {
-                        let mut reader = BufReader::new(File::open(path)?);
-                        let file = Mp3File::read_from(&mut reader, false)?;
-
-                        if let Some(id3v2_tag) = file.id3v2_tag() {
-                            for lyrics_frame in id3v2_tag.unsync_text() {
-                                lyric_frames.push(Lyrics {
-                                    lang: lyrics_frame.language.clone(),
-                                    description: lyrics_frame.description.clone(),
-                                    text: lyrics_frame.content.clone(),
-                                });
-                            }
-                        }
-                    }
-                    _ => {
-                        create_lyrics(tag, &mut lyric_frames);
+                if fields.contains(Fields::ARTWORK) {
+                    // Get the picture (not necessarily the front cover)
+                    let mut picture = tag
+                        .pictures()
+                        .iter()
+                        .find(|pic| pic.pic_type() == PictureType::CoverFront)
+                        .cloned();
+                    if picture.is_none() {
+                        picture = tag.pictures().first().cloned();
                     }
-                };
-                song.parsed_lyric = lyric_frames
-                    .first()
-                    .map(|lf| Lyric::from_str(&lf.text).ok())
-                    .and_then(|pl| pl);
-                song.lyric_frames = lyric_frames;
-
-                // Get the picture (not necessarily the front cover)
-                let mut picture = tag
-                    .pictures()
-                    .iter()
-                    .find(|pic| pic.pic_type() == PictureType::CoverFront)
-                    .cloned();
-                if picture.is_none() {
-                    picture = tag.pictures().first().cloned();
-                }
 
-                song.picture = picture;
+                    song.picture = picture;
+                }
             }
         }
+        song.parsed_lyric = lyric_frames
+            .first()
+            .map(|lf| Lyric::from_str(&lf.text).ok())
+            .and_then(|pl| pl);
+        song.lyric_frames = lyric_frames;
+
+        if !fields.contains(Fields::ARTWORK) {
+            return Ok(song);
+        }
 
         let mut parent_folder: PathBuf = PathBuf::new();
 
@@ -169,6 +238,110 @@ impl Track {
         Ok(song)
     }
 
+    // remote tracks are streamed, their tags are not known before playing
+    fn from_url(url: &str) -> Self {
+        let name = url
+            .split(&['?', '#'][..])
+            .next()
+            .and_then(|u| u.trim_end_matches('/').rsplit('/').next())
+            .map(|n| urlencoding::decode(n).map_or_else(|_| n.to_string(), |n| n.into_owned()));
+        let p = Path::new(name.as_deref().unwrap_or_default());
+        Self {
+            ext: p.extension().and_then(OsStr::to_str).map(String::from),
+            file_type: None,
+            artist: None,
+            album: None,
+            title: p.file_stem().and_then(OsStr::to_str).map(String::from),
+            file: Some(url.to_string()),
+            directory: None,
+            duration: Duration::from_secs(0),
+            name,
+            parsed_lyric: None,
+            lyric_frames: Vec::new(),
+            lyric_selected_index: 0,
+            picture: None,
+            album_photo: None,
+            last_modified: std::time::SystemTime::now(),
+            genre: None,
+            replay_gain: ReplayGainTags::default(),
+            cached: false,
+        }
+    }
+
+    /// A track restored from the playlist journal without opening its file.
+    pub fn from_cached(cached: Cached) -> Self {
+        let p = Path::new(&cached.file);
+        Self {
+            ext: p.extension().and_then(OsStr::to_str).map(String::from),
+            file_type: None,
+            artist: cached.artist,
+            album: cached.album,
+            title: cached.title,
+            directory: p.parent().map(|d| d.to_string_lossy().into_owned()),
+            duration: cached.duration,
+            name: p.file_name().and_then(OsStr::to_str).map(String::from),
+            parsed_lyric: None,
+            lyric_frames: Vec::new(),
+            lyric_selected_index: 0,
+            picture: None,
+            album_photo: None,
+            last_modified: std::time::UNIX_EPOCH,
+            genre: None,
+            replay_gain: ReplayGainTags::default(),
+            cached: true,
+            file: Some(cached.file),
+        }
+    }
+
+    pub fn to_cached(&self) -> Option<Cached> {
+        Some(Cached {
+            file: self.file.clone()?,
+            duration: self.duration,
+            artist: self.artist.clone(),
+            album: self.album.clone(),
+            title: self.title.clone(),
+        })
+    }
+
+    /// Read `files` in their order, split over the cores. None where a file could not be read.
+    pub fn read_all(files: Vec<String>) -> Vec<Option<Self>> {
+        let workers = std::thread::available_parallelism().map_or(1, std::num::NonZeroUsize::get);
+        let chunk = ((files.len() + workers - 1) / workers).max(1);
+        let handles: Vec<_> = files
+            .chunks(chunk)
+            .map(|chunk| {
+                let chunk = chunk.to_vec();
+                let len = chunk.len();
+                let handle = std::thread::spawn(move || {
+                    chunk
+                        .iter()
+                        .map(|f| Self::read_with(f, Fields::PLAYLIST).ok())
+                        .collect::<Vec<_>>()
+                });
+                (len, handle)
+            })
+            .collect();
+        handles
+            .into_iter()
+            .flat_map(|(len, handle)| {
+                handle
+                    .join()
+                    .unwrap_or_else(|_| (0..len).map(|_| None).collect())
+            })
+            .collect()
+    }
+
+    /// The full track with lyrics and cover, read once it is about to play.
+    pub fn hydrate(self) -> Self {
+        if !self.cached {
+            return self;
+        }
+        match self.file.as_deref().map(|f| Self::read_from_path(f, false)) {
+            Some(Ok(track)) => track,
+            _ => self,
+        }
+    }
+
     fn new<P: AsRef<Path>>(path: P) -> Self {
         let p = path.as_ref();
         let directory = Some(p.parent().unwrap().to_string_lossy().into_owned());
@@ -205,6 +378,8 @@ impl Track {
             album_photo,
             last_modified,
             genre,
+            replay_gain: ReplayGainTags::default(),
+            cached: false,
         }
     }
 
@@ -333,6 +508,10 @@ impl Track {
         self.album = Some(album.to_string());
     }
 
+    pub const fn replay_gain(&self) -> &ReplayGainTags {
+        &self.replay_gain
+    }
+
     pub fn genre(&self) -> Option<&str> {
         self.genre.as_deref()
         // match self.genre.as_ref() {
@@ -437,6 +616,13 @@ impl Track {
     // }
 
     pub fn save_tag(&mut self) -> Result<()> {
+        self.write_tag()?;
+        self.rename_by_tag()?;
+        Ok(())
+    }
+
+    // write tags in place without renaming the file, used when the file may be playing
+    pub fn write_tag(&self) -> Result<()> {
         match self.file_type {
             Some(FileType::MP3) => {
                 if let Some(file_path) = self.file() {
@@ -500,7 +686,6 @@ impl Track {
             }
         }
 
-        self.rename_by_tag()?;
         Ok(())
     }
 
@@ -585,3 +770,118 @@ fn create_lyrics(tag: &mut lofty::Tag, lyric_frames: &mut Vec<Lyrics>) {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::Instant;
+
+    // a second of silent mpeg frames under a tag with lyrics and a large cover
+    fn sample(path: &Path) {
+        let mut frame = vec![0_u8; 417];
+        frame[..4].copy_from_slice(&[0xFF, 0xFB, 0x90, 0x00]);
+        std::fs::write(path, frame.repeat(38)).unwrap();
+        let mut track = Track::new(path);
+        track.file_type = Some(FileType::MP3);
+        track.set_artist("Artist");
+        track.set_album("Album");
+        track.set_title("Title");
+        track.set_lyric("[00:00.50]first line", "eng");
+        let mut cover = vec![0xFF, 0xD8, 0xFF, 0xE0];
+        cover.resize(256 * 1024, 0);
+        track.set_photo(Picture::from_reader(&mut cover.as_slice()).unwrap());
+        track.write_tag().unwrap();
+    }
+
+    #[test]
+    fn test_fields_select_what_is_read() {
+        let dir = std::env::temp_dir().join(format!("termusic-track-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("sample.mp3");
+        sample(&path);
+
+        let full = Track::read_with(&path, Fields::ALL).unwrap();
+        assert_eq!(full.title(), Some("Title"));
+        assert_eq!(full.lyric_frames_len(), 1);
+        assert!(full.parsed_lyric.is_some());
+        assert!(full.picture().is_some());
+        assert!(full.duration() > Duration::ZERO);
+        assert!(!full.cached);
+
+        let row = Track::read_with(&path, Fields::PLAYLIST).unwrap();
+        assert_eq!(row.artist(), Some("Artist"));
+        assert_eq!(row.duration(), full.duration());
+        assert!(row.lyric_frames_is_empty());
+        assert!(row.picture().is_none());
+        assert!(row.cached);
+
+        let basic = Track::read_with(&path, Fields::BASIC).unwrap();
+        assert_eq!(basic.album(), Some("Album"));
+        assert_eq!(basic.duration(), Duration::ZERO);
+
+        // what was left out is read once the track plays
+        let played = row.hydrate();
+        assert_eq!(played.lyric_frames_len(), 1);
+        assert!(played.picture().is_some());
+
+        std::fs::remove_dir_all(&dir).ok();
+    }
+
+    // cargo test --release bench_read_with -- --ignored --nocapture
+    // TERMUSIC_BENCH_DIR points it at a real library instead of generated files
+    #[test]
+    #[ignore]
+    fn bench_read_with() {
+        let dir = std::env::temp_dir().join(format!("termusic-bench-{}", std::process::id()));
+        let files: Vec<PathBuf> = match std::env::var_os("TERMUSIC_BENCH_DIR") {
+            Some(root) => walkdir::WalkDir::new(root)
+                .into_iter()
+                .filter_map(std::result::Result::ok)
+                .map(walkdir::DirEntry::into_path)
+                .filter(|p| crate::utils::filetype_supported(&p.to_string_lossy()))
+                .collect(),
+            None => {
+                std::fs::create_dir_all(&dir).unwrap();
+                sample(&dir.join("0.mp3"));
+                (1..200)
+                    .map(|i| {
+                        let path = dir.join(format!("{}.mp3", i));
+                        std::fs::copy(dir.join("0.mp3"), &path).unwrap();
+                        path
+                    })
+                    .collect()
+            }
+        };
+        let per_file = |name: &str, read: &dyn Fn(&Path)| {
+            let start = Instant::now();
+            for file in &files {
+                read(file);
+            }
+            let micros = start.elapsed().as_micros() / files.len().max(1) as u128;
+            println!("{:<30}{:>8} us/file over {}", name, micros, files.len());
+        };
+
+        // how every track was read before, the id3v2 tag of an mp3 parsed a second time
+        per_file("two passes", &|path| {
+            let tagged = lofty::Probe::open(path).unwrap().read(true);
+            let _picture = tagged
+                .ok()
+                .and_then(|t| t.primary_tag().and_then(|t| t.pictures().first().cloned()));
+            if path.extension().map_or(false, |e| e == "mp3") {
+                let mut reader = std::io::BufReader::new(std::fs::File::open(path).unwrap());
+                Mp3File::read_from(&mut reader, false).ok();
+            }
+        });
+        per_file("Fields::ALL", &|path| {
+            Track::read_with(path, Fields::ALL).ok();
+        });
+        per_file("Fields::PLAYLIST", &|path| {
+            Track::read_with(path, Fields::PLAYLIST).ok();
+        });
+        per_file("Fields::BASIC", &|path| {
+            Track::read_with(path, Fields::BASIC).ok();
+        });
+
+        std::fs::remove_dir_all(&dir).ok();
+    }
+}
@@ -41,6 +41,10 @@ pub struct GSInputPopup {
 
 impl GSInputPopup {
     pub fn new(source: Source, config: &Settings) -> Self {
+        let title = match source {
+            Source::Saved => "Save as: (name, or name.m3u8/name.xspf to export)",
+            _ => "Search for: (support * and ?)",
+        };
         Self {
             component: Input::default()
                 .background(
@@ -66,7 +70,7 @@ impl GSInputPopup {
                         .modifiers(BorderType::Rounded),
                 )
                 .input_type(InputType::Text)
-                .title("Search for: (support * and ?)", Alignment::Left),
+                .title(title, Alignment::Left),
             source,
         }
     }
@@ -120,7 +124,13 @@ impl Component<Msg, NoUserEvent> for GSInputPopup {
                 Source::Database => {
                     Some(Msg::GeneralSearch(GSMsg::PopupUpdateDatabase(input_string)))
                 }
+                Source::Saved => Some(Msg::GeneralSearch(GSMsg::PopupUpdateSaved(input_string))),
             },
+            CmdResult::Submit(State::One(StateValue::String(input_string)))
+                if matches!(self.source, Source::Saved) && !input_string.is_empty() =>
+            {
+                Some(Msg::GeneralSearch(GSMsg::PopupCloseSave(input_string)))
+            }
             CmdResult::Submit(_) => Some(Msg::GeneralSearch(GSMsg::InputBlur)),
 
             _ => Some(Msg::None),
@@ -138,6 +148,7 @@ pub enum Source {
     Library,
     Playlist,
     Database,
+    Saved,
 }
 impl GSTablePopup {
     #[allow(clippy::too_many_lines)]
@@ -151,6 +162,10 @@ impl GSTablePopup {
             config.keys.global_right
         );
         let title_database = format!("Results:( {}: load to playlist)", config.keys.global_right);
+        let title_saved = format!(
+            "Saved:(Enter: replace playlist/{}: append/{}: delete)",
+            config.keys.global_right, config.keys.playlist_delete
+        );
         match source {
             Source::Library => Self {
                 component: Table::default()
@@ -297,6 +312,54 @@ impl GSTablePopup {
                 source,
                 keys: config.keys.clone(),
             },
+            Source::Saved => Self {
+                component: Table::default()
+                    .borders(
+                        Borders::default()
+                            .color(
+                                config
+                                    .style_color_symbol
+                                    .library_border()
+                                    .unwrap_or(Color::Magenta),
+                            )
+                            .modifiers(BorderType::Rounded),
+                    )
+                    .background(
+                        config
+                            .style_color_symbol
+                            .library_background()
+                            .unwrap_or(Color::Reset),
+                    )
+                    .foreground(
+                        config
+                            .style_color_symbol
+                            .library_foreground()
+                            .unwrap_or(Color::Magenta),
+                    )
+                    .title(title_saved, Alignment::Left)
+                    .scroll(true)
+                    .highlighted_color(
+                        config
+                            .style_color_symbol
+                            .library_highlight()
+                            .unwrap_or(Color::LightBlue),
+                    )
+                    .highlighted_str(&config.style_color_symbol.library_highlight_symbol)
+                    .rewind(false)
+                    .step(4)
+                    .row_height(1)
+                    .headers(&["Tracks", "Name"])
+                    .column_spacing(3)
+                    .widths(&[10, 90])
+                    .table(
+                        TableBuilder::default()
+                            .add_col(TextSpan::from("Empty result."))
+                            .add_col(TextSpan::from("Loading..."))
+                            .build(),
+                    ),
+                source,
+                keys: config.keys.clone(),
+            },
         }
     }
 }
@@ -356,8 +419,15 @@ impl Component<Msg, NoUserEvent> for GSTablePopup {
                     Source::Database => {
                         return Some(Msg::GeneralSearch(GSMsg::PopupCloseDatabaseAddPlaylist))
                     }
+                    Source::Saved => return Some(Msg::GeneralSearch(GSMsg::PopupCloseSavedAppend)),
                 }
             }
+            Event::Keyboard(keyevent)
+                if matches!(self.source, Source::Saved)
+                    && keyevent == self.keys.playlist_delete.key_event() =>
+            {
+                return Some(Msg::GeneralSearch(GSMsg::SavedDelete))
+            }
             Event::Keyboard(KeyEvent {
                 code: Key::Enter, ..
             }) => match self.source {
@@ -368,6 +438,7 @@ impl Component<Msg, NoUserEvent> for GSTablePopup {
                     return Some(Msg::GeneralSearch(GSMsg::PopupCloseOkPlaylistLocate))
                 }
                 Source::Database => return Some(Msg::GeneralSearch(GSMsg::PopupCloseCancel)),
+                Source::Saved => return Some(Msg::GeneralSearch(GSMsg::PopupCloseSavedSwitch)),
             },
             _ => CmdResult::None,
         };
@@ -434,7 +505,7 @@ impl Model {
                 if let Some(line) = table.get(result_index) {
                     if let Some(file_name_text_span) = line.get(3) {
                         let file_name = &file_name_text_span.content;
-                        for (idx, item) in self.player.playlist.tracks.iter().enumerate() {
+                        for (idx, item) in self.player.playlist.tracks().iter().enumerate() {
                             if item.file() == Some(file_name) {
                                 index = idx;
                                 matched = true;
@@ -462,7 +533,7 @@ impl Model {
                 if let Some(line) = table.get(result_index) {
                     if let Some(file_name_text_span) = line.get(3) {
                         let file_name = &file_name_text_span.content;
-                        for (idx, item) in self.player.playlist.tracks.iter().enumerate() {
+                        for (idx, item) in self.player.playlist.tracks().iter().enumerate() {
                             if item.file() == Some(file_name) {
                                 index = idx;
                                 matched = true;
@@ -478,6 +549,18 @@ impl Model {
         self.playlist_play_selected(index);
     }
 
+    pub fn general_search_saved_selected(&self) -> Option<String> {
+        if let Ok(State::One(StateValue::Usize(index))) = self.app.state(&Id::GeneralSearchTable) {
+            if let Ok(Some(AttrValue::Table(table))) =
+                self.app.query(&Id::GeneralSearchTable, Attribute::Content)
+            {
+                let text_span = table.get(index)?.get(1)?;
+                return Some(text_span.content.clone());
+            }
+        }
+        None
+    }
+
     pub fn general_search_after_database_add_playlist(&mut self) -> Result<()> {
         if let Ok(State::One(StateValue::Usize(index))) = self.app.state(&Id::GeneralSearchTable) {
             if let Ok(Some(AttrValue::Table(table))) =
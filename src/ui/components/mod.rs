@@ -32,6 +32,7 @@ mod playlist;
 mod popups;
 mod progress;
 mod tag_editor;
+mod visualizer;
 mod xywh;
 mod youtube_search;
 
@@ -48,6 +49,7 @@ pub use popups::{
     QuitPopup,
 };
 pub use progress::Progress;
+pub use visualizer::Visualizer;
 pub use youtube_search::{YSInputPopup, YSTablePopup};
 //Tag Editor Controls,
 pub use tag_editor::{
@@ -58,6 +60,7 @@ pub use xywh::{Alignment, Xywh};
 
 use crate::config::Keys;
 use crate::player::{Loop, PlayerTrait, Status};
+use crate::songtag::ENRICH_LOOKAHEAD;
 // #[cfg(any(feature = "mpris", feature = "discord"))]
 // use crate::track::Track;
 use crate::ui::{ConfigEditorMsg, GSMsg, Id, Model, Msg, PLMsg, YSMsg};
@@ -184,6 +187,30 @@ impl Component<Msg, NoUserEvent> for GlobalListener {
                 Some(Msg::ConfigEditor(ConfigEditorMsg::Open))
             }
 
+            Event::Keyboard(keyevent)
+                if keyevent == self.keys.global_tag_suggestions_apply.key_event() =>
+            {
+                Some(Msg::TagSuggestionsApply)
+            }
+
+            Event::Keyboard(keyevent)
+                if keyevent == self.keys.global_download_cancel_all.key_event() =>
+            {
+                Some(Msg::DownloadCancelAll)
+            }
+
+            Event::Keyboard(keyevent)
+                if keyevent == self.keys.global_player_next_eq_preset.key_event() =>
+            {
+                Some(Msg::PlayerNextEqPreset)
+            }
+
+            Event::Keyboard(keyevent)
+                if keyevent == self.keys.global_visualizer_cycle.key_event() =>
+            {
+                Some(Msg::VisualizerCycle)
+            }
+
             _ => None,
         }
     }
@@ -277,6 +304,22 @@ impl Model {
                 SubEventClause::Keyboard(keys.global_config_open.key_event()),
                 SubClause::Always,
             ),
+            Sub::new(
+                SubEventClause::Keyboard(keys.global_tag_suggestions_apply.key_event()),
+                SubClause::Always,
+            ),
+            Sub::new(
+                SubEventClause::Keyboard(keys.global_download_cancel_all.key_event()),
+                SubClause::Always,
+            ),
+            Sub::new(
+                SubEventClause::Keyboard(keys.global_player_next_eq_preset.key_event()),
+                SubClause::Always,
+            ),
+            Sub::new(
+                SubEventClause::Keyboard(keys.global_visualizer_cycle.key_event()),
+                SubClause::Always,
+            ),
             Sub::new(SubEventClause::WindowResize, SubClause::Always),
         ]
     }
@@ -294,6 +337,7 @@ impl Model {
             self.mount_error_popup(format!("update photo error: {}", e).as_str());
         };
         self.progress_update_title();
+        self.progress_update_waveform();
         self.lyric_update_title();
         self.update_lyric();
         self.force_redraw();
@@ -311,14 +355,23 @@ impl Model {
                 self.discord.update(song);
             }
         }
+        if let Some(file) = self.player.playlist.get_current_track() {
+            self.db.record_play(&file).ok();
+        }
         self.time_pos = 0;
         self.playlist_sync();
         if let Err(e) = self.update_photo() {
             self.mount_error_popup(format!("update photo error: {}", e).as_str());
         };
         self.progress_update_title();
+        self.progress_update_waveform();
         self.lyric_update_title();
         self.update_playing_song();
+        if self.config.enrich_upcoming_tracks {
+            for track in self.player.playlist.tracks().iter().take(ENRICH_LOOKAHEAD) {
+                self.enricher.enqueue(track);
+            }
+        }
     }
 
     pub fn player_previous(&mut self) {
@@ -331,11 +384,9 @@ impl Model {
             return;
         }
 
-        if let Some(song) = self.player.playlist.tracks.pop_back() {
-            self.player.playlist.tracks.push_front(song);
-        }
-        if let Some(song) = self.player.playlist.tracks.pop_back() {
-            self.player.playlist.tracks.push_front(song);
+        for _ in 0..2 {
+            let last = self.player.playlist.len() - 1;
+            self.player.playlist.move_track(last, 0);
         }
         self.player.skip();
     }
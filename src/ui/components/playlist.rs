@@ -1,16 +1,16 @@
 use crate::{
-    config::{Keys, Settings},
-    player::Loop,
-    track::Track,
+    config::{get_full_path_from_config, Keys, Settings},
+    player::{Loop, Shuffle},
+    track::{Fields, Track},
     ui::{GSMsg, Id, Model, Msg, PLMsg},
 };
 
 use crate::player::PlayerTrait;
+use crate::playlist::ExportItem;
 use crate::sqlite::TrackForDB;
-use crate::utils::{filetype_supported, is_playlist};
+use crate::utils::{filetype_supported, is_playlist, is_url};
 use anyhow::{anyhow, bail, Result};
-use rand::seq::SliceRandom;
-use rand::thread_rng;
+use std::collections::HashMap;
 use std::path::{Path, PathBuf};
 use std::time::Duration;
 use tui_realm_stdlib::Table;
@@ -131,6 +131,9 @@ impl Component<Msg, NoUserEvent> for Playlist {
             Event::Keyboard(key) if key == self.keys.playlist_shuffle.key_event() => {
                 return Some(Msg::Playlist(PLMsg::Shuffle))
             }
+            Event::Keyboard(key) if key == self.keys.playlist_shuffle_mode_cycle.key_event() => {
+                return Some(Msg::Playlist(PLMsg::ShuffleModeCycle))
+            }
             Event::Keyboard(key) if key == self.keys.playlist_mode_cycle.key_event() => {
                 return Some(Msg::Playlist(PLMsg::LoopModeCycle))
             }
@@ -146,6 +149,9 @@ impl Component<Msg, NoUserEvent> for Playlist {
             Event::Keyboard(key) if key == self.keys.playlist_search.key_event() => {
                 return Some(Msg::GeneralSearch(GSMsg::PopupShowPlaylist))
             }
+            Event::Keyboard(key) if key == self.keys.playlist_saved.key_event() => {
+                return Some(Msg::GeneralSearch(GSMsg::PopupShowSaved))
+            }
             Event::Keyboard(key) if key == self.keys.playlist_swap_down.key_event() => {
                 match self.component.state() {
                     State::One(StateValue::Usize(index_selected)) => {
@@ -170,6 +176,12 @@ impl Component<Msg, NoUserEvent> for Playlist {
             Event::Keyboard(key) if key == self.keys.playlist_cmus_tqueue.key_event() => {
                 return Some(Msg::Playlist(PLMsg::CmusTQueue));
             }
+            Event::Keyboard(key) if key == self.keys.playlist_undo.key_event() => {
+                return Some(Msg::Playlist(PLMsg::Undo));
+            }
+            Event::Keyboard(key) if key == self.keys.playlist_redo.key_event() => {
+                return Some(Msg::Playlist(PLMsg::Redo));
+            }
             _ => CmdResult::None,
         };
         Some(Msg::None)
@@ -195,36 +207,35 @@ impl Model {
         let str = std::fs::read_to_string(p)?;
         let items =
             crate::playlist::decode(&str).map_err(|e| anyhow!("playlist decode error: {}", e))?;
-        let mut vec = vec![];
-        for item in items {
-            if !filetype_supported(&item) {
-                continue;
-            }
-            if let Ok(pathbuf) = Self::playlist_get_absolute_pathbuf(&item, p_base) {
-                vec.push(pathbuf.to_string_lossy().to_string());
-            }
-        }
+        let vec: Vec<String> = items
+            .iter()
+            .filter_map(|item| {
+                if is_url(item) {
+                    return Some(item.to_string());
+                }
+                if !filetype_supported(item) {
+                    return None;
+                }
+                Self::playlist_get_absolute_pathbuf(item, p_base)
+                    .ok()
+                    .map(|pathbuf| pathbuf.to_string_lossy().into_owned())
+            })
+            .collect();
         self.playlist_add_items_common(&vec);
-        self.playlist_sync();
         Ok(())
     }
 
     fn playlist_get_absolute_pathbuf(item: &str, p_base: &Path) -> Result<PathBuf> {
-        let url_decoded = urlencoding::decode(item)?.into_owned();
-        let mut url = url_decoded.clone();
-        let mut pathbuf = PathBuf::from(p_base);
+        let url_decoded = urlencoding::decode(item)?;
         if url_decoded.starts_with("http") {
             bail!("http not supported");
         }
-        if url_decoded.starts_with("file") {
-            url = url_decoded.replace("file://", "");
-        }
-        if Path::new(&url).is_relative() {
-            pathbuf.push(url);
+        let url = url_decoded.strip_prefix("file://").unwrap_or(&url_decoded);
+        if Path::new(url).is_relative() {
+            Ok(p_base.join(url))
         } else {
-            pathbuf = PathBuf::from(url);
+            Ok(PathBuf::from(url))
         }
-        Ok(pathbuf)
     }
 
     fn playlist_add_item(&mut self, current_node: &str, add_playlist_front: bool) -> Result<()> {
@@ -232,14 +243,14 @@ impl Model {
             self.playlist_add_playlist(current_node)?;
             return Ok(());
         }
-        if !filetype_supported(current_node) {
+        if !filetype_supported(current_node) && !is_url(current_node) {
             return Ok(());
         }
-        let item = Track::read_from_path(current_node, false)?;
+        let item = Track::read_with(current_node, Fields::PLAYLIST)?;
         if add_playlist_front {
-            self.player.playlist.tracks.push_front(item);
+            self.player.playlist.push_front(item);
         } else {
-            self.player.playlist.tracks.push_back(item);
+            self.player.playlist.push_back(item);
         }
         self.playlist_sync();
         Ok(())
@@ -251,6 +262,7 @@ impl Model {
             return;
         }
 
+        self.player.playlist.remember();
         if p.is_dir() {
             self.playlist_add_all_from_treeview(p);
         } else if let Err(e) = self.playlist_add_item(current_node, self.config.add_playlist_front)
@@ -260,30 +272,50 @@ impl Model {
     }
 
     fn playlist_add_items_common(&mut self, vec: &[String]) {
-        let mut index = 0;
-        for s in vec {
-            if !filetype_supported(s) {
-                continue;
-            }
-            if self.config.add_playlist_front {
-                if let Ok(item) = Track::read_from_path(s, false) {
-                    self.player.playlist.tracks.insert(index, item);
-                    index += 1;
-                }
-                continue;
+        let files: Vec<&str> = vec
+            .iter()
+            .map(String::as_str)
+            .filter(|s| filetype_supported(s) || is_url(s))
+            .collect();
+        let tracks = self.playlist_read_tracks(&files);
+        if self.config.add_playlist_front {
+            for (index, track) in tracks.into_iter().enumerate() {
+                self.player.playlist.insert(index, track);
+            }
+        } else {
+            for track in tracks {
+                self.player.playlist.push_back(track);
             }
-
-            self.playlist_add_item(s, false).ok();
         }
         self.playlist_sync();
     }
 
+    // the tracks of `files` in order, from the library where it is current and read on every
+    // core otherwise, lyrics and covers are read once a track plays
+    fn playlist_read_tracks(&self, files: &[&str]) -> Vec<Track> {
+        let cached = self.db.get_cached(files);
+        let unread = files
+            .iter()
+            .filter(|f| !cached.contains_key(**f))
+            .map(|f| (*f).to_string())
+            .collect();
+        let mut read = Track::read_all(unread).into_iter();
+        files
+            .iter()
+            .filter_map(|f| match cached.get(*f) {
+                Some(c) => Some(Track::from_cached(c.clone())),
+                None => read.next().flatten(),
+            })
+            .collect()
+    }
+
     fn playlist_add_all_from_treeview(&mut self, p: &Path) {
         let new_items = Self::library_dir_children(p);
         self.playlist_add_items_common(&new_items);
     }
 
     pub fn playlist_add_all_from_db(&mut self, vec: &[TrackForDB]) {
+        self.player.playlist.remember();
         let vec2: Vec<String> = vec.iter().map(|f| f.file.clone()).collect();
         self.playlist_add_items_common(&vec2);
     }
@@ -305,7 +337,7 @@ impl Model {
     pub fn playlist_sync(&mut self) {
         let mut table: TableBuilder = TableBuilder::default();
 
-        for (idx, record) in self.player.playlist.tracks.iter().enumerate() {
+        for (idx, record) in self.player.playlist.tracks().iter().enumerate() {
             if idx > 0 {
                 table.add_row();
             }
@@ -324,7 +356,7 @@ impl Model {
                 .add_col(TextSpan::new(title).bold())
                 .add_col(TextSpan::new(record.album().unwrap_or("Unknown Album")));
         }
-        if self.player.playlist.tracks.is_empty() {
+        if self.player.playlist.tracks().is_empty() {
             table.add_col(TextSpan::from("0"));
             table.add_col(TextSpan::from("empty playlist"));
             table.add_col(TextSpan::from(""));
@@ -346,29 +378,124 @@ impl Model {
         if self.player.playlist.is_empty() {
             return;
         }
-        self.player.playlist.tracks.remove(index);
+        self.player.playlist.remember();
+        self.player.playlist.remove(index);
         self.playlist_sync();
     }
 
     pub fn playlist_empty(&mut self) {
-        self.player.playlist.tracks.clear();
+        self.player.playlist.remember();
+        self.player.playlist.clear();
         self.playlist_sync();
     }
 
     pub fn playlist_shuffle(&mut self) {
-        let mut rng = thread_rng();
+        let plays = match self.config.shuffle_mode {
+            Shuffle::Weighted => self.db.get_plays(),
+            _ => HashMap::new(),
+        };
+        self.player.playlist.remember();
         self.player
             .playlist
-            .tracks
-            .make_contiguous()
-            .shuffle(&mut rng);
+            .shuffle(self.config.shuffle_mode, &plays);
+        self.playlist_sync();
+    }
+
+    pub fn playlist_undo(&mut self) {
+        if self.player.playlist.undo() {
+            self.playlist_sync();
+        }
+    }
+
+    pub fn playlist_redo(&mut self) {
+        if self.player.playlist.redo() {
+            self.playlist_sync();
+        }
+    }
+
+    pub fn playlist_update_saved_search(&mut self, input: &str) {
+        let mut table: TableBuilder = TableBuilder::default();
+        let search = wildmatch::WildMatch::new(&format!("*{}*", input.to_lowercase()));
+        let saved = self.db.saved_playlists();
+        let mut idx = 0;
+        for (name, len) in &saved {
+            if search.matches(&name.to_lowercase()) {
+                if idx > 0 {
+                    table.add_row();
+                }
+                table
+                    .add_col(TextSpan::new(len.to_string()))
+                    .add_col(TextSpan::new(name).bold());
+                idx += 1;
+            }
+        }
+        if saved.is_empty() {
+            table.add_col(TextSpan::from("0"));
+            table.add_col(TextSpan::from("no saved playlist"));
+        }
+        let table = table.build();
+
+        self.general_search_update_show(table);
+    }
+
+    /// Store the playlist under `name`, or export it when `name` ends in .m3u, .m3u8 or .xspf.
+    pub fn playlist_save_as(&mut self, name: &str) -> Result<()> {
+        if !is_playlist(name) {
+            let tracks = self
+                .player
+                .playlist
+                .tracks()
+                .iter()
+                .filter_map(Track::to_cached);
+            self.db.save_playlist(name, tracks)?;
+            return Ok(());
+        }
+        let mut path = PathBuf::from(shellexpand::tilde(name).as_ref());
+        if path.is_relative() {
+            path = get_full_path_from_config(&self.config).join(path);
+        }
+        let items: Vec<ExportItem<'_>> = self
+            .player
+            .playlist
+            .tracks()
+            .iter()
+            .filter_map(|track| {
+                Some(ExportItem {
+                    location: track.file()?,
+                    artist: track.artist(),
+                    album: track.album(),
+                    title: track.title(),
+                    duration: track.duration(),
+                })
+            })
+            .collect();
+        let text = crate::playlist::encode(&path, &items)
+            .ok_or_else(|| anyhow!("only m3u, m3u8 and xspf can be exported"))?;
+        std::fs::write(&path, text)?;
+        Ok(())
+    }
+
+    // replace the playlist with a saved one, or append it, either can be undone
+    pub fn playlist_load_saved(&mut self, name: &str, append: bool) {
+        let cached = match self.db.load_playlist(name) {
+            Some(cached) => cached,
+            None => return,
+        };
+        self.player.playlist.remember();
+        let tracks = cached.into_iter().map(Track::from_cached);
+        if append {
+            for track in tracks {
+                self.player.playlist.push_back(track);
+            }
+        } else {
+            self.player.playlist.set_tracks(tracks);
+        }
         self.playlist_sync();
     }
 
     pub fn playlist_update_library_delete(&mut self) {
         self.player
             .playlist
-            .tracks
             .retain(|x| x.file().map_or(false, |p| Path::new(p).exists()));
 
         self.playlist_sync();
@@ -376,7 +503,7 @@ impl Model {
 
     pub fn playlist_update_title(&mut self) {
         let mut duration = Duration::from_secs(0);
-        for v in &self.player.playlist.tracks {
+        for v in self.player.playlist.tracks() {
             duration += v.duration();
         }
         let add_queue = if self.config.add_playlist_front {
@@ -394,10 +521,11 @@ impl Model {
             "last"
         };
         let title = format!(
-            "\u{2500} Playlist \u{2500}\u{2500}\u{2524} Total {} tracks | {} | Mode: {} | Add to: {} \u{251c}\u{2500}",
+            "\u{2500} Playlist \u{2500}\u{2500}\u{2524} Total {} tracks | {} | Mode: {} | Shuffle: {} | Add to: {} \u{251c}\u{2500}",
             self.player.playlist.len(),
             Track::duration_formatted_short(&duration),
             self.config.loop_mode.display(self.config.playlist_display_symbol),
+            self.config.shuffle_mode.display(self.config.playlist_display_symbol),
             add_queue
         );
         self.app
@@ -415,24 +543,27 @@ impl Model {
             }
             Loop::Playlist => {
                 self.config.loop_mode = Loop::Single;
-                if let Some(song) = self.player.playlist.tracks.pop_back() {
-                    self.player.playlist.tracks.push_front(song);
-                }
+                let last = self.player.playlist.len().saturating_sub(1);
+                self.player.playlist.move_track(last, 0);
             }
             Loop::Single => {
                 self.config.loop_mode = Loop::Queue;
-                if let Some(song) = self.player.playlist.tracks.pop_front() {
-                    self.player.playlist.tracks.push_back(song);
-                }
+                let last = self.player.playlist.len().saturating_sub(1);
+                self.player.playlist.move_track(0, last);
             }
         };
         self.player.config.loop_mode = self.config.loop_mode;
         self.playlist_sync();
         self.playlist_update_title();
     }
+
+    pub fn playlist_cycle_shuffle_mode(&mut self) {
+        self.config.shuffle_mode = self.config.shuffle_mode.next();
+        self.playlist_update_title();
+    }
     pub fn playlist_play_selected(&mut self, index: usize) {
-        if let Some(song) = self.player.playlist.tracks.remove(index) {
-            self.player.playlist.tracks.push_front(song);
+        if index < self.player.playlist.len() {
+            self.player.playlist.move_track(index, 0);
             self.playlist_sync();
             self.player.stop();
             // self.status = Some(Status::Stopped);
@@ -444,7 +575,7 @@ impl Model {
         let mut table: TableBuilder = TableBuilder::default();
         let mut idx = 0;
         let search = format!("*{}*", input.to_lowercase());
-        for record in &self.player.playlist.tracks {
+        for record in self.player.playlist.tracks() {
             let artist = record.artist().unwrap_or("Unknown artist");
             let title = record.title().unwrap_or("Unknown title");
             if wildmatch::WildMatch::new(&search).matches(&artist.to_lowercase())
@@ -281,6 +281,36 @@ impl HelpPopup {
                         )
                         .add_col(TextSpan::from("Toggle gapless playback"))
                         .add_row()
+                        .add_col(
+                            TextSpan::new(format!("<{}>", keys.global_tag_suggestions_apply))
+                                .bold()
+                                .fg(Color::Cyan),
+                        )
+                        .add_col(TextSpan::from(
+                            "Apply lyrics and covers found in background",
+                        ))
+                        .add_row()
+                        .add_col(
+                            TextSpan::new(format!("<{}>", keys.global_download_cancel_all))
+                                .bold()
+                                .fg(Color::Cyan),
+                        )
+                        .add_col(TextSpan::from("Cancel running and queued downloads"))
+                        .add_row()
+                        .add_col(
+                            TextSpan::new(format!("<{}>", keys.global_player_next_eq_preset))
+                                .bold()
+                                .fg(Color::Cyan),
+                        )
+                        .add_col(TextSpan::from("Switch to the next equalizer preset"))
+                        .add_row()
+                        .add_col(
+                            TextSpan::new(format!("<{}>", keys.global_visualizer_cycle))
+                                .bold()
+                                .fg(Color::Cyan),
+                        )
+                        .add_col(TextSpan::from("Cycle lyrics, spectrum and oscilloscope"))
+                        .add_row()
                         .add_col(TextSpan::new(key_lyric_adjust).bold().fg(Color::Cyan))
                         .add_col(TextSpan::from("Before 10 seconds,adjust offset of lyrics"))
                         .add_row()
@@ -401,11 +431,14 @@ impl HelpPopup {
                         .add_col(TextSpan::from("Play selected"))
                         .add_row()
                         .add_col(
-                            TextSpan::new(format!("<{}>", keys.playlist_shuffle))
-                                .bold()
-                                .fg(Color::Cyan),
+                            TextSpan::new(format!(
+                                "<{}>/<{}>",
+                                keys.playlist_shuffle, keys.playlist_shuffle_mode_cycle
+                            ))
+                            .bold()
+                            .fg(Color::Cyan),
                         )
-                        .add_col(TextSpan::from("Randomize playlist"))
+                        .add_col(TextSpan::from("Randomize playlist/shuffle mode toggle"))
                         .add_row()
                         .add_col(
                             TextSpan::new(format!("<{}>", keys.playlist_mode_cycle))
@@ -447,6 +480,23 @@ impl HelpPopup {
                         )
                         .add_col(TextSpan::from("Select random tracks/albums to playlist"))
                         .add_row()
+                        .add_col(
+                            TextSpan::new(format!(
+                                "<{}>/<{}>",
+                                keys.playlist_undo, keys.playlist_redo
+                            ))
+                            .bold()
+                            .fg(Color::Cyan),
+                        )
+                        .add_col(TextSpan::from("Undo/redo playlist edit"))
+                        .add_row()
+                        .add_col(
+                            TextSpan::new(format!("<{}>", keys.playlist_saved))
+                                .bold()
+                                .fg(Color::Cyan),
+                        )
+                        .add_col(TextSpan::from("Save, export or load named playlists"))
+                        .add_row()
                         .add_col(TextSpan::new("Database").bold().fg(Color::LightYellow))
                         .add_row()
                         .add_col(
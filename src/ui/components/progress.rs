@@ -1,45 +1,59 @@
 use crate::config::Settings;
 use crate::track::Track;
 use crate::ui::{Id, Model, Msg};
+use crate::waveform;
 
 use std::time::Duration;
 use tui_realm_stdlib::ProgressBar;
+use tuirealm::command::{Cmd, CmdResult};
 use tuirealm::event::NoUserEvent;
-use tuirealm::props::{Alignment, BorderType, Borders, Color, PropPayload, PropValue};
-use tuirealm::{AttrValue, Attribute, Component, Event, MockComponent};
+use tuirealm::props::{Alignment, BorderType, Borders, Color, PropPayload, PropValue, Style};
+use tuirealm::tui::buffer::Buffer;
+use tuirealm::tui::layout::Rect;
+use tuirealm::tui::widgets::{Block, Widget};
+use tuirealm::{AttrValue, Attribute, Component, Event, Frame, MockComponent, State};
+
+// the quietest rms that still shows in the waveform
+const WAVEFORM_RANGE_DB: f32 = 40.0;
+const BARS: [&str; 9] = [" ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"];
 
-#[derive(MockComponent)]
 pub struct Progress {
     component: ProgressBar,
+    // rms of each bucket of the playing track, empty draws the plain bar
+    waveform: Vec<f32>,
+    border: Color,
+    foreground: Color,
+    background: Color,
 }
 
 impl Progress {
     #[allow(clippy::cast_precision_loss)]
     pub fn new(config: &Settings) -> Self {
+        let border = config
+            .style_color_symbol
+            .progress_border()
+            .unwrap_or(Color::LightMagenta);
+        let background = config
+            .style_color_symbol
+            .progress_background()
+            .unwrap_or(Color::Reset);
+        let foreground = config
+            .style_color_symbol
+            .progress_foreground()
+            .unwrap_or(Color::Yellow);
         Self {
+            waveform: Vec::new(),
+            border,
+            foreground,
+            background,
             component: ProgressBar::default()
                 .borders(
                     Borders::default()
-                        .color(
-                            config
-                                .style_color_symbol
-                                .progress_border()
-                                .unwrap_or(Color::LightMagenta),
-                        )
+                        .color(border)
                         .modifiers(BorderType::Rounded),
                 )
-                .background(
-                    config
-                        .style_color_symbol
-                        .progress_background()
-                        .unwrap_or(Color::Reset),
-                )
-                .foreground(
-                    config
-                        .style_color_symbol
-                        .progress_foreground()
-                        .unwrap_or(Color::Yellow),
-                )
+                .background(background)
+                .foreground(foreground)
                 .label("Progress")
                 .title(
                     format!(
@@ -54,6 +68,130 @@ impl Progress {
     }
 }
 
+/// The overview of the whole track, the played part in the foreground color.
+struct WaveformBar<'a> {
+    columns: &'a [f32],
+    played: usize,
+    label: &'a str,
+    played_style: Style,
+    unplayed_style: Style,
+}
+
+impl Widget for WaveformBar<'_> {
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_precision_loss,
+        clippy::cast_sign_loss
+    )]
+    fn render(self, area: Rect, buf: &mut Buffer) {
+        let rows = usize::from(area.height);
+        for (x, level) in self
+            .columns
+            .iter()
+            .enumerate()
+            .take(usize::from(area.width))
+        {
+            let style = if x < self.played {
+                self.played_style
+            } else {
+                self.unplayed_style
+            };
+            // height in eighths of a cell, stacked up from the bottom row
+            let eighths = (level * (rows * 8) as f32).round() as usize;
+            for row in 0..rows {
+                let fill = eighths.saturating_sub(row * 8).min(8);
+                let y = area.bottom() - 1 - row as u16;
+                buf.get_mut(area.left() + x as u16, y)
+                    .set_symbol(BARS[fill])
+                    .set_style(style);
+            }
+        }
+        let width = self.label.chars().count() as u16;
+        if width <= area.width {
+            buf.set_string(
+                area.left() + (area.width - width) / 2,
+                area.top() + area.height / 2,
+                self.label,
+                self.played_style,
+            );
+        }
+    }
+}
+
+impl MockComponent for Progress {
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_precision_loss,
+        clippy::cast_sign_loss
+    )]
+    fn view(&mut self, frame: &mut Frame<'_>, area: Rect) {
+        if self.waveform.is_empty() {
+            self.component.view(frame, area);
+            return;
+        }
+
+        let mut block = Block::default()
+            .borders(tuirealm::tui::widgets::Borders::ALL)
+            .border_type(tuirealm::tui::widgets::BorderType::Rounded)
+            .border_style(Style::default().fg(self.border));
+        if let Some(AttrValue::Title((title, alignment))) = self.query(Attribute::Title) {
+            block = block.title(title).title_alignment(alignment);
+        }
+        let inner = block.inner(area);
+        frame.render_widget(block, area);
+
+        let progress = match self.query(Attribute::Value) {
+            Some(AttrValue::Payload(PropPayload::One(PropValue::F64(progress)))) => progress,
+            _ => 0.0,
+        };
+        let label = match self.query(Attribute::Text) {
+            Some(AttrValue::String(label)) => label,
+            _ => String::new(),
+        };
+        let width = usize::from(inner.width);
+        let columns = waveform::columns(&self.waveform, width, WAVEFORM_RANGE_DB);
+        frame.render_widget(
+            WaveformBar {
+                columns: &columns,
+                played: (progress * width as f64).round() as usize,
+                label: &label,
+                played_style: Style::default().fg(self.foreground).bg(self.background),
+                unplayed_style: Style::default().fg(Color::DarkGray).bg(self.background),
+            },
+            inner,
+        );
+    }
+
+    fn query(&self, attr: Attribute) -> Option<AttrValue> {
+        self.component.query(attr)
+    }
+
+    fn attr(&mut self, attr: Attribute, value: AttrValue) {
+        if attr == Attribute::Custom("waveform") {
+            self.waveform = match value {
+                AttrValue::Payload(PropPayload::Vec(levels)) => levels
+                    .into_iter()
+                    .filter_map(|v| match v {
+                        PropValue::F32(db) => Some(db),
+                        _ => None,
+                    })
+                    .collect(),
+                _ => Vec::new(),
+            };
+            return;
+        }
+        self.component.attr(attr, value);
+    }
+
+    fn state(&self) -> State {
+        self.component.state()
+    }
+
+    fn perform(&mut self, cmd: Cmd) -> CmdResult {
+        self.component.perform(cmd)
+    }
+}
+
 impl Component<Msg, NoUserEvent> for Progress {
     fn on(&mut self, _ev: Event<NoUserEvent>) -> Option<Msg> {
         Some(Msg::None)
@@ -70,6 +208,7 @@ impl Model {
                 Vec::new()
             )
             .is_ok());
+        self.progress_update_waveform();
         // self.progress_update_title();
     }
 
@@ -77,11 +216,12 @@ impl Model {
     pub fn progress_update_title(&mut self) {
         let gapless = if self.config.gapless { "True" } else { "False" };
         let progress_title = format!(
-            " Status: {} | Volume: {} | Speed: {:^.1} | Gapless: {} ",
+            " Status: {} | Volume: {} | Speed: {:^.1} | Gapless: {} | EQ: {} ",
             self.player.status(),
             self.config.volume,
             self.config.speed as f32 / 10.0,
             gapless,
+            self.config.eq_preset,
         );
         self.app
             .attr(
@@ -100,13 +240,15 @@ impl Model {
         }
 
         self.time_pos = time_pos;
+        self.player.playlist.checkpoint(time_pos);
 
         let progress = (time_pos * 100).checked_div(duration).unwrap() as f64;
 
         let new_prog = Self::progress_safeguard(progress);
 
-        // About to finish signal is a simulation of gstreamer, and used for gapless
-        #[cfg(any(not(feature = "gst"), feature = "mpv"))]
+        // About to finish signal is a simulation of gstreamer, and used for gapless. The rusty
+        // backend sends it from the audio thread.
+        #[cfg(feature = "mpv")]
         if !self.player.playlist.is_empty()
             && !self.player.has_next_track()
             && new_prog >= 0.5
@@ -122,6 +264,34 @@ impl Model {
         self.progress_set(new_prog, duration);
     }
 
+    /// Draw the overview of the playing track in the progress bar, or the plain bar when it is
+    /// not analyzed yet or the waveform is turned off.
+    pub fn progress_update_waveform(&mut self) {
+        let levels = self
+            .player
+            .playlist
+            .current_track
+            .as_ref()
+            .filter(|_| self.config.progress_waveform)
+            .and_then(Track::file)
+            .and_then(|file| self.db.get_waveform(file))
+            .map(|envelope| {
+                envelope
+                    .buckets
+                    .iter()
+                    .map(|b| PropValue::F32(b.rms_db))
+                    .collect()
+            })
+            .unwrap_or_default();
+        self.app
+            .attr(
+                &Id::Progress,
+                Attribute::Custom("waveform"),
+                AttrValue::Payload(PropPayload::Vec(levels)),
+            )
+            .ok();
+    }
+
     fn progress_safeguard(progress: f64) -> f64 {
         let mut new_prog = progress / 100.0;
         if new_prog > 1.0 {
@@ -21,7 +21,8 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
-use crate::songtag::{search, SongTag};
+use crate::download::DownloadJob;
+use crate::songtag::{search, Endpoint, SongTag};
 use crate::ui::{Id, IdTagEditor, Model, Msg, SearchLyricState, TEMsg};
 
 use anyhow::{anyhow, Context, Result};
@@ -240,7 +241,13 @@ impl Model {
             .with_context(|| format!("no song_tag with index {} found", index))?;
         if let Some(song) = &self.tageditor_song {
             let file = song.file().context("no file path found")?;
-            song_tag.download(file, &self.sender)?;
+            let dir = Path::new(file)
+                .parent()
+                .unwrap_or_else(|| Path::new("/tmp"));
+            self.download_manager.enqueue(&DownloadJob::SongTag {
+                song_tag: Box::new(song_tag.clone()),
+                dir: dir.to_string_lossy().to_string(),
+            })?;
         }
         Ok(())
     }
@@ -283,10 +290,10 @@ impl Model {
                 song.set_album(album);
             }
 
-            if let Ok(lyric_string) = song_tag.fetch_lyric() {
+            if let Ok(lyric_string) = song_tag.fetch_lyric(&Endpoint::services()) {
                 song.set_lyric(&lyric_string, lang_ext);
             }
-            if let Ok(artwork) = song_tag.fetch_photo() {
+            if let Ok(artwork) = song_tag.fetch_photo(&Endpoint::services()) {
                 song.set_photo(artwork);
             }
 
@@ -0,0 +1,179 @@
+use crate::config::Settings;
+use crate::ui::model::{VisualShared, VisualizerMode};
+use crate::ui::{Id, Model, Msg};
+use std::sync::atomic::Ordering;
+use std::sync::Arc;
+
+use tuirealm::command::{Cmd, CmdResult};
+use tuirealm::event::NoUserEvent;
+use tuirealm::props::{Color, Style};
+use tuirealm::tui::layout::Rect;
+use tuirealm::tui::symbols::Marker;
+use tuirealm::tui::widgets::canvas::{Canvas, Points};
+use tuirealm::tui::widgets::{Block, BorderType, Borders, Sparkline};
+use tuirealm::{AttrValue, Attribute, Component, Event, Frame, MockComponent, Props, State};
+
+/// Draws the spectrum or the waveform of what is playing in place of the lyrics.
+pub struct Visualizer {
+    props: Props,
+    shared: Arc<VisualShared>,
+    mode: VisualizerMode,
+    foreground: Color,
+    background: Color,
+    border: Color,
+}
+
+impl Visualizer {
+    pub fn new(config: &Settings, shared: Arc<VisualShared>, mode: VisualizerMode) -> Self {
+        Self {
+            props: Props::default(),
+            shared,
+            mode,
+            foreground: config
+                .style_color_symbol
+                .lyric_foreground()
+                .unwrap_or(Color::Cyan),
+            background: config
+                .style_color_symbol
+                .lyric_background()
+                .unwrap_or(Color::Reset),
+            border: config
+                .style_color_symbol
+                .lyric_border()
+                .unwrap_or(Color::Green),
+        }
+    }
+}
+
+impl MockComponent for Visualizer {
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_precision_loss,
+        clippy::cast_sign_loss
+    )]
+    fn view(&mut self, frame: &mut Frame<'_>, area: Rect) {
+        self.shared.fresh.store(false, Ordering::Release);
+        let visual = self.shared.frame.lock().unwrap().clone();
+
+        let name = match self.mode {
+            VisualizerMode::Oscilloscope => "Oscilloscope",
+            _ => "Spectrum",
+        };
+        let title = if visual.wave.is_empty() {
+            format!(" {} ", name)
+        } else {
+            format!(
+                " {} | Peak: {:.1} dB | RMS: {:.1} dB ",
+                name, visual.peak_db, visual.rms_db
+            )
+        };
+        let block = Block::default()
+            .borders(Borders::ALL)
+            .border_type(BorderType::Rounded)
+            .border_style(Style::default().fg(self.border))
+            .title(title);
+        let style = Style::default().fg(self.foreground).bg(self.background);
+        let inner = block.inner(area);
+
+        // one value per column, whatever the width of the pane
+        let width = usize::from(inner.width).max(1);
+        match self.mode {
+            VisualizerMode::Oscilloscope => {
+                let points = width * 2;
+                let coords: Vec<(f64, f64)> = (0..points)
+                    .filter_map(|x| {
+                        let index = x * visual.wave.len() / points;
+                        visual
+                            .wave
+                            .get(index)
+                            .map(|&y| (x as f64, f64::from(y.clamp(-1.0, 1.0))))
+                    })
+                    .collect();
+                let color = self.foreground;
+                frame.render_widget(
+                    Canvas::default()
+                        .block(block)
+                        .background_color(self.background)
+                        .marker(Marker::Braille)
+                        .x_bounds([0.0, points as f64])
+                        .y_bounds([-1.0, 1.0])
+                        .paint(|ctx| {
+                            ctx.draw(&Points {
+                                coords: &coords,
+                                color,
+                            });
+                        }),
+                    area,
+                );
+            }
+            _ => {
+                let bars: Vec<u64> = (0..width)
+                    .map(|x| {
+                        visual
+                            .bands
+                            .get(x * visual.bands.len() / width)
+                            .map_or(0, |&b| (b * 100.0) as u64)
+                    })
+                    .collect();
+                frame.render_widget(
+                    Sparkline::default()
+                        .block(block)
+                        .style(style)
+                        .data(&bars)
+                        .max(100),
+                    area,
+                );
+            }
+        }
+    }
+
+    fn query(&self, attr: Attribute) -> Option<AttrValue> {
+        self.props.get(attr)
+    }
+
+    fn attr(&mut self, attr: Attribute, value: AttrValue) {
+        self.props.set(attr, value);
+    }
+
+    fn state(&self) -> State {
+        State::None
+    }
+
+    fn perform(&mut self, _cmd: Cmd) -> CmdResult {
+        CmdResult::None
+    }
+}
+
+impl Component<Msg, NoUserEvent> for Visualizer {
+    fn on(&mut self, _ev: Event<NoUserEvent>) -> Option<Msg> {
+        None
+    }
+}
+
+impl Model {
+    /// Lyrics, then the spectrum, then the oscilloscope in the pane below the progress bar.
+    pub fn visualizer_cycle(&mut self) {
+        if !self.visualizer.is_available() {
+            self.mount_error_popup("The visualizer needs the built-in audio backend.");
+            return;
+        }
+        self.visualizer_mode = self.visualizer_mode.next();
+        self.visualizer
+            .set_active(self.visualizer_mode != VisualizerMode::Off);
+        if self.visualizer_mode == VisualizerMode::Off {
+            self.app.umount(&Id::Visualizer).ok();
+            return;
+        }
+        self.app
+            .remount(
+                Id::Visualizer,
+                Box::new(Visualizer::new(
+                    &self.config,
+                    self.visualizer.shared(),
+                    self.visualizer_mode,
+                )),
+                Vec::new(),
+            )
+            .ok();
+    }
+}
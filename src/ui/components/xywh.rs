@@ -27,14 +27,18 @@
 // -- export
 // pub use clock::Clock;
 // pub use counter::{Digit, Letter};
-use crate::ui::{model::ViuerSupported, Id, IdConfigEditor, IdTagEditor, Model};
+use crate::ui::{
+    model::{Artwork, ArtworkCache, ViuerSupported},
+    Id, IdConfigEditor, IdTagEditor, Model,
+};
 use anyhow::{anyhow, bail, Result};
-use image::io::Reader as ImageReader;
-use image::DynamicImage;
 use serde::{Deserialize, Serialize};
 use std::io::Write;
 #[cfg(feature = "cover")]
-use std::path::PathBuf;
+use std::path::Path;
+
+// Kitty expects the base64 payload to be split into chunks of at most 4096 bytes.
+const KITTY_CHUNK_SIZE: usize = 4096;
 
 #[derive(Clone, Deserialize, Serialize, Debug)]
 pub struct Xywh {
@@ -109,9 +113,10 @@ impl Default for Xywh {
     }
 }
 impl Xywh {
-    fn update_size(&self, image: &DynamicImage) -> Result<Self> {
+    fn update_size(&self, image_dimensions: (u32, u32)) -> Result<Self> {
         let (term_width, term_height) = Self::get_terminal_size_u32();
-        let (x, y, width, height) = self.calculate_xywh(term_width, term_height, image)?;
+        let (x, y, width, height) =
+            self.calculate_xywh(term_width, term_height, image_dimensions)?;
 
         let (x, y) = Self::safe_guard_xy(x, y, term_width, term_height, width, height);
         Ok(Self {
@@ -129,10 +134,10 @@ impl Xywh {
         &self,
         term_width: u32,
         term_height: u32,
-        image: &DynamicImage,
+        image_dimensions: (u32, u32),
     ) -> Result<(u32, u32, u32, u32)> {
         let width = self.get_width(term_width)?;
-        let height = Self::get_height(width, term_height, image)?;
+        let height = Self::get_height(width, term_height, image_dimensions)?;
         let (absolute_x, absolute_y) = (
             self.x_between_1_100 * term_width / 100,
             self.y_between_1_100 * term_height / 100,
@@ -156,8 +161,8 @@ impl Xywh {
         Ok(size)
     }
 
-    fn get_height(width: u32, term_height: u32, image: &DynamicImage) -> Result<u32> {
-        let (pic_width_orig, pic_height_orig) = image::GenericImageView::dimensions(image);
+    fn get_height(width: u32, term_height: u32, image_dimensions: (u32, u32)) -> Result<u32> {
+        let (pic_width_orig, pic_height_orig) = image_dimensions;
         // let width = width + width % 2;
         let height = (width * pic_height_orig) / (pic_width_orig);
         Self::safe_guard_width_or_height(height, term_height * 2)
@@ -244,74 +249,144 @@ impl Model {
         if self.config.disable_album_art_from_cli {
             return Ok(());
         }
-        self.clear_photo()?;
+        // kitty placements are moved or replaced by id, everything else is redrawn from scratch
+        if !matches!(self.viuer_supported, ViuerSupported::Kitty) {
+            self.clear_photo()?;
+        }
 
         if self.should_not_show_photo() {
-            return Ok(());
+            return self.clear_photo();
         }
-        let song = match &self.player.playlist.current_track {
-            Some(song) => song,
-            None => return Ok(()),
+        let key = match self
+            .player
+            .playlist
+            .current_track
+            .as_ref()
+            .and_then(ArtworkCache::key)
+        {
+            Some(key) => key,
+            None => return self.clear_photo(),
         };
 
-        // just show the first photo
-        if let Some(picture) = song.picture() {
-            if let Ok(image) = image::load_from_memory(picture.data()) {
-                self.show_image(&image)?;
-                return Ok(());
+        // decoding happens in the background, ArtworkReady calls us again once it is done
+        let artwork = match &self.player.playlist.current_track {
+            Some(song) => self.artwork_cache.get_or_request(&key, song),
+            None => None,
+        };
+        match artwork {
+            Some(artwork) => {
+                self.artwork_pending = None;
+                self.show_image(&artwork)?;
+            }
+            None => {
+                self.artwork_pending = Some(key);
+                self.clear_photo()?;
             }
-        }
-
-        if let Some(album_photo) = song.album_photo() {
-            let img = ImageReader::open(album_photo)?.decode()?;
-            self.show_image(&img)?;
         }
 
         Ok(())
     }
 
-    #[allow(clippy::cast_possible_truncation)]
-    fn show_image(&mut self, img: &DynamicImage) -> Result<()> {
-        match self.config.album_photo_xywh.update_size(img) {
+    fn show_image(&mut self, artwork: &Artwork) -> Result<()> {
+        match self
+            .config
+            .album_photo_xywh
+            .update_size(artwork.dimensions())
+        {
             Err(e) => self.mount_error_popup(&e.to_string()),
             Ok(xywh) => {
                 match self.viuer_supported {
-                    ViuerSupported::Kitty | ViuerSupported::ITerm => {
-                        let config = viuer::Config {
-                            transparent: true,
-                            absolute_offset: true,
-                            x: xywh.x as u16,
-                            y: xywh.y as i16,
-                            width: Some(xywh.width),
-                            height: None,
-                            ..viuer::Config::default()
-                        };
-                        viuer::print(img, &config)
-                            .map_err(|e| anyhow!("viuer print error: {}", e))?;
-                    }
+                    ViuerSupported::Kitty => self
+                        .print_image_kitty(artwork, &xywh)
+                        .map_err(|e| anyhow!("kitty print error: {}", e))?,
+                    ViuerSupported::ITerm => self
+                        .print_image_iterm(artwork, &xywh)
+                        .map_err(|e| anyhow!("iterm print error: {}", e))?,
                     ViuerSupported::NotSupported => {
                         #[cfg(feature = "cover")]
-                        let mut cache_file =
-                            dirs::cache_dir().unwrap_or_else(|| PathBuf::from("/tmp"));
-                        #[cfg(feature = "cover")]
-                        cache_file.push("termusic_cover.jpg");
-                        #[cfg(feature = "cover")]
-                        img.save(cache_file.clone())?;
-                        #[cfg(feature = "cover")]
-                        if let Some(file) = cache_file.as_path().to_str() {
+                        if let Some(file) = artwork.cover_file().and_then(Path::to_str) {
                             self.ueberzug_instance.draw_cover_ueberzug(file, &xywh)?;
                         }
                     }
                 };
-            } // }
-              // }
+            }
         }
         Ok(())
     }
 
+    // Every cover is transmitted to kitty only once and stored there under its image id. After
+    // that, showing it again or moving it on resize only costs a placement command.
+    fn print_image_kitty(&mut self, artwork: &Artwork, xywh: &Xywh) -> Result<()> {
+        let id = artwork.image_id();
+        if let Some(placed) = self.kitty_placement {
+            if placed != id {
+                self.clear_image_kitty()?;
+            }
+        }
+        self.free_images_kitty()?;
+
+        let writer = self.terminal.raw_mut().backend_mut();
+        if !self.kitty_images.contains(&id) {
+            let (width, height) = artwork.dimensions();
+            let mut chunks = artwork
+                .payload()
+                .as_bytes()
+                .chunks(KITTY_CHUNK_SIZE)
+                .peekable();
+            let mut first = true;
+            while let Some(chunk) = chunks.next() {
+                let more = u8::from(chunks.peek().is_some());
+                if first {
+                    write!(
+                        writer,
+                        "\x1b_Gf=32,a=t,t=d,q=2,i={},s={},v={},m={};",
+                        id, width, height, more
+                    )?;
+                    first = false;
+                } else {
+                    write!(writer, "\x1b_Gm={};", more)?;
+                }
+                writer.write_all(chunk)?;
+                write!(writer, "\x1b\\")?;
+            }
+            self.kitty_images.insert(id);
+        }
+
+        // placing with the same placement id again moves the existing placement
+        write!(
+            writer,
+            "\x1b7\x1b[{};{}H\x1b_Ga=p,q=2,i={},p=1,c={}\x1b\\\x1b8",
+            xywh.y + 1,
+            xywh.x + 1,
+            id,
+            xywh.width
+        )?;
+        writer.flush()?;
+        self.kitty_placement = Some(id);
+        Ok(())
+    }
+
+    fn print_image_iterm(&mut self, artwork: &Artwork, xywh: &Xywh) -> Result<()> {
+        let writer = self.terminal.raw_mut().backend_mut();
+        write!(
+            writer,
+            "\x1b7\x1b[{};{}H\x1b]1337;File=inline=1;preserveAspectRatio=1;width={}:{}\x07\x1b8",
+            xywh.y + 1,
+            xywh.x + 1,
+            xywh.width,
+            artwork.payload()
+        )?;
+        writer.flush()?;
+        Ok(())
+    }
+
     fn clear_photo(&mut self) -> Result<()> {
         match self.viuer_supported {
-            ViuerSupported::Kitty | ViuerSupported::ITerm => {
+            ViuerSupported::Kitty => {
+                self.clear_image_kitty()
+                    .map_err(|e| anyhow!("Clear album photo error: {}", e))?;
+            }
+            ViuerSupported::ITerm => {
                 self.clear_image_viuer_kitty()
                     .map_err(|e| anyhow!("Clear album photo error: {}", e))?;
             }
@@ -327,6 +402,38 @@ impl Model {
         }
         Ok(())
     }
+    // Only removes the placement, the image data stays in kitty for the next time it is shown.
+    fn clear_image_kitty(&mut self) -> Result<()> {
+        if let Some(id) = self.kitty_placement.take() {
+            write!(
+                self.terminal.raw_mut().backend_mut(),
+                "\x1b_Ga=d,d=i,q=2,i={}\x1b\\",
+                id
+            )?;
+            self.terminal.raw_mut().backend_mut().flush()?;
+        }
+        Ok(())
+    }
+
+    // Covers that left the artwork cache are deleted from kitty as well, otherwise kitty evicts
+    // images on its own to stay within its quota and the placement of such an id fails silently.
+    fn free_images_kitty(&mut self) -> Result<()> {
+        for id in self.artwork_cache.take_evicted() {
+            if !self.kitty_images.remove(&id) {
+                continue;
+            }
+            if self.kitty_placement == Some(id) {
+                self.kitty_placement = None;
+            }
+            write!(
+                self.terminal.raw_mut().backend_mut(),
+                "\x1b_Ga=d,d=I,q=2,i={}\x1b\\",
+                id
+            )?;
+        }
+        Ok(())
+    }
+
     fn clear_image_viuer_kitty(&mut self) -> Result<()> {
         write!(self.terminal.raw_mut().backend_mut(), "\x1b_Ga=d\x1b\\")?;
         // write!(self.terminal.raw_mut().backend_mut(), "\x1b_Ga=d\x1b\\")?;
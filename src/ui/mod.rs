@@ -62,12 +62,16 @@ pub enum Msg {
     LyricCycle,
     LyricAdjustDelay(i64),
     PlayerToggleGapless,
+    PlayerNextEqPreset,
+    VisualizerCycle,
     PlayerTogglePause,
     PlayerVolumeUp,
     PlayerVolumeDown,
     PlayerSpeedUp,
     PlayerSpeedDown,
     PlayerSeek(isize),
+    TagSuggestionsApply,
+    DownloadCancelAll,
     Playlist(PLMsg),
     QuitPopupCloseCancel,
     QuitPopupCloseOk,
@@ -280,27 +284,36 @@ pub enum PLMsg {
     LoopModeCycle,
     PlaySelected(usize),
     Shuffle,
+    ShuffleModeCycle,
     SwapDown(usize),
     SwapUp(usize),
     CmusLQueue,
     CmusTQueue,
+    Undo,
+    Redo,
 }
 #[derive(Clone, Debug, PartialEq)]
 pub enum GSMsg {
     PopupShowDatabase,
     PopupShowLibrary,
     PopupShowPlaylist,
+    PopupShowSaved,
     PopupCloseCancel,
     InputBlur,
     PopupUpdateDatabase(String),
     PopupUpdateLibrary(String),
     PopupUpdatePlaylist(String),
+    PopupUpdateSaved(String),
     TableBlur,
     PopupCloseDatabaseAddPlaylist,
     PopupCloseLibraryAddPlaylist,
     PopupCloseOkLibraryLocate,
     PopupClosePlaylistPlaySelected,
     PopupCloseOkPlaylistLocate,
+    PopupCloseSave(String),
+    PopupCloseSavedSwitch,
+    PopupCloseSavedAppend,
+    SavedDelete,
 }
 
 #[derive(Clone, Debug, PartialEq)]
@@ -365,6 +378,7 @@ pub enum Id {
     Progress,
     QuitPopup,
     TagEditor(IdTagEditor),
+    Visualizer,
     YoutubeSearchInputPopup,
     YoutubeSearchTablePopup,
 }
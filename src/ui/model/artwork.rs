@@ -0,0 +1,289 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use super::{UpdateComponents, ViuerSupported};
+use crate::track::Track;
+use anyhow::{bail, Result};
+use image::io::Reader as ImageReader;
+use image::{DynamicImage, ImageOutputFormat};
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::io::Cursor;
+#[cfg(feature = "cover")]
+use std::path::{Path, PathBuf};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::{Arc, Mutex};
+use std::thread;
+
+// Number of decoded covers kept around, the current and next track plus a bit of history.
+const ARTWORK_CACHE_CAPACITY: usize = 16;
+// Covers are drawn into a small corner of the terminal, bigger images only cost bandwidth.
+const ARTWORK_MAX_PIXELS: u32 = 512;
+
+enum ArtworkSource {
+    Embedded(Vec<u8>),
+    File(String),
+}
+
+struct ArtworkRequest {
+    key: String,
+    sources: Vec<ArtworkSource>,
+}
+
+/// A decoded and downscaled cover, together with the payload for the terminal in use.
+pub struct Artwork {
+    id: u32,
+    width: u32,
+    height: u32,
+    /// base64 rgba pixels for kitty, base64 png for iterm, empty otherwise
+    payload: String,
+    #[cfg(feature = "cover")]
+    cover_file: Option<PathBuf>,
+}
+
+impl Artwork {
+    fn prepare(key: &str, image: DynamicImage, viuer_supported: ViuerSupported) -> Result<Self> {
+        let (width, height) = image::GenericImageView::dimensions(&image);
+        let image = if width > ARTWORK_MAX_PIXELS || height > ARTWORK_MAX_PIXELS {
+            image.thumbnail(ARTWORK_MAX_PIXELS, ARTWORK_MAX_PIXELS)
+        } else {
+            image
+        };
+        let (width, height) = image::GenericImageView::dimensions(&image);
+
+        let payload = match viuer_supported {
+            ViuerSupported::Kitty => base64::encode(image.to_rgba8().as_raw()),
+            ViuerSupported::ITerm => {
+                let mut png = Vec::new();
+                image.write_to(&mut Cursor::new(&mut png), ImageOutputFormat::Png)?;
+                base64::encode(&png)
+            }
+            ViuerSupported::NotSupported => String::new(),
+        };
+
+        // ueberzug reads the cover from disk, so write it once per cover instead of per redraw
+        #[cfg(feature = "cover")]
+        let cover_file = if let ViuerSupported::NotSupported = viuer_supported {
+            let mut cover_file = dirs::cache_dir().unwrap_or_else(|| PathBuf::from("/tmp"));
+            cover_file.push(format!("termusic_cover_{}.jpg", key));
+            if !cover_file.exists() {
+                image.to_rgb8().save(&cover_file)?;
+            }
+            Some(cover_file)
+        } else {
+            None
+        };
+
+        // terminals that keep images around address them by a non zero 32 bit id
+        let id = u32::from_str_radix(key.get(..8).unwrap_or_default(), 16)
+            .unwrap_or_default()
+            .max(1);
+
+        Ok(Self {
+            id,
+            width,
+            height,
+            payload,
+            #[cfg(feature = "cover")]
+            cover_file,
+        })
+    }
+
+    pub const fn image_id(&self) -> u32 {
+        self.id
+    }
+
+    pub const fn dimensions(&self) -> (u32, u32) {
+        (self.width, self.height)
+    }
+
+    pub fn payload(&self) -> &str {
+        &self.payload
+    }
+
+    #[cfg(feature = "cover")]
+    pub fn cover_file(&self) -> Option<&Path> {
+        self.cover_file.as_deref()
+    }
+}
+
+#[derive(Default)]
+struct ArtworkEntries {
+    artworks: HashMap<String, Arc<Artwork>>,
+    // least recently used first
+    order: VecDeque<String>,
+    pending: HashSet<String>,
+    failed: HashSet<String>,
+    // image ids of dropped covers, the terminal may still store them
+    evicted: Vec<u32>,
+}
+
+impl ArtworkEntries {
+    fn get(&mut self, key: &str) -> Option<Arc<Artwork>> {
+        let artwork = self.artworks.get(key)?.clone();
+        if let Some(index) = self.order.iter().position(|k| k == key) {
+            if let Some(k) = self.order.remove(index) {
+                self.order.push_back(k);
+            }
+        }
+        Some(artwork)
+    }
+
+    fn insert(&mut self, key: String, artwork: Artwork) {
+        self.pending.remove(&key);
+        if self
+            .artworks
+            .insert(key.clone(), Arc::new(artwork))
+            .is_none()
+        {
+            self.order.push_back(key);
+        }
+
+        while self.order.len() > ARTWORK_CACHE_CAPACITY {
+            if let Some(oldest) = self.order.pop_front() {
+                #[cfg(feature = "cover")]
+                if let Some(cover_file) = self.artworks.get(&oldest).and_then(|a| a.cover_file()) {
+                    std::fs::remove_file(cover_file).ok();
+                }
+                if let Some(artwork) = self.artworks.remove(&oldest) {
+                    self.evicted.push(artwork.image_id());
+                }
+            }
+        }
+    }
+}
+
+/// LRU cache of album covers keyed by content hash. Decoding, scaling and encoding happens on a
+/// background thread, which sends `UpdateComponents::ArtworkReady` once a cover can be drawn.
+pub struct ArtworkCache {
+    entries: Arc<Mutex<ArtworkEntries>>,
+    request_tx: Sender<ArtworkRequest>,
+}
+
+impl ArtworkCache {
+    pub fn new(viuer_supported: ViuerSupported, tx: Sender<UpdateComponents>) -> Self {
+        let entries = Arc::new(Mutex::new(ArtworkEntries::default()));
+        let (request_tx, request_rx): (Sender<ArtworkRequest>, Receiver<ArtworkRequest>) =
+            mpsc::channel();
+
+        let worker_entries = entries.clone();
+        thread::spawn(move || {
+            while let Ok(request) = request_rx.recv() {
+                let artwork = Self::decode(&request.sources)
+                    .and_then(|image| Artwork::prepare(&request.key, image, viuer_supported));
+                let mut entries = worker_entries.lock().unwrap();
+                if let Ok(artwork) = artwork {
+                    entries.insert(request.key.clone(), artwork);
+                    // only kitty keeps images around that need to be freed
+                    if !matches!(viuer_supported, ViuerSupported::Kitty) {
+                        entries.evicted.clear();
+                    }
+                    drop(entries);
+                    tx.send(UpdateComponents::ArtworkReady(request.key)).ok();
+                } else {
+                    entries.pending.remove(&request.key);
+                    entries.failed.insert(request.key);
+                }
+            }
+        });
+
+        Self {
+            entries,
+            request_tx,
+        }
+    }
+
+    /// Embedded pictures are keyed by their content, album photos by path and modification
+    /// time so that looking them up never reads the file.
+    pub fn key(track: &Track) -> Option<String> {
+        if let Some(picture) = track.picture() {
+            return Some(format!("{:x}", md5::compute(picture.data())));
+        }
+
+        let album_photo = track.album_photo()?;
+        let modified = std::fs::metadata(album_photo)
+            .and_then(|m| m.modified())
+            .ok()?;
+        Some(format!(
+            "{:x}",
+            md5::compute(format!("{}{:?}", album_photo, modified))
+        ))
+    }
+
+    /// Returns the cover if it is ready, otherwise schedules it for decoding.
+    pub fn get_or_request(&self, key: &str, track: &Track) -> Option<Arc<Artwork>> {
+        let mut entries = self.entries.lock().unwrap();
+        if let Some(artwork) = entries.get(key) {
+            return Some(artwork);
+        }
+
+        if entries.pending.contains(key) || entries.failed.contains(key) {
+            return None;
+        }
+
+        let mut sources = Vec::new();
+        if let Some(picture) = track.picture() {
+            sources.push(ArtworkSource::Embedded(picture.data().to_vec()));
+        }
+        if let Some(album_photo) = track.album_photo() {
+            sources.push(ArtworkSource::File(album_photo.to_string()));
+        }
+
+        entries.pending.insert(key.to_string());
+        self.request_tx
+            .send(ArtworkRequest {
+                key: key.to_string(),
+                sources,
+            })
+            .ok();
+        None
+    }
+
+    /// Image ids of the covers dropped since the last call, their data can be freed in the
+    /// terminal.
+    pub fn take_evicted(&self) -> Vec<u32> {
+        std::mem::take(&mut self.entries.lock().unwrap().evicted)
+    }
+
+    /// Warm the cache for a track that is about to be played.
+    pub fn prefetch(&self, track: &Track) {
+        if let Some(key) = Self::key(track) {
+            self.get_or_request(&key, track);
+        }
+    }
+
+    // just show the first photo that can be decoded
+    fn decode(sources: &[ArtworkSource]) -> Result<DynamicImage> {
+        for source in sources {
+            let image = match source {
+                ArtworkSource::Embedded(data) => image::load_from_memory(data).ok(),
+                ArtworkSource::File(path) => ImageReader::open(path)
+                    .ok()
+                    .and_then(|reader| reader.decode().ok()),
+            };
+            if let Some(image) = image {
+                return Ok(image);
+            }
+        }
+        bail!("no decodable album photo found")
+    }
+}
@@ -24,10 +24,12 @@
 
 #[cfg(feature = "discord")]
 use crate::discord::Rpc;
+mod artwork;
 #[cfg(feature = "mpris")]
 mod mpris;
 mod update;
 mod view;
+mod visualizer;
 mod youtube_options;
 use crate::sqlite::{DataBase, SearchCriteria};
 #[cfg(feature = "cover")]
@@ -38,18 +40,23 @@ use crate::{
     ui::{Application, Id, Msg},
 };
 
-use crate::config::{Keys, StyleColorSymbol};
+use crate::config::{get_full_path_from_config, Keys, StyleColorSymbol};
 // use crate::player::{GeneralP, GeneralPl};
+use crate::download::{DownloadManager, DownloadSummary};
+use crate::loudness;
 use crate::player::GeneralPlayer;
-use crate::songtag::SongTag;
+use crate::songtag::{Enricher, SongTag, StagedTags};
 use crate::sqlite::TrackForDB;
 use crate::ui::SearchLyricState;
+pub use artwork::{Artwork, ArtworkCache};
+use std::collections::HashSet;
 use std::path::PathBuf;
 use std::sync::mpsc::{self, Receiver, Sender};
 use std::time::{Duration, Instant};
 use tui_realm_treeview::Tree;
 use tuirealm::event::NoUserEvent;
 use tuirealm::terminal::TerminalBridge;
+pub use visualizer::{VisualShared, VisualizerMode, VisualizerWorker};
 use youtube_options::YoutubeOptions;
 
 #[derive(PartialEq)]
@@ -68,7 +75,7 @@ pub enum ConfigEditorLayout {
 
 // TransferState is used to describe the status of download
 pub enum UpdateComponents {
-    DownloadRunning, // indicates progress
+    DownloadProgress(DownloadSummary),
     DownloadSuccess,
     DownloadCompleted(Option<String>),
     DownloadErrDownload(String),
@@ -77,6 +84,9 @@ pub enum UpdateComponents {
     MessageHide((String, String)),
     YoutubeSearchSuccess(YoutubeOptions),
     YoutubeSearchFail(String),
+    ArtworkReady(String),
+    TagSuggestionStaged(StagedTags),
+    VisualizerFrame,
 }
 
 pub struct Model {
@@ -106,6 +116,19 @@ pub struct Model {
     pub sender_songtag: Sender<SearchLyricState>,
     pub receiver_songtag: Receiver<SearchLyricState>,
     pub viuer_supported: ViuerSupported,
+    pub artwork_cache: ArtworkCache,
+    /// cover of the current track that is still being decoded
+    pub artwork_pending: Option<String>,
+    /// image ids already transmitted to kitty
+    pub kitty_images: HashSet<u32>,
+    pub kitty_placement: Option<u32>,
+    pub enricher: Enricher,
+    pub download_manager: DownloadManager,
+    /// lyrics and covers found by the enricher, applied on user request
+    pub tag_suggestions: Vec<StagedTags>,
+    pub visualizer: VisualizerWorker,
+    /// what the pane below the progress bar shows, lyrics when off
+    pub visualizer_mode: VisualizerMode,
     pub ce_themes: Vec<String>,
     pub ce_style_color_symbol: StyleColorSymbol,
     pub ke_key_config: Keys,
@@ -123,6 +146,7 @@ pub struct Model {
     pub downloading_item_quantity: usize,
 }
 
+#[derive(Clone, Copy)]
 pub enum ViuerSupported {
     Kitty,
     ITerm,
@@ -131,7 +155,7 @@ pub enum ViuerSupported {
 
 impl Model {
     pub fn new(config: &Settings) -> Self {
-        let path = Self::get_full_path_from_config(config);
+        let path = get_full_path_from_config(config);
         let tree = Tree::new(Self::library_dir_tree(&path, config.max_depth_cli));
 
         let (tx, rx): (Sender<UpdateComponents>, Receiver<UpdateComponents>) = mpsc::channel();
@@ -143,12 +167,18 @@ impl Model {
         } else if viuer::is_iterm_supported() {
             viuer_supported = ViuerSupported::ITerm;
         }
+        let artwork_cache = ArtworkCache::new(viuer_supported, tx.clone());
+        let enricher = Enricher::new(tx.clone(), Duration::from_secs(3));
+        let download_manager = DownloadManager::new(config.download_workers, tx.clone());
         let mut db = DataBase::new(config);
         db.sync_database(&path);
+        loudness::spawn_analyzer(config.loudness_workers);
         let db_criteria = SearchCriteria::Artist;
         let app = Self::init_app(&tree, config);
         let terminal = TerminalBridge::new().expect("Could not initialize terminal");
         let player = GeneralPlayer::new(config);
+        let visualizer =
+            VisualizerWorker::new(player.audio_tap(), config.visualizer_fps, tx.clone());
         // let viuer_supported =
         //     viuer::KittySupport::None != viuer::get_kitty_support() || viuer::is_iterm_supported();
 
@@ -181,6 +211,15 @@ impl Model {
             sender_songtag: tx3,
             receiver_songtag: rx3,
             viuer_supported,
+            artwork_cache,
+            artwork_pending: None,
+            kitty_images: HashSet::new(),
+            kitty_placement: None,
+            enricher,
+            download_manager,
+            tag_suggestions: vec![],
+            visualizer,
+            visualizer_mode: VisualizerMode::Off,
             ce_themes: vec![],
             ce_style_color_symbol: StyleColorSymbol::default(),
             ke_key_config: Keys::default(),
@@ -199,18 +238,6 @@ impl Model {
         }
     }
 
-    pub fn get_full_path_from_config(config: &Settings) -> PathBuf {
-        let mut full_path = String::new();
-        if let Some(dir) = config.music_dir.get(0) {
-            full_path = shellexpand::tilde(dir).to_string();
-        }
-
-        if let Some(music_dir) = &config.music_dir_from_cli {
-            full_path = shellexpand::tilde(music_dir).to_string();
-        };
-        PathBuf::from(full_path)
-    }
-
     pub fn init_config(&mut self) {
         if let Err(e) = Self::theme_select_save() {
             self.mount_error_popup(format!("theme save error: {}", e).as_str());
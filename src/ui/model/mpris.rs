@@ -1,5 +1,5 @@
 use crate::player::{PlayerTrait, Status};
-use crate::track::Track;
+use crate::track::{Fields, Track};
 // use crate::souvlaki::{
 //     MediaControlEvent, MediaControls, MediaMetadata, MediaPlayback, PlatformConfig,
 // };
@@ -49,7 +49,7 @@ impl Default for Mpris {
 
 impl Mpris {
     pub fn add_and_play(&mut self, song_str: &str) {
-        if let Ok(track) = Track::read_from_path(song_str, true) {
+        if let Ok(track) = Track::read_with(song_str, Fields::BASIC) {
             self.controls
                 .set_metadata(MediaMetadata {
                     title: Some(track.title().unwrap_or("Unknown Title")),
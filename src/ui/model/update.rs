@@ -23,6 +23,7 @@
  */
 use crate::player::{PlayerMsg, PlayerTrait};
 use crate::sqlite::SearchCriteria;
+use crate::track::Track;
 use crate::ui::{
     model::{TermusicLayout, UpdateComponents},
     DBMsg, GSMsg, Id, IdTagEditor, LIMsg, Model, Msg, PLMsg, TEMsg, YSMsg,
@@ -30,7 +31,7 @@ use crate::ui::{
 use std::thread::{self, sleep};
 use std::time::Duration;
 use tuirealm::props::{AttrValue, Attribute, Color};
-use tuirealm::Update;
+use tuirealm::{State, StateValue, Update};
 
 impl Update<Msg> for Model {
     fn update(&mut self, msg: Option<Msg>) -> Option<Msg> {
@@ -90,6 +91,8 @@ impl Update<Msg> for Model {
 
                 Msg::PlayerTogglePause
                 | Msg::PlayerToggleGapless
+                | Msg::PlayerNextEqPreset
+                | Msg::VisualizerCycle
                 | Msg::PlayerSpeedUp
                 | Msg::PlayerSpeedDown
                 | Msg::PlayerVolumeUp
@@ -129,6 +132,16 @@ impl Update<Msg> for Model {
                 }
                 Msg::LayoutDataBase | Msg::LayoutTreeView => self.update_layout(&msg),
 
+                Msg::TagSuggestionsApply => {
+                    self.tag_suggestions_apply();
+                    None
+                }
+
+                Msg::DownloadCancelAll => {
+                    self.download_manager.cancel_all();
+                    None
+                }
+
                 Msg::None => None,
             }
         } else {
@@ -171,6 +184,13 @@ impl Model {
                 self.player.toggle_gapless();
                 self.progress_update_title();
             }
+            Msg::VisualizerCycle => {
+                self.visualizer_cycle();
+            }
+            Msg::PlayerNextEqPreset => {
+                self.config.eq_preset = self.player.next_eq_preset().to_string();
+                self.progress_update_title();
+            }
             _ => {}
         }
         None
@@ -319,13 +339,7 @@ impl Model {
             }
             YSMsg::TablePopupCloseOk(index) => {
                 if let Err(e) = self.youtube_options_download(*index) {
-                    let tx = self.sender.clone();
-                    std::thread::spawn(move || {
-                        tx.send(UpdateComponents::DownloadErrDownload(e.to_string()))
-                            .ok();
-                        sleep(Duration::from_secs(5));
-                        tx.send(UpdateComponents::DownloadCompleted(None)).ok();
-                    });
+                    self.mount_error_popup(format!("download error: {}", e).as_str());
                 }
             }
         }
@@ -344,6 +358,10 @@ impl Model {
                 self.mount_search_playlist();
                 self.playlist_update_search("*");
             }
+            GSMsg::PopupShowSaved => {
+                self.mount_search_saved();
+                self.playlist_update_saved_search("");
+            }
 
             GSMsg::PopupUpdateLibrary(input) => self.library_update_search(input),
 
@@ -351,6 +369,8 @@ impl Model {
 
             GSMsg::PopupUpdateDatabase(input) => self.database_update_search(input),
 
+            GSMsg::PopupUpdateSaved(input) => self.playlist_update_saved_search(input),
+
             GSMsg::InputBlur => {
                 if self.app.mounted(&Id::GeneralSearchTable) {
                     self.app.active(&Id::GeneralSearchTable).ok();
@@ -412,6 +432,41 @@ impl Model {
                     self.mount_error_popup(format!("db add playlist error: {}", e).as_str());
                 };
             }
+            GSMsg::PopupCloseSave(name) => {
+                self.app.umount(&Id::GeneralSearchInput).ok();
+                self.app.umount(&Id::GeneralSearchTable).ok();
+                self.app.unlock_subs();
+                self.global_fix_focus();
+                if let Err(e) = self.playlist_save_as(name) {
+                    self.mount_error_popup(format!("save playlist error: {}", e).as_str());
+                }
+            }
+            GSMsg::PopupCloseSavedSwitch | GSMsg::PopupCloseSavedAppend => {
+                let name = self.general_search_saved_selected();
+                self.app.umount(&Id::GeneralSearchInput).ok();
+                self.app.umount(&Id::GeneralSearchTable).ok();
+                self.app.unlock_subs();
+                self.global_fix_focus();
+                if let Some(name) = name {
+                    let append = *msg == GSMsg::PopupCloseSavedAppend;
+                    self.playlist_load_saved(&name, append);
+                }
+                if let Err(e) = self.update_photo() {
+                    self.mount_error_popup(format!("update photo error: {}", e).as_ref());
+                }
+            }
+            GSMsg::SavedDelete => {
+                if let Some(name) = self.general_search_saved_selected() {
+                    if let Err(e) = self.db.delete_playlist(&name) {
+                        self.mount_error_popup(format!("delete playlist error: {}", e).as_str());
+                    }
+                }
+                let input = match self.app.state(&Id::GeneralSearchInput) {
+                    Ok(State::One(StateValue::String(input))) => input,
+                    _ => String::new(),
+                };
+                self.playlist_update_saved_search(&input);
+            }
         }
     }
     fn update_delete_confirmation(&mut self, msg: &Msg) -> Option<Msg> {
@@ -460,6 +515,9 @@ impl Model {
             PLMsg::Shuffle => {
                 self.playlist_shuffle();
             }
+            PLMsg::ShuffleModeCycle => {
+                self.playlist_cycle_shuffle_mode();
+            }
             PLMsg::PlaySelected(index) => {
                 // if let Some(song) = self.playlist_items.get(index) {}
                 self.playlist_play_selected(*index);
@@ -483,10 +541,12 @@ impl Model {
                 self.player_previous();
             }
             PLMsg::SwapDown(index) => {
+                self.player.playlist.remember();
                 self.player.playlist.swap_down(*index);
                 self.playlist_sync();
             }
             PLMsg::SwapUp(index) => {
+                self.player.playlist.remember();
                 self.player.playlist.swap_up(*index);
                 self.playlist_sync();
             }
@@ -496,6 +556,12 @@ impl Model {
             PLMsg::CmusTQueue => {
                 self.playlist_add_cmus_tqueue();
             }
+            PLMsg::Undo => {
+                self.playlist_undo();
+            }
+            PLMsg::Redo => {
+                self.playlist_redo();
+            }
         }
     }
     fn update_tageditor(&mut self, msg: &TEMsg) {
@@ -587,12 +653,26 @@ impl Model {
         if let Ok(update_components_state) = self.receiver.try_recv() {
             self.redraw = true;
             match update_components_state {
-                UpdateComponents::DownloadRunning => {
-                    self.downloading_item_quantity += 1;
+                UpdateComponents::DownloadProgress(summary) => {
+                    self.downloading_item_quantity = summary.running + summary.queued;
+                    if self.downloading_item_quantity == 0 {
+                        self.remount_label_help(None, None, None);
+                        return;
+                    }
+                    self.app
+                        .attr(
+                            &Id::LabelCounter,
+                            Attribute::Text,
+                            AttrValue::String(self.downloading_item_quantity.to_string()),
+                        )
+                        .ok();
                     self.remount_label_help(
                         Some(
-                            format!(" {} item downloading... ", self.downloading_item_quantity)
-                                .as_str(),
+                            format!(
+                                " {} item downloading ({:.0}%), {} queued... ",
+                                summary.running, summary.percent, summary.queued
+                            )
+                            .as_str(),
                         ),
                         Some(
                             self.config
@@ -609,141 +689,22 @@ impl Model {
                     );
                 }
                 UpdateComponents::DownloadSuccess => {
-                    self.downloading_item_quantity -= 1;
-                    if self.downloading_item_quantity > 0 {
-                        self.app
-                            .attr(
-                                &Id::LabelCounter,
-                                Attribute::Text,
-                                AttrValue::String(self.downloading_item_quantity.to_string()),
-                            )
-                            .ok();
-                        self.remount_label_help(
-                            Some(
-                                format!(
-                                    " 1 of {} Download Success! {} is still running.",
-                                    self.downloading_item_quantity + 1,
-                                    self.downloading_item_quantity
-                                )
-                                .as_str(),
-                            ),
-                            Some(
-                                self.config
-                                    .style_color_symbol
-                                    .library_highlight()
-                                    .unwrap_or(Color::Black),
-                            ),
-                            Some(
-                                self.config
-                                    .style_color_symbol
-                                    .library_background()
-                                    .unwrap_or(Color::Yellow),
-                            ),
-                        );
-                    } else {
-                        self.remount_label_help(
-                            Some(" All Downloads Success! "),
-                            Some(
-                                self.config
-                                    .style_color_symbol
-                                    .library_highlight()
-                                    .unwrap_or(Color::Black),
-                            ),
-                            Some(
-                                self.config
-                                    .style_color_symbol
-                                    .library_background()
-                                    .unwrap_or(Color::Yellow),
-                            ),
-                        );
-                    }
-
                     if self.app.mounted(&Id::TagEditor(IdTagEditor::LabelHint)) {
                         self.umount_tageditor();
                     }
                 }
+                // sent once the whole queue is done, so the library is reloaded once per batch
                 UpdateComponents::DownloadCompleted(Some(file)) => {
-                    if self.downloading_item_quantity > 0 {
-                        return;
-                    }
                     self.library_reload_with_node_focus(Some(file.as_str()));
-                    self.remount_label_help(None, None, None);
                 }
                 UpdateComponents::DownloadCompleted(None) => {
-                    if self.downloading_item_quantity > 0 {
-                        return;
-                    }
                     self.library_reload_tree();
-                    self.remount_label_help(None, None, None);
                 }
                 UpdateComponents::DownloadErrDownload(error_message) => {
-                    self.downloading_item_quantity -= 1;
-                    self.app
-                        .attr(
-                            &Id::LabelCounter,
-                            Attribute::Text,
-                            AttrValue::String(self.downloading_item_quantity.to_string()),
-                        )
-                        .ok();
                     self.mount_error_popup(format!("download failed: {}", error_message).as_str());
-                    if self.downloading_item_quantity > 0 {
-                        self.remount_label_help(
-                            Some(
-                                format!(
-                                    " 1 item download error! {} is still running. ",
-                                    self.downloading_item_quantity
-                                )
-                                .as_str(),
-                            ),
-                            Some(
-                                self.config
-                                    .style_color_symbol
-                                    .library_highlight()
-                                    .unwrap_or(Color::Black),
-                            ),
-                            Some(
-                                self.config
-                                    .style_color_symbol
-                                    .library_background()
-                                    .unwrap_or(Color::Yellow),
-                            ),
-                        );
-                        return;
-                    }
-
-                    self.remount_label_help(
-                        Some(" Download error "),
-                        Some(
-                            self.config
-                                .style_color_symbol
-                                .library_highlight()
-                                .unwrap_or(Color::Black),
-                        ),
-                        Some(
-                            self.config
-                                .style_color_symbol
-                                .library_background()
-                                .unwrap_or(Color::Yellow),
-                        ),
-                    );
                 }
                 UpdateComponents::DownloadErrEmbedData => {
                     self.mount_error_popup("download ok but tag info is not complete.");
-                    self.remount_label_help(
-                        Some(" Download Error! "),
-                        Some(
-                            self.config
-                                .style_color_symbol
-                                .library_highlight()
-                                .unwrap_or(Color::Black),
-                        ),
-                        Some(
-                            self.config
-                                .style_color_symbol
-                                .library_background()
-                                .unwrap_or(Color::Yellow),
-                        ),
-                    );
                 }
                 UpdateComponents::YoutubeSearchSuccess(y) => {
                     self.youtube_options = y;
@@ -758,11 +719,79 @@ impl Model {
                 }
                 UpdateComponents::MessageHide((title, text)) => {
                     self.umount_message(&title, &text);
-                } //_ => {}
+                }
+                UpdateComponents::ArtworkReady(key) => {
+                    if self.artwork_pending.as_ref() == Some(&key) {
+                        if let Err(e) = self.update_photo() {
+                            self.mount_error_popup(format!("update photo error: {}", e).as_ref());
+                        }
+                    }
+                }
+                UpdateComponents::TagSuggestionStaged(staged) => {
+                    self.tag_suggestions.push(staged);
+                    self.show_message_timeout(
+                        "Tag suggestions",
+                        &format!(
+                            "{} track(s) with new lyrics or covers, press <{}> to apply",
+                            self.tag_suggestions.len(),
+                            self.config.keys.global_tag_suggestions_apply
+                        ),
+                        None,
+                    );
+                }
+                // the pane reads the frame itself, this only asks for a redraw
+                UpdateComponents::VisualizerFrame => {} //_ => {}
             }
         };
     }
 
+    // embed staged lyrics and covers, without renaming files as they may be queued or playing
+    pub fn tag_suggestions_apply(&mut self) {
+        if self.tag_suggestions.is_empty() {
+            return;
+        }
+
+        let mut applied = 0;
+        for staged in std::mem::take(&mut self.tag_suggestions) {
+            let mut track = match Track::read_from_path(&staged.file, false) {
+                Ok(track) => track,
+                Err(_) => continue,
+            };
+            if let Some(lyric) = &staged.lyric {
+                if track.lyric_frames_is_empty() {
+                    track.set_lyric(lyric, &staged.lang_ext);
+                }
+            }
+            if let Some(picture) = staged.picture {
+                if track.picture().is_none() {
+                    track.set_photo(picture);
+                }
+            }
+            if let Err(e) = track.write_tag() {
+                self.mount_error_popup(format!("write tag error: {}", e).as_str());
+                continue;
+            }
+
+            self.player.playlist.replace(&track);
+            if let Some(current_track) = &mut self.player.playlist.current_track {
+                if current_track.file() == Some(staged.file.as_str()) {
+                    *current_track = track;
+                    if let Err(e) = self.update_photo() {
+                        self.mount_error_popup(format!("update photo error: {}", e).as_str());
+                    }
+                }
+            }
+            applied += 1;
+        }
+
+        self.playlist_sync();
+        self.show_message_timeout(
+            "Tag suggestions",
+            &format!("Lyrics and covers saved to {} track(s)", applied),
+            None,
+        );
+    }
+
     // update playlist items when loading
     // pub fn update_playlist_items(&mut self) {
     //     if let Ok(playlist_items) = self.receiver_playlist_items.try_recv() {
@@ -811,9 +840,17 @@ impl Model {
                     self.player.start_play();
                 }
                 PlayerMsg::AboutToFinish => {
-                    if self.config.gapless {
+                    // only the rusty backend crossfades
+                    #[cfg(not(any(feature = "mpv", feature = "gst")))]
+                    let queue_next = self.config.gapless || self.config.crossfade_secs > 0;
+                    #[cfg(any(feature = "mpv", feature = "gst"))]
+                    let queue_next = self.config.gapless;
+                    if queue_next {
                         // eprintln!("about to finish received");
                         self.player.enqueue_next();
+                        if let Some(track) = self.player.playlist.tracks().get(0) {
+                            self.artwork_cache.prefetch(track);
+                        }
                     }
                 }
                 PlayerMsg::CurrentTrackUpdated => {
@@ -826,6 +863,12 @@ impl Model {
                 PlayerMsg::Progress(time_pos, duration) => {
                     self.progress_update(time_pos, duration);
                 }
+                #[cfg(not(any(feature = "mpv", feature = "gst")))]
+                PlayerMsg::StreamOpened(item) => self.player.stream_opened(&item),
+                #[cfg(not(any(feature = "mpv", feature = "gst")))]
+                PlayerMsg::StreamFailed(e) => {
+                    self.mount_error_popup(format!("cannot play stream: {}", e).as_str());
+                }
             }
         }
     }
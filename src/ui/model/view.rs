@@ -188,7 +188,11 @@ impl Model {
 
                 self.app.view(&Id::Playlist, f, chunks_right[0]);
                 self.app.view(&Id::Progress, f, chunks_right[1]);
-                self.app.view(&Id::Lyric, f, chunks_right[2]);
+                if self.app.mounted(&Id::Visualizer) {
+                    self.app.view(&Id::Visualizer, f, chunks_right[2]);
+                } else {
+                    self.app.view(&Id::Lyric, f, chunks_right[2]);
+                }
                 Self::view_layout_commons(f, &mut self.app, self.downloading_item_quantity);
             })
             .is_ok());
@@ -225,7 +229,11 @@ impl Model {
                 self.app.view(&Id::Library, f, chunks_left[0]);
                 self.app.view(&Id::Playlist, f, chunks_right[0]);
                 self.app.view(&Id::Progress, f, chunks_right[1]);
-                self.app.view(&Id::Lyric, f, chunks_right[2]);
+                if self.app.mounted(&Id::Visualizer) {
+                    self.app.view(&Id::Visualizer, f, chunks_right[2]);
+                } else {
+                    self.app.view(&Id::Lyric, f, chunks_right[2]);
+                }
                 self.app.view(&Id::Label, f, chunks_main[1]);
 
                 Self::view_layout_commons(f, &mut self.app, self.downloading_item_quantity);
@@ -460,6 +468,30 @@ impl Model {
         }
     }
 
+    pub fn mount_search_saved(&mut self) {
+        assert!(self
+            .app
+            .remount(
+                Id::GeneralSearchInput,
+                Box::new(GSInputPopup::new(Source::Saved, &self.config)),
+                vec![]
+            )
+            .is_ok());
+        assert!(self
+            .app
+            .remount(
+                Id::GeneralSearchTable,
+                Box::new(GSTablePopup::new(Source::Saved, &self.config)),
+                vec![]
+            )
+            .is_ok());
+        assert!(self.app.active(&Id::GeneralSearchInput).is_ok());
+        self.app.lock_subs();
+        if let Err(e) = self.update_photo() {
+            self.mount_error_popup(format!("update photo error: {}", e).as_ref());
+        }
+    }
+
     pub fn mount_youtube_search_input(&mut self) {
         assert!(self
             .app
@@ -0,0 +1,373 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use super::UpdateComponents;
+use crate::player::AudioTap;
+use std::f32::consts::PI;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::mpsc::Sender;
+use std::sync::{Arc, Mutex};
+use std::thread::{self, Thread};
+use std::time::{Duration, Instant};
+
+// frames per transform, 46 ms at 44.1 kHz
+const FFT_LEN: usize = 2048;
+const BANDS: usize = 96;
+const MIN_FREQ: f32 = 30.0;
+const MAX_FREQ: f32 = 20_000.0;
+// the bottom of the spectrum pane
+const FLOOR_DB: f32 = -72.0;
+// bars sink back slowly instead of flickering
+const FALL_DB_PER_SEC: f32 = 48.0;
+const WAVE_POINTS: usize = 512;
+
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub enum VisualizerMode {
+    Off,
+    Spectrum,
+    Oscilloscope,
+}
+
+impl VisualizerMode {
+    pub const fn next(self) -> Self {
+        match self {
+            Self::Off => Self::Spectrum,
+            Self::Spectrum => Self::Oscilloscope,
+            Self::Oscilloscope => Self::Off,
+        }
+    }
+}
+
+/// What the visualizer pane draws.
+#[derive(Clone, Debug, Default)]
+pub struct VisualFrame {
+    /// spectrum bars from low to high frequencies, 0.0 is the floor and 1.0 full scale
+    pub bands: Vec<f32>,
+    /// the latest samples mixed down to mono
+    pub wave: Vec<f32>,
+    /// of the loudest channel, in dBFS
+    pub peak_db: f32,
+    pub rms_db: f32,
+}
+
+/// The latest frame, `fresh` until the pane drew it.
+#[derive(Default)]
+pub struct VisualShared {
+    pub frame: Mutex<VisualFrame>,
+    pub fresh: AtomicBool,
+}
+
+fn to_db(amplitude: f32) -> f32 {
+    20.0 * amplitude.max(1e-9).log10()
+}
+
+// in place radix 2 transform, `twiddles` holds the first half of the roots of unity
+fn fft(re: &mut [f32], im: &mut [f32], twiddles: &[(f32, f32)]) {
+    let n = re.len();
+    let mut j = 0;
+    for i in 1..n {
+        let mut bit = n >> 1;
+        while j & bit != 0 {
+            j ^= bit;
+            bit >>= 1;
+        }
+        j ^= bit;
+        if i < j {
+            re.swap(i, j);
+            im.swap(i, j);
+        }
+    }
+
+    let mut len = 2;
+    while len <= n {
+        let half = len / 2;
+        let step = n / len;
+        for start in (0..n).step_by(len) {
+            for k in 0..half {
+                let (wr, wi) = twiddles[k * step];
+                let (a, b) = (start + k, start + k + half);
+                let tr = re[b] * wr - im[b] * wi;
+                let ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+        len <<= 1;
+    }
+}
+
+struct Analyzer {
+    window: Vec<f32>,
+    window_gain: f32,
+    twiddles: Vec<(f32, f32)>,
+    re: Vec<f32>,
+    im: Vec<f32>,
+    bands: Vec<f32>,
+}
+
+impl Analyzer {
+    #[allow(clippy::cast_precision_loss)]
+    fn new() -> Self {
+        let window: Vec<f32> = (0..FFT_LEN)
+            .map(|i| 0.5 - 0.5 * (2.0 * PI * i as f32 / FFT_LEN as f32).cos())
+            .collect();
+        // a sine of amplitude a peaks at a * window_gain in its bin
+        let window_gain = window.iter().sum::<f32>() / 2.0;
+        let twiddles = (0..FFT_LEN / 2)
+            .map(|k| {
+                let angle = -2.0 * PI * k as f32 / FFT_LEN as f32;
+                (angle.cos(), angle.sin())
+            })
+            .collect();
+        Self {
+            window,
+            window_gain,
+            twiddles,
+            re: vec![0.0; FFT_LEN],
+            im: vec![0.0; FFT_LEN],
+            bands: vec![0.0; BANDS],
+        }
+    }
+
+    // `samples` are interleaved, `elapsed` is the time since the last frame
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_precision_loss,
+        clippy::cast_sign_loss
+    )]
+    fn analyze(
+        &mut self,
+        samples: &[f32],
+        channels: usize,
+        sample_rate: u32,
+        elapsed: Duration,
+    ) -> VisualFrame {
+        let channels = channels.max(1);
+        let frames = samples.len() / channels;
+
+        let mut peak = 0.0_f32;
+        let mut rms = 0.0_f32;
+        for ch in 0..channels {
+            let (p, sum) = samples
+                .iter()
+                .skip(ch)
+                .step_by(channels)
+                .fold((0.0_f32, 0.0_f32), |(p, sum), s| {
+                    (p.max(s.abs()), sum + s * s)
+                });
+            peak = peak.max(p);
+            rms = rms.max((sum / frames.max(1) as f32).sqrt());
+        }
+
+        // the most recent frames go in, older ones are zero
+        self.re.iter_mut().for_each(|x| *x = 0.0);
+        self.im.iter_mut().for_each(|x| *x = 0.0);
+        let take = frames.min(FFT_LEN);
+        let offset = FFT_LEN - take;
+        for (i, frame) in samples[(frames - take) * channels..]
+            .chunks_exact(channels)
+            .enumerate()
+        {
+            let mono = frame.iter().sum::<f32>() / channels as f32;
+            self.re[offset + i] = mono * self.window[offset + i];
+        }
+        let wave_step = (take / WAVE_POINTS).max(1);
+        let wave = self.re[offset..]
+            .iter()
+            .zip(&self.window[offset..])
+            .step_by(wave_step)
+            .map(|(x, w)| if *w > 0.0 { x / w } else { 0.0 })
+            .collect();
+
+        fft(&mut self.re, &mut self.im, &self.twiddles);
+
+        let bin_hz = sample_rate as f32 / FFT_LEN as f32;
+        let max_freq = MAX_FREQ.min(sample_rate as f32 / 2.0);
+        let fall = FALL_DB_PER_SEC * elapsed.as_secs_f32() / -FLOOR_DB;
+        for (i, bar) in self.bands.iter_mut().enumerate() {
+            let low = MIN_FREQ * (max_freq / MIN_FREQ).powf(i as f32 / BANDS as f32);
+            let high = MIN_FREQ * (max_freq / MIN_FREQ).powf((i + 1) as f32 / BANDS as f32);
+            let first = ((low / bin_hz).round() as usize).min(FFT_LEN / 2 - 1);
+            let last = ((high / bin_hz).round() as usize).clamp(first + 1, FFT_LEN / 2);
+            let amplitude = (first..last)
+                .map(|k| (self.re[k] * self.re[k] + self.im[k] * self.im[k]).sqrt())
+                .fold(0.0, f32::max)
+                / self.window_gain;
+            let level = ((to_db(amplitude) - FLOOR_DB) / -FLOOR_DB).clamp(0.0, 1.0);
+            *bar = level.max(*bar - fall);
+        }
+
+        VisualFrame {
+            bands: self.bands.clone(),
+            wave,
+            peak_db: to_db(peak),
+            rms_db: to_db(rms),
+        }
+    }
+}
+
+/// Turns the samples of the audio tap into spectrum and waveform frames on a worker thread,
+/// at most `fps` times a second and only while the pane is shown.
+pub struct VisualizerWorker {
+    shared: Arc<VisualShared>,
+    tap: Option<Arc<AudioTap>>,
+    active: Arc<AtomicBool>,
+    worker: Option<Thread>,
+}
+
+impl VisualizerWorker {
+    pub fn new(tap: Option<Arc<AudioTap>>, fps: u32, tx: Sender<UpdateComponents>) -> Self {
+        let shared = Arc::new(VisualShared::default());
+        let active = Arc::new(AtomicBool::new(false));
+        let worker = tap.clone().map(|tap| {
+            let shared = shared.clone();
+            let active = active.clone();
+            let interval = Duration::from_secs(1) / fps.clamp(1, 120);
+            thread::spawn(move || {
+                let mut analyzer = Analyzer::new();
+                let mut samples = Vec::with_capacity(FFT_LEN * 2);
+                let mut last_written = 0;
+                let mut last_frame = Instant::now();
+                loop {
+                    if !active.load(Ordering::Relaxed) {
+                        thread::park();
+                        last_frame = Instant::now();
+                        continue;
+                    }
+                    let start = Instant::now();
+                    let written = tap.written();
+                    // paused or stopped, the pane keeps the last frame
+                    if written != last_written {
+                        last_written = written;
+                        if let Some((channels, rate)) = tap.read_latest(FFT_LEN, &mut samples) {
+                            let frame =
+                                analyzer.analyze(&samples, channels, rate, last_frame.elapsed());
+                            last_frame = Instant::now();
+                            *shared.frame.lock().unwrap() = frame;
+                            // one redraw per frame, however long the ui takes to get to it
+                            if !shared.fresh.swap(true, Ordering::AcqRel) {
+                                tx.send(UpdateComponents::VisualizerFrame).ok();
+                            }
+                        }
+                    }
+                    thread::sleep(interval.saturating_sub(start.elapsed()));
+                }
+            })
+            .thread()
+            .clone()
+        });
+
+        Self {
+            shared,
+            tap,
+            active,
+            worker,
+        }
+    }
+
+    pub const fn is_available(&self) -> bool {
+        self.worker.is_some()
+    }
+
+    pub fn shared(&self) -> Arc<VisualShared> {
+        self.shared.clone()
+    }
+
+    /// Start or stop the tap and the worker, nothing runs while the pane is hidden.
+    pub fn set_active(&self, active: bool) {
+        self.active.store(active, Ordering::Relaxed);
+        if let Some(tap) = &self.tap {
+            tap.set_enabled(active);
+        }
+        if let Some(worker) = &self.worker {
+            worker.unpark();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sine(channels: usize, rate: u32, freq: f32, amplitude: f32) -> Vec<f32> {
+        (0..FFT_LEN)
+            .flat_map(|i| {
+                let v = amplitude * (2.0 * PI * freq * i as f32 / rate as f32).sin();
+                std::iter::repeat(v).take(channels)
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_fft_finds_the_tone() {
+        let mut analyzer = Analyzer::new();
+        // exactly on bin 64
+        let rate = 48_000;
+        let freq = 64.0 * rate as f32 / FFT_LEN as f32;
+        analyzer.re = (0..FFT_LEN)
+            .map(|i| (2.0 * PI * freq * i as f32 / rate as f32).cos())
+            .collect();
+        fft(&mut analyzer.re, &mut analyzer.im, &analyzer.twiddles);
+        let magnitude = |k: usize| analyzer.re[k].hypot(analyzer.im[k]);
+        assert!((magnitude(64) - FFT_LEN as f32 / 2.0).abs() < 0.5);
+        assert!(magnitude(63) < 1e-2 && magnitude(200) < 1e-2);
+    }
+
+    #[test]
+    fn test_frame_shows_level_and_spectrum() {
+        let mut analyzer = Analyzer::new();
+        let frame = analyzer.analyze(&sine(2, 48_000, 1_000.0, 0.5), 2, 48_000, Duration::ZERO);
+        assert!((frame.peak_db + 6.02).abs() < 0.05, "{}", frame.peak_db);
+        assert!((frame.rms_db + 9.03).abs() < 0.1, "{}", frame.rms_db);
+
+        let loudest =
+            frame.bands.iter().enumerate().fold(
+                (0, 0.0),
+                |best, (i, &b)| if b > best.1 { (i, b) } else { best },
+            );
+        let low = MIN_FREQ * (MAX_FREQ / MIN_FREQ).powf(loudest.0 as f32 / BANDS as f32);
+        let high = MIN_FREQ * (MAX_FREQ / MIN_FREQ).powf((loudest.0 + 1) as f32 / BANDS as f32);
+        assert!(low <= 1_050.0 && high >= 950.0, "{} {}", low, high);
+        // -6 dBFS on a scale starting at -72 dB
+        assert!((loudest.1 - 66.0 / 72.0).abs() < 0.03, "{}", loudest.1);
+        assert!(frame.bands[0] < 0.3 && frame.bands[BANDS - 1] < 0.3);
+        assert_eq!(frame.wave.len(), WAVE_POINTS);
+    }
+
+    #[test]
+    fn test_bars_fall_back_gradually() {
+        let mut analyzer = Analyzer::new();
+        analyzer.analyze(&sine(1, 48_000, 1_000.0, 0.5), 1, 48_000, Duration::ZERO);
+        let before = analyzer.bands.iter().copied().fold(0.0, f32::max);
+        let frame = analyzer.analyze(&[0.0; FFT_LEN], 1, 48_000, Duration::from_millis(500));
+        let after = frame.bands.iter().copied().fold(0.0, f32::max);
+        assert!(
+            (before - after - 24.0 / 72.0).abs() < 0.01,
+            "{} {}",
+            before,
+            after
+        );
+    }
+}
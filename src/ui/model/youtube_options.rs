@@ -23,33 +23,19 @@
  */
 use super::{
     Model,
-    UpdateComponents::{
-        DownloadCompleted, DownloadErrDownload, DownloadRunning, DownloadSuccess,
-        YoutubeSearchFail, YoutubeSearchSuccess,
-    },
+    UpdateComponents::{YoutubeSearchFail, YoutubeSearchSuccess},
 };
+use crate::download::DownloadJob;
 use crate::invidious::{Instance, YoutubeVideo};
 use crate::track::Track;
 use crate::ui::Id;
 use anyhow::{anyhow, bail, Result};
-use id3::TagLike;
-use id3::Version::Id3v24;
-use lazy_static::lazy_static;
-use regex::Regex;
 use std::path::{Path, PathBuf};
 // use std::sync::mpsc::{self, Receiver, Sender};
-use std::thread::{self, sleep};
+use std::thread;
 use std::time::Duration;
 use tuirealm::props::{Alignment, AttrValue, Attribute, TableBuilder, TextSpan};
 use tuirealm::{State, StateValue};
-use ytd_rs::{Arg, YoutubeDL};
-
-lazy_static! {
-    static ref RE_FILENAME: Regex =
-        Regex::new(r"\[ffmpeg\] Destination: (?P<name>.*)\.mp3").unwrap();
-    static ref RE_FILENAME_YTDLP: Regex =
-        Regex::new(r"\[ExtractAudio\] Destination: (?P<name>.*)\.mp3").unwrap();
-}
 
 pub struct YoutubeOptions {
     items: Vec<YoutubeVideo>,
@@ -72,20 +58,6 @@ impl YoutubeOptions {
         Err(anyhow!("index not found"))
     }
 
-    pub fn prev_page(&mut self) -> Result<()> {
-        if self.page > 1 {
-            self.page -= 1;
-            self.items = self.invidious_instance.get_search_query(self.page)?;
-        }
-        Ok(())
-    }
-
-    pub fn next_page(&mut self) -> Result<()> {
-        self.page += 1;
-        self.items = self.invidious_instance.get_search_query(self.page)?;
-        Ok(())
-    }
-
     pub const fn page(&self) -> u32 {
         self.page
     }
@@ -109,6 +81,7 @@ impl Model {
         thread::spawn(
             move || match crate::invidious::Instance::new(&search_word) {
                 Ok((instance, result)) => {
+                    instance.prefetch(2);
                     let youtube_options = YoutubeOptions {
                         items: result,
                         page: 1,
@@ -124,16 +97,35 @@ impl Model {
     }
 
     pub fn youtube_options_prev_page(&mut self) {
-        match self.youtube_options.prev_page() {
-            Ok(_) => self.sync_youtube_options(),
-            Err(e) => self.mount_error_popup(format!("search error: {}", e).as_str()),
+        if self.youtube_options.page > 1 {
+            self.youtube_options_turn_page(self.youtube_options.page - 1);
         }
     }
     pub fn youtube_options_next_page(&mut self) {
-        match self.youtube_options.next_page() {
-            Ok(_) => self.sync_youtube_options(),
-            Err(e) => self.mount_error_popup(format!("search error: {}", e).as_str()),
-        }
+        self.youtube_options_turn_page(self.youtube_options.page + 1);
+    }
+
+    // the page arrives like a new search, the ui keeps going while it is fetched
+    fn youtube_options_turn_page(&self, page: u32) {
+        let mut instance = self.youtube_options.invidious_instance.clone();
+        let tx = self.sender.clone();
+        thread::spawn(move || match instance.get_search_query(page) {
+            Ok(items) => {
+                instance.prefetch(page + 1);
+                if page > 1 {
+                    instance.prefetch(page - 1);
+                }
+                let youtube_options = YoutubeOptions {
+                    items,
+                    page,
+                    invidious_instance: instance,
+                };
+                tx.send(YoutubeSearchSuccess(youtube_options)).ok();
+            }
+            Err(e) => {
+                tx.send(YoutubeSearchFail(e.to_string())).ok();
+            }
+        });
     }
     pub fn sync_youtube_options(&mut self) {
         if self.youtube_options.items.is_empty() {
@@ -195,7 +187,6 @@ impl Model {
         }
     }
 
-    #[allow(clippy::too_many_lines)]
     pub fn youtube_dl(&mut self, link: &str) -> Result<()> {
         let mut path: PathBuf = PathBuf::new();
         if let Ok(State::One(StateValue::String(node_id))) = self.app.state(&Id::Library) {
@@ -206,188 +197,11 @@ impl Model {
                 path = p.to_path_buf();
             }
         }
-        let args = vec![
-            Arg::new("--extract-audio"),
-            // Arg::new_with_arg("--audio-format", "vorbis"),
-            Arg::new_with_arg("--audio-format", "mp3"),
-            Arg::new("--add-metadata"),
-            Arg::new("--embed-thumbnail"),
-            Arg::new_with_arg("--metadata-from-title", "%(artist) - %(title)s"),
-            Arg::new("--write-sub"),
-            Arg::new("--all-subs"),
-            Arg::new_with_arg("--convert-subs", "lrc"),
-            Arg::new_with_arg("--output", "%(title).90s.%(ext)s"),
-        ];
-
-        let ytd = YoutubeDL::new(&path, args, link)?;
-        let tx = self.sender.clone();
 
-        thread::spawn(move || -> Result<()> {
-            tx.send(DownloadRunning).ok();
-            // start download
-            let download = ytd.download();
-
-            // check what the result is and print out the path to the download or the error
-            match download {
-                Ok(result) => {
-                    tx.send(DownloadSuccess).ok();
-                    sleep(Duration::from_secs(5));
-                    // here we extract the full file name from download output
-                    if let Some(file_fullname) =
-                        extract_filepath(result.output(), &path.to_string_lossy())
-                    {
-                        tx.send(DownloadCompleted(Some(file_fullname.clone()))).ok();
-
-                        // here we remove downloaded live_chat.json file
-                        remove_downloaded_json(&path, &file_fullname);
-
-                        embed_downloaded_lrc(&path, &file_fullname);
-                    } else {
-                        tx.send(DownloadCompleted(None)).ok();
-                    }
-                }
-                Err(e) => {
-                    tx.send(DownloadErrDownload(e.to_string())).ok();
-                    sleep(Duration::from_secs(5));
-                    tx.send(DownloadCompleted(None)).ok();
-                }
-            }
-            Ok(())
-        });
+        self.download_manager.enqueue(&DownloadJob::Youtube {
+            url: link.to_string(),
+            dir: path.to_string_lossy().to_string(),
+        })?;
         Ok(())
     }
 }
-// This just parsing the output from youtubedl to get the audio path
-// This is used because we need to get the song name
-// example ~/path/to/song/song.mp3
-fn extract_filepath(output: &str, dir: &str) -> Option<String> {
-    // #[cfg(not(feature = "yt-dlp"))]
-    // if let Some(cap) = RE_FILENAME.captures(output) {
-    //     if let Some(c) = cap.name("name") {
-    //         let filename = format!("{}/{}.mp3", dir, c.as_str());
-    //         return Ok(filename);
-    //     }
-    // }
-    // #[cfg(feature = "yt-dlp")]
-    if let Some(cap) = RE_FILENAME_YTDLP.captures(output) {
-        if let Some(c) = cap.name("name") {
-            let filename = format!("{}/{}.mp3", dir, c.as_str());
-            return Some(filename);
-        }
-    }
-    None
-}
-
-fn remove_downloaded_json(path: &Path, file_fullname: &str) {
-    let files = walkdir::WalkDir::new(path).follow_links(true);
-    for f in files
-        .into_iter()
-        .filter_map(std::result::Result::ok)
-        .filter(|f| {
-            let name = f.file_name();
-            let p = Path::new(&name);
-            p.extension().map_or(false, |ext| ext == "json")
-        })
-        .filter(|f| {
-            let path_json = Path::new(f.file_name());
-            let p1: &Path = Path::new(file_fullname);
-            path_json.file_stem().map_or(false, |stem_lrc| {
-                p1.file_stem().map_or(false, |p_base| {
-                    stem_lrc
-                        .to_string_lossy()
-                        .to_string()
-                        .contains(p_base.to_string_lossy().as_ref())
-                })
-            })
-        })
-    {
-        std::fs::remove_file(f.path()).ok();
-    }
-}
-
-fn embed_downloaded_lrc(path: &Path, file_fullname: &str) {
-    let mut id3_tag = if let Ok(tag) = id3::Tag::read_from_path(file_fullname) {
-        tag
-    } else {
-        let mut t = id3::Tag::new();
-        let p: &Path = Path::new(file_fullname);
-        if let Some(p_base) = p.file_stem() {
-            t.set_title(p_base.to_string_lossy());
-        }
-        t.write_to_path(p, Id3v24).ok();
-        t
-    };
-
-    // here we add all downloaded lrc file
-    let files = walkdir::WalkDir::new(path).follow_links(true);
-
-    for f in files
-        .into_iter()
-        .filter_map(std::result::Result::ok)
-        .filter(|f| f.file_type().is_file())
-        .filter(|f| {
-            let name = f.file_name();
-            let p = Path::new(&name);
-            p.extension().map_or(false, |ext| ext == "lrc")
-        })
-        .filter(|f| {
-            let path_lrc = Path::new(f.file_name());
-            let p1: &Path = Path::new(file_fullname);
-            path_lrc.file_stem().map_or(false, |stem_lrc| {
-                p1.file_stem().map_or(false, |p_base| {
-                    stem_lrc
-                        .to_string_lossy()
-                        .to_string()
-                        .contains(p_base.to_string_lossy().as_ref())
-                })
-            })
-        })
-    {
-        let path_lrc = Path::new(f.file_name());
-        let mut lang_ext = "eng".to_string();
-        if let Some(p_short) = path_lrc.file_stem() {
-            let p2 = Path::new(p_short);
-            if let Some(ext2) = p2.extension() {
-                lang_ext = ext2.to_string_lossy().to_string();
-            }
-        }
-        let lyric_string = std::fs::read_to_string(f.path());
-        id3_tag.add_frame(id3::frame::Lyrics {
-            lang: "eng".to_string(),
-            description: lang_ext,
-            text: lyric_string.unwrap_or_else(|_| String::from("[00:00:01] No lyric")),
-        });
-        std::fs::remove_file(f.path()).ok();
-    }
-
-    id3_tag.write_to_path(file_fullname, Id3v24).ok();
-}
-
-#[cfg(test)]
-#[allow(clippy::non_ascii_literal)]
-mod tests {
-
-    use crate::ui::model::youtube_options::extract_filepath;
-    use pretty_assertions::assert_eq;
-
-    #[test]
-    fn test_youtube_output_parsing() {
-        // #[cfg(not(feature = "yt-dlp"))]
-        // assert_eq!(
-        //     extract_filepath(
-        //         r"sdflsdf [ffmpeg] Destination: 观众说“小哥哥，到饭点了”《干饭人之歌》走，端起饭盆干饭去.mp3 sldflsdfj",
-        //         "/tmp"
-        //     )
-        //     .unwrap(),
-        //     "/tmp/观众说“小哥哥，到饭点了”《干饭人之歌》走，端起饭盆干饭去.mp3".to_string()
-        // );
-        assert_eq!(
-            extract_filepath(
-                r"sdflsdf [ExtractAudio] Destination: 观众说“小哥哥，到饭点了”《干饭人之歌》走，端起饭盆干饭去.mp3 sldflsdfj",
-                "/tmp"
-            )
-            .unwrap(),
-            "/tmp/观众说“小哥哥，到饭点了”《干饭人之歌》走，端起饭盆干饭去.mp3".to_string()
-        );
-    }
-}
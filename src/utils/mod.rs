@@ -77,6 +77,10 @@ pub fn filetype_supported(current_node: &str) -> bool {
     }
 }
 
+pub fn is_url(item: &str) -> bool {
+    item.starts_with("http://") || item.starts_with("https://")
+}
+
 pub fn is_playlist(current_node: &str) -> bool {
     let p = Path::new(current_node);
 
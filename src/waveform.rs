@@ -0,0 +1,310 @@
+/**
+ * MIT License
+ *
+ * termusic - Copyright (c) 2021 Larry Hao
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+use rusqlite::{params, Connection, OptionalExtension};
+
+/// Number of buckets in an overview, whatever the length of the track.
+pub const BUCKETS: usize = 1000;
+// frames reduced at once while decoding, the buckets are made of these at the end
+const CHUNK_FRAMES: usize = 1024;
+// rms below this is stored as silence
+const FLOOR_DB: f32 = -96.0;
+
+/// Level of one slice of a track, samples of all channels together.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Bucket {
+    pub min: f32,
+    pub max: f32,
+    /// rms in dBFS
+    pub rms_db: f32,
+}
+
+/// Downsampled min/max/rms envelope of a whole track, as drawn in the progress bar.
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct Envelope {
+    pub buckets: Vec<Bucket>,
+}
+
+// three bytes per bucket: min and max as signed linear levels, rms on a dB scale
+impl Envelope {
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_possible_wrap,
+        clippy::cast_sign_loss
+    )]
+    pub fn to_blob(&self) -> Vec<u8> {
+        let mut blob = Vec::with_capacity(self.buckets.len() * 3);
+        for b in &self.buckets {
+            blob.push((b.min.clamp(-1.0, 1.0) * 127.0).round() as i8 as u8);
+            blob.push((b.max.clamp(-1.0, 1.0) * 127.0).round() as i8 as u8);
+            blob.push(
+                ((b.rms_db.clamp(FLOOR_DB, 0.0) - FLOOR_DB) * 255.0 / -FLOOR_DB).round() as u8,
+            );
+        }
+        blob
+    }
+
+    #[allow(clippy::cast_possible_wrap)]
+    pub fn from_blob(blob: &[u8]) -> Self {
+        let buckets = blob
+            .chunks_exact(3)
+            .map(|b| Bucket {
+                min: f32::from(b[0] as i8) / 127.0,
+                max: f32::from(b[1] as i8) / 127.0,
+                rms_db: f32::from(b[2]) * -FLOOR_DB / 255.0 + FLOOR_DB,
+            })
+            .collect();
+        Self { buckets }
+    }
+}
+
+/// Height of each of `width` columns in 0.0..=1.0, from the loudest of the rms levels under it,
+/// `range_db` below full scale is the bottom.
+pub fn columns(rms_db: &[f32], width: usize, range_db: f32) -> Vec<f32> {
+    let n = rms_db.len();
+    if n == 0 {
+        return vec![0.0; width];
+    }
+    (0..width)
+        .map(|x| {
+            let start = x * n / width;
+            let end = ((x + 1) * n / width).clamp(start + 1, n);
+            let db = rms_db[start..end].iter().copied().fold(FLOOR_DB, f32::max);
+            ((db + range_db) / range_db).clamp(0.0, 1.0)
+        })
+        .collect()
+}
+
+#[derive(Clone, Copy)]
+struct Chunk {
+    min: f32,
+    max: f32,
+    energy: f64,
+    samples: usize,
+}
+
+impl Chunk {
+    const EMPTY: Self = Self {
+        min: 0.0,
+        max: 0.0,
+        energy: 0.0,
+        samples: 0,
+    };
+
+    fn merge(self, other: Self) -> Self {
+        Self {
+            min: self.min.min(other.min),
+            max: self.max.max(other.max),
+            energy: self.energy + other.energy,
+            samples: self.samples + other.samples,
+        }
+    }
+}
+
+/// Builds an envelope from interleaved samples while the track is decoded. The length of the
+/// track is often unknown up front, so short chunks are kept and merged into buckets at the end.
+pub struct EnvelopeBuilder {
+    chunk_len: usize,
+    chunks: Vec<Chunk>,
+    current: Chunk,
+}
+
+impl EnvelopeBuilder {
+    pub fn new(channels: usize) -> Self {
+        Self {
+            chunk_len: CHUNK_FRAMES * channels.max(1),
+            chunks: Vec::new(),
+            current: Chunk::EMPTY,
+        }
+    }
+
+    /// Feed interleaved samples.
+    pub fn push(&mut self, samples: &[f32]) {
+        for &s in samples {
+            let c = &mut self.current;
+            c.min = c.min.min(s);
+            c.max = c.max.max(s);
+            c.energy += f64::from(s) * f64::from(s);
+            c.samples += 1;
+            if c.samples == self.chunk_len {
+                self.chunks.push(*c);
+                self.current = Chunk::EMPTY;
+            }
+        }
+    }
+
+    /// Up to `buckets` buckets of equal length, fewer for a track shorter than that many chunks.
+    #[allow(clippy::cast_possible_truncation, clippy::cast_precision_loss)]
+    pub fn finish(mut self, buckets: usize) -> Option<Envelope> {
+        if self.current.samples > 0 {
+            self.chunks.push(self.current);
+        }
+        let n = self.chunks.len();
+        if n == 0 || buckets == 0 {
+            return None;
+        }
+        let count = buckets.min(n);
+        let buckets = (0..count)
+            .map(|i| {
+                let chunk = self.chunks[i * n / count..(i + 1) * n / count]
+                    .iter()
+                    .fold(Chunk::EMPTY, |a, &b| a.merge(b));
+                let rms = (chunk.energy / chunk.samples.max(1) as f64).sqrt();
+                let rms_db = if rms > 0.0 {
+                    (20.0 * rms.log10()) as f32
+                } else {
+                    FLOOR_DB
+                };
+                Bucket {
+                    min: chunk.min,
+                    max: chunk.max,
+                    rms_db: rms_db.max(FLOOR_DB),
+                }
+            })
+            .collect();
+        Some(Envelope { buckets })
+    }
+}
+
+pub fn create_table(conn: &Connection) -> rusqlite::Result<()> {
+    conn.execute(
+        "create table if not exists waveform(
+         file TEXT PRIMARY KEY,
+         last_modified TEXT,
+         envelope BLOB
+        )",
+        [],
+    )?;
+    Ok(())
+}
+
+/// Store the envelope of `file`, a failed track keeps a row without one so it is not retried.
+pub fn store(
+    conn: &Connection,
+    file: &str,
+    last_modified: &str,
+    envelope: Option<&Envelope>,
+) -> rusqlite::Result<()> {
+    conn.execute(
+        "INSERT OR REPLACE INTO waveform (file, last_modified, envelope) values (?1, ?2, ?3)",
+        params![file, last_modified, envelope.map(Envelope::to_blob)],
+    )?;
+    Ok(())
+}
+
+/// The envelope of `file`, as long as the file did not change since it was computed.
+pub fn load(conn: &Connection, file: &str) -> rusqlite::Result<Option<Envelope>> {
+    let blob: Option<Option<Vec<u8>>> = conn
+        .query_row(
+            "SELECT waveform.envelope FROM waveform
+             JOIN track ON track.file = waveform.file
+             WHERE waveform.file = ? AND waveform.last_modified = track.last_modified",
+            [file],
+            |row| row.get(0),
+        )
+        .optional()?;
+    Ok(blob.flatten().map(|blob| Envelope::from_blob(&blob)))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_envelope_follows_the_level() {
+        // a stretch at full scale, then as long at a tenth of it
+        let half = CHUNK_FRAMES * 2 * 50;
+        let mut builder = EnvelopeBuilder::new(2);
+        let loud: Vec<f32> = (0..half)
+            .map(|i| if (i / 2) % 2 == 0 { 1.0 } else { -1.0 })
+            .collect();
+        let quiet: Vec<f32> = loud.iter().map(|s| s * 0.1).collect();
+        builder.push(&loud);
+        builder.push(&quiet);
+        let envelope = builder.finish(10).unwrap();
+
+        assert_eq!(envelope.buckets.len(), 10);
+        let first = envelope.buckets[0];
+        let last = envelope.buckets[9];
+        assert_eq!((first.min, first.max), (-1.0, 1.0));
+        assert!(first.rms_db.abs() < 0.01);
+        assert!((last.rms_db + 20.0).abs() < 0.01);
+        let levels: Vec<f32> = envelope.buckets.iter().map(|b| b.rms_db).collect();
+        assert_eq!(columns(&levels, 2, 40.0), vec![1.0, 0.5]);
+        // more columns than buckets repeat them
+        assert_eq!(columns(&levels[..1], 3, 40.0), vec![1.0; 3]);
+    }
+
+    #[test]
+    fn test_short_track_has_fewer_buckets() {
+        let mut builder = EnvelopeBuilder::new(1);
+        builder.push(&[0.5; CHUNK_FRAMES * 3]);
+        assert_eq!(builder.finish(BUCKETS).unwrap().buckets.len(), 3);
+        assert!(EnvelopeBuilder::new(1).finish(BUCKETS).is_none());
+    }
+
+    #[test]
+    fn test_blob_round_trip() {
+        let envelope = Envelope {
+            buckets: vec![
+                Bucket {
+                    min: -0.5,
+                    max: 1.0,
+                    rms_db: -12.0,
+                },
+                Bucket {
+                    min: 0.0,
+                    max: 0.0,
+                    rms_db: FLOOR_DB,
+                },
+            ],
+        };
+        let blob = envelope.to_blob();
+        assert_eq!(blob.len(), 6);
+        let back = Envelope::from_blob(&blob);
+        for (a, b) in envelope.buckets.iter().zip(&back.buckets) {
+            assert!((a.min - b.min).abs() < 0.01);
+            assert!((a.max - b.max).abs() < 0.01);
+            assert!((a.rms_db - b.rms_db).abs() < 0.2);
+        }
+    }
+
+    #[test]
+    fn test_stale_envelope_is_not_loaded() {
+        let conn = Connection::open_in_memory().unwrap();
+        conn.execute("create table track(file TEXT, last_modified TEXT)", [])
+            .unwrap();
+        conn.execute("INSERT INTO track values ('a', '1')", [])
+            .unwrap();
+        create_table(&conn).unwrap();
+        let mut builder = EnvelopeBuilder::new(1);
+        builder.push(&[0.5; CHUNK_FRAMES]);
+        let envelope = builder.finish(BUCKETS).unwrap();
+
+        store(&conn, "a", "1", Some(&envelope)).unwrap();
+        assert_eq!(load(&conn, "a").unwrap().unwrap().buckets.len(), 1);
+        conn.execute("UPDATE track SET last_modified = '2' WHERE file = 'a'", [])
+            .unwrap();
+        assert_eq!(load(&conn, "a").unwrap(), None);
+    }
+}